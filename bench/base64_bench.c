@@ -0,0 +1,89 @@
+/*  OpenVLBI - Open Source Very Long Baseline Interferometry
+*   Copyright © 2017-2022  Ilia Platone
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 3 of the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program; if not, write to the Free Software Foundation,
+*   Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <base64.h>
+
+/* Throughput of the base64 codec for each instruction set, level 0 is the table driven scalar code */
+
+#define CHUNK 65536
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char** argv)
+{
+    int size = (argc > 1 ? atoi(argv[1]) : 64) * 1024 * 1024;
+    int iterations = argc > 2 ? atoi(argv[2]) : 5;
+    int level, x, len, declen = 0;
+    double start, mb = (double)size * iterations / 1048576.0;
+    unsigned char *raw = (unsigned char*)malloc((size_t)size);
+    unsigned char *b64 = (unsigned char*)malloc((size_t)size / 3 * 4 + 8);
+    char *out = (char*)malloc((size_t)size + 8);
+    base64_state state;
+    srand(1);
+    for(x = 0; x < size; x++)
+        raw[x] = (unsigned char)rand();
+    printf("level,encode MB/s,decode MB/s,streaming decode MB/s\n");
+    for(level = 0; level <= base64_simd(-1); level++)
+    {
+        if(base64_simd(level) != level)
+            break;
+        start = now();
+        for(x = 0; x < iterations; x++)
+            len = to64frombits(b64, raw, size);
+        double enc = mb / (now() - start);
+        start = now();
+        for(x = 0; x < iterations; x++)
+            declen = from64tobits_fast(out, (char*)b64, len);
+        double dec = mb / (now() - start);
+        if(declen != size || memcmp(out, raw, (size_t)size))
+        {
+            fprintf(stderr, "level %d: decoded buffer differs\n", level);
+            return 1;
+        }
+        start = now();
+        for(x = 0; x < iterations; x++)
+        {
+            int pos;
+            declen = 0;
+            base64_init(&state);
+            for(pos = 0; pos < len; pos += CHUNK)
+                declen += from64tobits_update(&state, out + declen, (char*)b64 + pos, len - pos < CHUNK ? len - pos : CHUNK);
+            declen += from64tobits_final(&state, out + declen);
+        }
+        double stream = mb / (now() - start);
+        if(declen != size || memcmp(out, raw, (size_t)size))
+        {
+            fprintf(stderr, "level %d: stream decoded buffer differs\n", level);
+            return 1;
+        }
+        printf("%d,%.1lf,%.1lf,%.1lf\n", level, enc, dec, stream);
+    }
+    free(raw);
+    free(b64);
+    free(out);
+    return 0;
+}
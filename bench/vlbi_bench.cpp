@@ -0,0 +1,221 @@
+/*  OpenVLBI - Open Source Very Long Baseline Interferometry
+*   Copyright © 2017-2022  Ilia Platone
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 3 of the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program; if not, write to the Free Software Foundation,
+*   Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <thread>
+#include <vlbi.h>
+#include <base64.h>
+#include <node.h>
+#include <baseline.h>
+
+/* Microbenchmarks of the hot kernels and end-to-end imaging scenarios, results are printed as JSON
+ * usage: vlbi_bench [size] [iterations] [stations] [samples] [resolution] [max threads, the hardware threads by default] */
+
+static FILE *out;
+static int results = 0;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void result(const char *group, const char *name, long size, int threads, int iterations, double seconds)
+{
+    fprintf(out, "%s\n  { \"group\": \"%s\", \"name\": \"%s\", \"size\": %ld, \"threads\": %d, \"iterations\": %d, \"seconds\": %.9lf, \"items_per_second\": %.1lf }",
+            results++ > 0 ? "," : "", group, name, size, threads, iterations, seconds / iterations, (double)size * iterations / seconds);
+}
+
+static void micro(const char *name, long size, int iterations, std::function<void()> run)
+{
+    run();
+    double start = now();
+    for(int x = 0; x < iterations; x++)
+        run();
+    result("micro", name, size, (int)vlbi_max_threads(0), iterations, now() - start);
+}
+
+static dsp_stream_p new_stream(int width, int height)
+{
+    dsp_stream_p stream = dsp_stream_new();
+    dsp_stream_add_dim(stream, width);
+    if(height > 1)
+        dsp_stream_add_dim(stream, height);
+    dsp_stream_alloc_buffer(stream, stream->len);
+    for(int x = 0; x < stream->len; x++)
+        stream->buf[x] = (dsp_t)(rand() % 65536);
+    return stream;
+}
+
+static void free_stream(dsp_stream_p stream)
+{
+    dsp_stream_free_buffer(stream);
+    dsp_stream_free(stream);
+}
+
+static dsp_stream_p new_node_stream(int index, int samples, timespec_t starttime)
+{
+    dsp_stream_p stream = new_stream(samples, 1);
+    stream->location = (dsp_location*)calloc((size_t)samples, sizeof(dsp_location));
+    for(int x = 0; x < samples; x++)
+    {
+        stream->location[x].xyz.x = index * 37.0 + 5.0;
+        stream->location[x].xyz.y = index * index * 21.0 - 30.0;
+        stream->location[x].xyz.z = index * 3.0;
+    }
+    stream->starttimeutc = starttime;
+    stream->samplerate = 1.0;
+    return stream;
+}
+
+static vlbi_context new_context(int stations, int samples)
+{
+    vlbi_context ctx = vlbi_init();
+    timespec_t starttime = vlbi_time_string_to_timespec("2022-06-01T00:00:00");
+    vlbi_set_location(ctx, 34.0, 15.0, 100.0);
+    for(int n = 0; n < stations; n++)
+    {
+        char name[32];
+        sprintf(name, "node%d", n);
+        vlbi_add_node(ctx, new_node_stream(n, samples, starttime), name, 0);
+    }
+    return ctx;
+}
+
+static void bench_dsp(int size, int iterations)
+{
+    int side = (int)sqrt((double)size);
+    dsp_stream_p stream = new_stream(size, 1);
+    dsp_stream_p image = new_stream(side, side);
+    dsp_t *in = (dsp_t*)malloc(sizeof(dsp_t) * (size_t)size);
+    for(int x = 0; x < size; x++)
+        in[x] = (dsp_t)(rand() % 65536 + 1);
+    micro("dsp_buffer_sum", size, iterations, [&]() { dsp_buffer_sum(stream, in, size); });
+    micro("dsp_buffer_sub", size, iterations, [&]() { dsp_buffer_sub(stream, in, size); });
+    micro("dsp_buffer_mul", size, iterations, [&]() { dsp_buffer_mul(stream, in, size); dsp_buffer_div(stream, in, size); });
+    micro("dsp_buffer_max", size, iterations, [&]() { dsp_buffer_max(stream, in, size); });
+    micro("dsp_buffer_removemean", size, iterations, [&]() { dsp_buffer_removemean(stream); });
+    micro("dsp_buffer_stretch", size, iterations, [&]() { dsp_buffer_stretch(stream->buf, stream->len, 0.0, 65535.0); });
+    micro("dsp_buffer_median", image->len, 1, [&]() { dsp_buffer_median(image, 3, 1); });
+    micro("dsp_buffer_sigma", image->len, 1, [&]() { dsp_buffer_sigma(image, 3); });
+    micro("dsp_fourier_dft", image->len, iterations, [&]() { dsp_fourier_dft(image, 1); });
+    micro("dsp_fourier_idft", image->len, iterations, [&]() { dsp_fourier_idft(image); });
+    micro("dsp_stream_get_position", image->len, iterations, [&]()
+    {
+        for(int x = 0; x < image->len; x++)
+            free(dsp_stream_get_position(image, x));
+    });
+    free(in);
+    free_stream(image);
+    free_stream(stream);
+}
+
+static void bench_base64(int size, int iterations)
+{
+    unsigned char *raw = (unsigned char*)malloc((size_t)size);
+    unsigned char *b64 = (unsigned char*)malloc((size_t)size / 3 * 4 + 8);
+    char *dec = (char*)malloc((size_t)size + 8);
+    int len = 0;
+    for(int x = 0; x < size; x++)
+        raw[x] = (unsigned char)rand();
+    micro("to64frombits", size, iterations, [&]() { len = to64frombits(b64, raw, size); });
+    micro("from64tobits_fast", size, iterations, [&]() { from64tobits_fast(dec, (char*)b64, len); });
+    free(raw);
+    free(b64);
+    free(dec);
+}
+
+static void bench_geometry(int samples, int iterations)
+{
+    timespec_t starttime = vlbi_time_string_to_timespec("2022-06-01T00:00:00");
+    double start = vlbi_time_timespec_to_J2000time(starttime);
+    VLBINode *node1 = new VLBINode(new_node_stream(0, samples, starttime), "node0", 0, false);
+    VLBINode *node2 = new VLBINode(new_node_stream(1, samples, starttime), "node1", 1, false);
+    VLBIBaseline *baseline = new VLBIBaseline(node1, node2);
+    baseline->setTarget(18.5, 38.6);
+    baseline->setRa(18.5);
+    baseline->setDec(38.6);
+    baseline->setWaveLength(LIGHTSPEED / 1420000000.0);
+    baseline->setSampleRate(1.0);
+    micro("VLBIBaseline::getProjection", samples, iterations, [&]()
+    {
+        for(int x = 0; x < samples; x++)
+        {
+            baseline->setTime(start + x);
+            baseline->getProjection();
+        }
+    });
+    delete baseline;
+    delete node1;
+    delete node2;
+    vlbi_context ctx = new_context(2, samples);
+    double offset1, offset2;
+    micro("vlbi_get_offsets", samples, iterations, [&]()
+    {
+        for(int x = 0; x < samples; x++)
+            vlbi_get_offsets(ctx, start + x, "node0", "node1", 18.5, 38.6, &offset1, &offset2);
+    });
+    vlbi_exit(ctx);
+}
+
+static void bench_scenarios(int stations, int samples, int size, int max_threads)
+{
+    double target[2] = { 18.5, 38.6 };
+    for(int threads = 1; threads <= max_threads; threads = (threads < max_threads && threads * 2 > max_threads) ? max_threads : threads * 2)
+    {
+        vlbi_max_threads((unsigned long)threads);
+        vlbi_context ctx = new_context(stations, samples);
+        long baselines = (long)stations * (stations - 1) / 2 * samples;
+        double start = now();
+        vlbi_get_uv_plot(ctx, "magnitude", size, size, target, 1420000000.0, 1.0, 1, 0, vlbi_magnitude_delegate, nullptr);
+        result("scenario", "vlbi_get_uv_plot", baselines, threads, 1, now() - start);
+        vlbi_get_uv_plot(ctx, "phase", size, size, target, 1420000000.0, 1.0, 1, 0, vlbi_phase_delegate, nullptr);
+        start = now();
+        vlbi_get_ifft(ctx, "image", "magnitude", "phase");
+        result("scenario", "vlbi_get_ifft", (long)size * size, threads, 1, now() - start);
+        vlbi_exit(ctx);
+        if(threads == max_threads)
+            break;
+    }
+    vlbi_max_threads((unsigned long)max_threads);
+}
+
+int main(int argc, char** argv)
+{
+    int size = argc > 1 ? atoi(argv[1]) : 1048576;
+    int iterations = argc > 2 ? atoi(argv[2]) : 5;
+    int stations = argc > 3 ? atoi(argv[3]) : 8;
+    int samples = argc > 4 ? atoi(argv[4]) : 3600;
+    int resolution = argc > 5 ? atoi(argv[5]) : 256;
+    int max_threads = (int)vlbi_max_threads(argc > 6 ? strtoul(argv[6], nullptr, 10) : Max(1u, std::thread::hardware_concurrency()));
+    out = stdout;
+    srand(1);
+    fprintf(out, "{\n \"version\": \"%s\",\n \"max_threads\": %d,\n \"stations\": %d,\n \"samples\": %d,\n \"results\": [", VLBI_VERSION_STRING,
+            max_threads, stations, samples);
+    bench_dsp(size, iterations);
+    bench_base64(size, iterations);
+    bench_geometry(samples, iterations);
+    bench_scenarios(stations, samples, resolution, max_threads);
+    fprintf(out, "\n ]\n}\n");
+    return 0;
+}
@@ -37,69 +37,155 @@ static int dsp_qsort_star_diameter_desc(const void *arg1, const void *arg2)
     return -1;
 }
 
-static double calc_match_score(dsp_triangle t1, dsp_triangle t2, dsp_align_info align_info)
+static int dsp_qsort_triangle_ratio_asc(const void *arg1, const void *arg2)
+{
+    dsp_triangle* a = (dsp_triangle*)arg1;
+    dsp_triangle* b = (dsp_triangle*)arg2;
+    if(a->ratios[1] < b->ratios[1])
+        return -1;
+    if(a->ratios[1] > b->ratios[1])
+        return 1;
+    return 0;
+}
+
+static int dsp_align_lower_bound(dsp_triangle *triangles, int count, double ratio)
+{
+    int lo = 0;
+    int hi = count;
+    while(lo < hi) {
+        int mid = (lo + hi) / 2;
+        if(triangles[mid].ratios[1] < ratio)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static double calc_match_score(dsp_triangle *t1, dsp_triangle *t2, dsp_align_info *align_info)
 {
     int d = 0;
-    double err = fabs((t1.index - t2.index)/t1.index);
-    double size1 = t1.sizes[0];
-    double size2 = t2.sizes[0]/align_info.factor[0];
+    double err = fabs((t1->index - t2->index)/t1->index);
+    double size1 = t1->sizes[0];
+    double size2 = t2->sizes[0]/align_info->factor[0];
     err += fabs((size1 - size2)/size1);
-    for(d = 1; d < align_info.dims; d ++) {
-        double size1 = t1.sizes[d-1];
-        double size2 = t2.sizes[d-1]/align_info.factor[d-1];
-        double x1 = (t1.stars[d].center.location[d-1]-t1.stars[d-1].center.location[d-1]);
-        double y1 = (t1.stars[d].center.location[d]-t1.stars[d-1].center.location[d]);
-        double _x2 = (t2.stars[d].center.location[d-1]-align_info.offset[d-1]-align_info.center[d-1]);
-        double _y2 = (t2.stars[d].center.location[d]-align_info.offset[d]-align_info.center[d]);
-        double x2 = _x2*cos(align_info.radians[d-1])+_y2*sin(align_info.radians[d-1]);
-        double y2 = _y2*cos(align_info.radians[d-1])-_x2*sin(align_info.radians[d-1]);
-        x2 /= align_info.factor[d-1];
-        y2 /= align_info.factor[d];
+    for(d = 1; d < align_info->dims; d ++) {
+        double size1 = t1->sizes[d-1];
+        double size2 = t2->sizes[d-1]/align_info->factor[d-1];
+        double x1 = (t1->stars[d].center.location[d-1]-t1->stars[d-1].center.location[d-1]);
+        double y1 = (t1->stars[d].center.location[d]-t1->stars[d-1].center.location[d]);
+        double _x2 = (t2->stars[d].center.location[d-1]-align_info->offset[d-1]-align_info->center[d-1]);
+        double _y2 = (t2->stars[d].center.location[d]-align_info->offset[d]-align_info->center[d]);
+        double x2 = _x2*cos(align_info->radians[d-1])+_y2*sin(align_info->radians[d-1]);
+        double y2 = _y2*cos(align_info->radians[d-1])-_x2*sin(align_info->radians[d-1]);
+        x2 /= align_info->factor[d-1];
+        y2 /= align_info->factor[d];
         err += fabs(((x2-x1)+(y2-y1)+(size2-size1))/size1);
     }
-    for(d = 1 ; d < t1.dims; d++) {
-        err += fabs((t1.ratios[d] - t2.ratios[d])/t1.ratios[d]);
+    for(d = 1 ; d < t1->dims; d++) {
+        err += fabs((t1->ratios[d] - t2->ratios[d])/t1->ratios[d]);
     }
     err /= 2;
-    return err / (align_info.dims + t1.dims);
+    return err / (align_info->dims + t1->dims);
 }
 
-dsp_align_info dsp_align_fill_info(dsp_triangle t1, dsp_triangle t2)
+/* resizes the arrays already owned by align_info, they may be NULL */
+static void dsp_align_realloc_info(dsp_align_info *align_info, int dims)
 {
-    dsp_align_info align_info;
-    int dims = t1.dims - 1;
-    int d, x;
-    align_info.dims = dims;
-    align_info.center = (double*)malloc(sizeof(double)*(dims));
-    align_info.offset = (double*)malloc(sizeof(double)*(dims));
-    align_info.radians = (double*)malloc(sizeof(double)*(dims-1));
-    align_info.factor = (double*)malloc(sizeof(double)*(dims));
+    int d;
+    align_info->dims = dims;
+    align_info->center = (double*)realloc(align_info->center, sizeof(double)*(dims));
+    align_info->offset = (double*)realloc(align_info->offset, sizeof(double)*(dims));
+    align_info->radians = (double*)realloc(align_info->radians, sizeof(double)*(dims));
+    align_info->factor = (double*)realloc(align_info->factor, sizeof(double)*(dims));
     for(d = 0; d < dims; d++) {
-        align_info.factor[d] = 0;
-        align_info.offset[d] = 0;
-        align_info.center[d] = 0;
-        if(d < dims - 1)
-            align_info.radians[d] = 0;
+        align_info->factor[d] = 1;
+        align_info->offset[d] = 0;
+        align_info->center[d] = 0;
+        align_info->radians[d] = 0;
     }
+    align_info->score = 1.0;
+}
+
+static void dsp_align_alloc_info(dsp_align_info *align_info, int dims)
+{
+    align_info->center = NULL;
+    align_info->offset = NULL;
+    align_info->radians = NULL;
+    align_info->factor = NULL;
+    dsp_align_realloc_info(align_info, dims);
+}
+
+static void dsp_align_copy_info(dsp_align_info *dest, dsp_align_info *src)
+{
+    memcpy(dest->center, src->center, sizeof(double)*src->dims);
+    memcpy(dest->offset, src->offset, sizeof(double)*src->dims);
+    memcpy(dest->radians, src->radians, sizeof(double)*src->dims);
+    memcpy(dest->factor, src->factor, sizeof(double)*src->dims);
+    dest->dims = src->dims;
+    dest->score = src->score;
+}
+
+static void dsp_align_fill(dsp_triangle *t1, dsp_triangle *t2, dsp_align_info *align_info)
+{
+    int dims = align_info->dims;
+    int d, x;
     for(d = 0; d < dims; d++) {
-        align_info.center[d] = t2.stars[0].center.location[d];
-        align_info.offset[d] = t2.stars[0].center.location[d] - t1.stars[0].center.location[d];
+        align_info->factor[d] = 0;
+        align_info->center[d] = t2->stars[0].center.location[d];
+        align_info->offset[d] = t2->stars[0].center.location[d] - t1->stars[0].center.location[d];
         if(d < dims - 1) {
-            align_info.radians[d] = t1.theta[d] - t2.theta[d];
-            if(align_info.radians[d] >= M_PI*2.0)
-                align_info.radians[d] -= M_PI*2.0;
-            if(align_info.radians[d] < 0.0)
-                align_info.radians[d] += M_PI*2.0;
+            align_info->radians[d] = t1->theta[d] - t2->theta[d];
+            if(align_info->radians[d] >= M_PI*2.0)
+                align_info->radians[d] -= M_PI*2.0;
+            if(align_info->radians[d] < 0.0)
+                align_info->radians[d] += M_PI*2.0;
         }
-        for(x = 0; x < t2.dims; x++) {
-            align_info.factor[d] += t2.sizes[x] / t1.sizes[x];
+        for(x = 0; x < t2->dims; x++) {
+            align_info->factor[d] += t2->sizes[x] / t1->sizes[x];
         }
-        align_info.factor[d] /= t2.dims;
+        align_info->factor[d] /= t2->dims;
     }
-    align_info.score = calc_match_score(t1, t2, align_info);
+    align_info->score = calc_match_score(t1, t2, align_info);
+}
+
+dsp_align_info dsp_align_fill_info(dsp_triangle t1, dsp_triangle t2)
+{
+    dsp_align_info align_info;
+    dsp_align_alloc_info(&align_info, t1.dims - 1);
+    dsp_align_fill(&t1, &t2, &align_info);
     return align_info;
 }
 
+static void dsp_align_free_triangle(dsp_triangle *triangle)
+{
+    int d;
+    for(d = 0; d < triangle->dims; d++)
+        free(triangle->stars[d].center.location);
+    free(triangle->stars);
+    free(triangle->sizes);
+    free(triangle->ratios);
+    free(triangle->theta);
+}
+
+static void dsp_align_create_triangles(dsp_stream_p stream, int dims)
+{
+    int d, y;
+    dsp_star *stars = (dsp_star*)malloc(sizeof(dsp_star)*dims);
+    for(y = 0; y < stream->triangles_count; y++)
+        dsp_align_free_triangle(&stream->triangles[y]);
+    stream->triangles_count = 0;
+    for(y = 0; y < stream->stars_count-dims+1; y++) {
+        for(d = 0; d < dims; d++) {
+            stars[d] = stream->stars[y+d];
+        }
+        dsp_triangle t = dsp_align_calc_triangle(stars);
+        dsp_stream_add_triangle(stream, t);
+        dsp_align_free_triangle(&t);
+    }
+    free(stars);
+}
+
 dsp_triangle dsp_align_calc_triangle(dsp_star* stars)
 {
     int x;
@@ -116,6 +202,7 @@ dsp_triangle dsp_align_calc_triangle(dsp_star* stars)
     qsort(stars, 3, sizeof(dsp_star), dsp_qsort_star_diameter_desc);
     for(d = 0; d < triangle.dims; d++) {
         diff[d] = (double*)malloc(sizeof(double)*stars[d].center.dims);
+        delta[d] = 0;
         for(x = 0; x < triangle.dims-1; x++) {
             diff[d][x] = stars[(d + 1) < triangle.dims ? d : 0].center.location[x]-stars[(d + 1) < triangle.dims ? (d + 1) : (triangle.dims - 1)].center.location[x];
             delta[d] += pow(diff[d][x], 2);
@@ -166,54 +253,60 @@ int dsp_align_get_offset(dsp_stream_p stream1, dsp_stream_p stream2, double tole
 {
     dsp_align_info align_info;
     double decimals = pow(10, tolerance);
+    double band = 1.0 / decimals;
     double div = 0.0;
-    int d, t1, t2, x, y;
+    int d, t1, t2;
+    int done = 0;
     double phi = 0.0;
+    dsp_progress *progress = dsp_progress_get();
     int dims = stream1->dims+1;
     double min_score = 1.0;
-    double ratio = decimals*1600.0/div;
-    dsp_star *stars = (dsp_star*)malloc(sizeof(dsp_star)*dims);
+    if(stream1->stars_count > 0)
+        dims = stream1->stars[0].center.dims+1;
     for(d = 0; d < stream1->dims; d++) {
         div += pow(stream2->sizes[d], 2);
     }
     div = pow(div, 0.5);
+    double ratio = decimals*1600.0/div;
     pwarn("decimals: %lf\n", decimals);
     target_score = 1.0-target_score/100.0;
-    stream2->align_info.dims = 2;
-    stream2->align_info.score = 1.0;
-    stream2->align_info.decimals = decimals;
     pgarb("creating triangles for reference frame...\n");
-    stream1->align_info.triangles_count = 0;
-    for(x = 0; x < stream1->stars_count; x++) {
-        for(y = x; y < stream1->stars_count-dims+1; y++) {
-            for(d = 0; d < dims; d++) {
-                stars[d] = stream1->stars[y+d];
-            }
-            dsp_triangle t = dsp_align_calc_triangle(stars);
-            dsp_stream_add_triangle(stream1, t);
-        }
-    }
+    dsp_align_create_triangles(stream1, dims);
     pgarb("creating triangles for current frame...\n");
-    stream2->align_info.triangles_count = 0;
-    for(x = 0; x < stream2->stars_count; x++) {
-        for(y = x; y < stream2->stars_count-dims+1; y++) {
-            for(d = 0; d < dims; d++) {
-                stars[d] = stream2->stars[y+d];
-            }
-            dsp_triangle t = dsp_align_calc_triangle(stars);
-            dsp_stream_add_triangle(stream2, t);
-        }
-    }
-    free(stars);
+    dsp_align_create_triangles(stream2, dims);
+    qsort(stream2->triangles, (size_t)stream2->triangles_count, sizeof(dsp_triangle), dsp_qsort_triangle_ratio_asc);
+    dsp_align_alloc_info(&align_info, dims-1);
+    dsp_align_realloc_info(&stream2->align_info, dims-1);
+    stream2->align_info.decimals = decimals;
+    dsp_progress_add(progress, (unsigned long)stream1->triangles_count);
     for(t1 = 0; t1 < stream1->triangles_count; t1++) {
-        for(t2 = 0; t2 < stream2->triangles_count; t2++) {
-            align_info = dsp_align_fill_info(stream1->triangles[t1], stream2->triangles[t2]);
+        dsp_triangle *ref = &stream1->triangles[t1];
+        if(++done == DSP_PROGRESS_CHUNK) {
+            done = 0;
+            if(dsp_progress_step(progress, DSP_PROGRESS_CHUNK))
+                break;
+        }
+        t2 = dsp_align_lower_bound(stream2->triangles, stream2->triangles_count, ref->ratios[1] - band);
+        for(; t2 < stream2->triangles_count && stream2->triangles[t2].ratios[1] <= ref->ratios[1] + band; t2++) {
+            dsp_triangle *cur = &stream2->triangles[t2];
+            for(d = 2; d < dims; d++) {
+                if(fabs(cur->ratios[d] - ref->ratios[d]) > band)
+                    break;
+            }
+            if(d < dims)
+                continue;
+            dsp_align_fill(ref, cur, &align_info);
             if(align_info.score < min_score) {
-                stream2->align_info = align_info;
+                dsp_align_copy_info(&stream2->align_info, &align_info);
                 min_score = align_info.score;
             }
         }
     }
+    dsp_progress_step(progress, (unsigned long)done);
+    free(align_info.center);
+    free(align_info.offset);
+    free(align_info.radians);
+    free(align_info.factor);
     double radians = stream2->align_info.radians[0];
     if(radians > M_PI)
         radians -= M_PI*2;
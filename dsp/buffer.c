@@ -240,6 +240,7 @@ static void* dsp_buffer_median_th(void* arg)
         int median;
         dsp_stream_p stream;
         dsp_stream_p box;
+        dsp_progress *progress;
      } *arguments = arg;
     dsp_stream_p stream = arguments->stream;
     dsp_stream_p box = arguments->box;
@@ -251,6 +252,7 @@ static void* dsp_buffer_median_th(void* arg)
     int end = start + stream->len / dsp_max_threads(0);
     end = Min(stream->len, end);
     int x, y, dim, idx;
+    int done = 0;
     dsp_t* sorted = (dsp_t*)malloc(pow(size, stream->dims) * sizeof(dsp_t));
     int len = pow(size, in->dims);
     for(x = start; x < end; x++) {
@@ -270,7 +272,13 @@ static void* dsp_buffer_median_th(void* arg)
         }
         qsort(sorted, len, sizeof(dsp_t), compare);
         stream->buf[x] = sorted[median*box->len/size];
+        if(++done == DSP_PROGRESS_CHUNK) {
+            done = 0;
+            if(dsp_progress_step(arguments->progress, DSP_PROGRESS_CHUNK))
+                break;
+        }
     }
+    dsp_progress_step(arguments->progress, (unsigned long)done);
     dsp_stream_free_buffer(box);
     dsp_stream_free(box);
     free(sorted);
@@ -284,6 +292,8 @@ void dsp_buffer_median(dsp_stream_p in, int size, int median)
     dsp_stream_p stream = dsp_stream_copy(in);
     dsp_buffer_set(stream->buf, stream->len, 0);
     stream->parent = in;
+    dsp_progress *progress = dsp_progress_get();
+    dsp_progress_add(progress, (unsigned long)(stream->len / dsp_max_threads(0) * dsp_max_threads(0)));
     pthread_t *th = (pthread_t *)malloc(sizeof(pthread_t)*dsp_max_threads(0));
     struct {
        int cur_th;
@@ -291,6 +301,7 @@ void dsp_buffer_median(dsp_stream_p in, int size, int median)
        int median;
        dsp_stream_p stream;
        dsp_stream_p box;
+       dsp_progress *progress;
     } thread_arguments[dsp_max_threads(0)];
     for(y = 0; y < dsp_max_threads(0); y++)
     {
@@ -298,6 +309,7 @@ void dsp_buffer_median(dsp_stream_p in, int size, int median)
         thread_arguments[y].size = size;
         thread_arguments[y].median = median;
         thread_arguments[y].stream = stream;
+        thread_arguments[y].progress = progress;
         thread_arguments[y].box = dsp_stream_new();
         for(d = 0; d < stream->dims; d++)
             dsp_stream_add_dim(thread_arguments[y].box, size);
@@ -308,7 +320,8 @@ void dsp_buffer_median(dsp_stream_p in, int size, int median)
         pthread_join(th[y], NULL);
     free(th);
     stream->parent = NULL;
-    dsp_buffer_copy(stream->buf, in->buf, stream->len);
+    if(!dsp_progress_cancelled(progress))
+        dsp_buffer_copy(stream->buf, in->buf, stream->len);
     dsp_stream_free_buffer(stream);
     dsp_stream_free(stream);
 }
@@ -320,6 +333,7 @@ static void* dsp_buffer_sigma_th(void* arg)
         int size;
         dsp_stream_p stream;
         dsp_stream_p box;
+        dsp_progress *progress;
      } *arguments = arg;
     dsp_stream_p stream = arguments->stream;
     dsp_stream_p in = stream->parent;
@@ -330,6 +344,7 @@ static void* dsp_buffer_sigma_th(void* arg)
     int end = start + stream->len / dsp_max_threads(0);
     end = Min(stream->len, end);
     int x, y, dim, idx;
+    int done = 0;
     dsp_t* sigma = (dsp_t*)malloc(pow(size, stream->dims) * sizeof(dsp_t));
     int len = pow(size, in->dims);
     for(x = start; x < end; x++) {
@@ -348,7 +363,13 @@ static void* dsp_buffer_sigma_th(void* arg)
             free(mat);
         }
         stream->buf[x] = dsp_stats_stddev(buf, len);
+        if(++done == DSP_PROGRESS_CHUNK) {
+            done = 0;
+            if(dsp_progress_step(arguments->progress, DSP_PROGRESS_CHUNK))
+                break;
+        }
     }
+    dsp_progress_step(arguments->progress, (unsigned long)done);
     dsp_stream_free_buffer(box);
     dsp_stream_free(box);
     free(sigma);
@@ -362,18 +383,22 @@ void dsp_buffer_sigma(dsp_stream_p in, int size)
     dsp_stream_p stream = dsp_stream_copy(in);
     dsp_buffer_set(stream->buf, stream->len, 0);
     stream->parent = in;
+    dsp_progress *progress = dsp_progress_get();
+    dsp_progress_add(progress, (unsigned long)(stream->len / dsp_max_threads(0) * dsp_max_threads(0)));
     pthread_t *th = (pthread_t *)malloc(sizeof(pthread_t)*dsp_max_threads(0));
     struct {
        int cur_th;
        int size;
        dsp_stream_p stream;
        dsp_stream_p box;
+       dsp_progress *progress;
     } thread_arguments[dsp_max_threads(0)];
     for(y = 0; y < dsp_max_threads(0); y++)
     {
         thread_arguments[y].cur_th = y;
         thread_arguments[y].size = size;
         thread_arguments[y].stream = stream;
+        thread_arguments[y].progress = progress;
         thread_arguments[y].box = dsp_stream_new();
         for(d = 0; d < stream->dims; d++)
             dsp_stream_add_dim(thread_arguments[y].box, size);
@@ -383,7 +408,8 @@ void dsp_buffer_sigma(dsp_stream_p in, int size)
         pthread_join(th[y], NULL);
     free(th);
     stream->parent = NULL;
-    dsp_buffer_copy(stream->buf, in->buf, stream->len);
+    if(!dsp_progress_cancelled(progress))
+        dsp_buffer_copy(stream->buf, in->buf, stream->len);
     dsp_stream_free_buffer(stream);
     dsp_stream_free(stream);
 }
@@ -397,3 +423,94 @@ void dsp_buffer_deviate(dsp_stream_p stream, dsp_t* deviation, dsp_t mindeviatio
     }
     dsp_stream_free(tmp);
 }
+
+/* Hoare selection, the k-th smallest element ends at buf[k] */
+static dsp_t dsp_buffer_select(dsp_t *buf, int len, int k)
+{
+    int lo = 0, hi = len - 1;
+    while(lo < hi) {
+        dsp_t pivot = buf[(lo + hi) / 2];
+        int i = lo, j = hi;
+        while(i <= j) {
+            while(buf[i] < pivot) i++;
+            while(buf[j] > pivot) j--;
+            if(i <= j) {
+                dsp_t tmp = buf[i];
+                buf[i++] = buf[j];
+                buf[j--] = tmp;
+            }
+        }
+        if(k <= j)
+            hi = j;
+        else if(k >= i)
+            lo = i;
+        else
+            break;
+    }
+    return buf[k];
+}
+
+/* the window median into median, the signed distance of each sample from it into dist, the robust sigma is returned */
+static double dsp_buffer_flag_window(dsp_t *in, dsp_t *dist, int len, dsp_t *median)
+{
+    int x;
+    memcpy(dist, in, sizeof(dsp_t) * len);
+    *median = dsp_buffer_select(dist, len, len / 2);
+    for(x = 0; x < len; x++)
+        dist[x] = fabs(in[x] - *median);
+    double sigma = 1.4826 * dsp_buffer_select(dist, len, len / 2);
+    for(x = 0; x < len; x++)
+        dist[x] = in[x] - *median;
+    return sigma;
+}
+
+void dsp_buffer_flag_mad(dsp_t *in, dsp_t *flags, int len, int window, double threshold)
+{
+    int x, y;
+    dsp_t median;
+    window = Max(1, Min(window, len));
+    dsp_t *dist = (dsp_t*)malloc(sizeof(dsp_t) * window);
+    for(x = 0; x < len; x += window) {
+        int n = Min(window, len - x);
+        double limit = threshold * dsp_buffer_flag_window(&in[x], dist, n, &median);
+        for(y = 0; y < n; y++)
+            flags[x + y] *= (fabs(dist[y]) <= limit);
+    }
+    free(dist);
+}
+
+void dsp_buffer_flag_sumthreshold(dsp_t *in, dsp_t *flags, int len, int window, double threshold, int max_length)
+{
+    int x, y, m;
+    dsp_t median;
+    window = Max(1, Min(window, len));
+    dsp_t *dist = (dsp_t*)malloc(sizeof(dsp_t) * window);
+    int *runs = (int*)malloc(sizeof(int) * (window + 1));
+    for(x = 0; x < len; x += window) {
+        int n = Min(window, len - x);
+        double sigma = dsp_buffer_flag_window(&in[x], dist, n, &median);
+        dsp_t *mask = &flags[x];
+        for(m = 1; m <= Min(max_length, n); m <<= 1) {
+            double limit = threshold * sigma / pow(1.5, log2(m));
+            double sum = 0.0;
+            memset(runs, 0, sizeof(int) * (n + 1));
+            /* samples flagged so far count as the current limit with their sign, so they do not hide their neighbours */
+            for(y = 0; y < n; y++) {
+                sum += mask[y] * dist[y] + (1.0 - mask[y]) * copysign(limit, dist[y]);
+                if(y >= m)
+                    sum -= mask[y - m] * dist[y - m] + (1.0 - mask[y - m]) * copysign(limit, dist[y - m]);
+                if(y >= m - 1 && fabs(sum) > limit * m) {
+                    runs[y - m + 1]++;
+                    runs[y + 1]--;
+                }
+            }
+            int flagged = 0;
+            for(y = 0; y < n; y++) {
+                flagged += runs[y];
+                mask[y] *= (flagged == 0);
+            }
+        }
+    }
+    free(runs);
+    free(dist);
+}
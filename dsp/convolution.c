@@ -19,42 +19,278 @@
 
 #include "dsp.h"
 
-void dsp_convolution_convolution(dsp_stream_p stream, dsp_stream_p matrix) {
-    int x, y, d;
-    dsp_t mn = dsp_stats_min(stream->buf, stream->len);
-    dsp_t mx = dsp_stats_max(stream->buf, stream->len);
-    int* d_pos = (int*)malloc(sizeof(int)*stream->dims);
-    for(y = 0; y < matrix->len; y++) {
-        int* pos = dsp_stream_get_position(matrix, y);
-        for(d = 0; d < stream->dims; d++) {
-            d_pos[d] = stream->sizes[d]/2+pos[d]-matrix->sizes[d]/2;
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DSP_CONVOLUTION_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define DSP_CONVOLUTION_CACHE 8
+
+typedef struct {
+    dsp_convolution *convolution;
+    int users;
+    unsigned long used;
+} dsp_convolution_entry;
+
+static dsp_convolution_entry convolution_cache[DSP_CONVOLUTION_CACHE];
+static unsigned long convolution_used = 0;
+static pthread_mutex_t convolution_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* the smallest 7-smooth size not lower than len, FFTW is fastest on those */
+static int dsp_convolution_fast_size(int len)
+{
+    int n, m;
+    for(n = Max(1, len);; n++) {
+        m = n;
+        while(m % 2 == 0) m /= 2;
+        while(m % 3 == 0) m /= 3;
+        while(m % 5 == 0) m /= 5;
+        while(m % 7 == 0) m /= 7;
+        if(m == 1)
+            return n;
+    }
+}
+
+#ifdef DSP_CONVOLUTION_SIMD
+/* two complex products per iteration, addsub gives re*re-im*im into the even lanes and im*re+re*im into the odd ones */
+__attribute__((target("avx")))
+static int dsp_convolution_mul_avx(complex_t *a, complex_t *b, int len)
+{
+    int x = 0;
+    for(; len - x >= 2; x += 2) {
+        __m256d va = _mm256_loadu_pd(a[x]);
+        __m256d vb = _mm256_loadu_pd(b[x]);
+        __m256d re = _mm256_movedup_pd(vb);
+        __m256d im = _mm256_permute_pd(vb, 0xf);
+        __m256d swap = _mm256_permute_pd(va, 0x5);
+        _mm256_storeu_pd(a[x], _mm256_addsub_pd(_mm256_mul_pd(va, re), _mm256_mul_pd(swap, im)));
+    }
+    return x;
+}
+#endif
+
+static void dsp_convolution_mul(complex_t *a, complex_t *b, int len)
+{
+    int x = 0;
+#ifdef DSP_CONVOLUTION_SIMD
+    static int avx = -1;
+    if(avx < 0) {
+        __builtin_cpu_init();
+        avx = __builtin_cpu_supports("avx");
+    }
+    if(avx)
+        x = dsp_convolution_mul_avx(a, b, len);
+#endif
+    for(; x < len; x++) {
+        double re = a[x][0] * b[x][0] - a[x][1] * b[x][1];
+        double im = a[x][0] * b[x][1] + a[x][1] * b[x][0];
+        a[x][0] = re;
+        a[x][1] = im;
+    }
+}
+
+dsp_convolution* dsp_convolution_new(dsp_stream_p stream, dsp_stream_p matrix, int correlation)
+{
+    int x, d;
+    if(matrix->dims > stream->dims)
+        return NULL;
+    dsp_convolution *convolution = (dsp_convolution*)calloc(1, sizeof(dsp_convolution));
+    convolution->dims = stream->dims;
+    convolution->correlation = correlation;
+    convolution->sizes = (int*)malloc(sizeof(int) * stream->dims);
+    convolution->kernel_sizes = (int*)malloc(sizeof(int) * stream->dims);
+    convolution->fft_sizes = (int*)malloc(sizeof(int) * stream->dims);
+    convolution->len = stream->len;
+    convolution->kernel_len = matrix->len;
+    convolution->fft_len = 1;
+    for(d = 0; d < stream->dims; d++) {
+        convolution->sizes[d] = stream->sizes[d];
+        convolution->kernel_sizes[d] = d < matrix->dims ? matrix->sizes[d] : 1;
+        convolution->fft_sizes[d] = dsp_convolution_fast_size(convolution->sizes[d] + convolution->kernel_sizes[d] - 1);
+        convolution->fft_len *= convolution->fft_sizes[d];
+    }
+    convolution->kernel = (dsp_t*)malloc(sizeof(dsp_t) * matrix->len);
+    memcpy(convolution->kernel, matrix->buf, sizeof(dsp_t) * matrix->len);
+    /* a direct pass costs len * kernel_len products, the transforms about fft_len * log2(fft_len) each */
+    if((double)convolution->len * convolution->kernel_len <= 8.0 * convolution->fft_len * log2(convolution->fft_len))
+        return convolution;
+    convolution->response = (complex_t*)calloc(convolution->fft_len, sizeof(complex_t));
+    for(x = 0; x < convolution->kernel_len; x++) {
+        int index = 0, m = 1, k = x;
+        for(d = 0; d < convolution->dims; d++) {
+            int pos = k % convolution->kernel_sizes[d] - convolution->kernel_sizes[d] / 2;
+            k /= convolution->kernel_sizes[d];
+            if(correlation)
+                pos = -pos;
+            index += ((pos + convolution->fft_sizes[d]) % convolution->fft_sizes[d]) * m;
+            m *= convolution->fft_sizes[d];
         }
-        x = dsp_stream_set_position(stream, d_pos);
-        free(pos);
-        stream->magnitude->buf[x] *= sqrt(matrix->magnitude->buf[y]);
+        convolution->response[index][0] = convolution->kernel[x] / convolution->fft_len;
     }
-    free(d_pos);
-    dsp_fourier_idft(stream);
-    dsp_buffer_stretch(stream->buf, stream->len, mn, mx);
+    dsp_fourier_dft_complex(convolution->response, convolution->response, convolution->dims, convolution->fft_sizes, -1);
+    return convolution;
 }
 
-void dsp_convolution_correlation(dsp_stream_p stream, dsp_stream_p matrix) {
+void dsp_convolution_free(dsp_convolution *convolution)
+{
+    if(convolution == NULL)
+        return;
+    free(convolution->sizes);
+    free(convolution->kernel_sizes);
+    free(convolution->fft_sizes);
+    free(convolution->kernel);
+    free(convolution->response);
+    free(convolution);
+}
+
+static void dsp_convolution_direct(dsp_convolution *convolution, dsp_stream_p stream)
+{
     int x, y, d;
-    dsp_t mn = dsp_stats_min(stream->buf, stream->len);
-    dsp_t mx = dsp_stats_max(stream->buf, stream->len);
-    int* d_pos = (int*)malloc(sizeof(int)*stream->dims);
-    dsp_buffer_shift(matrix->magnitude);
-    for(y = 0; y < matrix->len; y++) {
-        int* pos = dsp_stream_get_position(matrix, y);
-        for(d = 0; d < stream->dims; d++) {
-            d_pos[d] = stream->sizes[d]/2+pos[d]-matrix->sizes[d]/2;
+    int dims = convolution->dims;
+    int *offsets = (int*)malloc(sizeof(int) * dims * convolution->kernel_len);
+    int *pos = (int*)calloc(dims, sizeof(int));
+    dsp_t *out = (dsp_t*)malloc(sizeof(dsp_t) * stream->len);
+    for(y = 0; y < convolution->kernel_len; y++) {
+        int k = y;
+        for(d = 0; d < dims; d++) {
+            offsets[y * dims + d] = k % convolution->kernel_sizes[d] - convolution->kernel_sizes[d] / 2;
+            k /= convolution->kernel_sizes[d];
+            if(!convolution->correlation)
+                offsets[y * dims + d] = -offsets[y * dims + d];
+        }
+    }
+    for(x = 0; x < stream->len; x++) {
+        double sum = 0.0;
+        for(y = 0; y < convolution->kernel_len; y++) {
+            int index = 0, m = 1;
+            for(d = 0; d < dims; d++) {
+                int p = pos[d] + offsets[y * dims + d];
+                if(p < 0 || p >= stream->sizes[d])
+                    break;
+                index += p * m;
+                m *= stream->sizes[d];
+            }
+            if(d == dims)
+                sum += convolution->kernel[y] * stream->buf[index];
         }
-        x = dsp_stream_set_position(stream, d_pos);
-        free(pos);
-        stream->magnitude->buf[x] *= sqrt(matrix->magnitude->buf[y]);
-    }
-    dsp_buffer_shift(matrix->magnitude);
-    free(d_pos);
-    dsp_fourier_idft(stream);
-    dsp_buffer_stretch(stream->buf, stream->len, mn, mx);
+        out[x] = sum;
+        for(d = 0; d < dims && ++pos[d] == stream->sizes[d]; d++)
+            pos[d] = 0;
+    }
+    memcpy(stream->buf, out, sizeof(dsp_t) * stream->len);
+    free(out);
+    free(pos);
+    free(offsets);
+}
+
+static void dsp_convolution_fft(dsp_convolution *convolution, dsp_stream_p stream)
+{
+    int x, d;
+    int dims = convolution->dims;
+    int *pos = (int*)calloc(dims, sizeof(int));
+    int *index = (int*)malloc(sizeof(int) * stream->len);
+    complex_t *work = (complex_t*)calloc(convolution->fft_len, sizeof(complex_t));
+    for(x = 0; x < stream->len; x++) {
+        int i = 0, m = 1;
+        for(d = 0; d < dims; d++) {
+            i += pos[d] * m;
+            m *= convolution->fft_sizes[d];
+        }
+        index[x] = i;
+        work[i][0] = stream->buf[x];
+        for(d = 0; d < dims && ++pos[d] == stream->sizes[d]; d++)
+            pos[d] = 0;
+    }
+    dsp_fourier_dft_complex(work, work, dims, convolution->fft_sizes, -1);
+    dsp_convolution_mul(work, convolution->response, convolution->fft_len);
+    dsp_fourier_dft_complex(work, work, dims, convolution->fft_sizes, 1);
+    for(x = 0; x < stream->len; x++)
+        stream->buf[x] = work[index[x]][0];
+    free(work);
+    free(index);
+    free(pos);
+}
+
+void dsp_convolution_apply(dsp_convolution *convolution, dsp_stream_p stream)
+{
+    int d;
+    if(convolution == NULL || stream->dims != convolution->dims)
+        return;
+    for(d = 0; d < stream->dims; d++)
+        if(stream->sizes[d] != convolution->sizes[d])
+            return;
+    if(convolution->response != NULL)
+        dsp_convolution_fft(convolution, stream);
+    else
+        dsp_convolution_direct(convolution, stream);
+}
+
+static int dsp_convolution_matches(dsp_convolution *convolution, dsp_stream_p stream, dsp_stream_p matrix, int correlation)
+{
+    int d;
+    if(convolution->correlation != correlation || convolution->dims != stream->dims || convolution->kernel_len != matrix->len)
+        return 0;
+    for(d = 0; d < stream->dims; d++) {
+        if(convolution->sizes[d] != stream->sizes[d])
+            return 0;
+        if(convolution->kernel_sizes[d] != (d < matrix->dims ? matrix->sizes[d] : 1))
+            return 0;
+    }
+    return !memcmp(convolution->kernel, matrix->buf, sizeof(dsp_t) * matrix->len);
+}
+
+static void dsp_convolution_cached(dsp_stream_p stream, dsp_stream_p matrix, int correlation)
+{
+    int x, slot = -1;
+    dsp_convolution *convolution = NULL;
+    pthread_mutex_lock(&convolution_mutex);
+    for(x = 0; x < DSP_CONVOLUTION_CACHE; x++) {
+        if(convolution_cache[x].convolution != NULL && dsp_convolution_matches(convolution_cache[x].convolution, stream, matrix, correlation)) {
+            slot = x;
+            break;
+        }
+    }
+    if(slot >= 0) {
+        convolution = convolution_cache[slot].convolution;
+        convolution_cache[slot].users++;
+        convolution_cache[slot].used = ++convolution_used;
+    }
+    pthread_mutex_unlock(&convolution_mutex);
+    if(convolution == NULL) {
+        convolution = dsp_convolution_new(stream, matrix, correlation);
+        if(convolution == NULL)
+            return;
+        pthread_mutex_lock(&convolution_mutex);
+        for(x = 0; x < DSP_CONVOLUTION_CACHE; x++) {
+            if(convolution_cache[x].users > 0)
+                continue;
+            if(slot < 0 || convolution_cache[x].used < convolution_cache[slot].used)
+                slot = x;
+        }
+        if(slot >= 0) {
+            dsp_convolution_free(convolution_cache[slot].convolution);
+            convolution_cache[slot].convolution = convolution;
+            convolution_cache[slot].users = 1;
+            convolution_cache[slot].used = ++convolution_used;
+        }
+        pthread_mutex_unlock(&convolution_mutex);
+    }
+    dsp_convolution_apply(convolution, stream);
+    if(slot < 0) {
+        dsp_convolution_free(convolution);
+        return;
+    }
+    pthread_mutex_lock(&convolution_mutex);
+    convolution_cache[slot].users--;
+    pthread_mutex_unlock(&convolution_mutex);
+}
+
+void dsp_convolution_convolution(dsp_stream_p stream, dsp_stream_p matrix)
+{
+    dsp_convolution_cached(stream, matrix, 0);
+}
+
+void dsp_convolution_correlation(dsp_stream_p stream, dsp_stream_p matrix)
+{
+    dsp_convolution_cached(stream, matrix, 1);
 }
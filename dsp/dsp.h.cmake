@@ -78,6 +78,156 @@ typedef double complex_t[2];
 */
 DLL_EXPORT unsigned long int dsp_max_threads(unsigned long value);
 
+/**
+* \brief The number of work units processed between two updates of a progress token
+*/
+#define DSP_PROGRESS_CHUNK 4096
+
+/**
+* \brief A progress and cancellation token shared between a long running operation and its caller
+* \sa dsp_progress_set()
+*/
+typedef struct dsp_progress_t
+{
+    ///Set to non-zero to cancel the operation, it is checked between work chunks
+    int cancel;
+    ///The work units completed, updated atomically once per chunk
+    unsigned long done;
+    ///The work units expected
+    unsigned long total;
+} dsp_progress;
+
+/**
+* \brief Bind a progress token to the calling thread, the long running functions called by this thread will update it
+* and stop when its cancel flag is raised, the worker threads they create inherit it.
+* \param progress The token, or NULL to unbind the current one
+*/
+DLL_EXPORT void dsp_progress_set(dsp_progress *progress);
+
+/**
+* \brief Get the progress token bound to the calling thread
+* \return The token, or NULL if none is bound
+*/
+DLL_EXPORT dsp_progress *dsp_progress_get(void);
+
+/**
+* \brief Announce more work units on a progress token
+* \param progress The token, can be NULL
+* \param units The number of work units
+*/
+DLL_EXPORT void dsp_progress_add(dsp_progress *progress, unsigned long units);
+
+/**
+* \brief Account completed work units on a progress token, call it once per chunk
+* \param progress The token, can be NULL
+* \param units The number of work units completed
+* \return Non-zero if the operation was cancelled
+*/
+DLL_EXPORT int dsp_progress_step(dsp_progress *progress, unsigned long units);
+
+/**
+* \brief Check whether the operation of a progress token was cancelled
+* \param progress The token, can be NULL
+* \return Non-zero if the operation was cancelled
+*/
+DLL_EXPORT int dsp_progress_cancelled(dsp_progress *progress);
+
+/**
+* \brief Get the completed fraction of a progress token
+* \param progress The token, can be NULL
+* \return The fraction of work done, between 0 and 1
+*/
+DLL_EXPORT double dsp_progress_value(dsp_progress *progress);
+
+#cmakedefine DSP_INSTRUMENTATION
+
+/**
+* \brief The processing stages timed by the instrumentation counters
+*/
+typedef enum {
+    ///Baseline geometry and uv projection
+    dsp_perf_geometry = 0,
+    ///Delay model
+    dsp_perf_delay,
+    ///Correlation of the samples
+    dsp_perf_correlation,
+    ///Gridding into the uv plane
+    dsp_perf_gridding,
+    ///Fourier transforms
+    dsp_perf_fft,
+    ///File and image encoding input and output
+    dsp_perf_io,
+    ///Base64 encoding and decoding
+    dsp_perf_base64,
+    ///Time spent waiting for locks
+    dsp_perf_lock,
+    ///The number of stages
+    dsp_perf_stages,
+} dsp_perf_stage;
+
+/**
+* \brief Instrumentation counters, summed across all threads
+*/
+typedef struct dsp_perf_counters_t {
+    ///Number of timed sections of each stage
+    unsigned long calls[dsp_perf_stages];
+    ///Time spent into each stage in nanoseconds, nested stages are accounted in both
+    unsigned long long time[dsp_perf_stages];
+} dsp_perf_counters;
+
+/**
+* \brief Get a monotonic timestamp
+* \return The timestamp in nanoseconds
+*/
+DLL_EXPORT unsigned long long dsp_perf_now(void);
+
+/**
+* \brief Account a timed section into the counters of the calling thread
+* \param stage The stage of the section
+* \param start The timestamp of the start of the section
+*/
+DLL_EXPORT void dsp_perf_add(dsp_perf_stage stage, unsigned long long start);
+
+/**
+* \brief Sum the counters of all threads, zero if the instrumentation is not compiled in
+* \param counters The counters to fill
+*/
+DLL_EXPORT void dsp_perf_get(dsp_perf_counters *counters);
+
+/**
+* \brief Reset the counters of all threads
+*/
+DLL_EXPORT void dsp_perf_reset(void);
+
+/**
+* \brief Get the name of a stage
+* \param stage The stage
+* \return The stage name
+*/
+DLL_EXPORT const char *dsp_perf_stage_name(dsp_perf_stage stage);
+
+/**
+* \brief Enable or disable the recording of the timed sections for the trace dump
+* \param enable Non-zero to record, recorded sections are kept until the process exits
+*/
+DLL_EXPORT void dsp_perf_trace(int enable);
+
+/**
+* \brief Write the recorded sections as Chrome trace event JSON
+* \param f The stream receiving the trace
+*/
+DLL_EXPORT void dsp_perf_trace_dump(FILE *f);
+
+#ifdef DSP_INSTRUMENTATION
+///Start timing a stage section, use end_gettime with the same stage into the same scope to account it
+#define start_gettime(stage) unsigned long long dsp_perf_start_##stage = dsp_perf_now()
+///Stop timing a stage section started with start_gettime
+#define end_gettime(stage) dsp_perf_add(stage, dsp_perf_start_##stage)
+#else
+#define start_gettime(stage)
+#define end_gettime(stage)
+#endif
+
 #ifndef DSP_DEBUG
 #define DSP_DEBUG
 /**
@@ -154,16 +304,12 @@ dsp_print(x, str); \
 #define pwarn(...) pdbg(DSP_DEBUG_WARNING, __VA_ARGS__)
 #define pgarb(...) pdbg(DSP_DEBUG_DEBUG, __VA_ARGS__)
 #define pfunc pgarb("%s\n", __func__)
-#define start_gettime
-#define end_gettime
 #else
 #define pinfo(...)
 #define perr(...)
 #define pwarn(...)
 #define pgarb(...)
 #define pfunc(...)
-#define start_gettime(...)
-#define end_gettime(...)
 #endif
 
 
@@ -202,6 +348,18 @@ dsp_print(x, str); \
 ///No matches were found during comparison
 #define DSP_ALIGN_NO_MATCH 8
 #endif
+#ifndef DSP_INTERPOLATION_NEAREST
+///Resample taking the nearest input pixel
+#define DSP_INTERPOLATION_NEAREST 0
+#endif
+#ifndef DSP_INTERPOLATION_BILINEAR
+///Resample interpolating linearly the 2x2 nearest input pixels
+#define DSP_INTERPOLATION_BILINEAR 1
+#endif
+#ifndef DSP_INTERPOLATION_LANCZOS
+///Resample with a 6x6 Lanczos (a=3) kernel
+#define DSP_INTERPOLATION_LANCZOS 2
+#endif
 /**\}*/
 /**
  * \defgroup DSP_Types DSP API types
@@ -349,6 +507,11 @@ typedef union dsp_location_t
 */
 typedef void *(*dsp_func_t) (void *, ...);
 
+/**
+* \brief Output delegate of the streaming encoders, receives each chunk of the encoded file as soon as it is produced
+*/
+typedef void (*dsp_file_output_t) (void *arg, const void *buf, size_t len);
+
 /**
 * \brief Contains a set of informations and data relative to a buffer and how to use it
 * \sa dsp_stream_new
@@ -427,6 +590,62 @@ typedef struct dsp_stream_t
     int frame_number;
 } dsp_stream, *dsp_stream_p;
 
+/**
+* \brief A streaming FIR filter or polyphase filter bank, it keeps the input history between blocks
+* \sa dsp_fir_new()
+*/
+typedef struct dsp_fir_t
+{
+    /// The number of taps, a multiple of channels for a filter bank
+    int taps_count;
+    /// The output decimation factor
+    int decimation;
+    /// The number of sub-bands, 1 for a plain FIR filter
+    int channels;
+    /// The block size, the FFT size for a FIR filter or taps_count for a filter bank
+    int block;
+    /// The input samples buffered into the current block
+    int fill;
+    /// The decimation phase of the next output sample
+    int phase;
+    /// The filter taps
+    double *taps;
+    /// The fourier transform of the zero padded taps
+    complex_t *response;
+    /// The input block
+    dsp_t *buf;
+    /// The fourier transform work buffer
+    complex_t *work;
+} dsp_fir;
+
+/**
+* \brief A convolution or correlation kernel prepared for streams of a given shape
+* \sa dsp_convolution_new()
+*/
+typedef struct dsp_convolution_t
+{
+    /// The number of dimensions
+    int dims;
+    /// The sizes of the streams to process
+    int *sizes;
+    /// The sizes of the kernel
+    int *kernel_sizes;
+    /// The zero padded sizes of the fourier transforms
+    int *fft_sizes;
+    /// The length of the streams to process
+    int len;
+    /// The length of the kernel
+    int kernel_len;
+    /// The length of the fourier transforms
+    int fft_len;
+    /// Non-zero for a correlation
+    int correlation;
+    /// The kernel
+    dsp_t *kernel;
+    /// The normalized fourier transform of the kernel, NULL if the kernel is applied directly
+    complex_t *response;
+} dsp_convolution;
+
 /**\}*/
 /**
  * \defgroup dsp_FourierTransform DSP API Fourier transform related functions
@@ -446,6 +665,21 @@ DLL_EXPORT void dsp_fourier_dft(dsp_stream_p stream, int exp);
 */
 DLL_EXPORT void dsp_fourier_idft(dsp_stream_p stream);
 
+/**
+* \brief Perform a complex discrete Fourier Transform of a buffer, using a plan cached per size and direction
+* \param in the input complex buffer.
+* \param out the output complex buffer, can be the same as in.
+* \param dims the number of dimensions.
+* \param sizes the sizes of each dimension, the first one is the fastest varying.
+* \param sign -1 for the forward transform, 1 for the inverse one. The inverse transform is not normalized.
+*/
+DLL_EXPORT void dsp_fourier_dft_complex(complex_t *in, complex_t *out, int dims, int *sizes, int sign);
+
+/**
+* \brief Release all the fourier transform plans cached so far
+*/
+DLL_EXPORT void dsp_fourier_plans_clear(void);
+
 /**
 * \brief Fill the magnitude and phase buffers with the current data in stream->dft
 * \param stream the inout stream.
@@ -527,20 +761,112 @@ DLL_EXPORT void dsp_filter_bandpass(dsp_stream_p stream, double LowFrequency,
 DLL_EXPORT void dsp_filter_bandreject(dsp_stream_p stream, double LowFrequency,
                                       double HighFrequency);
 
+/**
+* \brief Design the taps of a windowed-sinc low pass filter, usable as prototype of a filter bank
+* \param taps_count the number of taps.
+* \param frequency the cutoff frequency of the filter in radians per sample, pi/channels for a filter bank.
+* \return the taps array, to be freed
+*/
+DLL_EXPORT double* dsp_fir_lowpass_taps(int taps_count, double frequency);
+
+/**
+* \brief Create a streaming FIR filter using overlap-save block convolution, or a polyphase filter bank
+* \param taps the filter taps, they are copied.
+* \param taps_count the number of taps.
+* \param decimation the output decimation factor of a FIR filter, ignored by filter banks that output one spectrum
+* every channels input samples.
+* \param channels the number of sub-bands, 1 for a FIR filter.
+* \return the filter, to be freed with dsp_fir_free()
+*/
+DLL_EXPORT dsp_fir* dsp_fir_new(double *taps, int taps_count, int decimation, int channels);
+
+/**
+* \brief Free a streaming filter
+* \param fir the filter.
+*/
+DLL_EXPORT void dsp_fir_free(dsp_fir *fir);
+
+/**
+* \brief Clear the input history of a streaming filter
+* \param fir the filter.
+*/
+DLL_EXPORT void dsp_fir_reset(dsp_fir *fir);
+
+/**
+* \brief Filter a block of samples, the output is produced once a whole FFT block has been buffered
+* \param fir the FIR filter.
+* \param in the input samples.
+* \param len the number of input samples.
+* \param out the output samples, at least (len + fir->block) / fir->decimation elements.
+* \return the number of output samples written, -1 if the filter is a channelizer
+*/
+DLL_EXPORT int dsp_fir_process(dsp_fir *fir, dsp_t *in, int len, dsp_t *out);
+
+/**
+* \brief Filter the samples still buffered, as if the input were followed by zeros, then reset the filter
+* \param fir the FIR filter.
+* \param out the output samples, at least fir->block / fir->decimation elements.
+* \return the number of output samples written, -1 if the filter is a channelizer
+*/
+DLL_EXPORT int dsp_fir_flush(dsp_fir *fir, dsp_t *out);
+
+/**
+* \brief Split a block of samples into sub-bands through a critically sampled polyphase filter bank
+* \param fir the filter bank.
+* \param in the input samples.
+* \param len the number of input samples.
+* \param out the output spectra, channels complex values each, at least (len / fir->channels + 1) spectra.
+* \return the number of output spectra written, -1 if the filter has a single channel
+*/
+DLL_EXPORT int dsp_fir_channelize(dsp_fir *fir, dsp_t *in, int len, complex_t *out);
+
+/**
+* \brief Apply a FIR filter to a stream, the output is delayed by the filter group delay
+* \param stream the inout stream.
+* \param taps the filter taps.
+* \param taps_count the number of taps.
+*/
+DLL_EXPORT void dsp_filter_fir(dsp_stream_p stream, double *taps, int taps_count);
+
 /**\}*/
 /**
  * \defgroup dsp_Convolution DSP API Convolution and cross-correlation functions
 */
 /**\{*/
 /**
-* \brief A cross-convolution processor
+* \brief Prepare a convolution or correlation kernel, small kernels are applied directly, larger ones through
+* zero padded fourier transforms of the kernel computed here once
+* \param stream a stream with the shape of the streams to process.
+* \param matrix the kernel stream, centered at sizes/2.
+* \param correlation non-zero to correlate instead of convolving.
+* \return the prepared kernel, to be freed with dsp_convolution_free()
+*/
+DLL_EXPORT dsp_convolution* dsp_convolution_new(dsp_stream_p stream, dsp_stream_p matrix, int correlation);
+
+/**
+* \brief Convolve or correlate a stream with a prepared kernel, the result has the size of the stream and zeros
+* are assumed outside of it
+* \param convolution the prepared kernel.
+* \param stream the inout stream, with the shape given to dsp_convolution_new().
+*/
+DLL_EXPORT void dsp_convolution_apply(dsp_convolution *convolution, dsp_stream_p stream);
+
+/**
+* \brief Free a prepared kernel
+* \param convolution the prepared kernel.
+*/
+DLL_EXPORT void dsp_convolution_free(dsp_convolution *convolution);
+
+/**
+* \brief A linear convolution processor, the latest kernels prepared are cached so repeated calls with the same
+* matrix cost one fourier transform pair
 * \param stream the input stream.
 * \param matrix the convolution matrix stream.
 */
 DLL_EXPORT void dsp_convolution_convolution(dsp_stream_p stream, dsp_stream_p matrix);
 
 /**
-* \brief A cross-correlation processor
+* \brief A linear cross-correlation processor, the latest kernels prepared are cached
 * \param stream the input stream.
 * \param matrix the correlation matrix stream.
 */
@@ -982,6 +1308,30 @@ DLL_EXPORT void dsp_buffer_sigma(dsp_stream_p stream, int size);
 */
 DLL_EXPORT void dsp_buffer_deviate(dsp_stream_p stream, dsp_t* deviation, dsp_t mindeviation, dsp_t maxdeviation);
 
+/**
+* \brief Flag the outliers of a buffer, the median and the median absolute deviation are estimated over each window
+* with a scalar quickselect on a copy of the window, the windows are the unit of parallelism of the callers.
+* \param in the input buffer.
+* \param flags the flag mask, its elements are multiplied by 0 where the input is flagged and left unchanged elsewhere,
+* so the masks of several passes combine.
+* \param len the length of the buffers, it can be a block of a longer stream.
+* \param window the number of samples of each estimation window.
+* \param threshold the distance from the median in standard deviations (1.4826 times the MAD) at which a sample is flagged.
+*/
+DLL_EXPORT void dsp_buffer_flag_mad(dsp_t *in, dsp_t *flags, int len, int window, double threshold);
+
+/**
+* \brief Flag the outliers of a buffer with the SumThreshold method: runs of 1, 2, 4 and up to max_length samples
+* are flagged when their summed distance from the window median exceeds a threshold decreasing with the run length
+* \param in the input buffer.
+* \param flags the flag mask, multiplied by 0 where the input is flagged.
+* \param len the length of the buffers, it can be a block of a longer stream.
+* \param window the number of samples of each estimation window.
+* \param threshold the single sample threshold in standard deviations, runs of n samples use threshold / 1.5^log2(n).
+* \param max_length the longest run checked.
+*/
+DLL_EXPORT void dsp_buffer_flag_sumthreshold(dsp_t *in, dsp_t *flags, int len, int window, double threshold, int max_length);
+
 #ifndef dsp_buffer_reverse
 /**
 * \brief Reverse the order of the buffer elements
@@ -1277,6 +1627,33 @@ DLL_EXPORT void dsp_stream_scale(dsp_stream_p stream);
 */
 DLL_EXPORT void dsp_stream_align(dsp_stream_p stream);
 
+/**
+* \brief Resample a stream through an affine transformation in-place
+* The matrix maps each output pixel (x, y) to the input coordinates
+* (matrix[0]*x + matrix[1]*y + matrix[2], matrix[3]*x + matrix[4]*y + matrix[5]),
+* streams with more than two dimensions are warped plane by plane.
+* Row tiles are shared by the calling thread and a pool of persistent workers, up to dsp_max_threads in total.
+* \param stream The stream that will be transformed
+* \param matrix The 2x3 transformation matrix, row major
+* \param interpolation One of the DSP_INTERPOLATION_* values
+*/
+DLL_EXPORT void dsp_stream_warp(dsp_stream_p stream, double *matrix, int interpolation);
+
+/**
+* \brief Combine the scale, translation and rotation of the align_info field into a single warp matrix
+* \param stream The stream containing the alignment information
+* \param matrix The 2x3 matrix that will be filled, as accepted by dsp_stream_warp
+*/
+DLL_EXPORT void dsp_stream_get_align_matrix(dsp_stream_p stream, double *matrix);
+
+/**
+* \brief Align a frame and add it to a stack in a single resampling pass
+* \param stack The accumulation stream, same sizes as frame
+* \param frame The stream to align by its align_info field, left untouched
+* \param interpolation One of the DSP_INTERPOLATION_* values
+*/
+DLL_EXPORT void dsp_stream_stack(dsp_stream_p stack, dsp_stream_p frame, int interpolation);
+
 /**\}*/
 /**
  * \defgroup dsp_SignalGen DSP API Signal generation functions
@@ -1408,6 +1785,39 @@ DLL_EXPORT dsp_stream_p* dsp_file_read_png(const char* filename, int *channels,
 */
 DLL_EXPORT void dsp_file_write_png_composite(const char* filename, int components, int compression, dsp_stream_p* stream);
 
+/**
+* \brief Encode the components dsp_stream_p array as a PNG file without writing it to disk,
+* rows are quantized in parallel bands and passed to the encoder as they are ready.
+* \param components the number of streams in the array to be used as components 1 or 3.
+* \param compression the compression of the output PNG 0-9.
+* \param stream the input stream array to be encoded
+* \param output the delegate receiving the encoded bytes
+* \param arg the first argument passed to output
+*/
+DLL_EXPORT void dsp_file_encode_png(int components, int compression, dsp_stream_p* stream, dsp_file_output_t output, void *arg);
+
+/**
+* \brief Encode the components dsp_stream_p array as a JPEG file without writing it to disk,
+* rows are quantized in parallel bands and passed to the encoder as they are ready.
+* \param components the number of streams in the array to be used as components 1 or 3.
+* \param quality the quality of the output JPEG file 0-100.
+* \param stream the input stream array to be encoded
+* \param output the delegate receiving the encoded bytes
+* \param arg the first argument passed to output
+*/
+DLL_EXPORT void dsp_file_encode_jpeg(int components, int quality, dsp_stream_p* stream, dsp_file_output_t output, void *arg);
+
+/**
+* \brief Encode the components dsp_stream_p array as a FITS file without writing it to disk,
+* the components are stored as the last axis of the primary image.
+* \param components the number of streams in the array to be used as components.
+* \param bpp the bit depth of the output FITS file [8,16,32,-32,-64], floating point samples are not stretched.
+* \param stream the input stream array to be encoded
+* \param output the delegate receiving the encoded bytes
+* \param arg the first argument passed to output
+*/
+DLL_EXPORT void dsp_file_encode_fits(int components, int bpp, dsp_stream_p* stream, dsp_file_output_t output, void *arg);
+
 /**
 * \brief Convert a bayer pattern dsp_t array into a grayscale array
 * \param src the input buffer
@@ -1504,6 +1914,7 @@ DLL_EXPORT dsp_triangle dsp_align_calc_triangle(dsp_star* stars);
 
 /**
 * \brief Calculate offsets, rotation and scaling of two streams giving reference alignment point
+* Only the triangles whose side ratios differ less than 10^-tolerance from the reference ones are compared.
 * \param ref the reference stream
 * \param to_align the stream to be aligned
 * \param tolerance number of decimals allowed
@@ -20,6 +20,107 @@
 #include "dsp.h"
 #include <fftw3.h>
 
+#define DSP_FOURIER_PLAN_R2C 0
+#define DSP_FOURIER_PLAN_C2R 1
+#define DSP_FOURIER_PLAN_C2C 2
+#define DSP_FOURIER_PLAN_C2C_INPLACE 3
+
+typedef struct {
+    int type;
+    int sign;
+    int dims;
+    int *sizes;
+    fftw_plan plan;
+} dsp_fourier_plan;
+
+static dsp_fourier_plan *plans = NULL;
+static int plans_count = 0;
+static pthread_mutex_t plans_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* FFTW planning is not thread safe, while executing a plan on new arrays is.
+ * Plans are created once per shape with FFTW_UNALIGNED so they can run on any buffer. */
+static fftw_plan dsp_fourier_get_plan(int type, int sign, int dims, int *sizes)
+{
+    int x, d;
+    fftw_plan plan = NULL;
+    start_gettime(dsp_perf_lock);
+    pthread_mutex_lock(&plans_mutex);
+    end_gettime(dsp_perf_lock);
+    for(x = 0; x < plans_count; x++) {
+        if(plans[x].type != type || plans[x].sign != sign || plans[x].dims != dims)
+            continue;
+        for(d = 0; d < dims && plans[x].sizes[d] == sizes[d]; d++);
+        if(d == dims) {
+            plan = plans[x].plan;
+            break;
+        }
+    }
+    if(plan == NULL) {
+        int len = 1;
+        for(d = 0; d < dims; d++)
+            len *= sizes[d];
+        double *in = (double*)fftw_malloc(sizeof(complex_t) * len);
+        complex_t *out = (complex_t*)fftw_malloc(sizeof(complex_t) * len);
+        switch(type) {
+            case DSP_FOURIER_PLAN_R2C:
+                plan = fftw_plan_dft_r2c(dims, sizes, in, out, FFTW_ESTIMATE | FFTW_UNALIGNED);
+                break;
+            case DSP_FOURIER_PLAN_C2R:
+                plan = fftw_plan_dft_c2r(dims, sizes, out, in, FFTW_ESTIMATE | FFTW_UNALIGNED);
+                break;
+            case DSP_FOURIER_PLAN_C2C_INPLACE:
+                plan = fftw_plan_dft(dims, sizes, out, out, sign, FFTW_ESTIMATE | FFTW_UNALIGNED);
+                break;
+            default:
+                plan = fftw_plan_dft(dims, sizes, (complex_t*)in, out, sign, FFTW_ESTIMATE | FFTW_UNALIGNED);
+                break;
+        }
+        fftw_free(in);
+        fftw_free(out);
+        if(plan != NULL) {
+            plans = (dsp_fourier_plan*)realloc(plans, sizeof(dsp_fourier_plan) * (plans_count + 1));
+            plans[plans_count].type = type;
+            plans[plans_count].sign = sign;
+            plans[plans_count].dims = dims;
+            plans[plans_count].sizes = (int*)malloc(sizeof(int) * dims);
+            memcpy(plans[plans_count].sizes, sizes, sizeof(int) * dims);
+            plans[plans_count].plan = plan;
+            plans_count++;
+        }
+    }
+    pthread_mutex_unlock(&plans_mutex);
+    return plan;
+}
+
+void dsp_fourier_plans_clear()
+{
+    int x;
+    pthread_mutex_lock(&plans_mutex);
+    for(x = 0; x < plans_count; x++) {
+        fftw_destroy_plan(plans[x].plan);
+        free(plans[x].sizes);
+    }
+    free(plans);
+    plans = NULL;
+    plans_count = 0;
+    pthread_mutex_unlock(&plans_mutex);
+}
+
+void dsp_fourier_dft_complex(complex_t *in, complex_t *out, int dims, int *sizes, int sign)
+{
+    int d;
+    int *n = (int*)malloc(sizeof(int) * dims);
+    for(d = 0; d < dims; d++)
+        n[d] = sizes[dims - 1 - d];
+    fftw_plan plan = dsp_fourier_get_plan(in == out ? DSP_FOURIER_PLAN_C2C_INPLACE : DSP_FOURIER_PLAN_C2C, sign < 0 ? FFTW_FORWARD : FFTW_BACKWARD, dims, n);
+    free(n);
+    if(plan != NULL) {
+        start_gettime(dsp_perf_fft);
+        fftw_execute_dft(plan, in, out);
+        end_gettime(dsp_perf_fft);
+    }
+}
+
 static void dsp_fourier_dft_magnitude(dsp_stream_p stream)
 {
     if(stream->magnitude)
@@ -128,14 +229,18 @@ static void* dsp_stream_dft_th(void* arg)
     struct {
         int exp;
        dsp_stream_p stream;
+       dsp_progress *progress;
     } *arguments = arg;
+    dsp_progress_set(arguments->progress);
     dsp_fourier_dft(arguments->stream, arguments->exp);
     return NULL;
 }
 void dsp_fourier_dft(dsp_stream_p stream, int exp)
 {
-    if(exp < 1)
+    dsp_progress *progress = dsp_progress_get();
+    if(exp < 1 || dsp_progress_cancelled(progress))
         return;
+    dsp_progress_add(progress, 1);
     double* buf = (double*)malloc(sizeof(double) * stream->len);
     if(stream->phase == NULL)
         stream->phase = dsp_stream_copy(stream);
@@ -143,26 +248,31 @@ void dsp_fourier_dft(dsp_stream_p stream, int exp)
         stream->magnitude = dsp_stream_copy(stream);
     dsp_buffer_set(stream->dft.buf, stream->len * 2, 0);
     dsp_buffer_copy(stream->buf, buf, stream->len);
-    int *sizes = (int*)malloc(sizeof(int)*stream->dims);
-    dsp_buffer_reverse(sizes, stream->dims);
-    fftw_plan plan = fftw_plan_dft_r2c(stream->dims, stream->sizes, buf, stream->dft.pairs, FFTW_ESTIMATE_PATIENT);
-    fftw_execute(plan);
-    fftw_free(plan);
-    free(sizes);
+    fftw_plan plan = dsp_fourier_get_plan(DSP_FOURIER_PLAN_R2C, 0, stream->dims, stream->sizes);
+    if(plan != NULL) {
+        start_gettime(dsp_perf_fft);
+        fftw_execute_dft_r2c(plan, buf, stream->dft.pairs);
+        end_gettime(dsp_perf_fft);
+    }
     free(buf);
     dsp_fourier_2dsp(stream);
+    if(dsp_progress_step(progress, 1))
+        return;
     if(exp > 1) {
         exp--;
         pthread_t th[2];
         struct {
            int exp;
            dsp_stream_p stream;
+           dsp_progress *progress;
         } thread_arguments[2];
         thread_arguments[0].exp = exp;
         thread_arguments[0].stream = stream->phase;
+        thread_arguments[0].progress = progress;
         pthread_create(&th[0], NULL, dsp_stream_dft_th, &thread_arguments[0]);
         thread_arguments[1].exp = exp;
         thread_arguments[1].stream = stream->magnitude;
+        thread_arguments[1].progress = progress;
         pthread_create(&th[1], NULL, dsp_stream_dft_th, &thread_arguments[1]);
         pthread_join(th[0], NULL);
         pthread_join(th[1], NULL);
@@ -171,20 +281,25 @@ void dsp_fourier_dft(dsp_stream_p stream, int exp)
 
 void dsp_fourier_idft(dsp_stream_p stream)
 {
+    dsp_progress *progress = dsp_progress_get();
+    if(dsp_progress_cancelled(progress))
+        return;
+    dsp_progress_add(progress, 1);
     double *buf = (double*)malloc(sizeof(double)*stream->len);
     dsp_t mn = dsp_stats_min(stream->buf, stream->len);
     dsp_t mx = dsp_stats_max(stream->buf, stream->len);
     dsp_buffer_set(buf, stream->len, 0);
     dsp_fourier_2complex_t(stream);
-    int *sizes = (int*)malloc(sizeof(int)*stream->dims);
-    dsp_buffer_reverse(sizes, stream->dims);
-    fftw_plan plan = fftw_plan_dft_c2r(stream->dims, stream->sizes, stream->dft.pairs, buf, FFTW_ESTIMATE_PATIENT);
-    fftw_execute(plan);
-    fftw_free(plan);
-    free(sizes);
+    fftw_plan plan = dsp_fourier_get_plan(DSP_FOURIER_PLAN_C2R, 0, stream->dims, stream->sizes);
+    if(plan != NULL) {
+        start_gettime(dsp_perf_fft);
+        fftw_execute_dft_c2r(plan, stream->dft.pairs, buf);
+        end_gettime(dsp_perf_fft);
+    }
     dsp_buffer_stretch(buf, stream->len, mn, mx);
     dsp_buffer_copy(buf, stream->buf, stream->len);
     dsp_buffer_shift(stream->magnitude);
     dsp_buffer_shift(stream->phase);
     free(buf);
+    dsp_progress_step(progress, 1);
 }
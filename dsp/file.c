@@ -22,6 +22,7 @@
 #include <time.h>
 #include <locale.h>
 #include <unistd.h>
+#include <stdint.h>
 #include <jpeglib.h>
 #include <png.h>
 
@@ -581,8 +582,6 @@ void dsp_file_write_jpeg(const char* filename, int quality, dsp_stream_p stream)
     cinfo.input_components = components;
     jpeg_set_defaults(&cinfo);
     cinfo.dct_method = JDCT_FLOAT;
-    cinfo.optimize_coding = TRUE;
-    cinfo.restart_in_rows = 1;
 
     jpeg_set_quality(&cinfo, quality, TRUE);
     jpeg_start_compress(&cinfo, TRUE);
@@ -601,49 +600,374 @@ void dsp_file_write_jpeg(const char* filename, int quality, dsp_stream_p stream)
     jpeg_destroy_compress(&cinfo);
 }
 
-void dsp_file_write_jpeg_composite(const char* filename, int components, int quality, dsp_stream_p* stream)
+#define DSP_FILE_BAND_ROWS 256
+#define DSP_FILE_QUANTIZE_SAMPLES 16384
+#define DSP_FILE_CHUNK 65536
+#define DSP_FILE_FITS_BLOCK 2880
+
+typedef struct {
+    dsp_stream_p *stream;
+    int components;
+    int bpp;
+    int width;
+    int height;
+    int planar;
+    double *offset;
+    double *scale;
+    unsigned char *out;
+    size_t row_stride;
+    int first;
+    int rows;
+    int *next_row;
+    dsp_progress *progress;
+} dsp_file_quantizer;
+
+static void dsp_file_put_sample(unsigned char *out, int bpp, double v)
 {
-    int bpp = 8;
-    unsigned int row_stride;
-    int width = stream[components]->sizes[0];
-    int height = stream[components]->sizes[1];
-    void *buf = malloc((size_t)(stream[components]->len*components));
-    unsigned char *image = (unsigned char *)buf;
-    dsp_buffer_components_to_rgb(stream, buf, components, bpp);
+    union {
+        float f;
+        uint32_t u;
+    } f32;
+    union {
+        double d;
+        uint64_t u;
+    } f64;
+    uint32_t u32;
+    int b;
+    switch(bpp) {
+    case 8:
+        out[0] = (unsigned char)v;
+        break;
+    case 16:
+        u32 = (uint32_t)v;
+        out[0] = (unsigned char)(u32 >> 8);
+        out[1] = (unsigned char)u32;
+        break;
+    case 32:
+        u32 = (uint32_t)v;
+        out[0] = (unsigned char)(u32 >> 24);
+        out[1] = (unsigned char)(u32 >> 16);
+        out[2] = (unsigned char)(u32 >> 8);
+        out[3] = (unsigned char)u32;
+        break;
+    case -32:
+        f32.f = (float)v;
+        out[0] = (unsigned char)(f32.u >> 24);
+        out[1] = (unsigned char)(f32.u >> 16);
+        out[2] = (unsigned char)(f32.u >> 8);
+        out[3] = (unsigned char)f32.u;
+        break;
+    case -64:
+        f64.d = v;
+        for(b = 0; b < 8; b++)
+            out[b] = (unsigned char)(f64.u >> (56 - b * 8));
+        break;
+    default:
+        break;
+    }
+}
+
+static void* dsp_file_quantize_th(void* arg)
+{
+    dsp_file_quantizer *q = (dsp_file_quantizer*)arg;
+    int bytes = abs(q->bpp) / 8;
+    int row, x, c;
+    while((row = __sync_fetch_and_add(q->next_row, 1)) < q->rows) {
+        int y = q->first + row;
+        unsigned char *out = &q->out[q->row_stride * (size_t)row];
+        if(q->planar) {
+            dsp_t *in;
+            c = y / q->height;
+            in = &q->stream[c]->buf[(size_t)(y % q->height) * (size_t)q->width];
+            for(x = 0; x < q->width; x++, out += bytes)
+                dsp_file_put_sample(out, q->bpp, (in[x] - q->offset[c]) * q->scale[c]);
+        } else {
+            size_t start = (size_t)y * (size_t)q->width;
+            for(x = 0; x < q->width; x++) {
+                for(c = 0; c < q->components; c++, out += bytes)
+                    dsp_file_put_sample(out, q->bpp, (q->stream[c]->buf[start + x] - q->offset[c]) * q->scale[c]);
+            }
+        }
+    }
+    return NULL;
+}
 
+static void dsp_file_quantize_init(dsp_file_quantizer *q, dsp_stream_p *stream, int components, int bpp, int planar, double max)
+{
+    int c;
+    memset(q, 0, sizeof(dsp_file_quantizer));
+    q->stream = stream;
+    q->components = components;
+    q->bpp = bpp;
+    q->width = stream[0]->sizes[0];
+    q->height = stream[0]->len / q->width;
+    q->planar = planar;
+    q->progress = dsp_progress_get();
+    dsp_progress_add(q->progress, (unsigned long)q->height * (unsigned long)(planar ? components : 1));
+    q->offset = (double*)malloc(sizeof(double) * (size_t)components);
+    q->scale = (double*)malloc(sizeof(double) * (size_t)components);
+    q->row_stride = (size_t)q->width * (size_t)(planar ? 1 : components) * (size_t)(abs(bpp) / 8);
+    q->out = (unsigned char*)malloc(q->row_stride * DSP_FILE_BAND_ROWS);
+    for(c = 0; c < components; c++) {
+        q->offset[c] = 0.0;
+        q->scale[c] = 1.0;
+        if(bpp < 0)
+            continue;
+        double mn = dsp_stats_min(stream[c]->buf, stream[c]->len);
+        double mx = dsp_stats_max(stream[c]->buf, stream[c]->len);
+        double iratio = mx - mn;
+        if(iratio == 0)
+            iratio = 1;
+        q->offset[c] = mn;
+        q->scale[c] = max / iratio;
+    }
+}
+
+static void dsp_file_quantize_band(dsp_file_quantizer *q, int first, int rows)
+{
+    int next_row = 0;
+    int t;
+    int threads = Max(1, Min((int)dsp_max_threads(0), rows * q->width / DSP_FILE_QUANTIZE_SAMPLES));
+    q->first = first;
+    q->rows = rows;
+    q->next_row = &next_row;
+    if(threads == 1) {
+        dsp_file_quantize_th(q);
+    } else {
+        pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)threads);
+        for(t = 0; t < threads; t++)
+            pthread_create(&th[t], NULL, dsp_file_quantize_th, q);
+        for(t = 0; t < threads; t++)
+            pthread_join(th[t], NULL);
+        free(th);
+    }
+    dsp_progress_step(q->progress, (unsigned long)rows);
+}
+
+static void dsp_file_quantize_free(dsp_file_quantizer *q)
+{
+    free(q->offset);
+    free(q->scale);
+    free(q->out);
+}
+
+typedef struct {
+    dsp_file_output_t output;
+    void *arg;
+} dsp_file_png_destination;
+
+static void dsp_file_png_write(png_structp png, png_bytep data, png_size_t len)
+{
+    dsp_file_png_destination *dest = (dsp_file_png_destination*)png_get_io_ptr(png);
+    dest->output(dest->arg, data, len);
+}
+
+static void dsp_file_png_flush(png_structp png)
+{
+    (void)png;
+}
+
+void dsp_file_encode_png(int components, int compression, dsp_stream_p* stream, dsp_file_output_t output, void *arg)
+{
+    int bpp = 16;
+    int first, row;
+    dsp_file_png_destination dest = { output, arg };
+    dsp_file_quantizer q;
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png)
+        return;
+    png_infop info = png_create_info_struct(png);
+    if (!info) {
+        png_destroy_write_struct(&png, NULL);
+        return;
+    }
+    dsp_file_quantize_init(&q, stream, components, bpp, 0, 65535.0);
+    if (setjmp(png_jmpbuf(png))) {
+        perr("can't encode png\n");
+        png_destroy_write_struct(&png, &info);
+        dsp_file_quantize_free(&q);
+        return;
+    }
+    png_set_write_fn(png, &dest, dsp_file_png_write, dsp_file_png_flush);
+    png_set_IHDR(png,
+                 info,
+                 (unsigned int)q.width,
+                 (unsigned int)q.height,
+                 bpp,
+                 components == 1 ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_RGB,
+                 PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT,
+                 PNG_FILTER_TYPE_DEFAULT);
+    png_set_compression_level(png, compression);
+    png_write_info(png, info);
+    for (first = 0; first < q.height && !dsp_progress_cancelled(q.progress); first += DSP_FILE_BAND_ROWS) {
+        int rows = Min(DSP_FILE_BAND_ROWS, q.height - first);
+        start_gettime(dsp_perf_io);
+        dsp_file_quantize_band(&q, first, rows);
+        for (row = 0; row < rows; row++)
+            png_write_row(png, &q.out[q.row_stride * (size_t)row]);
+        end_gettime(dsp_perf_io);
+    }
+    if(!dsp_progress_cancelled(q.progress))
+        png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+    dsp_file_quantize_free(&q);
+}
+
+typedef struct {
+    struct jpeg_destination_mgr pub;
+    dsp_file_output_t output;
+    void *arg;
+    JOCTET buffer[DSP_FILE_CHUNK];
+} dsp_file_jpeg_destination;
+
+static void dsp_file_jpeg_init(j_compress_ptr cinfo)
+{
+    dsp_file_jpeg_destination *dest = (dsp_file_jpeg_destination*)cinfo->dest;
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = DSP_FILE_CHUNK;
+}
+
+static boolean dsp_file_jpeg_empty(j_compress_ptr cinfo)
+{
+    dsp_file_jpeg_destination *dest = (dsp_file_jpeg_destination*)cinfo->dest;
+    dest->output(dest->arg, dest->buffer, DSP_FILE_CHUNK);
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = DSP_FILE_CHUNK;
+    return TRUE;
+}
+
+static void dsp_file_jpeg_term(j_compress_ptr cinfo)
+{
+    dsp_file_jpeg_destination *dest = (dsp_file_jpeg_destination*)cinfo->dest;
+    size_t len = DSP_FILE_CHUNK - dest->pub.free_in_buffer;
+    if(len > 0)
+        dest->output(dest->arg, dest->buffer, len);
+}
+
+void dsp_file_encode_jpeg(int components, int quality, dsp_stream_p* stream, dsp_file_output_t output, void *arg)
+{
+    int bpp = 8;
+    int first, row;
+    dsp_file_quantizer q;
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr jerr;
-    FILE * outfile;
+    dsp_file_jpeg_destination *dest = (dsp_file_jpeg_destination*)malloc(sizeof(dsp_file_jpeg_destination));
+    dsp_file_quantize_init(&q, stream, components, bpp, 0, 255.0);
     cinfo.err = jpeg_std_error(&jerr);
-    if ((outfile = fopen(filename, "wb")) == NULL) {
-        perr("can't open %s\n", filename);
-        return;
-    }
     jpeg_create_compress(&cinfo);
-    jpeg_stdio_dest(&cinfo, outfile);
-    cinfo.image_width = (unsigned int)width;
-    cinfo.image_height = (unsigned int)height;
+    dest->pub.init_destination = dsp_file_jpeg_init;
+    dest->pub.empty_output_buffer = dsp_file_jpeg_empty;
+    dest->pub.term_destination = dsp_file_jpeg_term;
+    dest->output = output;
+    dest->arg = arg;
+    cinfo.dest = &dest->pub;
+    cinfo.image_width = (unsigned int)q.width;
+    cinfo.image_height = (unsigned int)q.height;
     cinfo.in_color_space = (components == 1 ? JCS_GRAYSCALE : JCS_RGB);
     cinfo.input_components = components;
-    cinfo.dct_method = JDCT_FLOAT;
-    cinfo.optimize_coding = TRUE;
-    cinfo.restart_in_rows = 1;
     jpeg_set_defaults(&cinfo);
-
+    cinfo.dct_method = JDCT_FLOAT;
     jpeg_set_quality(&cinfo, quality, TRUE);
     jpeg_start_compress(&cinfo, TRUE);
-    row_stride = (unsigned int)width * (unsigned int)components;
-    int row;
-    for (row = 0; row < height; row++)
-    {
-        jpeg_write_scanlines(&cinfo, &image, 1);
-        image += row_stride;
+    for (first = 0; first < q.height && !dsp_progress_cancelled(q.progress); first += DSP_FILE_BAND_ROWS) {
+        int rows = Min(DSP_FILE_BAND_ROWS, q.height - first);
+        start_gettime(dsp_perf_io);
+        dsp_file_quantize_band(&q, first, rows);
+        for (row = 0; row < rows; row++) {
+            JSAMPROW image = &q.out[q.row_stride * (size_t)row];
+            jpeg_write_scanlines(&cinfo, &image, 1);
+        }
+        end_gettime(dsp_perf_io);
     }
-
-    jpeg_finish_compress(&cinfo);
+    if(dsp_progress_cancelled(q.progress))
+        jpeg_abort_compress(&cinfo);
+    else
+        jpeg_finish_compress(&cinfo);
     jpeg_destroy_compress(&cinfo);
+    dsp_file_quantize_free(&q);
+    free(dest);
+}
+
+static void dsp_file_fits_card(char *header, int *cards, const char *key, const char *value)
+{
+    char card[81];
+    snprintf(card, sizeof(card), "%-8.8s= %20.20s", key, value);
+    memset(&card[strlen(card)], ' ', 80 - strlen(card));
+    memcpy(&header[*cards * 80], card, 80);
+    (*cards)++;
+}
+
+void dsp_file_encode_fits(int components, int bpp, dsp_stream_p* stream, dsp_file_output_t output, void *arg)
+{
+    int i, first, rows;
+    int cards = 0;
+    static const unsigned char zero[DSP_FILE_FITS_BLOCK] = { 0 };
+    char key[FLEN_KEYWORD];
+    char value[32];
+    dsp_stream_p tmp = stream[0];
+    if(bpp != 8 && bpp != 16 && bpp != 32 && bpp != -32 && bpp != -64) {
+        perr("Unsupported bits per sample value %d", bpp);
+        return;
+    }
+    char *header = (char*)malloc((size_t)DSP_FILE_FITS_BLOCK * (size_t)((tmp->dims + 36) / 36 + 1));
+    dsp_file_fits_card(header, &cards, "SIMPLE", "T");
+    sprintf(value, "%d", bpp);
+    dsp_file_fits_card(header, &cards, "BITPIX", value);
+    sprintf(value, "%d", tmp->dims + 1);
+    dsp_file_fits_card(header, &cards, "NAXIS", value);
+    for (i = 0; i < tmp->dims; i++) {
+        snprintf(key, sizeof(key), "NAXIS%d", i + 1);
+        sprintf(value, "%d", tmp->sizes[i]);
+        dsp_file_fits_card(header, &cards, key, value);
+    }
+    snprintf(key, sizeof(key), "NAXIS%d", i + 1);
+    sprintf(value, "%d", components);
+    dsp_file_fits_card(header, &cards, key, value);
+    memset(&header[cards * 80], ' ', 80);
+    memcpy(&header[cards * 80], "END", 3);
+    cards++;
+    size_t len = (size_t)cards * 80;
+    size_t padded = (len + DSP_FILE_FITS_BLOCK - 1) / DSP_FILE_FITS_BLOCK * DSP_FILE_FITS_BLOCK;
+    memset(&header[len], ' ', padded - len);
+    output(arg, header, padded);
+    free(header);
+
+    dsp_file_quantizer q;
+    dsp_file_quantize_init(&q, stream, components, bpp, 1, bpp > 0 ? (double)((1ULL << bpp) / 2 - 1) : 1.0);
+    rows = q.height * components;
+    for (first = 0; first < rows; first += DSP_FILE_BAND_ROWS) {
+        int n = Min(DSP_FILE_BAND_ROWS, rows - first);
+        if(dsp_progress_cancelled(q.progress)) {
+            dsp_file_quantize_free(&q);
+            return;
+        }
+        start_gettime(dsp_perf_io);
+        dsp_file_quantize_band(&q, first, n);
+        output(arg, q.out, q.row_stride * (size_t)n);
+        end_gettime(dsp_perf_io);
+    }
+    len = q.row_stride * (size_t)rows;
+    padded = (len + DSP_FILE_FITS_BLOCK - 1) / DSP_FILE_FITS_BLOCK * DSP_FILE_FITS_BLOCK;
+    if(padded > len)
+        output(arg, zero, padded - len);
+    dsp_file_quantize_free(&q);
+}
+
+static void dsp_file_output_stdio(void *arg, const void *buf, size_t len)
+{
+    fwrite(buf, 1, len, (FILE*)arg);
+}
+
+void dsp_file_write_jpeg_composite(const char* filename, int components, int quality, dsp_stream_p* stream)
+{
+    FILE * outfile;
+    if ((outfile = fopen(filename, "wb")) == NULL) {
+        perr("can't open %s\n", filename);
+        return;
+    }
+    dsp_file_encode_jpeg(components, quality, stream, dsp_file_output_stdio, outfile);
     fclose(outfile);
-    free(buf);
 }
 
 dsp_stream_p* dsp_file_read_png(const char* filename, int *channels, int stretch)
@@ -705,47 +1029,12 @@ dsp_stream_p* dsp_file_read_png(const char* filename, int *channels, int stretch
 
 void dsp_file_write_png_composite(const char* filename, int components, int compression, dsp_stream_p* stream)
 {
-    int bpp = 16;
-    unsigned int row_stride;
-    int width = stream[0]->sizes[0];
-    int height = stream[0]->sizes[1];
-
-    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (!png)
-        return;
-    png_infop info = png_create_info_struct(png);
-    if (!info)
-        return;
-    if (setjmp(png_jmpbuf(png)))
-        return;
     FILE * outfile;
     if ((outfile = fopen(filename, "wb")) == NULL) {
         perr("can't open %s\n", filename);
         return;
     }
-    png_init_io(png, outfile);
-    png_set_IHDR(png,
-                 info,
-                 (unsigned int)width,
-                 (unsigned int)height,
-                 bpp,
-                 components == 1 ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_RGB,
-                 PNG_INTERLACE_NONE,
-                 PNG_COMPRESSION_TYPE_DEFAULT,
-                 PNG_FILTER_TYPE_DEFAULT);
-    png_set_compression_level(png, compression);
-    png_write_info(png, info);
-    row_stride = (unsigned int)(width * components * bpp / 8);
-    int row;
-    void *buf = malloc((size_t)(stream[0]->len*components*bpp/8));
-    unsigned char *image = (unsigned char *)buf;
-    dsp_buffer_components_to_rgb(stream, image, components, bpp);
-    for (row = 0; row < height; row++) {
-        png_write_row(png, image);
-        image += row_stride;
-    }
-    png_destroy_write_struct(&png, &info);
-    free(buf);
+    dsp_file_encode_png(components, compression, stream, dsp_file_output_stdio, outfile);
     fclose(outfile);
 }
 
@@ -44,6 +44,8 @@ void dsp_filter_lowpass(dsp_stream_p stream, double Frequency)
     }
     radius = sqrt(radius);
     dsp_fourier_dft(stream, 1);
+    if(dsp_progress_cancelled(dsp_progress_get()))
+        return;
     for(x = 0; x < stream->len; x++) {
         int* pos = dsp_stream_get_position(stream, x);
         double dist = 0.0;
@@ -68,6 +70,8 @@ void dsp_filter_highpass(dsp_stream_p stream, double Frequency)
     }
     radius = sqrt(radius);
     dsp_fourier_dft(stream, 1);
+    if(dsp_progress_cancelled(dsp_progress_get()))
+        return;
     for(x = 0; x < stream->len; x++) {
         int* pos = dsp_stream_get_position(stream, x);
         double dist = 0.0;
@@ -92,6 +96,8 @@ void dsp_filter_bandreject(dsp_stream_p stream, double LowFrequency, double High
     }
     radius = sqrt(radius);
     dsp_fourier_dft(stream, 1);
+    if(dsp_progress_cancelled(dsp_progress_get()))
+        return;
     for(x = 0; x < stream->len; x++) {
         int* pos = dsp_stream_get_position(stream, x);
         double dist = 0.0;
@@ -116,6 +122,8 @@ void dsp_filter_bandpass(dsp_stream_p stream, double LowFrequency, double HighFr
     }
     radius = sqrt(radius);
     dsp_fourier_dft(stream, 1);
+    if(dsp_progress_cancelled(dsp_progress_get()))
+        return;
     for(x = 0; x < stream->len; x++) {
         int* pos = dsp_stream_get_position(stream, x);
         double dist = 0.0;
@@ -130,3 +138,181 @@ void dsp_filter_bandpass(dsp_stream_p stream, double LowFrequency, double HighFr
     }
     dsp_fourier_idft(stream);
 }
+
+double* dsp_fir_lowpass_taps(int taps_count, double frequency)
+{
+    int x;
+    double sum = 0.0;
+    double center = (taps_count - 1) / 2.0;
+    double *taps = (double*)malloc(sizeof(double) * taps_count);
+    for(x = 0; x < taps_count; x++) {
+        double n = x - center;
+        taps[x] = n == 0.0 ? frequency / M_PI : sin(frequency * n) / (M_PI * n);
+        if(taps_count > 1)
+            taps[x] *= 0.54 - 0.46 * cos(2.0 * M_PI * x / (taps_count - 1));
+        sum += taps[x];
+    }
+    for(x = 0; x < taps_count && sum != 0.0; x++)
+        taps[x] /= sum;
+    return taps;
+}
+
+dsp_fir* dsp_fir_new(double *taps, int taps_count, int decimation, int channels)
+{
+    int x;
+    if(taps_count < 1)
+        return NULL;
+    dsp_fir *fir = (dsp_fir*)calloc(1, sizeof(dsp_fir));
+    fir->channels = Max(1, channels);
+    fir->decimation = fir->channels > 1 ? fir->channels : Max(1, decimation);
+    if(fir->channels > 1) {
+        fir->taps_count = (taps_count + fir->channels - 1) / fir->channels * fir->channels;
+        fir->block = fir->taps_count;
+    } else {
+        fir->taps_count = taps_count;
+        for(fir->block = 256; fir->block < taps_count * 4; fir->block <<= 1);
+    }
+    fir->taps = (double*)calloc(fir->taps_count, sizeof(double));
+    memcpy(fir->taps, taps, sizeof(double) * taps_count);
+    fir->buf = (dsp_t*)calloc(fir->block, sizeof(dsp_t));
+    fir->work = (complex_t*)calloc(fir->block, sizeof(complex_t));
+    if(fir->channels == 1) {
+        fir->response = (complex_t*)calloc(fir->block, sizeof(complex_t));
+        for(x = 0; x < taps_count; x++)
+            fir->response[x][0] = taps[x];
+        dsp_fourier_dft_complex(fir->response, fir->response, 1, &fir->block, -1);
+    }
+    dsp_fir_reset(fir);
+    return fir;
+}
+
+void dsp_fir_free(dsp_fir *fir)
+{
+    if(fir == NULL)
+        return;
+    free(fir->taps);
+    free(fir->response);
+    free(fir->buf);
+    free(fir->work);
+    free(fir);
+}
+
+void dsp_fir_reset(dsp_fir *fir)
+{
+    memset(fir->buf, 0, sizeof(dsp_t) * fir->block);
+    fir->fill = fir->channels > 1 ? fir->block - fir->channels : fir->taps_count - 1;
+    fir->phase = 0;
+}
+
+/* Overlap-save: the block starts with the last taps_count-1 input samples, after the circular convolution
+ * only the outputs past them are free of wrap-around. */
+static int dsp_fir_block(dsp_fir *fir, int valid, dsp_t *out)
+{
+    int x, count = 0;
+    int history = fir->taps_count - 1;
+    for(x = 0; x < fir->block; x++) {
+        fir->work[x][0] = fir->buf[x];
+        fir->work[x][1] = 0.0;
+    }
+    dsp_fourier_dft_complex(fir->work, fir->work, 1, &fir->block, -1);
+    for(x = 0; x < fir->block; x++) {
+        double re = fir->work[x][0] * fir->response[x][0] - fir->work[x][1] * fir->response[x][1];
+        double im = fir->work[x][0] * fir->response[x][1] + fir->work[x][1] * fir->response[x][0];
+        fir->work[x][0] = re;
+        fir->work[x][1] = im;
+    }
+    dsp_fourier_dft_complex(fir->work, fir->work, 1, &fir->block, 1);
+    for(x = 0; x < valid; x++) {
+        if(fir->phase == 0)
+            out[count++] = fir->work[history + x][0] / fir->block;
+        if(++fir->phase == fir->decimation)
+            fir->phase = 0;
+    }
+    return count;
+}
+
+int dsp_fir_process(dsp_fir *fir, dsp_t *in, int len, dsp_t *out)
+{
+    int count = 0;
+    int history = fir->taps_count - 1;
+    if(fir->response == NULL) {
+        perr("Filter bank with %d channels, use dsp_fir_channelize\n", fir->channels);
+        return -1;
+    }
+    while(len > 0) {
+        int n = Min(len, fir->block - fir->fill);
+        memcpy(&fir->buf[fir->fill], in, sizeof(dsp_t) * n);
+        fir->fill += n;
+        in += n;
+        len -= n;
+        if(fir->fill < fir->block)
+            break;
+        count += dsp_fir_block(fir, fir->block - history, &out[count]);
+        memmove(fir->buf, &fir->buf[fir->block - history], sizeof(dsp_t) * history);
+        fir->fill = history;
+    }
+    return count;
+}
+
+int dsp_fir_flush(dsp_fir *fir, dsp_t *out)
+{
+    int count = 0;
+    int valid = fir->fill - (fir->taps_count - 1);
+    if(fir->response == NULL) {
+        perr("Filter bank with %d channels, use dsp_fir_channelize\n", fir->channels);
+        return -1;
+    }
+    if(valid > 0) {
+        memset(&fir->buf[fir->fill], 0, sizeof(dsp_t) * (fir->block - fir->fill));
+        count = dsp_fir_block(fir, valid, out);
+    }
+    dsp_fir_reset(fir);
+    return count;
+}
+
+/* Each spectrum weights the last taps_count input samples with the time reversed taps, folds them into
+ * channels branches and transforms them, then the input advances by channels samples. */
+int dsp_fir_channelize(dsp_fir *fir, dsp_t *in, int len, complex_t *out)
+{
+    int x, p, count = 0;
+    int channels = fir->channels;
+    if(channels < 2) {
+        perr("Single channel filter, use dsp_fir_process\n");
+        return -1;
+    }
+    while(len > 0) {
+        int n = Min(len, fir->block - fir->fill);
+        memcpy(&fir->buf[fir->fill], in, sizeof(dsp_t) * n);
+        fir->fill += n;
+        in += n;
+        len -= n;
+        if(fir->fill < fir->block)
+            break;
+        complex_t *spectrum = &out[count * channels];
+        for(x = 0; x < channels; x++) {
+            double sum = 0.0;
+            for(p = x; p < fir->block; p += channels)
+                sum += fir->buf[p] * fir->taps[fir->block - 1 - p];
+            spectrum[x][0] = sum;
+            spectrum[x][1] = 0.0;
+        }
+        dsp_fourier_dft_complex(spectrum, spectrum, 1, &channels, -1);
+        memmove(fir->buf, &fir->buf[channels], sizeof(dsp_t) * (fir->block - channels));
+        fir->fill -= channels;
+        count++;
+    }
+    return count;
+}
+
+void dsp_filter_fir(dsp_stream_p stream, double *taps, int taps_count)
+{
+    dsp_fir *fir = dsp_fir_new(taps, taps_count, 1, 1);
+    if(fir == NULL)
+        return;
+    dsp_t *out = (dsp_t*)malloc(sizeof(dsp_t) * (stream->len + fir->block));
+    int count = dsp_fir_process(fir, stream->buf, stream->len, out);
+    count += dsp_fir_flush(fir, &out[count]);
+    memcpy(stream->buf, out, sizeof(dsp_t) * Min(count, stream->len));
+    free(out);
+    dsp_fir_free(fir);
+}
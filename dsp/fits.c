@@ -464,3 +464,174 @@ fail:
     }
     return NULL;
 }
+
+dsp_fits_fitsidi_writer *dsp_fits_create_fitsidi(char *filename, int nantennas, char **names, dsp_location *locations, int geographic,
+        int nchan, double ref_freq, double chan_bw, long batch)
+{
+    fitsfile *fptr = NULL;
+    int status = 0;
+    int x;
+    int ival;
+    double dval;
+    char *path = NULL;
+    char format[16];
+    char keyname[16];
+    char error_status[64];
+    char *frame = geographic ? "GEOGRAPHIC" : "RELATIVE";
+    char *ctype[4] = { "COMPLEX", "STOKES", "FREQ", "BAND" };
+    int maxis[4] = { 3, 1, nchan, 1 };
+    char *geometry_type[3] = { FITSIDI_ARRAY_GEOMETRY_COLUMN_ANNAME.name, FITSIDI_ARRAY_GEOMETRY_COLUMN_STABXYZ.name, FITSIDI_ARRAY_GEOMETRY_COLUMN_NOSTA.name };
+    char *geometry_form[3] = { FITSIDI_ARRAY_GEOMETRY_COLUMN_ANNAME.format, FITSIDI_ARRAY_GEOMETRY_COLUMN_STABXYZ.format, FITSIDI_ARRAY_GEOMETRY_COLUMN_NOSTA.format };
+    char *geometry_unit[3] = { "", FITSIDI_ARRAY_GEOMETRY_COLUMN_STABXYZ.unit, "" };
+    char *uv_type[8] = { FITSIDI_UV_DATA_COLUMN_UU_SIN.name, FITSIDI_UV_DATA_COLUMN_VV_SIN.name, FITSIDI_UV_DATA_COLUMN_WW_SIN.name,
+                         FITSIDI_UV_DATA_COLUMN_DATE.name, FITSIDI_UV_DATA_COLUMN_TIME.name, FITSIDI_UV_DATA_COLUMN_BASELINE.name,
+                         FITSIDI_UV_DATA_COLUMN_INTTIM.name, "FLUX"
+                       };
+    char *uv_form[8] = { FITSIDI_UV_DATA_COLUMN_UU_SIN.format, FITSIDI_UV_DATA_COLUMN_VV_SIN.format, FITSIDI_UV_DATA_COLUMN_WW_SIN.format,
+                         FITSIDI_UV_DATA_COLUMN_DATE.format, FITSIDI_UV_DATA_COLUMN_TIME.format, FITSIDI_UV_DATA_COLUMN_BASELINE.format,
+                         FITSIDI_UV_DATA_COLUMN_INTTIM.format, format
+                       };
+    char *uv_unit[8] = { FITSIDI_UV_DATA_COLUMN_UU_SIN.unit, FITSIDI_UV_DATA_COLUMN_VV_SIN.unit, FITSIDI_UV_DATA_COLUMN_WW_SIN.unit,
+                         FITSIDI_UV_DATA_COLUMN_DATE.unit, FITSIDI_UV_DATA_COLUMN_TIME.unit, "", FITSIDI_UV_DATA_COLUMN_INTTIM.unit, "Jy"
+                       };
+    dsp_fits_fitsidi_writer *writer = NULL;
+
+    if(nantennas < 1 || nchan < 1)
+        return NULL;
+    batch = Max(1, batch);
+    path = (char*)malloc(strlen(filename) + 2);
+    sprintf(path, "!%s", filename);
+    snprintf(format, 16, "%dE", nchan * 3);
+
+    fits_create_file(&fptr, path, &status);
+    free(path);
+    fits_create_img(fptr, BYTE_IMG, 0, NULL, &status);
+    fits_update_key(fptr, TSTRING, FITSIDI_COLUMN_CORRELAT.name, "OPENVLBI", FITSIDI_COLUMN_CORRELAT.comment, &status);
+    if(status)
+        goto fail;
+
+    fits_create_tbl(fptr, BINARY_TBL, nantennas, 3, geometry_type, geometry_form, geometry_unit, FITS_TABLE_FITSIDI_ARRAY_GEOMETRY, &status);
+    ival = 1;
+    fits_update_key(fptr, TINT, FITSIDI_KEYWORD_TABREV, &ival, "", &status);
+    fits_update_key(fptr, TSTRING, "FRAME", frame, "Coordinate frame", &status);
+    fits_write_col(fptr, TSTRING, 1, 1, 1, nantennas, names, &status);
+    for(x = 0; x < nantennas; x++)
+    {
+        short nosta = (short)(x + 1);
+        fits_write_col(fptr, TDOUBLE, 2, x + 1, 1, 3, locations[x].coordinates, &status);
+        fits_write_col(fptr, TSHORT, 3, x + 1, 1, 1, &nosta, &status);
+    }
+    if(status)
+        goto fail;
+
+    fits_create_tbl(fptr, BINARY_TBL, 0, 8, uv_type, uv_form, uv_unit, FITS_TABLE_FITSIDI_UV_DATA, &status);
+    ival = 2;
+    fits_update_key(fptr, TINT, FITSIDI_KEYWORD_TABREV, &ival, "", &status);
+    ival = 1;
+    fits_update_key(fptr, TINT, "NMATRIX", &ival, "", &status);
+    ival = 4;
+    fits_update_key(fptr, TINT, "MAXIS", &ival, "", &status);
+    for(x = 0; x < 4; x++)
+    {
+        snprintf(keyname, 16, "MAXIS%d", x + 1);
+        fits_update_key(fptr, TINT, keyname, &maxis[x], "", &status);
+        snprintf(keyname, 16, "CTYPE%d", x + 1);
+        fits_update_key(fptr, TSTRING, keyname, ctype[x], "", &status);
+    }
+    ival = 1;
+    fits_update_key(fptr, TLOGICAL, "TMATX8", &ival, "", &status);
+    fits_update_key(fptr, TINT, FITSIDI_KEYWORD_NO_STKD, &ival, "", &status);
+    fits_update_key(fptr, TINT, FITSIDI_KEYWORD_STK_1, &ival, "", &status);
+    fits_update_key(fptr, TINT, FITSIDI_KEYWORD_NO_BAND, &ival, "", &status);
+    fits_update_key(fptr, TINT, FITSIDI_KEYWORD_NO_CHAN, &nchan, "", &status);
+    fits_update_key(fptr, TDOUBLE, FITSIDI_KEYWORD_REF_FREQ, &ref_freq, "", &status);
+    fits_update_key(fptr, TDOUBLE, FITSIDI_KEYWORD_CHAN_BW, &chan_bw, "", &status);
+    dval = 1.0;
+    fits_update_key(fptr, TDOUBLE, FITSIDI_KEYWORD_REF_PIXL, &dval, "", &status);
+    if(status)
+        goto fail;
+
+    writer = (dsp_fits_fitsidi_writer*)malloc(sizeof(dsp_fits_fitsidi_writer));
+    writer->fptr = fptr;
+    writer->nchan = nchan;
+    writer->batch = batch;
+    writer->pending = 0;
+    writer->rows = 0;
+    writer->uu = (double*)malloc(sizeof(double) * (size_t)batch);
+    writer->vv = (double*)malloc(sizeof(double) * (size_t)batch);
+    writer->ww = (double*)malloc(sizeof(double) * (size_t)batch);
+    writer->date = (double*)malloc(sizeof(double) * (size_t)batch);
+    writer->time = (double*)malloc(sizeof(double) * (size_t)batch);
+    writer->inttim = (double*)malloc(sizeof(double) * (size_t)batch);
+    writer->baseline = (int*)malloc(sizeof(int) * (size_t)batch);
+    writer->flux = (float*)malloc(sizeof(float) * (size_t)batch * (size_t)nchan * 3);
+    return writer;
+fail:
+    fits_get_errstatus(status, error_status);
+    perr("FITS Error: %s\n", error_status);
+    status = 0;
+    if(fptr != NULL)
+        fits_close_file(fptr, &status);
+    return NULL;
+}
+
+int dsp_fits_flush_fitsidi(dsp_fits_fitsidi_writer *writer)
+{
+    int status = 0;
+    LONGLONG first = writer->rows + 1;
+    LONGLONG n = writer->pending;
+    if(n == 0)
+        return 0;
+    fits_write_col(writer->fptr, TDOUBLE, 1, first, 1, n, writer->uu, &status);
+    fits_write_col(writer->fptr, TDOUBLE, 2, first, 1, n, writer->vv, &status);
+    fits_write_col(writer->fptr, TDOUBLE, 3, first, 1, n, writer->ww, &status);
+    fits_write_col(writer->fptr, TDOUBLE, 4, first, 1, n, writer->date, &status);
+    fits_write_col(writer->fptr, TDOUBLE, 5, first, 1, n, writer->time, &status);
+    fits_write_col(writer->fptr, TINT, 6, first, 1, n, writer->baseline, &status);
+    fits_write_col(writer->fptr, TDOUBLE, 7, first, 1, n, writer->inttim, &status);
+    fits_write_col(writer->fptr, TFLOAT, 8, first, 1, n * writer->nchan * 3, writer->flux, &status);
+    writer->rows += writer->pending;
+    writer->pending = 0;
+    return status;
+}
+
+int dsp_fits_append_fitsidi_row(dsp_fits_fitsidi_writer *writer, double jd, double inttim, int baseline, double *uvw, complex_t *flux, double weight)
+{
+    int c;
+    long row = writer->pending;
+    double date = floor(jd - 0.5) + 0.5;
+    float *out = &writer->flux[row * writer->nchan * 3];
+    writer->uu[row] = uvw[0];
+    writer->vv[row] = uvw[1];
+    writer->ww[row] = uvw[2];
+    writer->date[row] = date;
+    writer->time[row] = jd - date;
+    writer->inttim[row] = inttim;
+    writer->baseline[row] = baseline;
+    for(c = 0; c < writer->nchan; c++)
+    {
+        out[c * 3] = (float)flux[c][0];
+        out[c * 3 + 1] = (float)flux[c][1];
+        out[c * 3 + 2] = (float)weight;
+    }
+    writer->pending++;
+    if(writer->pending < writer->batch)
+        return 0;
+    return dsp_fits_flush_fitsidi(writer);
+}
+
+int dsp_fits_close_fitsidi(dsp_fits_fitsidi_writer *writer)
+{
+    int status = dsp_fits_flush_fitsidi(writer);
+    fits_close_file(writer->fptr, &status);
+    free(writer->uu);
+    free(writer->vv);
+    free(writer->ww);
+    free(writer->date);
+    free(writer->time);
+    free(writer->inttim);
+    free(writer->baseline);
+    free(writer->flux);
+    free(writer);
+    return status;
+}
@@ -822,6 +822,80 @@ extern "C" {
 ///Tapering function ('HANNING' or 'UNIFORM')
 #define FITSIDI_MODEL_COMPS_KEYWORD_TAPER_FN (dsp_fits_keyword){"TAPER_FN", EXTFITS_ELEMENT_STRING.typestr, "", "", "Tapering function ('HANNING' or 'UNIFORM')", (char*[]){""}}
 
+///FITS-IDI UV_DATA streaming writer, rows are buffered and written in batches
+typedef struct
+{
+    ///The fits file pointer
+    fitsfile *fptr;
+    ///Number of spectral channels per row
+    int nchan;
+    ///Number of rows buffered before each write
+    long batch;
+    ///Number of buffered rows not yet written
+    long pending;
+    ///Number of rows already written
+    long rows;
+    ///Buffered u coordinates in seconds
+    double *uu;
+    ///Buffered v coordinates in seconds
+    double *vv;
+    ///Buffered w coordinates in seconds
+    double *ww;
+    ///Buffered julian dates at 0 hours
+    double *date;
+    ///Buffered times elapsed since 0 hours in days
+    double *time;
+    ///Buffered integration times in seconds
+    double *inttim;
+    ///Buffered baseline numbers
+    int *baseline;
+    ///Buffered real, imaginary and weight triplets, one per channel
+    float *flux;
+} dsp_fits_fitsidi_writer;
+
+/**
+* \brief Create a FITS-IDI file with its ARRAY_GEOMETRY table and an empty UV_DATA table
+* \param filename The file name of the fits to create, overwritten if existing
+* \param nantennas The number of antennas
+* \param names The antenna names
+* \param locations The antenna locations, stored into STABXYZ
+* \param geographic Whether the locations are geographic coordinates
+* \param nchan The number of spectral channels of each visibility
+* \param ref_freq The reference frequency in Hz
+* \param chan_bw The channel bandwidth in Hz
+* \param batch The number of rows buffered before each write
+* \return The writer to pass to dsp_fits_append_fitsidi_row, or NULL on failure
+*/
+dsp_fits_fitsidi_writer *dsp_fits_create_fitsidi(char *filename, int nantennas, char **names, dsp_location *locations, int geographic,
+        int nchan, double ref_freq, double chan_bw, long batch);
+
+/**
+* \brief Append a row to the UV_DATA table of a FITS-IDI writer
+* \param writer The FITS-IDI writer
+* \param jd The julian date of the integration
+* \param inttim The integration time in seconds
+* \param baseline The baseline number, 256 * antenna1 + antenna2
+* \param uvw The u, v and w coordinates in seconds
+* \param flux The complex visibilities, one per channel
+* \param weight The weight of the visibilities
+* \return The cfitsio status of the last batch written
+*/
+int dsp_fits_append_fitsidi_row(dsp_fits_fitsidi_writer *writer, double jd, double inttim, int baseline, double *uvw, complex_t *flux, double weight);
+
+/**
+* \brief Write the buffered rows of a FITS-IDI writer
+* \param writer The FITS-IDI writer
+* \return The cfitsio status
+*/
+int dsp_fits_flush_fitsidi(dsp_fits_fitsidi_writer *writer);
+
+/**
+* \brief Flush and close a FITS-IDI writer, freeing it
+* \param writer The FITS-IDI writer
+* \return The cfitsio status
+*/
+int dsp_fits_close_fitsidi(dsp_fits_fitsidi_writer *writer);
+
 /**
 * \brief read a fits file containing a FITS-IDI Extension
 * \param filename The file name of the fits to read
@@ -0,0 +1,213 @@
+/*
+*   DSP API - a digital signal processing library for astronomy usage
+*   Copyright © 2017-2022  Ilia Platone
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 3 of the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program; if not, write to the Free Software Foundation,
+*   Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "dsp.h"
+#include <unistd.h>
+
+static const char *dsp_perf_names[dsp_perf_stages] = { "geometry", "delay", "correlation", "gridding", "fft", "io", "base64", "lock" };
+
+unsigned long long dsp_perf_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+const char *dsp_perf_stage_name(dsp_perf_stage stage)
+{
+    if(stage < 0 || stage >= dsp_perf_stages)
+        return "unknown";
+    return dsp_perf_names[stage];
+}
+
+#ifdef DSP_INSTRUMENTATION
+
+#define DSP_PERF_TRACE_CHUNK 4096
+
+/* Each thread owns a slot of counters and only it writes there, readers sum all the slots.
+ * Slots live into a list that only grows, a slot is released when its thread exits and reused by the next new thread. */
+
+typedef struct dsp_perf_event_t {
+    int stage;
+    unsigned long long start;
+    unsigned long long duration;
+} dsp_perf_event;
+
+typedef struct dsp_perf_chunk_t {
+    dsp_perf_event events[DSP_PERF_TRACE_CHUNK];
+    int count;
+    struct dsp_perf_chunk_t *next;
+} dsp_perf_chunk;
+
+typedef struct dsp_perf_slot_t {
+    dsp_perf_counters counters;
+    int id;
+    int in_use;
+    dsp_perf_chunk *first;
+    dsp_perf_chunk *last;
+    struct dsp_perf_slot_t *next;
+} dsp_perf_slot;
+
+static dsp_perf_slot *dsp_perf_slots = NULL;
+static int dsp_perf_slots_count = 0;
+static int dsp_perf_tracing = 0;
+static __thread dsp_perf_slot *dsp_perf_current = NULL;
+static pthread_key_t dsp_perf_key;
+static pthread_once_t dsp_perf_once = PTHREAD_ONCE_INIT;
+
+static void dsp_perf_release(void *arg)
+{
+    dsp_perf_slot *slot = (dsp_perf_slot*)arg;
+    __atomic_store_n(&slot->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void dsp_perf_init()
+{
+    pthread_key_create(&dsp_perf_key, dsp_perf_release);
+}
+
+static dsp_perf_slot *dsp_perf_get_slot()
+{
+    dsp_perf_slot *slot = dsp_perf_current;
+    if(slot != NULL)
+        return slot;
+    pthread_once(&dsp_perf_once, dsp_perf_init);
+    for(slot = __atomic_load_n(&dsp_perf_slots, __ATOMIC_ACQUIRE); slot != NULL; slot = slot->next) {
+        int in_use = 0;
+        if(__atomic_compare_exchange_n(&slot->in_use, &in_use, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if(slot == NULL) {
+        slot = (dsp_perf_slot*)calloc(1, sizeof(dsp_perf_slot));
+        slot->in_use = 1;
+        slot->id = __atomic_add_fetch(&dsp_perf_slots_count, 1, __ATOMIC_RELAXED);
+        slot->next = __atomic_load_n(&dsp_perf_slots, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&dsp_perf_slots, &slot->next, slot, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    pthread_setspecific(dsp_perf_key, slot);
+    dsp_perf_current = slot;
+    return slot;
+}
+
+static void dsp_perf_record(dsp_perf_slot *slot, dsp_perf_stage stage, unsigned long long start, unsigned long long duration)
+{
+    dsp_perf_chunk *chunk = slot->last;
+    if(chunk == NULL || chunk->count == DSP_PERF_TRACE_CHUNK) {
+        dsp_perf_chunk *next = (dsp_perf_chunk*)calloc(1, sizeof(dsp_perf_chunk));
+        if(next == NULL)
+            return;
+        if(chunk == NULL)
+            __atomic_store_n(&slot->first, next, __ATOMIC_RELEASE);
+        else
+            __atomic_store_n(&chunk->next, next, __ATOMIC_RELEASE);
+        slot->last = chunk = next;
+    }
+    chunk->events[chunk->count].stage = stage;
+    chunk->events[chunk->count].start = start;
+    chunk->events[chunk->count].duration = duration;
+    __atomic_store_n(&chunk->count, chunk->count + 1, __ATOMIC_RELEASE);
+}
+
+void dsp_perf_add(dsp_perf_stage stage, unsigned long long start)
+{
+    unsigned long long duration = dsp_perf_now() - start;
+    dsp_perf_slot *slot = dsp_perf_get_slot();
+    __atomic_fetch_add(&slot->counters.calls[stage], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&slot->counters.time[stage], duration, __ATOMIC_RELAXED);
+    if(__atomic_load_n(&dsp_perf_tracing, __ATOMIC_RELAXED))
+        dsp_perf_record(slot, stage, start, duration);
+}
+
+void dsp_perf_get(dsp_perf_counters *counters)
+{
+    int stage;
+    dsp_perf_slot *slot;
+    memset(counters, 0, sizeof(dsp_perf_counters));
+    for(slot = __atomic_load_n(&dsp_perf_slots, __ATOMIC_ACQUIRE); slot != NULL; slot = slot->next) {
+        for(stage = 0; stage < dsp_perf_stages; stage++) {
+            counters->calls[stage] += __atomic_load_n(&slot->counters.calls[stage], __ATOMIC_RELAXED);
+            counters->time[stage] += __atomic_load_n(&slot->counters.time[stage], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void dsp_perf_reset()
+{
+    int stage;
+    dsp_perf_slot *slot;
+    for(slot = __atomic_load_n(&dsp_perf_slots, __ATOMIC_ACQUIRE); slot != NULL; slot = slot->next) {
+        for(stage = 0; stage < dsp_perf_stages; stage++) {
+            __atomic_store_n(&slot->counters.calls[stage], 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&slot->counters.time[stage], 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void dsp_perf_trace(int enable)
+{
+    __atomic_store_n(&dsp_perf_tracing, enable, __ATOMIC_RELAXED);
+}
+
+void dsp_perf_trace_dump(FILE *f)
+{
+    int x, count, first = 1;
+    dsp_perf_slot *slot;
+    dsp_perf_chunk *chunk;
+    fprintf(f, "{\"traceEvents\":[");
+    for(slot = __atomic_load_n(&dsp_perf_slots, __ATOMIC_ACQUIRE); slot != NULL; slot = slot->next) {
+        for(chunk = __atomic_load_n(&slot->first, __ATOMIC_ACQUIRE); chunk != NULL; chunk = __atomic_load_n(&chunk->next, __ATOMIC_ACQUIRE)) {
+            count = __atomic_load_n(&chunk->count, __ATOMIC_ACQUIRE);
+            for(x = 0; x < count; x++) {
+                fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"openvlbi\",\"ph\":\"X\",\"ts\":%.3lf,\"dur\":%.3lf,\"pid\":%d,\"tid\":%d}", first ? "" : ",",
+                        dsp_perf_names[chunk->events[x].stage], chunk->events[x].start / 1000.0, chunk->events[x].duration / 1000.0, (int)getpid(), slot->id);
+                first = 0;
+            }
+        }
+    }
+    fprintf(f, "\n]}\n");
+}
+
+#else
+
+void dsp_perf_add(dsp_perf_stage stage, unsigned long long start)
+{
+    (void)stage;
+    (void)start;
+}
+
+void dsp_perf_get(dsp_perf_counters *counters)
+{
+    memset(counters, 0, sizeof(dsp_perf_counters));
+}
+
+void dsp_perf_reset()
+{
+}
+
+void dsp_perf_trace(int enable)
+{
+    (void)enable;
+}
+
+void dsp_perf_trace_dump(FILE *f)
+{
+    fprintf(f, "{\"traceEvents\":[]}\n");
+}
+
+#endif
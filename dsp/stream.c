@@ -37,6 +37,51 @@ unsigned long int dsp_max_threads(unsigned long value)
     return MAX_THREADS;
 }
 
+static __thread dsp_progress *dsp_progress_current = NULL;
+
+void dsp_progress_set(dsp_progress *progress)
+{
+    dsp_progress_current = progress;
+}
+
+dsp_progress *dsp_progress_get()
+{
+    return dsp_progress_current;
+}
+
+void dsp_progress_add(dsp_progress *progress, unsigned long units)
+{
+    if(progress != NULL)
+        __sync_fetch_and_add(&progress->total, units);
+}
+
+int dsp_progress_step(dsp_progress *progress, unsigned long units)
+{
+    if(progress == NULL)
+        return 0;
+    __sync_fetch_and_add(&progress->done, units);
+    return __atomic_load_n(&progress->cancel, __ATOMIC_RELAXED);
+}
+
+int dsp_progress_cancelled(dsp_progress *progress)
+{
+    if(progress == NULL)
+        return 0;
+    return __atomic_load_n(&progress->cancel, __ATOMIC_RELAXED);
+}
+
+double dsp_progress_value(dsp_progress *progress)
+{
+    unsigned long done, total;
+    if(progress == NULL)
+        return 0.0;
+    done = __atomic_load_n(&progress->done, __ATOMIC_RELAXED);
+    total = __atomic_load_n(&progress->total, __ATOMIC_RELAXED);
+    if(total == 0)
+        return 0.0;
+    return Min(1.0, (double)done / (double)total);
+}
+
 void dsp_set_stdout(FILE *f)
 {
     out = f;
@@ -141,6 +186,7 @@ dsp_stream_p dsp_stream_new()
     stream->align_info.center = (double*)malloc(sizeof(double)*1);
     stream->align_info.radians = (double*)malloc(sizeof(double)*1);
     stream->align_info.factor = (double*)malloc(sizeof(double)*1);
+    stream->align_info.dims = 0;
     stream->stars_count = 0;
     stream->triangles_count = 0;
     stream->child_count = 0;
@@ -206,7 +252,20 @@ dsp_stream_p dsp_stream_copy(dsp_stream_p stream)
     dest->diameter = stream->diameter;
     dest->focal_ratio = stream->focal_ratio;
     memcpy(&dest->starttimeutc,  &stream->starttimeutc, sizeof(struct timespec));
+    double *offset = dest->align_info.offset;
+    double *center = dest->align_info.center;
+    double *radians = dest->align_info.radians;
+    double *factor = dest->align_info.factor;
     memcpy(&dest->align_info, &stream->align_info, sizeof(dsp_align_info));
+    i = Max(1, stream->align_info.dims);
+    dest->align_info.offset = (double*)realloc(offset, sizeof(double) * i);
+    dest->align_info.center = (double*)realloc(center, sizeof(double) * i);
+    dest->align_info.radians = (double*)realloc(radians, sizeof(double) * i);
+    dest->align_info.factor = (double*)realloc(factor, sizeof(double) * i);
+    memcpy(dest->align_info.offset, stream->align_info.offset, sizeof(double) * stream->align_info.dims);
+    memcpy(dest->align_info.center, stream->align_info.center, sizeof(double) * stream->align_info.dims);
+    memcpy(dest->align_info.radians, stream->align_info.radians, sizeof(double) * Max(0, stream->align_info.dims - 1));
+    memcpy(dest->align_info.factor, stream->align_info.factor, sizeof(double) * stream->align_info.dims);
     memcpy(dest->ROI, stream->ROI, sizeof(dsp_region) * stream->dims);
     memcpy(dest->pixel_sizes, stream->pixel_sizes, sizeof(double) * stream->dims);
     memcpy(dest->target, stream->target, sizeof(double) * 3);
@@ -368,22 +427,23 @@ void dsp_stream_add_triangle(dsp_stream_p stream, dsp_triangle triangle)
 {
     int s;
     int d;
-    stream->triangles = (dsp_triangle*)realloc(stream->triangles, sizeof(dsp_triangle)*(stream->triangles_count+1));
+    if((stream->triangles_count & (stream->triangles_count - 1)) == 0)
+        stream->triangles = (dsp_triangle*)realloc(stream->triangles, sizeof(dsp_triangle)*Max(1, stream->triangles_count*2));
     stream->triangles[stream->triangles_count].dims = triangle.dims;
     stream->triangles[stream->triangles_count].index = triangle.index;
-    stream->triangles[stream->triangles_count].theta = (double*)malloc(sizeof(double)*(stream->dims-1));
+    stream->triangles[stream->triangles_count].theta = (double*)malloc(sizeof(double)*(triangle.dims-1));
     stream->triangles[stream->triangles_count].ratios = (double*)malloc(sizeof(double)*triangle.dims);
     stream->triangles[stream->triangles_count].sizes = (double*)malloc(sizeof(double)*triangle.dims);
     stream->triangles[stream->triangles_count].stars = (dsp_star*)malloc(sizeof(dsp_star)*triangle.dims);
     for (s = 0; s < triangle.dims; s++) {
-        if(s < stream->dims - 1) {
+        if(s < triangle.dims - 1) {
             stream->triangles[stream->triangles_count].theta[s] = triangle.theta[s];
         }
         stream->triangles[stream->triangles_count].sizes[s] = triangle.sizes[s];
         stream->triangles[stream->triangles_count].ratios[s] = triangle.ratios[s];
         stream->triangles[stream->triangles_count].stars[s].center.dims = triangle.stars[s].center.dims;
         stream->triangles[stream->triangles_count].stars[s].diameter = triangle.stars[s].diameter;
-        stream->triangles[stream->triangles_count].stars[s].center.location = (double*)malloc(sizeof(double)*stream->dims);
+        stream->triangles[stream->triangles_count].stars[s].center.location = (double*)malloc(sizeof(double)*triangle.stars[s].center.dims);
         for(d = 0; d < triangle.stars[s].center.dims; d++) {
             stream->triangles[stream->triangles_count].stars[s].center.location[d] = triangle.stars[s].center.location[d];
         }
@@ -400,8 +460,9 @@ void dsp_stream_del_triangle(dsp_stream_p stream, int index)
 {
     dsp_triangle* triangles = (dsp_triangle*)malloc(sizeof(dsp_triangle) * stream->triangles_count);
     int triangles_count = stream->triangles_count;
-    memcpy(triangles, stream->triangles, sizeof(dsp_triangle*) * stream->triangles_count);
+    memcpy(triangles, stream->triangles, sizeof(dsp_triangle) * stream->triangles_count);
     free(stream->triangles);
+    stream->triangles = NULL;
     stream->triangles_count = 0;
     int i;
     for(i = 0; i < triangles_count; i++) {
@@ -448,72 +509,283 @@ int dsp_stream_set_position(dsp_stream_p stream, int* pos) {
     return index;
 }
 
-static void* dsp_stream_align_th(void* arg)
+#define DSP_WARP_TILE_ROWS 16
+#define DSP_LANCZOS_A 3
+#define DSP_LANCZOS_STEPS 1024
+
+static double dsp_lanczos_lut[DSP_LANCZOS_A * DSP_LANCZOS_STEPS + 1];
+static pthread_once_t dsp_lanczos_once = PTHREAD_ONCE_INIT;
+
+static void dsp_lanczos_init(void)
+{
+    int x;
+    dsp_lanczos_lut[0] = 1.0;
+    for(x = 1; x <= DSP_LANCZOS_A * DSP_LANCZOS_STEPS; x++) {
+        double t = M_PI * x / DSP_LANCZOS_STEPS;
+        dsp_lanczos_lut[x] = DSP_LANCZOS_A * sin(t) * sin(t / DSP_LANCZOS_A) / (t * t);
+    }
+}
+
+static inline double dsp_lanczos(double x)
+{
+    int i = (int)(fabs(x) * DSP_LANCZOS_STEPS + 0.5);
+    if(i > DSP_LANCZOS_A * DSP_LANCZOS_STEPS)
+        return 0.0;
+    return dsp_lanczos_lut[i];
+}
+
+static dsp_t dsp_stream_warp_sample(dsp_t *in, int w, int h, double x, double y, int interpolation)
+{
+    int ix, iy, tx, ty;
+    double fx, fy;
+    switch(interpolation) {
+        case DSP_INTERPOLATION_BILINEAR:
+            ix = (int)floor(x);
+            iy = (int)floor(y);
+            fx = x - ix;
+            fy = y - iy;
+            if(ix < 0 || iy < 0 || ix + 1 >= w || iy + 1 >= h) {
+                double v = 0.0;
+                for(ty = 0; ty < 2; ty++) {
+                    for(tx = 0; tx < 2; tx++) {
+                        if(ix + tx >= 0 && ix + tx < w && iy + ty >= 0 && iy + ty < h)
+                            v += in[(iy + ty) * w + ix + tx] * (tx ? fx : 1.0 - fx) * (ty ? fy : 1.0 - fy);
+                    }
+                }
+                return v;
+            }
+            in += iy * w + ix;
+            return (in[0] * (1.0 - fx) + in[1] * fx) * (1.0 - fy) + (in[w] * (1.0 - fx) + in[w + 1] * fx) * fy;
+        case DSP_INTERPOLATION_LANCZOS: {
+            double wx[DSP_LANCZOS_A * 2];
+            double wy[DSP_LANCZOS_A * 2];
+            double v = 0.0;
+            double sum = 0.0;
+            ix = (int)floor(x) - DSP_LANCZOS_A + 1;
+            iy = (int)floor(y) - DSP_LANCZOS_A + 1;
+            for(tx = 0; tx < DSP_LANCZOS_A * 2; tx++)
+                wx[tx] = dsp_lanczos(x - ix - tx);
+            for(ty = 0; ty < DSP_LANCZOS_A * 2; ty++)
+                wy[ty] = dsp_lanczos(y - iy - ty);
+            for(ty = 0; ty < DSP_LANCZOS_A * 2; ty++) {
+                if(iy + ty < 0 || iy + ty >= h)
+                    continue;
+                dsp_t *row = &in[(iy + ty) * w];
+                for(tx = 0; tx < DSP_LANCZOS_A * 2; tx++) {
+                    if(ix + tx < 0 || ix + tx >= w)
+                        continue;
+                    v += row[ix + tx] * wx[tx] * wy[ty];
+                    sum += wx[tx] * wy[ty];
+                }
+            }
+            return sum > 0.0 ? v / sum : 0.0;
+        }
+        default:
+            ix = (int)floor(x + 0.5);
+            iy = (int)floor(y + 0.5);
+            if(ix < 0 || iy < 0 || ix >= w || iy >= h)
+                return 0;
+            return in[iy * w + ix];
+    }
+}
+
+/**
+ * @brief dsp_stream_warp_th
+ * Workers pick row tiles from a shared counter, the input coordinates
+ * are advanced by the matrix increments so the inner loop only adds.
+ * @param arg
+ */
+
+static void* dsp_stream_warp_th(void* arg)
 {
     struct {
-       int cur_th;
-       dsp_stream_p stream;
+        dsp_t *in;
+        dsp_t *out;
+        int width;
+        int height;
+        int tiles;
+        int *next_tile;
+        double *matrix;
+        int interpolation;
+        double gain;
+        int accumulate;
     } *arguments = arg;
-    dsp_stream_p stream = arguments->stream;
-    dsp_stream_p in = stream->parent;
-    int cur_th = arguments->cur_th;
-    int start = cur_th * stream->len / dsp_max_threads(0);
-    int end = start + stream->len / dsp_max_threads(0);
-    end = Min(stream->len, end);
-    int y;
-    for(y = start; y < end; y++)
-    {
-        int *pos = dsp_stream_get_position(stream, y);
-        int dim;
-        for (dim = 1; dim < stream->dims; dim++) {
-            pos[dim] -= stream->align_info.center[dim];
-            pos[dim-1] -= stream->align_info.center[dim-1];
-            pos[dim] += stream->align_info.offset[dim];
-            pos[dim-1] += stream->align_info.offset[dim-1];
-            double r1 = stream->align_info.radians[dim-1];
-            double x = pos[dim-1];
-            double y = pos[dim];
-            double h = pow(pow(x, 2)+pow(y, 2), 0.5);
-            double r2 = acos(x/h);
-            if(y < 0)
-                r2 = - r2;
-            pos[dim] = sin(r2-r1)*h;
-            pos[dim-1] = cos(r2-r1)*h;
-            pos[dim] /= stream->align_info.factor[dim];
-            pos[dim-1] /= stream->align_info.factor[dim-1];
-            pos[dim] += stream->align_info.center[dim];
-            pos[dim-1] += stream->align_info.center[dim-1];
+    int w = arguments->width;
+    int h = arguments->height;
+    double *m = arguments->matrix;
+    int tiles_per_plane = (h + DSP_WARP_TILE_ROWS - 1) / DSP_WARP_TILE_ROWS;
+    int tile;
+    while((tile = __sync_fetch_and_add(arguments->next_tile, 1)) < arguments->tiles) {
+        int plane = tile / tiles_per_plane;
+        int first = (tile % tiles_per_plane) * DSP_WARP_TILE_ROWS;
+        int last = Min(h, first + DSP_WARP_TILE_ROWS);
+        dsp_t *in = &arguments->in[(size_t)plane * w * h];
+        dsp_t *out = &arguments->out[(size_t)plane * w * h];
+        int x, y;
+        for(y = first; y < last; y++) {
+            double sx = m[1] * y + m[2];
+            double sy = m[4] * y + m[5];
+            dsp_t *row = &out[y * w];
+            for(x = 0; x < w; x++, sx += m[0], sy += m[3]) {
+                dsp_t v = dsp_stream_warp_sample(in, w, h, sx, sy, arguments->interpolation) * arguments->gain;
+                if(arguments->accumulate)
+                    row[x] += v;
+                else
+                    row[x] = v;
+            }
         }
-        int x = dsp_stream_set_position(in, pos);
-        free(pos);
-        if(x >= 0 && x < in->len)
-            stream->buf[y] = in->buf[x];
     }
     return NULL;
 }
 
-void dsp_stream_align(dsp_stream_p in)
+/* Warps share a pool of persistent workers, the caller works on the tiles too. Only one warp at a time uses
+ * the pool, a concurrent warp runs its tiles on the calling thread alone. */
+static struct {
+    pthread_mutex_t lock;
+    pthread_mutex_t busy;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    int workers;
+    int active;
+    int pending;
+    unsigned long generation;
+    void *arguments;
+} dsp_warp_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 0, NULL };
+
+static void* dsp_stream_warp_worker(void* arg)
+{
+    int index = (int)(long)arg;
+    unsigned long generation = 0;
+    pthread_mutex_lock(&dsp_warp_pool.lock);
+    while(1) {
+        while(generation == dsp_warp_pool.generation)
+            pthread_cond_wait(&dsp_warp_pool.start, &dsp_warp_pool.lock);
+        generation = dsp_warp_pool.generation;
+        if(index >= dsp_warp_pool.active)
+            continue;
+        void *arguments = dsp_warp_pool.arguments;
+        pthread_mutex_unlock(&dsp_warp_pool.lock);
+        dsp_stream_warp_th(arguments);
+        pthread_mutex_lock(&dsp_warp_pool.lock);
+        if(--dsp_warp_pool.pending == 0)
+            pthread_cond_signal(&dsp_warp_pool.done);
+    }
+    return NULL;
+}
+
+static void dsp_stream_warp_run(void *arguments)
 {
-    dsp_stream_p stream = dsp_stream_copy(in);
-    dsp_buffer_set(stream->buf, stream->len, 0);
-    stream->parent = in;
-    size_t y;
-    pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t)*dsp_max_threads(0));
-    struct {
-       int cur_th;
-       dsp_stream_p stream;
-    } thread_arguments[dsp_max_threads(0)];
-    for(y = 0; y < dsp_max_threads(0); y++) {
-        thread_arguments[y].cur_th = y;
-        thread_arguments[y].stream = stream;
-        pthread_create(&th[y], NULL, dsp_stream_align_th, &thread_arguments[y]);
+    int active = Max(1, (int)dsp_max_threads(0)) - 1;
+    if(active == 0 || pthread_mutex_trylock(&dsp_warp_pool.busy)) {
+        dsp_stream_warp_th(arguments);
+        return;
     }
-    for(y = 0; y < dsp_max_threads(0); y++)
-        pthread_join(th[y], NULL);
-    free(th);
-    dsp_buffer_copy(stream->buf, in->buf, stream->len);
-    dsp_stream_free_buffer(stream);
-    dsp_stream_free(stream);
+    pthread_mutex_lock(&dsp_warp_pool.lock);
+    while(dsp_warp_pool.workers < active) {
+        pthread_t th;
+        if(pthread_create(&th, NULL, dsp_stream_warp_worker, (void*)(long)dsp_warp_pool.workers))
+            break;
+        pthread_detach(th);
+        dsp_warp_pool.workers++;
+    }
+    dsp_warp_pool.active = Min(active, dsp_warp_pool.workers);
+    dsp_warp_pool.pending = dsp_warp_pool.active;
+    dsp_warp_pool.arguments = arguments;
+    dsp_warp_pool.generation++;
+    pthread_cond_broadcast(&dsp_warp_pool.start);
+    pthread_mutex_unlock(&dsp_warp_pool.lock);
+    dsp_stream_warp_th(arguments);
+    pthread_mutex_lock(&dsp_warp_pool.lock);
+    while(dsp_warp_pool.pending > 0)
+        pthread_cond_wait(&dsp_warp_pool.done, &dsp_warp_pool.lock);
+    pthread_mutex_unlock(&dsp_warp_pool.lock);
+    pthread_mutex_unlock(&dsp_warp_pool.busy);
+}
+
+static void dsp_stream_warp_buffer(dsp_stream_p stream, dsp_t *in, dsp_t *out, double *matrix, int interpolation, double gain, int accumulate)
+{
+    int w = stream->sizes[0];
+    int h = stream->dims > 1 ? stream->sizes[1] : 1;
+    int next_tile = 0;
+    double m[6];
+    if(w < 1 || h < 1)
+        return;
+    memcpy(m, matrix, sizeof(double) * 6);
+    if(h == 1) {
+        m[1] = m[3] = m[4] = m[5] = 0.0;
+    }
+    if(interpolation == DSP_INTERPOLATION_LANCZOS)
+        pthread_once(&dsp_lanczos_once, dsp_lanczos_init);
+    struct {
+        dsp_t *in;
+        dsp_t *out;
+        int width;
+        int height;
+        int tiles;
+        int *next_tile;
+        double *matrix;
+        int interpolation;
+        double gain;
+        int accumulate;
+    } thread_arguments;
+    thread_arguments.in = in;
+    thread_arguments.out = out;
+    thread_arguments.width = w;
+    thread_arguments.height = h;
+    thread_arguments.tiles = (stream->len / (w * h)) * ((h + DSP_WARP_TILE_ROWS - 1) / DSP_WARP_TILE_ROWS);
+    thread_arguments.next_tile = &next_tile;
+    thread_arguments.matrix = m;
+    thread_arguments.interpolation = interpolation;
+    thread_arguments.gain = gain;
+    thread_arguments.accumulate = accumulate;
+    dsp_stream_warp_run(&thread_arguments);
+}
+
+/**
+ * @brief dsp_stream_warp
+ * @param stream
+ * @param matrix
+ * @param interpolation
+ */
+void dsp_stream_warp(dsp_stream_p stream, double *matrix, int interpolation)
+{
+    dsp_t *in = (dsp_t*)malloc(sizeof(dsp_t) * stream->len);
+    dsp_buffer_copy(stream->buf, in, stream->len);
+    dsp_stream_warp_buffer(stream, in, stream->buf, matrix, interpolation, 1.0, 0);
+    free(in);
+}
+
+void dsp_stream_get_align_matrix(dsp_stream_p stream, double *matrix)
+{
+    double r = stream->dims > 1 ? stream->align_info.radians[0] : 0.0;
+    double c = cos(r);
+    double s = sin(r);
+    double fx = stream->align_info.factor[0];
+    double fy = stream->dims > 1 ? stream->align_info.factor[1] : 1.0;
+    double ox = stream->align_info.offset[0] - stream->align_info.center[0];
+    double oy = stream->dims > 1 ? stream->align_info.offset[1] - stream->align_info.center[1] : 0.0;
+    matrix[0] = c / fx;
+    matrix[1] = s / fx;
+    matrix[2] = (c * ox + s * oy) / fx + stream->align_info.center[0];
+    matrix[3] = -s / fy;
+    matrix[4] = c / fy;
+    matrix[5] = (c * oy - s * ox) / fy + (stream->dims > 1 ? stream->align_info.center[1] : 0.0);
+}
+
+void dsp_stream_stack(dsp_stream_p stack, dsp_stream_p frame, int interpolation)
+{
+    double matrix[6];
+    if(stack->len != frame->len)
+        return;
+    dsp_stream_get_align_matrix(frame, matrix);
+    dsp_stream_warp_buffer(frame, frame->buf, stack->buf, matrix, interpolation, 1.0, 1);
+}
+
+void dsp_stream_align(dsp_stream_p in)
+{
+    double matrix[6];
+    dsp_stream_get_align_matrix(in, matrix);
+    dsp_stream_warp(in, matrix, DSP_INTERPOLATION_NEAREST);
 }
 
 /**
@@ -581,142 +853,33 @@ void dsp_stream_crop(dsp_stream_p in)
 
 void dsp_stream_translate(dsp_stream_p in)
 {
-    dsp_stream_p stream = dsp_stream_copy(in);
-    int* offset = (int*)malloc(sizeof(int)*stream->dims);
-    dsp_buffer_copy(in->align_info.offset, offset, in->dims);
-    int z = dsp_stream_set_position(stream, offset);
-    free(offset);
-    int k = -z;
-    z = Max(0, z);
-    k = Max(0, k);
-    int len = stream->len-z-k;
-    dsp_t *buf = &stream->buf[z];
-    dsp_t *data = &in->buf[k];
-    memset(in->buf, 0, sizeof(dsp_t)*in->len);
-    memcpy(data, buf, sizeof(dsp_t)*len);
-    dsp_stream_free_buffer(stream);
-    dsp_stream_free(stream);
-}
-
-/**
- * @brief dsp_stream_scale_th
- * @param arg
- * @return
- */
-static void* dsp_stream_scale_th(void* arg)
-{
-    struct {
-        int cur_th;
-        dsp_stream_p stream;
-     } *arguments = arg;
-    dsp_stream_p stream = arguments->stream;
-    dsp_stream_p in = stream->parent;
-    int cur_th = arguments->cur_th;
-    int start = cur_th * stream->len / dsp_max_threads(0);
-    int end = start + stream->len / dsp_max_threads(0);
-    end = Min(stream->len, end);
-    int y, d;
-    for(y = start; y < end; y++)
-    {
-        int* pos = dsp_stream_get_position(stream, y);
-        double factor = 0.0;
-        for(d = 0; d < stream->dims; d++) {
-            pos[d] -= stream->align_info.center[d];
-            pos[d] /= stream->align_info.factor[d];
-            pos[d] += stream->align_info.center[d];
-            factor += pow(stream->align_info.factor[d], 2);
-        }
-        factor = sqrt(factor);
-        int x = dsp_stream_set_position(in, pos);
-        if(x >= 0 && x < in->len)
-            stream->buf[y] += in->buf[x]/(factor*stream->dims);
-        free(pos);
-    }
-    return NULL;
+    double matrix[6] = { 1.0, 0.0, in->align_info.offset[0], 0.0, 1.0, in->dims > 1 ? in->align_info.offset[1] : 0.0 };
+    dsp_stream_warp(in, matrix, DSP_INTERPOLATION_NEAREST);
 }
 
 void dsp_stream_scale(dsp_stream_p in)
 {
-    dsp_stream_p stream = dsp_stream_copy(in);
-    dsp_buffer_set(stream->buf, stream->len, 0);
-    stream->parent = in;
-    size_t y;
-    pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t)*dsp_max_threads(0));
-    struct {
-       int cur_th;
-       dsp_stream_p stream;
-    } thread_arguments[dsp_max_threads(0)];
-    for(y = 0; y < dsp_max_threads(0); y++) {
-        thread_arguments[y].cur_th = y;
-        thread_arguments[y].stream = stream;
-        pthread_create(&th[y], NULL, dsp_stream_scale_th, &thread_arguments[y]);
-    }
-    for(y = 0; y < dsp_max_threads(0); y++)
-        pthread_join(th[y], NULL);
-    free(th);
-    dsp_buffer_copy(stream->buf, in->buf, stream->len);
-    dsp_stream_free_buffer(stream);
-    dsp_stream_free(stream);
-}
-
-static void* dsp_stream_rotate_th(void* arg)
-{
-    struct {
-       int cur_th;
-       dsp_stream_p stream;
-    } *arguments = arg;
-    dsp_stream_p stream = arguments->stream;
-    dsp_stream_p in = stream->parent;
-    int cur_th = arguments->cur_th;
-    int start = cur_th * stream->len / dsp_max_threads(0);
-    int end = start + stream->len / dsp_max_threads(0);
-    end = Min(stream->len, end);
-    int y;
-    for(y = start; y < end; y++)
-    {
-        int *pos = dsp_stream_get_position(stream, y);
-        int dim;
-        for (dim = 1; dim < stream->dims; dim++) {
-            pos[dim] -= stream->align_info.center[dim];
-            pos[dim-1] -= stream->align_info.center[dim-1];
-            double r = stream->align_info.radians[dim-1];
-            double x = pos[dim-1];
-            double y = pos[dim];
-            pos[dim] = x*-sin(r);
-            pos[dim-1] = x*cos(r);
-            pos[dim] += y*cos(r);
-            pos[dim-1] += y*sin(r);
-            pos[dim] += stream->align_info.center[dim];
-            pos[dim-1] += stream->align_info.center[dim-1];
-        }
-        int x = dsp_stream_set_position(in, pos);
-        free(pos);
-        if(x >= 0 && x < in->len)
-            stream->buf[y] = in->buf[x];
-    }
-    return NULL;
+    double factor = 0.0;
+    int d;
+    for(d = 0; d < in->dims; d++)
+        factor += pow(in->align_info.factor[d], 2);
+    factor = sqrt(factor);
+    double fx = in->align_info.factor[0];
+    double fy = in->dims > 1 ? in->align_info.factor[1] : 1.0;
+    double cx = in->align_info.center[0];
+    double cy = in->dims > 1 ? in->align_info.center[1] : 0.0;
+    double matrix[6] = { 1.0 / fx, 0.0, cx - cx / fx, 0.0, 1.0 / fy, cy - cy / fy };
+    dsp_t *buf = (dsp_t*)malloc(sizeof(dsp_t) * in->len);
+    dsp_buffer_copy(in->buf, buf, in->len);
+    dsp_stream_warp_buffer(in, buf, in->buf, matrix, DSP_INTERPOLATION_NEAREST, 1.0 / (factor * in->dims), 0);
+    free(buf);
 }
 
 void dsp_stream_rotate(dsp_stream_p in)
 {
-    dsp_stream_p stream = dsp_stream_copy(in);
-    dsp_buffer_set(stream->buf, stream->len, 0);
-    stream->parent = in;
-    size_t y;
-    pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t)*dsp_max_threads(0));
-    struct {
-       int cur_th;
-       dsp_stream_p stream;
-    } thread_arguments[dsp_max_threads(0)];
-    for(y = 0; y < dsp_max_threads(0); y++) {
-        thread_arguments[y].cur_th = y;
-        thread_arguments[y].stream = stream;
-        pthread_create(&th[y], NULL, dsp_stream_rotate_th, &thread_arguments[y]);
-    }
-    for(y = 0; y < dsp_max_threads(0); y++)
-        pthread_join(th[y], NULL);
-    free(th);
-    dsp_buffer_copy(stream->buf, in->buf, stream->len);
-    dsp_stream_free_buffer(stream);
-    dsp_stream_free(stream);
+    double r = in->dims > 1 ? in->align_info.radians[0] : 0.0;
+    double cx = in->align_info.center[0];
+    double cy = in->dims > 1 ? in->align_info.center[1] : 0.0;
+    double matrix[6] = { cos(r), sin(r), cx - cos(r) * cx - sin(r) * cy, -sin(r), cos(r), cy + sin(r) * cx - cos(r) * cy };
+    dsp_stream_warp(in, matrix, DSP_INTERPOLATION_NEAREST);
 }
@@ -0,0 +1,113 @@
+/*  OpenVLBI - Open Source Very Long Baseline Interferometry
+*   Copyright © 2017-2022  Ilia Platone
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 3 of the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program; if not, write to the Free Software Foundation,
+*   Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <vlbi.h>
+
+/* A catalog loaded from its cache must be the same as the catalog parsed from the element files
+ * usage: catalog_cache_test <catalog index.txt> */
+
+static int count_cache_files(const char *dir)
+{
+    int count = 0;
+    DIR *d = opendir(dir);
+    if(d == NULL)
+        return 0;
+    struct dirent *entry;
+    while((entry = readdir(d)) != NULL)
+        if(!strncmp(entry->d_name, "catalog-", 8))
+            count++;
+    closedir(d);
+    return count;
+}
+
+static void remove_cache(const char *base, const char *dir)
+{
+    DIR *d = opendir(dir);
+    if(d != NULL) {
+        struct dirent *entry;
+        char path[PATH_MAX + 256];
+        while((entry = readdir(d)) != NULL) {
+            if(entry->d_name[0] == '.')
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            unlink(path);
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+    rmdir(base);
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s <catalog index.txt>\n", argv[0]);
+        return 1;
+    }
+    char base[] = "/tmp/openvlbi-test-XXXXXX";
+    char dir[PATH_MAX];
+    if(mkdtemp(base) == NULL)
+        return 1;
+    snprintf(dir, sizeof(dir), "%s/openvlbi", base);
+    setenv("XDG_CACHE_HOME", base, 1);
+    dsp_stream_p *cold = NULL;
+    dsp_stream_p *cached = NULL;
+    int cold_size = 0;
+    int cached_size = 0;
+    int failed = 0;
+    vlbi_astro_load_spectra_catalog(argv[1], &cold, &cold_size);
+    if(count_cache_files(dir) != 1) {
+        fprintf(stderr, "catalog cache not written into %s\n", dir);
+        failed = 1;
+    }
+    vlbi_astro_load_spectra_catalog(argv[1], &cached, &cached_size);
+    if(cold_size <= 0 || cold_size != cached_size) {
+        fprintf(stderr, "catalog sizes differ: %d cold, %d cached\n", cold_size, cached_size);
+        failed = 1;
+        cached_size = 0;
+    }
+    for(int x = 0; x < cached_size; x++) {
+        if(strcmp(cold[x]->name, cached[x]->name)) {
+            fprintf(stderr, "spectrum %d named \"%s\" cold, \"%s\" cached\n", x, cold[x]->name, cached[x]->name);
+            failed = 1;
+        }
+        if(cold[x]->stars_count != cached[x]->stars_count || cold[x]->len != cached[x]->len) {
+            fprintf(stderr, "spectrum %s differs in size\n", cold[x]->name);
+            failed = 1;
+            continue;
+        }
+        for(int s = 0; s < cold[x]->stars_count; s++) {
+            dsp_star *a = &cold[x]->stars[s];
+            dsp_star *b = &cached[x]->stars[s];
+            /* spectra without intensities normalize to NaN, so values are compared bitwise */
+            if(memcmp(&a->diameter, &b->diameter, sizeof(double)) || memcmp(a->center.location, b->center.location, sizeof(double)) ||
+               strcmp(a->name, b->name)) {
+                fprintf(stderr, "spectrum %s differs at line %d\n", cold[x]->name, s);
+                failed = 1;
+                break;
+            }
+        }
+    }
+    remove_cache(base, dir);
+    return failed;
+}
@@ -0,0 +1,96 @@
+/*  OpenVLBI - Open Source Very Long Baseline Interferometry
+*   Copyright © 2017-2022  Ilia Platone
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 3 of the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program; if not, write to the Free Software Foundation,
+*   Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vlbi.h>
+
+/* Flagging or unflagging a node between two vlbi_get_coverage calls must not return the cached coverage */
+
+#define SAMPLES 8000
+#define SIZE 128
+
+static dsp_t *get_coverage(vlbi_context ctx)
+{
+    double target[2] = { 18.5, 38.6 };
+    vlbi_get_coverage(ctx, "coverage", SIZE, SIZE, target, 50000000.0, 1.0, 1, 0, NULL);
+    dsp_stream_p coverage = vlbi_get_model(ctx, "coverage");
+    if(coverage == NULL || coverage->len != SIZE * SIZE)
+        return NULL;
+    dsp_t *buf = (dsp_t*)malloc(sizeof(dsp_t) * SIZE * SIZE);
+    memcpy(buf, coverage->buf, sizeof(dsp_t) * SIZE * SIZE);
+    return buf;
+}
+
+int main()
+{
+    vlbi_context ctx = vlbi_init();
+    timespec_t starttime = vlbi_time_string_to_timespec("2022-06-01T00:00:00");
+    vlbi_set_location(ctx, 34.0, 15.0, 100.0);
+    for(int n = 0; n < 3; n++)
+    {
+        char name[32];
+        dsp_stream_p stream = dsp_stream_new();
+        dsp_stream_add_dim(stream, SAMPLES);
+        dsp_stream_alloc_buffer(stream, SAMPLES);
+        stream->location = (dsp_location*)calloc(SAMPLES, sizeof(dsp_location));
+        for(int x = 0; x < SAMPLES; x++)
+        {
+            stream->buf[x] = 100.0 + x % 7;
+            if(n == 0 && x < SAMPLES / 4)
+                stream->buf[x] = 1000000.0;
+            stream->location[x].xyz.x = n * 37.0 + 5.0;
+            stream->location[x].xyz.y = n * n * 21.0 - 30.0;
+            stream->location[x].xyz.z = n * 3.0;
+        }
+        stream->starttimeutc = starttime;
+        stream->samplerate = 1.0;
+        sprintf(name, "node%d", n);
+        vlbi_add_node(ctx, stream, name, 0);
+    }
+    int failed = 0;
+    dsp_t *unflagged = get_coverage(ctx);
+    vlbi_flag_node(ctx, "node0", vlbi_flagging_mad, SAMPLES, 6.0);
+    dsp_t *flagged = get_coverage(ctx);
+    vlbi_unflag_node(ctx, "node0");
+    dsp_t *restored = get_coverage(ctx);
+    if(unflagged == NULL || flagged == NULL || restored == NULL)
+    {
+        fprintf(stderr, "coverage not generated\n");
+        failed = 1;
+    }
+    else
+    {
+        if(!memcmp(unflagged, flagged, sizeof(dsp_t) * SIZE * SIZE))
+        {
+            fprintf(stderr, "coverage unchanged after flagging\n");
+            failed = 1;
+        }
+        if(memcmp(unflagged, restored, sizeof(dsp_t) * SIZE * SIZE))
+        {
+            fprintf(stderr, "coverage not restored after unflagging\n");
+            failed = 1;
+        }
+    }
+    free(unflagged);
+    free(flagged);
+    free(restored);
+    vlbi_exit(ctx);
+    return failed;
+}
@@ -17,6 +17,8 @@
 */
 
 #include <vlbi.h>
+#include <limits.h>
+#include <sys/stat.h>
 
 static double SPEED_MEAN = LIGHTSPEED;
 
@@ -26,7 +28,13 @@ static int vlbi_qsort_star_diameter_desc(const void *arg1, const void *arg2)
     dsp_star* b = (dsp_star*)arg2;
     if(a->diameter < b->diameter)
         return 1;
-    return -1;
+    if(a->diameter > b->diameter)
+        return -1;
+    if(a->center.location[0] < b->center.location[0])
+        return -1;
+    if(a->center.location[0] > b->center.location[0])
+        return 1;
+    return 0;
 }
 
 double vlbi_astro_mean_speed(double speed)
@@ -70,170 +78,377 @@ void vlbi_astro_get_alt_az_coordinates(double Ha, double Dec, double Lat, double
     *Az = az;
 }
 
-dsp_stream_p vlbi_astro_load_spectrum(char *filename)
+#define VLBI_CATALOG_CACHE_MAGIC "VLBICAT2"
+
+typedef struct {
+    char *path;
+    struct stat st;
+    dsp_stream_p spectrum;
+} vlbi_catalog_file;
+
+static char *vlbi_astro_read_file(const char *filename, size_t *fsize)
 {
-    if(strlen(filename) >= strlen("index.txt")) {
-        if(!strcmp(basename(filename), "index.txt")) {
-            return NULL;
-        }
-    }
     FILE *f = fopen(filename, "r");
     if(!f) return NULL;
-    pinfo("loading spectrum from %s\n", filename);
     fseek(f, 0, SEEK_END);
-    size_t fsize = (size_t)ftell(f);
+    *fsize = (size_t)ftell(f);
     fseek(f, 0, SEEK_SET);
-    char *buf = malloc(fsize + 1);
-    size_t nread = fread(buf, fsize, 1, f);
-    (void)nread;
+    char *buf = (char*)malloc(*fsize + 1);
+    if(fread(buf, 1, *fsize, f) != *fsize) {
+        free(buf);
+        fclose(f);
+        return NULL;
+    }
+    buf[*fsize] = 0;
     fclose(f);
+    return buf;
+}
 
-    double w = 0;
+static dsp_stream_p vlbi_astro_new_spectrum(int stars_count)
+{
     dsp_stream_p spectrum = dsp_stream_new();
     dsp_stream_add_dim(spectrum, 1);
     dsp_stream_add_dim(spectrum, 1);
-    dsp_star line;
-    line.center.dims = spectrum->dims;
-    line.center.location = (double*)malloc(sizeof(double)*2);
-    line.center.location[1] = 0;
-    char str[150];
-    size_t c = 0;
-    while(c < fsize) {
-        int k = 0;
-        while (buf[c] != '\n') {
-            str[k++] = buf[c];
-            c++;
-        }
-        c++;
-        str[k] = 0;
-        k = 0;
-        char value[150];
-        int i = 0;
-        while (str[k] != ' ') {
-            value[i++] = str[k];
-            k++;
-        }
-        k++;
-        value[i] = 0;
-        line.diameter = atof(value);
-        char character[150];
-        i = 0;
-        while (str[k] != ' ') {
-            character[i++] = str[k];
-            k++;
+    if(stars_count > 0) {
+        spectrum->stars = (dsp_star*)malloc(sizeof(dsp_star) * (size_t)stars_count);
+        double *locations = (double*)calloc((size_t)stars_count * 2, sizeof(double));
+        for(int x = 0; x < stars_count; x++) {
+            spectrum->stars[x].center.dims = 2;
+            spectrum->stars[x].center.location = &locations[x * 2];
         }
-        k++;
-        character[i] = 0;
-        i = 0;
-        while (str[k] != ' ') {
-            value[i++] = str[k];
-            k++;
+    }
+    return spectrum;
+}
+
+static void vlbi_astro_free_spectrum(dsp_stream_p spectrum)
+{
+    if(spectrum->stars != NULL)
+        free(spectrum->stars[0].center.location);
+    dsp_stream_free_buffer(spectrum);
+    dsp_stream_free(spectrum);
+}
+
+static void vlbi_astro_set_spectrum_size(dsp_stream_p spectrum)
+{
+    double w = 0;
+    for(int x = 0; x < spectrum->stars_count; x++)
+        w = fmax(w, spectrum->stars[x].center.location[0]);
+    spectrum->sizes[0] = w;
+    spectrum->len = w;
+    dsp_stream_alloc_buffer(spectrum, 1);
+}
+
+/* Each line is "intensity character wavelength name", fields are split on single spaces so character may be empty
+ * and the name takes the rest of the line. Lines are counted first, so stars and their locations are allocated once. */
+static dsp_stream_p vlbi_astro_parse_spectrum(char *buf, size_t fsize)
+{
+    char *line = buf;
+    char *end = buf + fsize;
+    int lines = 0;
+    for(char *c = buf; c < end; c++)
+        if(*c == '\n')
+            lines++;
+    if(fsize > 0 && end[-1] != '\n')
+        lines++;
+    dsp_stream_p spectrum = vlbi_astro_new_spectrum(lines);
+    for(; line < end; line++) {
+        char *eol = (char*)memchr(line, '\n', (size_t)(end - line));
+        if(eol == NULL)
+            eol = end;
+        *eol = 0;
+        if(line == eol)
+            continue;
+        char *character = strchr(line, ' ');
+        char *wavelength = character ? strchr(character + 1, ' ') : NULL;
+        char *name = wavelength ? strchr(wavelength + 1, ' ') : NULL;
+        if(name == NULL) {
+            vlbi_astro_free_spectrum(spectrum);
+            return NULL;
         }
-        k++;
-        value[i] = 0;
-        line.center.location[0] = atof(value)/1000000000000.0;
-        char name[150];
-        i = 0;
-        while (str[k] != '\0') {
-            name[i++] = str[k];
-            k++;
+        *character++ = 0;
+        *wavelength++ = 0;
+        *name++ = 0;
+        dsp_star *star = &spectrum->stars[spectrum->stars_count];
+        star->diameter = strtod(line, NULL);
+        star->center.location[0] = strtod(wavelength, NULL) / 1000000000000.0;
+        if(isnan(star->diameter) || isnan(star->center.location[0])) {
+            vlbi_astro_free_spectrum(spectrum);
+            return NULL;
         }
-        k++;
-        name[i] = 0;
-        if(!isnan(line.diameter) && !isnan(line.center.location[0])) {
-            spectrum->name[0] = 0;
-            strcpy(spectrum->name, name);
-            strcat(spectrum->name, ",");
-            strcat(spectrum->name, character);
-            strcpy(line.name, name);
-            strcat(line.name, ",");
-            strcat(line.name, character);
-            w = fmax(w, line.center.location[0]);
-            dsp_stream_add_star(spectrum, line);
-        } else {
+        snprintf(star->name, sizeof(star->name), "%s,%s", name, character);
+        spectrum->stars_count++;
+        line = eol;
+    }
+    if(spectrum->stars_count > 0) {
+        size_t namelen = Min(strlen(spectrum->stars[spectrum->stars_count - 1].name), sizeof(spectrum->name) - 1);
+        memcpy(spectrum->name, spectrum->stars[spectrum->stars_count - 1].name, namelen);
+        spectrum->name[namelen] = 0;
+    }
+    vlbi_astro_set_spectrum_size(spectrum);
+    qsort(spectrum->stars, (size_t)spectrum->stars_count, sizeof(dsp_star), vlbi_qsort_star_diameter_desc);
+    return spectrum;
+}
+
+dsp_stream_p vlbi_astro_load_spectrum(char *filename)
+{
+    if(strlen(filename) >= strlen("index.txt")) {
+        if(!strcmp(basename(filename), "index.txt")) {
             return NULL;
         }
     }
-    spectrum->sizes[0] = w;
-    spectrum->len = w;
-    dsp_stream_alloc_buffer(spectrum, 1);
-    free(line.center.location);
+    size_t fsize = 0;
+    char *buf = vlbi_astro_read_file(filename, &fsize);
+    if(buf == NULL)
+        return NULL;
+    pinfo("loading spectrum from %s\n", filename);
+    dsp_stream_p spectrum = vlbi_astro_parse_spectrum(buf, fsize);
     free(buf);
-    qsort(spectrum->stars, (size_t)spectrum->stars_count, sizeof(dsp_star), vlbi_qsort_star_diameter_desc);
     return spectrum;
 }
 
-int vlbi_astro_load_spectra_catalog(char *path, dsp_stream_p **catalog, int *catalog_size)
+static int vlbi_astro_collect_catalog(const char *path, vlbi_catalog_file **files, int *count)
 {
-    if(path == NULL)
-        path = VLBI_CATALOG_PATH;
-    if((*catalog) == NULL)
-        *catalog = (dsp_stream_p*)malloc(sizeof(dsp_stream_p));
-    if(strlen(path) >= strlen("index.txt")) {
-        if(strcmp(basename(path), "index.txt")) {
-            return -ENODEV;
+    if(strcmp(basename((char*)path), "index.txt"))
+        return -ENODEV;
+    size_t fsize = 0;
+    char *buf = vlbi_astro_read_file(path, &fsize);
+    if(buf == NULL)
+        return -ENOENT;
+    char *tmp = strdup(path);
+    char *dir = dirname(tmp);
+    char *line, *save = NULL;
+    for(line = strtok_r(buf, "\r\n", &save); line != NULL; line = strtok_r(NULL, "\r\n", &save)) {
+        if(!strcmp(line, "index.txt"))
+            continue;
+        char *element = (char*)malloc(strlen(dir) + strlen(line) + 2);
+        sprintf(element, "%s/%s", dir, line);
+        if(!strcmp(basename(line), "index.txt")) {
+            vlbi_astro_collect_catalog(element, files, count);
+            free(element);
+            continue;
         }
+        *files = (vlbi_catalog_file*)realloc(*files, sizeof(vlbi_catalog_file) * (size_t)(*count + 1));
+        vlbi_catalog_file *file = &(*files)[(*count)++];
+        memset(file, 0, sizeof(vlbi_catalog_file));
+        file->path = element;
+        stat(element, &file->st);
     }
-    FILE *f = fopen(path, "r");
-    if(!f) return -ENOENT;
-    pinfo("loading catalog from %s\n", path);
-    fseek(f, 0, SEEK_END);
-    size_t fsize = (size_t)ftell(f);
-    fseek(f, 0, SEEK_SET);
-    char *buf = malloc(fsize + 1);
-    size_t nread = fread(buf, fsize, 1, f);
-    (void)nread;
-    fclose(f);
-    int w = 0, x = 0;
-    char str[150];
-    char *dir = dirname(path);
-    size_t c = 0;
-    while(c < fsize) {
-        int k = 0;
-        while (buf[c] != '\n') {
-            str[k++] = buf[c];
-            c++;
+    free(tmp);
+    free(buf);
+    return *count;
+}
+
+static void *vlbi_astro_load_spectra_th(void *arg)
+{
+    struct {
+        vlbi_catalog_file *files;
+        int count;
+        int next;
+    } *arguments = arg;
+    int x;
+    while((x = __atomic_fetch_add(&arguments->next, 1, __ATOMIC_RELAXED)) < arguments->count) {
+        dsp_stream_p spectrum = vlbi_astro_load_spectrum(arguments->files[x].path);
+        if(spectrum != NULL) {
+            double refsize = 0.0;
+            for(int s = 0; s < spectrum->stars_count; s++)
+                refsize = fmax(spectrum->stars[s].diameter, refsize);
+            for(int s = 0; s < spectrum->stars_count; s++)
+                spectrum->stars[s].diameter /= refsize;
         }
-        c++;
-        str[k] = 0;
-        char element[150];
-        memset(element, 0, 150);
-        strcpy(element, dir);
-        strcat(element, "/");
-        strcat(element, str);
-        int subdir = vlbi_astro_load_spectra_catalog(element, catalog, catalog_size);
-        if(0 > subdir) {
-            dsp_stream_p spectrum = vlbi_astro_load_spectrum(element);
-            if(spectrum != NULL) {
-                double refsize = 0.0;
-                for(x = 0; x < spectrum->stars_count; x++)
-                    refsize = fmax(spectrum->stars[x].diameter, refsize);
-                for(x = 0; x < spectrum->stars_count; x++)
-                    spectrum->stars[x].diameter /= refsize;
-                (*catalog)[(*catalog_size)+w] = spectrum;
-                w++;
-                *catalog = (dsp_stream_p*)realloc(*catalog, sizeof(dsp_stream_p)*(size_t)((*catalog_size)+w+1));
-            }
+        arguments->files[x].spectrum = spectrum;
+    }
+    return NULL;
+}
+
+static int vlbi_astro_catalog_cache_path(const char *path, char *cache, size_t len)
+{
+    char dir[PATH_MAX];
+    char real[PATH_MAX];
+    unsigned long hash = 5381;
+    const char *base = getenv("XDG_CACHE_HOME");
+    if(base != NULL && base[0] != 0) {
+        snprintf(dir, sizeof(dir), "%s", base);
+    } else {
+        base = getenv("HOME");
+        if(base == NULL)
+            return 0;
+        snprintf(dir, sizeof(dir), "%s/.cache", base);
+        mkdir(dir, 0755);
+    }
+    strcat(dir, "/openvlbi");
+    mkdir(dir, 0755);
+    if(realpath(path, real) == NULL)
+        snprintf(real, sizeof(real), "%s", path);
+    for(const char *c = real; *c; c++)
+        hash = hash * 33 + (unsigned char)*c;
+    snprintf(cache, len, "%s/catalog-%016lx.bin", dir, hash);
+    return 1;
+}
+
+/* The cache stores every element file with its size and modification time, followed by its spectrum name and lines
+ * already normalized and sorted, it is discarded as a whole when any element file changes. */
+static int vlbi_astro_read_catalog_cache(const char *cache, vlbi_catalog_file *files, int count)
+{
+    size_t fsize = 0;
+    char *buf = vlbi_astro_read_file(cache, &fsize);
+    if(buf == NULL)
+        return 0;
+    char *c = buf;
+    char *end = buf + fsize;
+    int x, n, s;
+#define vlbi_cache_read(dst, size) if(c + (size) > end) goto invalid; memcpy((dst), c, (size)); c += (size)
+    char magic[8];
+    vlbi_cache_read(magic, 8);
+    vlbi_cache_read(&n, sizeof(int));
+    if(memcmp(magic, VLBI_CATALOG_CACHE_MAGIC, 8) || n != count)
+        goto invalid;
+    for(x = 0; x < count; x++) {
+        int stars_count, pathlen;
+        long long mtime, size;
+        vlbi_cache_read(&pathlen, sizeof(int));
+        if(pathlen != (int)strlen(files[x].path) || c + pathlen > end || memcmp(c, files[x].path, (size_t)pathlen))
+            goto invalid;
+        c += pathlen;
+        vlbi_cache_read(&mtime, sizeof(long long));
+        vlbi_cache_read(&size, sizeof(long long));
+        if(mtime != (long long)files[x].st.st_mtime || size != (long long)files[x].st.st_size)
+            goto invalid;
+        vlbi_cache_read(&stars_count, sizeof(int));
+        if(stars_count < 0)
+            continue;
+        dsp_stream_p spectrum = vlbi_astro_new_spectrum(stars_count);
+        files[x].spectrum = spectrum;
+        unsigned char namelen;
+        vlbi_cache_read(&namelen, 1);
+        vlbi_cache_read(spectrum->name, namelen);
+        spectrum->name[namelen] = 0;
+        for(s = 0; s < stars_count; s++) {
+            unsigned char namelen;
+            dsp_star *star = &spectrum->stars[s];
+            vlbi_cache_read(&star->center.location[0], sizeof(double));
+            vlbi_cache_read(&star->diameter, sizeof(double));
+            vlbi_cache_read(&namelen, 1);
+            vlbi_cache_read(star->name, namelen);
+            star->name[namelen] = 0;
+            spectrum->stars_count++;
         }
+        vlbi_astro_set_spectrum_size(spectrum);
+    }
+#undef vlbi_cache_read
+    free(buf);
+    return 1;
+invalid:
+    for(x = 0; x < count; x++) {
+        if(files[x].spectrum != NULL)
+            vlbi_astro_free_spectrum(files[x].spectrum);
+        files[x].spectrum = NULL;
     }
     free(buf);
-    (*catalog_size) = (*catalog_size) + w;
+    return 0;
+}
+
+static void vlbi_astro_write_catalog_cache(const char *cache, vlbi_catalog_file *files, int count)
+{
+    char tmp[PATH_MAX + 80];
+    if(snprintf(tmp, sizeof(tmp), "%s.%d", cache, (int)getpid()) >= (int)sizeof(tmp))
+        return;
+    FILE *f = fopen(tmp, "w");
+    if(f == NULL)
+        return;
+    fwrite(VLBI_CATALOG_CACHE_MAGIC, 1, 8, f);
+    fwrite(&count, sizeof(int), 1, f);
+    for(int x = 0; x < count; x++) {
+        int pathlen = (int)strlen(files[x].path);
+        long long mtime = (long long)files[x].st.st_mtime;
+        long long size = (long long)files[x].st.st_size;
+        int stars_count = files[x].spectrum != NULL ? files[x].spectrum->stars_count : -1;
+        fwrite(&pathlen, sizeof(int), 1, f);
+        fwrite(files[x].path, 1, (size_t)pathlen, f);
+        fwrite(&mtime, sizeof(long long), 1, f);
+        fwrite(&size, sizeof(long long), 1, f);
+        fwrite(&stars_count, sizeof(int), 1, f);
+        if(stars_count >= 0) {
+            unsigned char namelen = (unsigned char)Min(strlen(files[x].spectrum->name), sizeof(files[x].spectrum->name) - 1);
+            fwrite(&namelen, 1, 1, f);
+            fwrite(files[x].spectrum->name, 1, namelen, f);
+        }
+        for(int s = 0; s < stars_count; s++) {
+            dsp_star *star = &files[x].spectrum->stars[s];
+            unsigned char namelen = (unsigned char)Min(strlen(star->name), 149);
+            fwrite(&star->center.location[0], sizeof(double), 1, f);
+            fwrite(&star->diameter, sizeof(double), 1, f);
+            fwrite(&namelen, 1, 1, f);
+            fwrite(star->name, 1, namelen, f);
+        }
+    }
+    if(fclose(f) == 0)
+        rename(tmp, cache);
+    else
+        unlink(tmp);
+}
+
+int vlbi_astro_load_spectra_catalog(char *path, dsp_stream_p **catalog, int *catalog_size)
+{
+    if(path == NULL)
+        path = VLBI_CATALOG_PATH;
+    vlbi_catalog_file *files = NULL;
+    int count = 0;
+    char cache[PATH_MAX + 64];
+    int ret = vlbi_astro_collect_catalog(path, &files, &count);
+    if(ret < 0)
+        return ret;
+    pinfo("loading catalog from %s\n", path);
+    int cached = vlbi_astro_catalog_cache_path(path, cache, sizeof(cache));
+    if(!cached || !vlbi_astro_read_catalog_cache(cache, files, count)) {
+        int nthreads = (int)Max(1, Min(vlbi_max_threads(0), (unsigned long)count));
+        pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)nthreads);
+        struct {
+            vlbi_catalog_file *files;
+            int count;
+            int next;
+        } arguments = { files, count, 0 };
+        for(int t = 0; t < nthreads; t++)
+            pthread_create(&th[t], NULL, vlbi_astro_load_spectra_th, &arguments);
+        for(int t = 0; t < nthreads; t++)
+            pthread_join(th[t], NULL);
+        free(th);
+        if(cached)
+            vlbi_astro_write_catalog_cache(cache, files, count);
+    }
+    int w = 0;
+    for(int x = 0; x < count; x++)
+        if(files[x].spectrum != NULL)
+            w++;
+    *catalog = (dsp_stream_p*)realloc(*catalog, sizeof(dsp_stream_p) * (size_t)((*catalog_size) + w + 1));
+    for(int x = 0; x < count; x++) {
+        if(files[x].spectrum != NULL)
+            (*catalog)[(*catalog_size)++] = files[x].spectrum;
+        free(files[x].path);
+    }
+    free(files);
     return (*catalog_size);
 }
 
 dsp_stream_p vlbi_astro_create_reference_catalog(dsp_stream_p *catalog, int catalog_size)
 {
-    dsp_stream_p stream = dsp_stream_new();
-    dsp_stream_add_dim(stream, 1);
-    dsp_stream_add_dim(stream, 1);
+    int stars_count = 0;
+    for(int c = 0; c < catalog_size; c++)
+        stars_count += catalog[c]->stars_count;
+    dsp_stream_p stream = vlbi_astro_new_spectrum(stars_count);
     dsp_stream_alloc_buffer(stream, stream->len);
     for(int c = 0; c < catalog_size; c++) {
         dsp_stream_p element = catalog[c];
-        qsort(element->stars, (size_t)element->stars_count, sizeof(dsp_star), vlbi_qsort_star_diameter_desc);
-        for(int s = 0; s < element->stars_count; s++)
-            dsp_stream_add_star(stream, element->stars[s]);
-        qsort(stream->stars, (size_t)stream->stars_count, sizeof(dsp_star), vlbi_qsort_star_diameter_desc);
+        for(int s = 0; s < element->stars_count; s++) {
+            dsp_star *star = &stream->stars[stream->stars_count++];
+            double *location = star->center.location;
+            *star = element->stars[s];
+            star->center.location = location;
+            star->center.dims = 2;
+            star->center.location[0] = element->stars[s].center.location[0];
+            star->center.location[1] = element->stars[s].center.location[1];
+        }
     }
+    qsort(stream->stars, (size_t)stream->stars_count, sizeof(dsp_star), vlbi_qsort_star_diameter_desc);
     return stream;
 }
 
@@ -282,9 +497,94 @@ void vlbi_astro_scan_spectrum(dsp_stream_p stream, int sample_size)
     qsort(stream->stars, (size_t)stream->stars_count, sizeof(dsp_star), vlbi_qsort_star_diameter_desc);
 }
 
-dsp_align_info vlbi_astro_align_spectra(dsp_stream_p spectrum, dsp_stream_p catalog, int max_lines, double decimals, double min_score)
+typedef struct {
+    double wavelength;
+    int line;
+} vlbi_spectral_entry;
+
+static int vlbi_qsort_spectral_entry_asc(const void *arg1, const void *arg2)
+{
+    vlbi_spectral_entry* a = (vlbi_spectral_entry*)arg1;
+    vlbi_spectral_entry* b = (vlbi_spectral_entry*)arg2;
+    if(a->wavelength < b->wavelength)
+        return -1;
+    if(a->wavelength > b->wavelength)
+        return 1;
+    return a->line - b->line;
+}
+
+vlbi_spectral_index *vlbi_astro_create_spectral_index(dsp_stream_p catalog)
 {
-    int x = 0, y = 0;
+    int x;
+    vlbi_spectral_index *index = (vlbi_spectral_index*)malloc(sizeof(vlbi_spectral_index));
+    vlbi_spectral_entry *entries = (vlbi_spectral_entry*)malloc(sizeof(vlbi_spectral_entry) * (size_t)Max(1, catalog->stars_count));
+    index->count = catalog->stars_count;
+    index->wavelength = (double*)malloc(sizeof(double) * (size_t)Max(1, index->count));
+    index->line = (int*)malloc(sizeof(int) * (size_t)Max(1, index->count));
+    for(x = 0; x < index->count; x++) {
+        entries[x].wavelength = catalog->stars[x].center.location[0];
+        entries[x].line = x;
+    }
+    qsort(entries, (size_t)index->count, sizeof(vlbi_spectral_entry), vlbi_qsort_spectral_entry_asc);
+    for(x = 0; x < index->count; x++) {
+        index->wavelength[x] = entries[x].wavelength;
+        index->line[x] = entries[x].line;
+    }
+    free(entries);
+    return index;
+}
+
+void vlbi_astro_free_spectral_index(vlbi_spectral_index *index)
+{
+    if(index == NULL)
+        return;
+    free(index->wavelength);
+    free(index->line);
+    free(index);
+}
+
+int vlbi_astro_find_spectral_line(vlbi_spectral_index *index, double wavelength, double tolerance)
+{
+    int lo = 0, hi = index->count;
+    int line = -1;
+    while(lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if(index->wavelength[mid] < wavelength - tolerance)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for(; lo < index->count && index->wavelength[lo] <= wavelength + tolerance; lo++) {
+        if(line < 0 || index->line[lo] < line)
+            line = index->line[lo];
+    }
+    return line;
+}
+
+/* Lines match when their wavelengths truncated at the given scale are equal, (long)(wavelength * scale) grows with the
+ * wavelength so the window is found with a binary search and the first catalog line into it wins. */
+static int vlbi_astro_match_spectral_line(vlbi_spectral_index *index, double wavelength, double scale)
+{
+    long key = (long)(wavelength * scale);
+    int lo = 0, hi = index->count;
+    int line = -1;
+    while(lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if((long)(index->wavelength[mid] * scale) < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for(; lo < index->count && (long)(index->wavelength[lo] * scale) == key; lo++) {
+        if(line < 0 || index->line[lo] < line)
+            line = index->line[lo];
+    }
+    return line;
+}
+
+static dsp_align_info vlbi_astro_align_spectrum(dsp_stream_p spectrum, dsp_stream_p catalog, vlbi_spectral_index *index, int max_lines, double decimals, double min_score)
+{
+    int x = 0;
     int catalog_count = catalog->stars_count;
     int spectrum_count = spectrum->stars_count;
     catalog->stars_count = Min(catalog_count, max_lines);
@@ -297,20 +597,78 @@ dsp_align_info vlbi_astro_align_spectra(dsp_stream_p spectrum, dsp_stream_p cata
         for(x = 0; x < spectrum->stars_count; x++) {
             spectrum->stars[x].center.location[0] -= spectrum->align_info.offset[0];
             spectrum->stars[x].center.location[0] /= spectrum->align_info.factor[0];
-            dsp_star star = spectrum->stars[x];
-            for(y = 0; y < catalog->stars_count; y++) {
-                dsp_star star0 = catalog->stars[y];
-                if((long)(star0.center.location[0]*factor) == (long)(star.center.location[0]*factor)) {
-                    strcpy(spectrum->stars[x].name, catalog->stars[y].name);
-                    spectrum->stars[x].diameter = vlbi_astro_estimate_temperature(spectrum->stars[x].center.location[0], spectrum->stars[x].diameter);
-                    break;
-                }
+            int y = vlbi_astro_match_spectral_line(index, spectrum->stars[x].center.location[0], factor);
+            if(y >= 0) {
+                strcpy(spectrum->stars[x].name, catalog->stars[y].name);
+                spectrum->stars[x].diameter = vlbi_astro_estimate_temperature(spectrum->stars[x].center.location[0], spectrum->stars[x].diameter);
             }
         }
     }
     return spectrum->align_info;
 }
 
+dsp_align_info vlbi_astro_align_spectra(dsp_stream_p spectrum, dsp_stream_p catalog, int max_lines, double decimals, double min_score)
+{
+    vlbi_spectral_index *index = vlbi_astro_create_spectral_index(catalog);
+    dsp_align_info info = vlbi_astro_align_spectrum(spectrum, catalog, index, max_lines, decimals, min_score);
+    vlbi_astro_free_spectral_index(index);
+    return info;
+}
+
+typedef struct {
+    dsp_stream_p *spectra;
+    dsp_stream_p catalog;
+    vlbi_spectral_index *index;
+    int count;
+    int next;
+    int matched;
+    int max_lines;
+    double decimals;
+    double min_score;
+} vlbi_align_batch;
+
+static void *vlbi_astro_align_spectra_th(void *arg)
+{
+    vlbi_align_batch *batch = (vlbi_align_batch*)arg;
+    int x, t, d;
+    /* the reference triangles are rebuilt for every alignment, so each thread aligns against its own copy of the
+     * catalog stream sharing the same lines */
+    dsp_stream catalog = *batch->catalog;
+    catalog.triangles = NULL;
+    catalog.triangles_count = 0;
+    while((x = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count) {
+        dsp_align_info info = vlbi_astro_align_spectrum(batch->spectra[x], &catalog, batch->index, batch->max_lines, batch->decimals, batch->min_score);
+        if((info.err & DSP_ALIGN_NO_MATCH) == 0)
+            __atomic_fetch_add(&batch->matched, 1, __ATOMIC_RELAXED);
+    }
+    for(t = 0; t < catalog.triangles_count; t++) {
+        for(d = 0; d < catalog.triangles[t].dims; d++)
+            free(catalog.triangles[t].stars[d].center.location);
+        free(catalog.triangles[t].stars);
+        free(catalog.triangles[t].sizes);
+        free(catalog.triangles[t].ratios);
+        free(catalog.triangles[t].theta);
+    }
+    free(catalog.triangles);
+    return NULL;
+}
+
+int vlbi_astro_align_spectra_batch(dsp_stream_p *spectra, int count, dsp_stream_p catalog, int max_lines, double decimals, double min_score)
+{
+    if(count < 1)
+        return 0;
+    int nthreads = (int)Max(1, Min(vlbi_max_threads(0), (unsigned long)count));
+    pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)nthreads);
+    vlbi_align_batch batch = { spectra, catalog, vlbi_astro_create_spectral_index(catalog), count, 0, 0, max_lines, decimals, min_score };
+    for(int t = 0; t < nthreads; t++)
+        pthread_create(&th[t], NULL, vlbi_astro_align_spectra_th, &batch);
+    for(int t = 0; t < nthreads; t++)
+        pthread_join(th[t], NULL);
+    free(th);
+    vlbi_astro_free_spectral_index(batch.index);
+    return batch.matched;
+}
+
 double vlbi_astro_diff_spectra(dsp_stream_p spectrum0, dsp_stream_p spectrum, double decades)
 {
     decades = pow(10, decades);
@@ -322,22 +680,22 @@ double vlbi_astro_diff_spectra(dsp_stream_p spectrum0, dsp_stream_p spectrum, do
     double delta_spectrum = 0;
     int nlines = 0;
     int x, y;
+    vlbi_spectral_index *index = vlbi_astro_create_spectral_index(spectrum);
     for(x = 0; x < spectrum0->stars_count; x++) {
         dsp_star star0 = spectrum0->stars[x];
-        for(y = 0; y < spectrum->stars_count; y++) {
+        y = vlbi_astro_match_spectral_line(index, star0.center.location[0], decades);
+        if(y >= 0) {
             dsp_star star = spectrum->stars[y];
-            if((long)(star0.center.location[0]*decades) == (long)(star.center.location[0]*decades)) {
-                wavelength = star0.center.location[0];
-                flux = star.diameter;
-                flux0 = star0.diameter;
-                temp = vlbi_astro_estimate_temperature(wavelength, flux);
-                temp0 = vlbi_astro_estimate_temperature(wavelength, flux0);
-                delta_spectrum += temp-temp0;
-                nlines ++;
-                break;
-            }
+            wavelength = star0.center.location[0];
+            flux = star.diameter;
+            flux0 = star0.diameter;
+            temp = vlbi_astro_estimate_temperature(wavelength, flux);
+            temp0 = vlbi_astro_estimate_temperature(wavelength, flux0);
+            delta_spectrum += temp-temp0;
+            nlines ++;
         }
     }
+    vlbi_astro_free_spectral_index(index);
     return delta_spectrum / nlines;
 }
 
@@ -36,21 +36,245 @@
 
 #include <ctype.h>
 #include <stdint.h>
+#include <string.h>
 #include "base64.h"
 #include "base64_luts.h"
 #include <stdio.h>
 #include <dsp.h>
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BASE64_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* instruction set in use: 0 scalar, 1 SSSE3, 2 AVX2, -1 not yet probed */
+static int base64_level = -1;
+
+static int base64_supported(void)
+{
+#ifdef BASE64_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return 2;
+    if (__builtin_cpu_supports("ssse3"))
+        return 1;
+#endif
+    return 0;
+}
+
+int base64_simd(int level)
+{
+    int supported = base64_supported();
+    if (level < 0)
+        return supported;
+    base64_level = level < supported ? level : supported;
+    return base64_level;
+}
+
+static inline int base64_get_level(void)
+{
+    if (base64_level < 0)
+        base64_level = base64_supported();
+    return base64_level;
+}
+
+static const int8_t base64_values[256] =
+{
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+static inline int base64_value(unsigned char c)
+{
+    return base64_values[c];
+}
+
+#ifdef BASE64_SIMD
+/* 12 bytes to 16 characters, reads 16 input bytes */
+__attribute__((target("ssse3")))
+static int base64_encode_ssse3(unsigned char *out, const unsigned char *in, int inlen)
+{
+    int n = 0;
+    const __m128i shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    for (; inlen - n >= 16; n += 12, out += 16)
+    {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + n)), shuffle);
+        __m128i hi = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        __m128i lo = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        __m128i indices = _mm_or_si128(hi, lo);
+        __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+        _mm_storeu_si128((__m128i *)out, _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices));
+    }
+    return n;
+}
+
+/* 24 bytes to 32 characters, reads 28 input bytes */
+__attribute__((target("avx2")))
+static int base64_encode_avx2(unsigned char *out, const unsigned char *in, int inlen)
+{
+    int n = 0;
+    const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                             'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    for (; inlen - n >= 28; n += 24, out += 32)
+    {
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(in + n))),
+                                            _mm_loadu_si128((const __m128i *)(in + n + 12)), 1);
+        v = _mm256_shuffle_epi8(v, shuffle);
+        __m256i hi = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+        __m256i lo = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+        __m256i indices = _mm256_or_si256(hi, lo);
+        __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+        _mm256_storeu_si256((__m256i *)out, _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices));
+    }
+    return n;
+}
+
+/* 16 characters to 12 bytes, stops at the first block holding anything but the 64 digits */
+__attribute__((target("ssse3")))
+static int base64_decode_ssse3(unsigned char *out, const char *in, int inlen)
+{
+    int n = 0;
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    for (; inlen - n >= 16; n += 16, out += 12)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + n));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), v));
+        __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), v));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), v));
+        __m128i plus = _mm_cmpeq_epi8(v, _mm_set1_epi8('+'));
+        __m128i slash = _mm_cmpeq_epi8(v, _mm_set1_epi8('/'));
+        __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(plus, slash)));
+        if (_mm_movemask_epi8(valid) != 0xffff)
+            break;
+        __m128i shift = _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')), _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+        shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+        shift = _mm_or_si128(shift, _mm_or_si128(_mm_and_si128(plus, _mm_set1_epi8(62 - '+')), _mm_and_si128(slash, _mm_set1_epi8(63 - '/'))));
+        v = _mm_add_epi8(v, shift);
+        v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+        v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+        v = _mm_shuffle_epi8(v, pack);
+        _mm_storel_epi64((__m128i *)out, v);
+        uint32_t tail = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+        memcpy(out + 8, &tail, 4);
+    }
+    return n;
+}
+
+/* 32 characters to 24 bytes, stops at the first block holding anything but the 64 digits */
+__attribute__((target("avx2")))
+static int base64_decode_avx2(unsigned char *out, const char *in, int inlen)
+{
+    int n = 0;
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    for (; inlen - n >= 32; n += 32, out += 24)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + n));
+        __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+        __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), v));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+        __m256i plus = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('+'));
+        __m256i slash = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/'));
+        __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, _mm256_or_si256(plus, slash)));
+        if (_mm256_movemask_epi8(valid) != -1)
+            break;
+        __m256i shift = _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')), _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+        shift = _mm256_or_si256(shift, _mm256_or_si256(_mm256_and_si256(plus, _mm256_set1_epi8(62 - '+')), _mm256_and_si256(slash, _mm256_set1_epi8(63 - '/'))));
+        v = _mm256_add_epi8(v, shift);
+        v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+        v = _mm256_shuffle_epi8(v, pack);
+        v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(v));
+        _mm_storel_epi64((__m128i *)(out + 16), _mm256_extracti128_si256(v, 1));
+    }
+    return n;
+}
+#endif
+
+/* encode the leading whole 3 byte groups that the vector units can take, return the bytes consumed */
+static int base64_encode_block(unsigned char *out, const unsigned char *in, int inlen)
+{
+    int n = 0;
+#ifdef BASE64_SIMD
+    int level = base64_get_level();
+    if (level > 1)
+        n = base64_encode_avx2(out, in, inlen);
+    if (level > 0)
+        n += base64_encode_ssse3(out + n / 3 * 4, in + n, inlen - n);
+#else
+    (void)out;
+    (void)in;
+    (void)inlen;
+#endif
+    return n;
+}
+
+/* decode the leading unpadded 4 character groups, return the characters consumed */
+static int base64_decode_block(unsigned char *out, const char *in, int inlen)
+{
+    int n = 0;
+    int a, b, c, d;
+#ifdef BASE64_SIMD
+    int level = base64_get_level();
+    if (level > 1)
+        n = base64_decode_avx2(out, in, inlen);
+    if (level > 0)
+        n += base64_decode_ssse3(out + n / 4 * 3, in + n, inlen - n);
+#endif
+    out += n / 4 * 3;
+    for (; inlen - n >= 4; n += 4, out += 3)
+    {
+        a = base64_value((unsigned char)in[n]);
+        b = base64_value((unsigned char)in[n + 1]);
+        c = base64_value((unsigned char)in[n + 2]);
+        d = base64_value((unsigned char)in[n + 3]);
+        if ((a | b | c | d) < 0)
+            break;
+        out[0] = (unsigned char)(a << 2 | b >> 4);
+        out[1] = (unsigned char)(b << 4 | c >> 2);
+        out[2] = (unsigned char)(c << 6 | d);
+    }
+    return n;
+}
+
 /* convert inlen raw bytes at in to base64 string (NUL-terminated) at out. 
  * out size should be at least 4*inlen/3 + 4.
  * return length of out (sans trailing NUL).
  */
 int to64frombits(unsigned char *out, const unsigned char *in, int inlen)
 {
+    start_gettime(dsp_perf_base64);
     uint16_t *b64lut = (uint16_t *)base64lut;
     int dlen         = ((inlen + 2) / 3) * 4; /* 4/3, rounded up */
-    uint16_t *wbuf   = (uint16_t *)out;
+    int done         = base64_encode_block(out, in, inlen);
+    uint16_t *wbuf   = (uint16_t *)(out + done / 3 * 4);
 
+    in += done;
+    inlen -= done;
     for (; inlen > 2; inlen -= 3)
     {
         uint32_t n = in[0] << 16 | in[1] << 8 | in[2];
@@ -75,6 +299,7 @@ int to64frombits(unsigned char *out, const unsigned char *in, int inlen)
         *out++ = '=';
     }
     *out = 0; // NULL terminate
+    end_gettime(dsp_perf_base64);
     return dlen;
 }
 
@@ -92,18 +317,29 @@ int from64tobits(char *out, char *in)
 
 int from64tobits_fast(char *out, char *in, int inlen)
 {
-    int outlen = 0;
+    start_gettime(dsp_perf_base64);
+    char *start = out;
+    char *end   = in + inlen;
     uint8_t b1, b2, b3;
     uint16_t s1, s2;
     uint32_t n32;
-    int j;
-    int n         = (inlen / 4) - 1;
+    int n;
     uint16_t *inp = (uint16_t *)in;
 
-    for (j = 0; j < n; j++)
+    while (end - in > 4)
     {
         if (in[0] == '\n')
+        {
             in++;
+            continue;
+        }
+        n = base64_get_level() > 0 ? base64_decode_block((unsigned char *)out, in, (int)(end - in) - 4) : 0;
+        if (n > 0)
+        {
+            in += n;
+            out += n / 4 * 3;
+            continue;
+        }
         inp = (uint16_t *)in;
 
         s1 = rbase64lut[inp[0]];
@@ -126,9 +362,12 @@ int from64tobits_fast(char *out, char *in, int inlen)
         in += 4;
         out += 3;
     }
-    outlen = (inlen / 4 - 1) * 3;
-    if (in[0] == '\n')
+    if (in < end && in[0] == '\n')
         in++;
+    if (end - in < 4) {
+        end_gettime(dsp_perf_base64);
+        return (int)(out - start);
+    }
     inp = (uint16_t *)in;
 
     s1 = rbase64lut[inp[0]];
@@ -145,20 +384,123 @@ int from64tobits_fast(char *out, char *in, int inlen)
     b1 = (n32 & 0x00ff);
 
     *out++ = b1;
-    outlen++;
     if ((inp[1] & 0x00FF) != 0x003D)
     {
         *out++ = b2;
-        outlen++;
         if ((inp[1] & 0xFF00) != 0x3D00)
         {
             *out++ = b3;
-            outlen++;
         }
     }
+    end_gettime(dsp_perf_base64);
+    return (int)(out - start);
+}
+
+void base64_init(base64_state *state)
+{
+    state->ncarry = 0;
+}
+
+int to64frombits_update(base64_state *state, unsigned char *out, const unsigned char *in, int inlen)
+{
+    int outlen = 0;
+    int n;
+    while (state->ncarry > 0 && state->ncarry < 3 && inlen > 0)
+    {
+        state->carry[state->ncarry++] = *in++;
+        inlen--;
+    }
+    if (state->ncarry == 3)
+    {
+        outlen += to64frombits(out, state->carry, 3);
+        state->ncarry = 0;
+    }
+    n = inlen / 3 * 3;
+    if (n > 0)
+        outlen += to64frombits(out + outlen, in, n);
+    for (in += n, inlen -= n; inlen > 0; inlen--)
+        state->carry[state->ncarry++] = *in++;
+    return outlen;
+}
+
+int to64frombits_final(base64_state *state, unsigned char *out)
+{
+    int outlen = 0;
+    if (state->ncarry > 0)
+        outlen = to64frombits(out, state->carry, state->ncarry);
+    state->ncarry = 0;
+    out[outlen] = 0;
+    return outlen;
+}
+
+/* decode the quartet held by the state, padding included */
+static int base64_decode_carry(base64_state *state, unsigned char *out)
+{
+    int v[4];
+    int x;
+    int len = state->ncarry;
+    while (len > 0 && state->carry[len - 1] == '=')
+        len--;
+    if (len < 2)
+        return -1;
+    for (x = 0; x < len; x++)
+    {
+        v[x] = base64_value(state->carry[x]);
+        if (v[x] < 0)
+            return -1;
+    }
+    for (; x < 4; x++)
+        v[x] = 0;
+    out[0] = (unsigned char)(v[0] << 2 | v[1] >> 4);
+    out[1] = (unsigned char)(v[1] << 4 | v[2] >> 2);
+    out[2] = (unsigned char)(v[2] << 6 | v[3]);
+    state->ncarry = 0;
+    return len - 1;
+}
+
+int from64tobits_update(base64_state *state, char *out, const char *in, int inlen)
+{
+    start_gettime(dsp_perf_base64);
+    int outlen = 0;
+    int n;
+    const char *end = in + inlen;
+    while (in < end)
+    {
+        if (state->ncarry == 0)
+        {
+            n = base64_decode_block((unsigned char *)out + outlen, in, (int)(end - in));
+            in += n;
+            outlen += n / 4 * 3;
+            if (in == end)
+                break;
+        }
+        if (isspace((unsigned char)*in))
+        {
+            in++;
+            continue;
+        }
+        if (*in != '=' && base64_value((unsigned char)*in) < 0)
+            return -1;
+        state->carry[state->ncarry++] = (unsigned char)*in++;
+        if (state->ncarry == 4)
+        {
+            n = base64_decode_carry(state, (unsigned char *)out + outlen);
+            if (n < 0)
+                return -1;
+            outlen += n;
+        }
+    }
+    end_gettime(dsp_perf_base64);
     return outlen;
 }
 
+int from64tobits_final(base64_state *state, char *out)
+{
+    if (state->ncarry == 0)
+        return 0;
+    return base64_decode_carry(state, (unsigned char *)out);
+}
+
 #ifdef BASE64_PROGRAM
 /* standalone program that converts to/from base64.
  * cc -o base64 -DBASE64_PROGRAM base64.c
@@ -51,6 +51,56 @@ extern int to64frombits(unsigned char *out, const unsigned char *in, int inlen);
 extern int from64tobits(char *out, char *in);
 extern int from64tobits_fast(char *out, char *in, int inlen);
 
+/** \brief State of an incremental base64 conversion, holds the bytes or characters of an incomplete group */
+typedef struct
+{
+    unsigned char carry[4];
+    int ncarry;
+} base64_state;
+
+/** \brief Reset the state of an incremental conversion.
+    \param state the state to reset
+ */
+extern void base64_init(base64_state *state);
+
+/** \brief Convert a chunk of a bytes array to base64, the bytes not filling a group are kept by the state.
+    \param state the conversion state
+    \param out output buffer in base64. The buffer size must be at least (4 * inlen / 3 + 8) bytes long.
+    \param in input binary chunk
+    \param inlen number of bytes of the chunk
+    \return the number of characters written.
+ */
+extern int to64frombits_update(base64_state *state, unsigned char *out, const unsigned char *in, int inlen);
+
+/** \brief Write the padded group left in the state, if any.
+    \param state the conversion state
+    \param out output buffer, at least 5 bytes long
+    \return the number of characters written.
+ */
+extern int to64frombits_final(base64_state *state, unsigned char *out);
+
+/** \brief Convert a chunk of base64 to bytes, whitespaces are skipped and groups may span chunks.
+    \param state the conversion state
+    \param out output buffer in bytes. The buffer size must be at least (3 * inlen / 4 + 3) bytes long.
+    \param in input base64 chunk
+    \param inlen base64 chunk length
+    \return the number of bytes written, -1 on invalid input.
+ */
+extern int from64tobits_update(base64_state *state, char *out, const char *in, int inlen);
+
+/** \brief Convert the unpadded group left in the state, if any.
+    \param state the conversion state
+    \param out output buffer, at least 3 bytes long
+    \return the number of bytes written, -1 on invalid input.
+ */
+extern int from64tobits_final(base64_state *state, char *out);
+
+/** \brief Select the instruction set used by the codec, capped to what the processor supports.
+    \param level 0 for scalar code, 1 for SSSE3, 2 for AVX2, negative to query the best one supported
+    \return the instruction set in use, or the best one supported when querying.
+ */
+extern int base64_simd(int level);
+
 /*@}*/
 
 #ifdef __cplusplus
@@ -40,7 +40,9 @@ double VLBIBaseline::Correlate(double time)
 {
     if(!Locked())
         return 0.0;
-    int idx = (time - getStartTime()) / getSampleRate();
+    int idx = (time - getStartTime()) * getSampleRate();
+    if(idx >= 0 && idx < getStream()->len && hasVisibilities())
+        return getStream()->dft.pairs[idx][0];
     if(idx >= 0 && idx < getStream()->len)
         return dsp_correlation_delegate(getStream()->dft.pairs[idx][0], getStream()->dft.pairs[idx][1]);
     return 0.0;
@@ -48,17 +50,49 @@ double VLBIBaseline::Correlate(double time)
 
 double VLBIBaseline::Correlate(double time1, double time2)
 {
-    int idx1 = (time1 - getStartTime()) / getSampleRate();
-    int idx2 = (time2 - getStartTime()) / getSampleRate();
+    int idx1 = (time1 - getStartTime()) * getSampleRate();
+    int idx2 = (time2 - getStartTime()) * getSampleRate();
     if(idx1 >= 0 && idx2 >= 0 && idx1 < getNode1()->getStream()->len && idx2 < getNode2()->getStream()->len)
-        return dsp_correlation_delegate(getNode1()->getStream()->buf[idx1], getNode2()->getStream()->buf[idx2]);
+        return dsp_correlation_delegate(getNode1()->getStream()->buf[idx1], getNode2()->getStream()->buf[idx2]) *
+               getNode1()->getFlag(idx1) * getNode2()->getFlag(idx2);
     return 0.0;
 }
 
+double VLBIBaseline::getWeight(double time1, double time2)
+{
+    int idx1 = (time1 - getStartTime()) * getSampleRate();
+    int idx2 = (time2 - getStartTime()) * getSampleRate();
+    if(idx1 >= 0 && idx2 >= 0 && idx1 < getNode1()->getStream()->len && idx2 < getNode2()->getStream()->len)
+        return getNode1()->getFlag(idx1) * getNode2()->getFlag(idx2);
+    return 0.0;
+}
+
+bool VLBIBaseline::getSamples(double time, complex_t pair)
+{
+    int idx = (time - getStartTime()) * getSampleRate();
+    if(!Locked() || idx < 0 || idx >= getStream()->len)
+        return false;
+    pair[0] = getStream()->dft.pairs[idx][0];
+    pair[1] = getStream()->dft.pairs[idx][1];
+    return true;
+}
+
+bool VLBIBaseline::getSamples(double time1, double time2, complex_t pair)
+{
+    int idx1 = (time1 - getStartTime()) * getSampleRate();
+    int idx2 = (time2 - getStartTime()) * getSampleRate();
+    if(idx1 < 0 || idx2 < 0 || idx1 >= getNode1()->getStream()->len || idx2 >= getNode2()->getStream()->len)
+        return false;
+    pair[0] = getNode1()->getStream()->buf[idx1];
+    pair[1] = getNode2()->getStream()->buf[idx2];
+    return true;
+}
+
 double VLBIBaseline::Correlate(int idx1, int idx2)
 {
     if(idx1 > 0 && idx2 > 0 && idx1 < getNode1()->getStream()->len && idx2 < getNode2()->getStream()->len)
-        return dsp_correlation_delegate(getNode1()->getStream()->buf[idx1], getNode2()->getStream()->buf[idx2]);
+        return dsp_correlation_delegate(getNode1()->getStream()->buf[idx1], getNode2()->getStream()->buf[idx2]) *
+               getNode1()->getFlag(idx1) * getNode2()->getFlag(idx2);
     return 0.0;
 }
 
@@ -120,6 +154,7 @@ double *VLBIBaseline::getBaseline()
 
 void VLBIBaseline::getProjection()
 {
+    start_gettime(dsp_perf_geometry);
     double *b = getBaseline();
     double *tmp = vlbi_matrix_calc_3d_projection(Target[1], Target[0], b);
     free (b);
@@ -129,10 +164,12 @@ void VLBIBaseline::getProjection()
     v = proj[1];
     delay = proj[2];
     free (proj);
+    end_gettime(dsp_perf_geometry);
 }
 
 void VLBIBaseline::setTime(double time)
 {
+    start_gettime(dsp_perf_geometry);
     double Alt, Az;
     if(!isRelative())
     {
@@ -165,4 +202,5 @@ void VLBIBaseline::setTime(double time)
                                       &Az);
     }
     setTarget(Az, Alt);
+    end_gettime(dsp_perf_geometry);
 }
@@ -36,6 +36,9 @@ public:
     double Correlate(double time);
     double Correlate(double time1, double time2);
     double Correlate(int idx1, int idx2);
+    double getWeight(double time1, double time2);
+    bool getSamples(double time, complex_t pair);
+    bool getSamples(double time1, double time2, complex_t pair);
     double getStartTime();
     double getEndTime();
 
@@ -88,8 +91,9 @@ public:
     inline void setDelegate(vlbi_func2_t delegate) { dsp_correlation_delegate = delegate; }
 
     inline bool Locked() { return locked; }
-    inline void Lock() { locked = true; }
-    inline void Unlock() { locked = false; }
+    inline void Lock(bool vis = false) { locked = true; visibility = vis; }
+    inline void Unlock() { locked = false; visibility = false; }
+    inline bool hasVisibilities() { return visibility; }
     inline void setRelative(bool rel) { relative = rel; }
     inline bool isRelative() { return relative; }
     inline dsp_location* stationLocation() { return &station; }
@@ -99,6 +103,7 @@ private:
     dsp_location station;
     bool relative { false };
     bool locked { false };
+    bool visibility { false };
     double Target[3];
     double Ra { 0 };
     double Dec { 0 };
@@ -48,7 +48,7 @@ void VLBICollection::Add(void* el, const char* name)
         return;
     VLBIElement item;
     item.item = el;
-    item.name = (char*)malloc(strlen(name));
+    item.name = (char*)malloc(strlen(name) + 1);
     strcpy(item.name, name);
     count++;
     Items = (VLBIElement*)realloc(Items, S * Count());
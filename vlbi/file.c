@@ -17,6 +17,10 @@
 */
 
 #include <vlbi.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 static int f_scansexa(const char *str0, /* input string */
                       double *dp)       /* cracked value, if return 0 */
@@ -64,109 +68,325 @@ static int f_scansexa(const char *str0, /* input string */
     return (0);
 }
 
+#define VLBI_SDFITS_CHUNK 256
+
+enum
+{
+    sdfits_objctra = 0,
+    sdfits_objctdec,
+    sdfits_obsfreq,
+    sdfits_sitelat,
+    sdfits_sitelong,
+    sdfits_siteelev,
+    sdfits_date_obs,
+    sdfits_exposure,
+    sdfits_time,
+    sdfits_data,
+    sdfits_ncolumns
+};
+
+typedef struct
+{
+    fitsfile *fptr;
+    int *columns;
+    int typecode;
+    int naxis;
+    long *naxes;
+    long first;
+    long last;
+    dsp_stream_p *stream;
+} sdfits_chunk;
+
+static void sdfits_read_doubles(fitsfile *fptr, int column, long first, long nrows, double *values)
+{
+    int anynul = 0;
+    int status = 0;
+    memset(values, 0, sizeof(double) * (size_t)nrows);
+    if(column > 0)
+        fits_read_col(fptr, TDOUBLE, column, first + 1, 1, nrows, NULL, values, &anynul, &status);
+}
+
+static void sdfits_read_strings(fitsfile *fptr, int column, long first, long nrows, char **values)
+{
+    int anynul = 0;
+    int status = 0;
+    long r;
+    for(r = 0; r < nrows; r++)
+        values[r][0] = 0;
+    if(column > 0)
+        fits_read_col(fptr, TSTRING, column, first + 1, 1, nrows, NULL, values, &anynul, &status);
+}
+
+static void* sdfits_read_chunk(void *arg)
+{
+    sdfits_chunk *chunk = (sdfits_chunk*)arg;
+    int *columns = chunk->columns;
+    double doubles[sdfits_data][VLBI_SDFITS_CHUNK];
+    char strings[3][VLBI_SDFITS_CHUNK][FLEN_VALUE];
+    char *ra[VLBI_SDFITS_CHUNK];
+    char *dec[VLBI_SDFITS_CHUNK];
+    char *date[VLBI_SDFITS_CHUNK];
+    long first, r;
+    int c, dim;
+    for(r = 0; r < VLBI_SDFITS_CHUNK; r++)
+    {
+        ra[r] = strings[0][r];
+        dec[r] = strings[1][r];
+        date[r] = strings[2][r];
+    }
+    for(first = chunk->first; first < chunk->last; first += VLBI_SDFITS_CHUNK)
+    {
+        long nrows = Min(VLBI_SDFITS_CHUNK, chunk->last - first);
+        sdfits_read_strings(chunk->fptr, columns[sdfits_objctra], first, nrows, ra);
+        sdfits_read_strings(chunk->fptr, columns[sdfits_objctdec], first, nrows, dec);
+        sdfits_read_strings(chunk->fptr, columns[sdfits_date_obs], first, nrows, date);
+        for(c = sdfits_obsfreq; c < sdfits_data; c++)
+        {
+            if(c != sdfits_date_obs)
+                sdfits_read_doubles(chunk->fptr, columns[c], first, nrows, doubles[c]);
+        }
+        for(r = 0; r < nrows; r++)
+        {
+            int anynul = 0;
+            int status = 0;
+            dsp_stream_p stream = dsp_stream_new();
+            chunk->stream[first + r] = stream;
+            f_scansexa(ra[r], &stream->target[0]);
+            f_scansexa(dec[r], &stream->target[1]);
+            stream->wavelength = vlbi_astro_mean_speed(0) / doubles[sdfits_obsfreq][r];
+            stream->location[0].geographic.lat = doubles[sdfits_sitelat][r];
+            stream->location[0].geographic.lon = doubles[sdfits_sitelong][r];
+            stream->location[0].geographic.el = doubles[sdfits_siteelev][r];
+            stream->starttimeutc = vlbi_time_string_to_timespec(date[r]);
+            stream->samplerate = doubles[sdfits_exposure][r];
+            double time = doubles[sdfits_time][r];
+            time -= stream->samplerate / 2.0;
+            stream->starttimeutc.tv_sec += (long)time;
+            stream->starttimeutc.tv_nsec += (long)((time - (long)time) * 1000000000);
+
+            for(dim = 0; dim < chunk->naxis; dim++)
+                dsp_stream_add_dim(stream, (int)chunk->naxes[dim]);
+            dsp_stream_alloc_buffer(stream, stream->len);
+
+            stream->samplerate /= stream->len;
+            stream->samplerate = 1.0 / stream->samplerate;
+            if(chunk->typecode == TCOMPLEX || chunk->typecode == TDBLCOMPLEX)
+                fits_read_col(chunk->fptr, TDBLCOMPLEX, columns[sdfits_data], first + r + 1, 1, stream->len, NULL, stream->dft.buf, &anynul, &status);
+            else
+                fits_read_col(chunk->fptr, TDOUBLE, columns[sdfits_data], first + r + 1, 1, stream->len, NULL, stream->buf, &anynul, &status);
+        }
+    }
+    return NULL;
+}
+
 dsp_stream_p * vlbi_file_read_sdfits(char * filename, long *n)
 {
-    long nrows = 0;
-    long dim;
-    long dims, *sizes;
+    static const char *names[sdfits_ncolumns] = { "OBJCTRA", "OBJCTDEC", "OBSFREQ", "SITELAT", "SITELONG", "SITEELEV", "DATE-OBS", "EXPOSURE", "TIME", "DATA" };
+    fitsfile **fptr = NULL;
+    int status = 0;
+    char error_status[64];
+    dsp_stream_p *stream = NULL;
+    int columns[sdfits_ncolumns];
+    long naxes[8];
+    int naxis = 0;
     int typecode = 0;
-    long width = 0;
     long repeat = 0;
-    int r = 0;
-    dsp_fits_row *rows = dsp_fits_read_sdfits(filename, &nrows, &dims, &sizes);
-    dsp_stream_p *stream = (dsp_stream_p*)malloc(sizeof(dsp_stream_p) * (size_t)nrows);
-    for(r = 0; r < nrows; r++)
+    long width = 0;
+    long nrows = 0;
+    int threads = 1;
+    int handles = 1;
+    int t, c;
+    struct stat st;
+    void *map = MAP_FAILED;
+    void *memptr = NULL;
+    size_t memsize = 0;
+
+    *n = 0;
+    int fd = open(filename, O_RDONLY);
+    if(fd > -1)
     {
-        stream[r] = dsp_stream_new();
-        int k = 0;
-        dsp_fits_row row = rows[r];
-        for(k = 0; strcmp(SDFITS_COLUMN_OBJCTRA.name, row.columns[k].name); k++);
-        f_scansexa(row.columns[k].value, &stream[r]->target[0]);
-        for(k = 0; strcmp(SDFITS_COLUMN_OBJCTDEC.name, row.columns[k].name); k++);
-        f_scansexa(row.columns[k].value, &stream[r]->target[1]);
-        for(k = 0; strcmp(SDFITS_COLUMN_OBJCTDEC.name, row.columns[k].name); k++);
-        f_scansexa(row.columns[k].value, &stream[r]->target[1]);
-        for(k = 0; strcmp(SDFITS_COLUMN_OBSFREQ.name, row.columns[k].name); k++);
-        stream[r]->wavelength = *((double*)row.columns[k].value);
-        stream[r]->wavelength = vlbi_astro_mean_speed(0) / stream[r]->wavelength;
-        for(k = 0; strcmp(SDFITS_COLUMN_SITELAT.name, row.columns[k].name); k++);
-        stream[r]->location[0].geographic.lat = *((double*)row.columns[k].value);
-        for(k = 0; strcmp(SDFITS_COLUMN_SITELONG.name, row.columns[k].name); k++);
-        stream[r]->location[0].geographic.lon = *((double*)row.columns[k].value);
-        for(k = 0; strcmp(SDFITS_COLUMN_SITEELEV.name, row.columns[k].name); k++);
-        stream[r]->location[0].geographic.el = *((double*)row.columns[k].value);
-        for(k = 0; strcmp(SDFITS_COLUMN_DATE_OBS.name, row.columns[k].name); k++);
-        stream[r]->starttimeutc = vlbi_time_string_to_timespec(row.columns[k].value);
-        for(k = 0; strcmp(SDFITS_COLUMN_EXPOSURE.name, row.columns[k].name); k++);
-        stream[r]->samplerate = *((double*)row.columns[k].value);
-        for(k = 0; strcmp(SDFITS_COLUMN_TIME.name, row.columns[k].name); k++);
-        double time = (long) * ((double*)row.columns[k].value);
-        time -= stream[r]->samplerate / 2.0;
-        stream[r]->starttimeutc.tv_sec += (long)time;
-        stream[r]->starttimeutc.tv_nsec += (long)((time - stream[r]->starttimeutc.tv_sec) * 1000000000);
-
-        for(k = 0; strcmp(SDFITS_COLUMN_DATA.name, row.columns[k].name); k++);
-
-        dsp_fits_read_typecode(row.columns[k].format, &typecode, &width, &repeat);
-        dsp_stream_add_dim(stream[r], (int)width);
-        dsp_stream_add_dim(stream[r], (int)repeat);
-        for(dim = 0; dim < dims; dim++)
+        if(!fstat(fd, &st) && st.st_size > 0)
+            map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+    }
+    if(map != MAP_FAILED && ((size_t)st.st_size < 80 || strncmp((char*)map, "SIMPLE", 6)))
+    {
+        munmap(map, (size_t)st.st_size);
+        map = MAP_FAILED;
+    }
+    if(map != MAP_FAILED)
+    {
+        threads = fits_is_reentrant() ? Max(1, (int)dsp_max_threads(0)) : 1;
+        memptr = map;
+        memsize = (size_t)st.st_size;
+    }
+    handles = threads;
+    fptr = (fitsfile**)calloc((size_t)handles, sizeof(fitsfile*));
+
+    if(map != MAP_FAILED)
+        fits_open_memfile(&fptr[0], filename, READONLY, &memptr, &memsize, 0, NULL, &status);
+    else
+        fits_open_file(&fptr[0], filename, READONLY, &status);
+    if(status)
+        goto fail;
+
+    fits_movnam_hdu(fptr[0], BINARY_TBL, FITS_TABLE_SDFITS, 0, &status);
+    if(status)
+        goto fail;
+
+    for(c = 0; c < sdfits_ncolumns; c++)
+    {
+        columns[c] = 0;
+        fits_get_colnum(fptr[0], CASEINSEN, (char*)names[c], &columns[c], &status);
+        if(!status && (c == sdfits_objctra || c == sdfits_objctdec || c == sdfits_date_obs))
         {
-            dsp_stream_add_dim(stream[r], (int)sizes[dim]);
+            fits_get_coltype(fptr[0], columns[c], &typecode, &repeat, &width, &status);
+            if(repeat >= FLEN_VALUE)
+                columns[c] = 0;
         }
-        dsp_stream_alloc_buffer(stream[r], stream[r]->len);
+        status = 0;
+    }
+    if(columns[sdfits_data] < 1)
+        goto fail;
+
+    fits_get_eqcoltype(fptr[0], columns[sdfits_data], &typecode, &repeat, &width, &status);
+    fits_read_tdim(fptr[0], columns[sdfits_data], 8, &naxis, naxes, &status);
+    fits_get_num_rows(fptr[0], &nrows, &status);
+    if(status || nrows < 1)
+        goto fail;
+    if(naxis < 1)
+    {
+        naxis = 1;
+        naxes[0] = repeat;
+    }
+
+    for(t = 1; t < threads; t++)
+    {
+        fits_open_memfile(&fptr[t], filename, READONLY, &memptr, &memsize, 0, NULL, &status);
+        fits_movnam_hdu(fptr[t], BINARY_TBL, FITS_TABLE_SDFITS, 0, &status);
+        if(status)
+            goto fail;
+    }
 
-        stream[r]->samplerate /= stream[r]->len;
-        stream[r]->samplerate = 1.0 / stream[r]->samplerate;
-        switch(typecode)
+    threads = (int)Min((long)threads, nrows);
+    stream = (dsp_stream_p*)malloc(sizeof(dsp_stream_p) * (size_t)nrows);
+    pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)threads);
+    sdfits_chunk *chunks = (sdfits_chunk*)malloc(sizeof(sdfits_chunk) * (size_t)threads);
+    for(t = 0; t < threads; t++)
+    {
+        chunks[t].fptr = fptr[t];
+        chunks[t].columns = columns;
+        chunks[t].typecode = typecode;
+        chunks[t].naxis = naxis;
+        chunks[t].naxes = naxes;
+        chunks[t].first = t * nrows / threads;
+        chunks[t].last = (t + 1) * nrows / threads;
+        chunks[t].stream = stream;
+        pthread_create(&th[t], NULL, sdfits_read_chunk, &chunks[t]);
+    }
+    for(t = 0; t < threads; t++)
+        pthread_join(th[t], NULL);
+    free(chunks);
+    free(th);
+    *n = nrows;
+fail:
+    if(status)
+    {
+        fits_get_errstatus(status, error_status);
+        perr("FITS Error: %s\n", error_status);
+    }
+    for(t = 0; t < handles; t++)
+    {
+        if(fptr[t] != NULL)
         {
-            case TBYTE:
-            case TSBYTE:
-            case TLOGICAL:
-                dsp_buffer_copy(((unsigned char*)row.columns[k].value), stream[r]->buf, stream[r]->len);
-                break;
-            case TSHORT:
-                dsp_buffer_copy(((short*)row.columns[k].value), stream[r]->buf, stream[r]->len);
-                break;
-            case TUSHORT:
-                dsp_buffer_copy(((unsigned short*)row.columns[k].value), stream[r]->buf, stream[r]->len);
-                break;
-            case TINT:
-                dsp_buffer_copy(((int*)row.columns[k].value), stream[r]->buf, stream[r]->len);
-                break;
-            case TUINT:
-                dsp_buffer_copy(((unsigned int*)row.columns[k].value), stream[r]->buf, stream[r]->len);
-                break;
-            case TLONG:
-                dsp_buffer_copy(((long*)row.columns[k].value), stream[r]->buf, stream[r]->len);
-                break;
-            case TULONG:
-                dsp_buffer_copy(((unsigned long*)row.columns[k].value), stream[r]->buf, stream[r]->len);
-                break;
-            case TFLOAT:
-                dsp_buffer_copy(((float*)row.columns[k].value), stream[r]->buf, stream[r]->len);
-                break;
-            case TDOUBLE:
-                dsp_buffer_copy(((double*)row.columns[k].value), stream[r]->buf, stream[r]->len);
-                break;
-            case TCOMPLEX:
-                dsp_buffer_copy(((float*)row.columns[k].value), stream[r]->dft.buf, stream[r]->len * 2);
-                break;
-            case TDBLCOMPLEX:
-                dsp_buffer_copy(((double*)row.columns[k].value), stream[r]->dft.buf, stream[r]->len * 2);
-                break;
-            default:
-                break;
+            status = 0;
+            fits_close_file(fptr[t], &status);
         }
     }
-    *n = nrows;
+    free(fptr);
+    if(map != MAP_FAILED)
+        munmap(map, (size_t)st.st_size);
     return stream;
 }
 
-dsp_stream_p vlbi_file_read_fits(char *filename)
+static int vlbi_file_read_fits_direct(fitsfile *fptr, void *base, size_t size, int bpp, dsp_stream_p stream)
+{
+    LONGLONG headstart = 0, datastart = 0, dataend = 0;
+    double bscale = 1.0, bzero = 0.0;
+    size_t nelements = (size_t)stream->len;
+    size_t x;
+    int status = 0;
+    if(base == NULL || fits_is_compressed_image(fptr, &status))
+        return 0;
+    fits_read_key(fptr, TDOUBLE, "BSCALE", &bscale, NULL, &status);
+    status = 0;
+    fits_read_key(fptr, TDOUBLE, "BZERO", &bzero, NULL, &status);
+    status = 0;
+    if(bscale != 1.0 || bzero != 0.0)
+        return 0;
+    fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend, &status);
+    if(status || datastart < 0 || (size_t)datastart + nelements * (size_t)abs(bpp) / 8 > size)
+        return 0;
+    unsigned char *in = (unsigned char*)base + datastart;
+    switch(bpp)
+    {
+        case BYTE_IMG:
+            dsp_buffer_copy(in, stream->buf, stream->len);
+            break;
+        case SHORT_IMG:
+            for(x = 0; x < nelements; x++)
+            {
+                uint16_t v;
+                memcpy(&v, &in[x * 2], 2);
+                stream->buf[x] = (int16_t)be16toh(v);
+            }
+            break;
+        case LONG_IMG:
+            for(x = 0; x < nelements; x++)
+            {
+                uint32_t v;
+                memcpy(&v, &in[x * 4], 4);
+                stream->buf[x] = (int32_t)be32toh(v);
+            }
+            break;
+        case LONGLONG_IMG:
+            for(x = 0; x < nelements; x++)
+            {
+                uint64_t v;
+                memcpy(&v, &in[x * 8], 8);
+                stream->buf[x] = (int64_t)be64toh(v);
+            }
+            break;
+        case FLOAT_IMG:
+            for(x = 0; x < nelements; x++)
+            {
+                uint32_t v;
+                float f;
+                memcpy(&v, &in[x * 4], 4);
+                v = be32toh(v);
+                memcpy(&f, &v, 4);
+                stream->buf[x] = f;
+            }
+            break;
+        case DOUBLE_IMG:
+            for(x = 0; x < nelements; x++)
+            {
+                uint64_t v;
+                double f;
+                memcpy(&v, &in[x * 8], 8);
+                v = be64toh(v);
+                memcpy(&f, &v, 8);
+                stream->buf[x] = f;
+            }
+            break;
+        default:
+            return 0;
+    }
+    return 1;
+}
+
+static dsp_stream_p vlbi_file_read_fits_hdu(fitsfile *fptr, void *base, size_t size)
 {
-    fitsfile *fptr = (fitsfile*)malloc(sizeof(fitsfile));
-    memset(fptr, 0, sizeof(fitsfile));
     int bpp = 16;
     int status = 0;
     char value[150];
@@ -179,13 +399,6 @@ dsp_stream_p vlbi_file_read_fits(char *filename)
     int anynul = 0;
     void *array = NULL;
 
-    fits_open_file(&fptr, filename, READONLY, &status);
-
-    if (status)
-    {
-        goto fail;
-    }
-
     fits_movabs_hdu(fptr, 1, IMAGE_HDU, &status);
     if(status)
     {
@@ -205,45 +418,48 @@ dsp_stream_p vlbi_file_read_fits(char *filename)
     dsp_stream_alloc_buffer(stream, stream->len);
     nelements = stream->len;
 
-    array = malloc((size_t)(abs(bpp) * nelements / 8));
-    switch(bpp)
+    if(!vlbi_file_read_fits_direct(fptr, base, size, bpp, stream))
     {
-        case BYTE_IMG:
-            fits_read_img(fptr, TBYTE, 1, (long)nelements, NULL, array, &anynul, &status);
-            dsp_buffer_copy(((unsigned char*)array), stream->buf, nelements);
-            break;
-        case SHORT_IMG:
-            fits_read_img(fptr, TUSHORT, 1, (long)nelements, NULL, array, &anynul, &status);
-            dsp_buffer_copy(((short*)array), stream->buf, nelements);
-            break;
-        case USHORT_IMG:
-            fits_read_img(fptr, TUSHORT, 1, (long)nelements, NULL, array, &anynul, &status);
-            dsp_buffer_copy(((unsigned short*)array), stream->buf, nelements);
-            break;
-        case LONG_IMG:
-            fits_read_img(fptr, TULONG, 1, (long)nelements, NULL, array, &anynul, &status);
-            dsp_buffer_copy(((int*)array), stream->buf, nelements);
-            break;
-        case ULONG_IMG:
-            fits_read_img(fptr, TULONG, 1, (long)nelements, NULL, array, &anynul, &status);
-            dsp_buffer_copy(((unsigned int*)array), stream->buf, nelements);
-            break;
-        case LONGLONG_IMG:
-            fits_read_img(fptr, TLONGLONG, 1, (long)nelements, NULL, array, &anynul, &status);
-            dsp_buffer_copy(((long*)array), stream->buf, nelements);
-            break;
-        case FLOAT_IMG:
-            fits_read_img(fptr, TFLOAT, 1, (long)nelements, NULL, array, &anynul, &status);
-            dsp_buffer_copy(((float*)array), stream->buf, nelements);
-            break;
-        case DOUBLE_IMG:
-            fits_read_img(fptr, TDOUBLE, 1, (long)nelements, NULL, array, &anynul, &status);
-            dsp_buffer_copy(((double*)array), stream->buf, nelements);
-            break;
+        array = malloc((size_t)(abs(bpp) * nelements / 8));
+        switch(bpp)
+        {
+            case BYTE_IMG:
+                fits_read_img(fptr, TBYTE, 1, (long)nelements, NULL, array, &anynul, &status);
+                dsp_buffer_copy(((unsigned char*)array), stream->buf, nelements);
+                break;
+            case SHORT_IMG:
+                fits_read_img(fptr, TUSHORT, 1, (long)nelements, NULL, array, &anynul, &status);
+                dsp_buffer_copy(((short*)array), stream->buf, nelements);
+                break;
+            case USHORT_IMG:
+                fits_read_img(fptr, TUSHORT, 1, (long)nelements, NULL, array, &anynul, &status);
+                dsp_buffer_copy(((unsigned short*)array), stream->buf, nelements);
+                break;
+            case LONG_IMG:
+                fits_read_img(fptr, TULONG, 1, (long)nelements, NULL, array, &anynul, &status);
+                dsp_buffer_copy(((int*)array), stream->buf, nelements);
+                break;
+            case ULONG_IMG:
+                fits_read_img(fptr, TULONG, 1, (long)nelements, NULL, array, &anynul, &status);
+                dsp_buffer_copy(((unsigned int*)array), stream->buf, nelements);
+                break;
+            case LONGLONG_IMG:
+                fits_read_img(fptr, TLONGLONG, 1, (long)nelements, NULL, array, &anynul, &status);
+                dsp_buffer_copy(((long*)array), stream->buf, nelements);
+                break;
+            case FLOAT_IMG:
+                fits_read_img(fptr, TFLOAT, 1, (long)nelements, NULL, array, &anynul, &status);
+                dsp_buffer_copy(((float*)array), stream->buf, nelements);
+                break;
+            case DOUBLE_IMG:
+                fits_read_img(fptr, TDOUBLE, 1, (long)nelements, NULL, array, &anynul, &status);
+                dsp_buffer_copy(((double*)array), stream->buf, nelements);
+                break;
+        }
+        free(array);
+        if(status || anynul)
+            goto fail;
     }
-    free(array);
-    if(status || anynul)
-        goto fail;
 
     ffgkey(fptr, "EPOCH", value, comment, &status);
     if (!status)
@@ -304,10 +520,6 @@ dsp_stream_p vlbi_file_read_fits(char *filename)
     }
     status = 0;
 
-    status = 0;
-    fits_close_file(fptr, &status);
-    if(status)
-        goto fail;
     return stream;
 fail:
     if(status)
@@ -315,5 +527,67 @@ fail:
         fits_get_errstatus(status, error_status);
         perr("FITS Error: %s\n", error_status);
     }
+    dsp_stream_free_buffer(stream);
+    dsp_stream_free(stream);
     return NULL;
 }
+
+dsp_stream_p vlbi_file_read_fits_memory(void *buf, size_t len)
+{
+    fitsfile *fptr = NULL;
+    int status = 0;
+    char error_status[64];
+    dsp_stream_p stream = NULL;
+    void *memptr = buf;
+    size_t memsize = len;
+
+    fits_open_memfile(&fptr, "node", READONLY, &memptr, &memsize, 0, NULL, &status);
+    if(status)
+    {
+        fits_get_errstatus(status, error_status);
+        perr("FITS Error: %s\n", error_status);
+        return NULL;
+    }
+    stream = vlbi_file_read_fits_hdu(fptr, buf, len);
+    fits_close_file(fptr, &status);
+    return stream;
+}
+
+dsp_stream_p vlbi_file_read_fits(char *filename)
+{
+    fitsfile *fptr = NULL;
+    int status = 0;
+    char error_status[64];
+    dsp_stream_p stream = NULL;
+    struct stat st;
+    void *map = MAP_FAILED;
+
+    int fd = open(filename, O_RDONLY);
+    if(fd > -1)
+    {
+        if(!fstat(fd, &st) && st.st_size > 0)
+            map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+    }
+    if(map != MAP_FAILED)
+    {
+        if((size_t)st.st_size >= 80 && !strncmp((char*)map, "SIMPLE", 6))
+        {
+            stream = vlbi_file_read_fits_memory(map, (size_t)st.st_size);
+            munmap(map, (size_t)st.st_size);
+            return stream;
+        }
+        munmap(map, (size_t)st.st_size);
+    }
+
+    fits_open_file(&fptr, filename, READONLY, &status);
+    if (status)
+    {
+        fits_get_errstatus(status, error_status);
+        perr("FITS Error: %s\n", error_status);
+        return NULL;
+    }
+    stream = vlbi_file_read_fits_hdu(fptr, NULL, 0);
+    fits_close_file(fptr, &status);
+    return stream;
+}
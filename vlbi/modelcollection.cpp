@@ -31,11 +31,13 @@ ModelCollection::~ModelCollection()
 void ModelCollection::Add(dsp_stream_p element, const char *name)
 {
     strcpy(element->name, name);
+    Keys.erase(name);
     VLBICollection::Add(element, name);
 }
 
 void ModelCollection::Remove(const char* name)
 {
+    Keys.erase(name);
     VLBICollection::Remove(name);
 }
 
@@ -54,3 +56,25 @@ bool ModelCollection::Contains(const char* element)
     return VLBICollection::Contains(element);
 }
 
+void ModelCollection::setKey(const char *name, const char *key)
+{
+    Keys[name] = key;
+}
+
+const char *ModelCollection::getKey(const char *name)
+{
+    std::map<std::string, std::string>::iterator it = Keys.find(name);
+    if(it == Keys.end())
+        return nullptr;
+    return it->second.c_str();
+}
+
+dsp_stream_p ModelCollection::Find(const char *key)
+{
+    for(std::map<std::string, std::string>::iterator it = Keys.begin(); it != Keys.end(); it++)
+    {
+        if(it->second == key)
+            return Get(it->first.c_str());
+    }
+    return nullptr;
+}
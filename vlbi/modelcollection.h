@@ -20,6 +20,7 @@
 #define _MODELCOLLECTION_H
 
 #include "collection.h"
+#include <string>
 
 class ModelCollection : public VLBICollection
 {
@@ -33,6 +34,12 @@ class ModelCollection : public VLBICollection
         dsp_stream_p  At(int index);
         bool Contains(const char* element);
         int IndexOf(dsp_stream_p element);
+        void setKey(const char *name, const char *key);
+        const char *getKey(const char *name);
+        dsp_stream_p Find(const char *key);
+
+    private:
+        std::map<std::string, std::string> Keys;
 };
 
 #endif //_MODELCOLLECTION_H
@@ -22,6 +22,7 @@
 VLBINode::VLBINode(dsp_stream_p stream, const char* name, int index, bool geographic_coordinates)
 {
     setStream(stream);
+    getFlags();
     Name = (char*)calloc(150, 1);
     sprintf(Name, "%s", name);
     Index = index;
@@ -31,9 +32,40 @@ VLBINode::VLBINode(dsp_stream_p stream, const char* name, int index, bool geogra
 
 VLBINode::~VLBINode()
 {
+    free(Flags);
     free(Name);
 }
 
+dsp_t *VLBINode::getFlags()
+{
+    if(FlagsLen != getStream()->len)
+    {
+        Flags = (dsp_t*)realloc(Flags, sizeof(dsp_t) * Max(1, getStream()->len));
+        FlagsLen = getStream()->len;
+        dsp_buffer_set(Flags, FlagsLen, 1.0);
+    }
+    return Flags;
+}
+
+void VLBINode::clearFlags()
+{
+    dsp_t *flags = getFlags();
+    dsp_buffer_set(flags, FlagsLen, 1.0);
+}
+
+unsigned long VLBINode::getFlagsHash()
+{
+    dsp_t *flags = getFlags();
+    uint64_t hash = 14695981039346656037ULL;
+    for(int x = 0; x < FlagsLen; x++)
+    {
+        uint64_t bits = 0;
+        memcpy(&bits, &flags[x], sizeof(dsp_t));
+        hash = (hash ^ bits) * 1099511628211ULL;
+    }
+    return (unsigned long)hash;
+}
+
 void VLBINode::setSampleRate(double samplerate)
 {
     getStream()->align_info.factor[0] = getStream()->samplerate / samplerate;
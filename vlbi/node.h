@@ -141,7 +141,16 @@ class VLBINode
         {
             return StationLocation;
         }
+        inline double getFlag(int x)
+        {
+            return Flags[x];
+        }
+        dsp_t *getFlags();
+        void clearFlags();
+        unsigned long getFlagsHash();
     private:
+        dsp_t *Flags { nullptr };
+        int FlagsLen { 0 };
         dsp_location StationLocation;
         double GeographicLocation[3];
         double Location[3];
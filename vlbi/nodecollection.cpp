@@ -22,16 +22,21 @@
 #include "nodecollection.h"
 #include "baselinecollection.h"
 #include "modelcollection.h"
+#include "uvplanecollection.h"
 
 NodeCollection::NodeCollection() : VLBICollection::VLBICollection()
 {
     relative = false;
     baselines = new BaselineCollection(this);
     models = new ModelCollection();
+    uvplanes = new UVPlaneCollection();
 }
 
 NodeCollection::~NodeCollection()
 {
+    delete uvplanes;
+    delete models;
+    delete baselines;
 }
 
 void NodeCollection::Add(VLBINode * element)
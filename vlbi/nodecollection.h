@@ -24,6 +24,7 @@
 
 class BaselineCollection;
 class ModelCollection;
+class UVPlaneCollection;
 
 class NodeCollection : public VLBICollection
 {
@@ -45,6 +46,10 @@ class NodeCollection : public VLBICollection
         {
             return models;
         }
+        inline UVPlaneCollection* getUVPlanes()
+        {
+            return uvplanes;
+        }
         dsp_location *stationLocation()
         {
             return &station;
@@ -54,12 +59,79 @@ class NodeCollection : public VLBICollection
             return relative;
         }
         void setRelative(bool value);
+        inline void setGridding(vlbi_gridding_kernel kernel, int support, int oversampling)
+        {
+            gridding_kernel = kernel;
+            gridding_support = support;
+            gridding_oversampling = oversampling;
+        }
+        inline vlbi_gridding_kernel getGriddingKernel()
+        {
+            return gridding_kernel;
+        }
+        inline int getGriddingSupport()
+        {
+            return gridding_support;
+        }
+        inline int getGriddingOversampling()
+        {
+            return gridding_oversampling;
+        }
+        inline void setWeighting(vlbi_weighting value, double robust)
+        {
+            weighting = value;
+            robustness = robust;
+        }
+        inline vlbi_weighting getWeighting()
+        {
+            return weighting;
+        }
+        inline double getRobustness()
+        {
+            return robustness;
+        }
+        inline void setAveraging(double fov, double smearing, double interval)
+        {
+            averaging_fov = fov;
+            averaging_smearing = smearing;
+            averaging_interval = interval;
+        }
+        inline double getAveragingFov()
+        {
+            return averaging_fov;
+        }
+        inline double getAveragingSmearing()
+        {
+            return averaging_smearing;
+        }
+        inline double getAveragingInterval()
+        {
+            return averaging_interval;
+        }
+        inline void setCleanMethod(vlbi_clean_method value)
+        {
+            clean_method = value;
+        }
+        inline vlbi_clean_method getCleanMethod()
+        {
+            return clean_method;
+        }
 
     private:
         bool relative;
         dsp_location station;
         BaselineCollection *baselines;
         ModelCollection *models;
+        UVPlaneCollection *uvplanes;
+        vlbi_gridding_kernel gridding_kernel { vlbi_kernel_box };
+        int gridding_support { 1 };
+        int gridding_oversampling { 1 };
+        vlbi_weighting weighting { vlbi_weighting_uniform };
+        double robustness { 0 };
+        double averaging_fov { 0 };
+        double averaging_smearing { 0 };
+        double averaging_interval { 0 };
+        vlbi_clean_method clean_method { vlbi_clean_hogbom };
 };
 
 #endif //_NODECOLLECTION_H
@@ -20,15 +20,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <nodecollection.h>
 #include <baselinecollection.h>
 #include <modelcollection.h>
+#include <uvplanecollection.h>
 #include <base64.h>
 #include <thread>
 
-static pthread_mutex_t mutex;
-static pthread_mutexattr_t mutexattr;
-static bool mutex_initialized = false;
 static unsigned long MAX_THREADS = 1;
 
 unsigned long int vlbi_max_threads(unsigned long value)
@@ -41,32 +44,6 @@ unsigned long int vlbi_max_threads(unsigned long value)
     return MAX_THREADS;
 }
 
-static void init_mutex()
-{
-    pthread_mutexattr_init(&mutexattr);
-    pthread_mutexattr_settype(&mutexattr, PTHREAD_MUTEX_ERRORCHECK);
-    pthread_mutex_init(&mutex, &mutexattr);
-    mutex_initialized = true;
-}
-
-static void destroy_mutex()
-{
-    pthread_mutex_destroy(&mutex);
-    pthread_mutexattr_destroy(&mutexattr);
-    mutex_initialized = false;
-}
-
-static void lock_mutex()
-{
-    while(pthread_mutex_trylock(&mutex))
-        usleep(100);
-}
-
-static void unlock_mutex()
-{
-    pthread_mutex_unlock(&mutex);
-}
-
 static NodeCollection *vlbi_nodes = new NodeCollection();
 
 const char* vlbi_get_version()
@@ -94,6 +71,7 @@ void vlbi_get_offsets(vlbi_context ctx, double J200Time, const char* node1, cons
 {
     NodeCollection* nodes = (NodeCollection*)ctx;
     char baseline[150];
+    start_gettime(dsp_perf_delay);
     sprintf(baseline, "%s_%s", node1, node2);
     VLBIBaseline *b = nodes->getBaselines()->Get(baseline);
     if(b != nullptr) {
@@ -130,105 +108,465 @@ void vlbi_get_offsets(vlbi_context ctx, double J200Time, const char* node1, cons
             *offset2 = getDelay(J200Time, nodes, bl, bl->getRa(), bl->getDec(), bl->getWaveLength());
         }
     }
+    end_gettime(dsp_perf_delay);
+}
+
+typedef struct
+{
+    double u;
+    double v;
+    double w;
+    double value;
+    double weight;
+    unsigned long samples;
+} visibility;
+
+static void baselinegeometry(NodeCollection *nodes, VLBIBaseline *b, double t, int l, bool moving_baseline, bool nodelay, double *uvw,
+                             double *offsets)
+{
+    for (int x = 0; x < nodes->Count(); x++)
+        nodes->At(x)->setLocation(moving_baseline ? l : 0);
+    if(nodelay)
+    {
+        offsets[0] = 0.0;
+        offsets[1] = 0.0;
+    }
+    else
+    {
+        vlbi_get_offsets((void*)nodes, t, b->getNode1()->getName(), b->getNode2()->getName(), b->getRa(), b->getDec(), &offsets[0], &offsets[1]);
+    }
+    b->setTime(t);
+    b->getProjection();
+    uvw[0] = b->getU();
+    uvw[1] = b->getV();
+    uvw[2] = b->getDelay();
+}
+
+/* Correlates the samples of a baseline from the first one and averages them into visibilities, gridded into plane when passed or
+ * appended to table otherwise. With averaging enabled the geometry is evaluated at the edges of each bin only and interpolated
+ * in between: a bin doubles while its uv chord stays within smearing / fov wavelengths and shrinks when it does not, so long
+ * baselines, moving faster into the uv plane, get shorter bins. Moving baselines are not averaged. The index of the next sample is returned. */
+static long integratebaseline(NodeCollection *nodes, VLBIBaseline *b, long first, bool moving_baseline, bool nodelay, int *stop,
+                              dsp_progress *progress, VLBIUVPlane *plane, visibility **table, long *count, long *capacity)
+{
+    double st = b->getStartTime();
+    double et = b->getEndTime();
+    double tau = 1.0 / b->getSampleRate();
+    double start = st + first * tau;
+    double freq = vlbi_astro_mean_speed(0) / b->getWaveLength();
+    double fov = nodes->getAveragingFov();
+    double limit = fov > 0.0 ? nodes->getAveragingSmearing() / fov : 0.0;
+    double interval = nodes->getAveragingInterval();
+    bool averaging = fov > 0.0 && !moving_baseline;
+    long total = (long)ceil((et - st) / tau) - first;
+    long max_samples = interval > 0.0 ? Max(1, (long)(interval / tau)) : Max(1, total);
+    int l = (int)first;
+    long i = 0;
+    long n = 1;
+    unsigned long done = 0;
+    double uvw0[3], uvw1[3];
+    double offsets0[2], offsets1[2];
+    double d = 0.0;
+    visibility vis;
+    if(total > 0)
+        baselinegeometry(nodes, b, start, l, moving_baseline, nodelay, uvw0, offsets0);
+    while(i < total)
+    {
+        if(*stop)
+            break;
+        if(averaging)
+        {
+            n = Min(n, Min(total - i, max_samples));
+            baselinegeometry(nodes, b, start + (i + n) * tau, l + i + n, moving_baseline, nodelay, uvw1, offsets1);
+            d = sqrt(pow(uvw1[0] - uvw0[0], 2) + pow(uvw1[1] - uvw0[1], 2));
+            if(d > limit && n > 1)
+            {
+                n = Max(1, (long)(n * limit / d));
+                continue;
+            }
+        }
+        else
+        {
+            n = 1;
+            memcpy(uvw1, uvw0, sizeof(uvw0));
+            memcpy(offsets1, offsets0, sizeof(offsets0));
+        }
+        double f = (n - 1) / (2.0 * n);
+        vis.u = uvw0[0] + (uvw1[0] - uvw0[0]) * f;
+        vis.v = uvw0[1] + (uvw1[1] - uvw0[1]) * f;
+        vis.w = (uvw0[2] + (uvw1[2] - uvw0[2]) * f) * freq;
+        if(plane == nullptr || (fabs(vis.u) < plane->getWidth() / 2 + plane->getSupport() && fabs(vis.v) < plane->getHeight() / 2 + plane->getSupport()))
+        {
+            double value = 0.0;
+            double weight = 0.0;
+            start_gettime(dsp_perf_correlation);
+            for(long k = 0; k < n; k++)
+            {
+                double t = start + (i + k) * tau;
+                double t1 = t + offsets0[0] + (offsets1[0] - offsets0[0]) * k / n;
+                double t2 = t + offsets0[1] + (offsets1[1] - offsets0[1]) * k / n;
+                double w = b->Locked() ? 1.0 : b->getWeight(t1, t2);
+                value += (b->Locked() ? b->Correlate(t) : b->Correlate(t1, t2)) * w;
+                weight += w;
+            }
+            end_gettime(dsp_perf_correlation);
+            vis.value = weight > 0.0 ? value / weight : 0.0;
+            vis.weight = weight;
+            vis.samples = (unsigned long)n;
+            if(plane != nullptr)
+            {
+                start_gettime(dsp_perf_gridding);
+                plane->Grid(vis.u, vis.v, vis.value, vis.weight, vis.samples);
+                end_gettime(dsp_perf_gridding);
+            }
+            else
+            {
+                if(*count == *capacity)
+                {
+                    *capacity = Max(64, *capacity * 2);
+                    *table = (visibility*)realloc(*table, sizeof(visibility) * (size_t)*capacity);
+                }
+                (*table)[(*count)++] = vis;
+            }
+        }
+        i += n;
+        done += (unsigned long)n;
+        if(done >= DSP_PROGRESS_CHUNK)
+        {
+            dsp_progress_step(progress, done);
+            done = 0;
+        }
+        if(averaging)
+        {
+            memcpy(uvw0, uvw1, sizeof(uvw0));
+            memcpy(offsets0, offsets1, sizeof(offsets0));
+            if(d <= limit / 2)
+                n *= 2;
+        }
+        else if(i < total)
+        {
+            baselinegeometry(nodes, b, start + i * tau, l + (int)i, moving_baseline, nodelay, uvw0, offsets0);
+        }
+    }
+    dsp_progress_step(progress, done);
+    return first + i;
 }
 
-static void* fillplane(void *arg)
+static void* accumulateplane(void *arg)
 {
     pfunc;
     struct args
     {
         VLBIBaseline *b;
         NodeCollection *nodes;
+        VLBIUVPlane *plane;
         bool moving_baseline;
         bool nodelay;
         int *stop;
         int *nthreads;
+        dsp_progress *progress;
     };
     if(arg == nullptr)return nullptr;
     args *argument = (args*)arg;
-    double stack = (*argument->nthreads);
     VLBIBaseline *b = argument->b;
     if(b == nullptr)return nullptr;
-    bool moving_baseline = argument->moving_baseline;
-    bool nodelay = argument->nodelay;
+    VLBIUVPlane *plane = argument->plane;
+    if(plane == nullptr)return nullptr;
     NodeCollection *nodes = argument->nodes;
     if(nodes == nullptr)return nullptr;
+    long first = plane->getProcessedSamples(b->getName());
+    pgarb("%s: integrating from sample %ld\n", b->getName(), first);
+    long next = integratebaseline(nodes, b, first, argument->moving_baseline, argument->nodelay, argument->stop, argument->progress, plane,
+                                  nullptr, nullptr, nullptr);
+    plane->setProcessedSamples(b->getName(), next);
+    (*argument->nthreads)--;
+    return nullptr;
+}
+
+static void setupplane(NodeCollection *nodes, VLBIUVPlane *plane, int u, int v, double *target, double freq, double sr, int nodelay,
+                       int moving_baseline, vlbi_func2_t delegate)
+{
+    plane->setKernel(nodes->getGriddingKernel(), nodes->getGriddingSupport(), nodes->getGriddingOversampling());
+    plane->setWeighting(nodes->getWeighting(), nodes->getRobustness());
+    if(!plane->Matches(u, v, target, freq, sr, nodelay, moving_baseline, delegate))
+    {
+        pgarb("%s: accumulator parameters changed, restarting integration\n", plane->getName());
+        plane->Setup(u, v, target, freq, sr, nodelay, moving_baseline, delegate);
+    }
     BaselineCollection *baselines = nodes->getBaselines();
-    if(baselines == nullptr)return nullptr;
-    dsp_stream_p parent = baselines->getStream();
-    if(parent == nullptr)return nullptr;
-    int u = parent->sizes[0];
-    int v = parent->sizes[1];
-    double st = b->getStartTime();
-    double et = b->getEndTime();
-    double tau = 1.0 / b->getSampleRate();
-    double t;
-    int l = 0;
-    int e = 0;
-    int s = 0;
-    int i = 1;
-    double offset1;
-    double offset2;
-    int idx = 0;
-    int oldidx = 0;
-    int x;
-    double val;
-    for(t = st; t < et; t += tau * i, l++)
+    baselines->SetFrequency(freq);
+    baselines->SetSampleRate(sr);
+    baselines->setRa(target[0]);
+    baselines->setDec(target[1]);
+    baselines->SetDelegate(delegate);
+}
+
+static void syncflags(NodeCollection *nodes)
+{
+    for(int x = 0; x < nodes->Count(); x++)
+        nodes->At(x)->getFlags();
+}
+
+static void integrateplane(NodeCollection *nodes, VLBIUVPlane *plane, int nodelay, int moving_baseline, int *interrupt)
+{
+    BaselineCollection *baselines = nodes->getBaselines();
+    int stop = 0;
+    syncflags(nodes);
+    pgarb("%ld nodes, %ld baselines\n", nodes->Count(), baselines->Count());
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * baselines->Count());
+    int threads_running = 0;
+    int max_threads = (int)vlbi_max_threads(0);
+    dsp_progress *progress = dsp_progress_get();
+    if(interrupt == nullptr && progress != nullptr)
+        interrupt = &progress->cancel;
+    struct args
     {
-        if(*argument->stop)
+        VLBIBaseline *b;
+        NodeCollection *nodes;
+        VLBIUVPlane *plane;
+        bool moving_baseline;
+        bool nodelay;
+        int *stop;
+        int *nthreads;
+        dsp_progress *progress;
+    };
+    args *argument = (args*)malloc(sizeof(args) * (size_t)baselines->Count());
+    for(int i = 0; i < baselines->Count(); i++)
+    {
+        VLBIBaseline *b = baselines->At(i);
+        if(b == nullptr)continue;
+        argument[i].b = b;
+        argument[i].nodes = nodes;
+        argument[i].plane = plane;
+        argument[i].moving_baseline = moving_baseline;
+        argument[i].nodelay = nodelay;
+        argument[i].nthreads = &threads_running;
+        argument[i].progress = progress;
+        long remaining = (long)ceil((b->getEndTime() - b->getStartTime()) * b->getSampleRate()) - plane->getProcessedSamples(b->getName());
+        if(remaining > 0)
+            dsp_progress_add(progress, (unsigned long)remaining);
+        if(interrupt != nullptr)
+            argument[i].stop = interrupt;
+        else
+            argument[i].stop = &stop;
+        while(threads_running > max_threads - 1)
+            usleep(100000);
+        threads_running++;
+        pthread_create(&threads[i], &attr, accumulateplane, &argument[i]);
+    }
+    for(int i = 0; i < baselines->Count(); i++)
+        pthread_join(threads[i], nullptr);
+    free(argument);
+    free(threads);
+    pthread_attr_destroy(&attr);
+}
+
+static void storemodel(NodeCollection *nodes, const char *name, dsp_stream_p like, dsp_t *buf)
+{
+    dsp_stream_p model = nodes->getModels()->Get(name);
+    if(model == nullptr)
+    {
+        model = dsp_stream_copy(like);
+        nodes->getModels()->Add(model, name);
+    }
+    else
+    {
+        dsp_stream_set_dim(model, 0, like->sizes[0]);
+        dsp_stream_set_dim(model, 1, like->sizes[1]);
+        dsp_stream_alloc_buffer(model, model->len);
+    }
+    dsp_buffer_copy(buf, model->buf, like->len);
+}
+
+static std::string coveragekey(NodeCollection *nodes, int u, int v, double *target, double freq, double sr, int nodelay, int moving_baseline)
+{
+    char str[256];
+    snprintf(str, 256, "%dx%d %lf %lf %lf %lf %d %d %d %d %d %d %lf %lf %lf %lf", u, v, target[0], target[1], freq, sr, nodelay, moving_baseline,
+             nodes->getGriddingKernel(), nodes->getGriddingSupport(), nodes->getGriddingOversampling(), nodes->getWeighting(), nodes->getRobustness(),
+             nodes->getAveragingFov(), nodes->getAveragingSmearing(), nodes->getAveragingInterval());
+    std::string key = str;
+    for(int x = 0; x < nodes->Count(); x++)
+    {
+        dsp_stream_p stream = nodes->At(x)->getStream();
+        dsp_location *first = &stream->location[0];
+        dsp_location *last = &stream->location[moving_baseline ? stream->len - 1 : 0];
+        snprintf(str, 256, "|%s %lx %d %lf %ld.%09ld %lf %lf %lf %lf %lf %lf", nodes->At(x)->getName(), nodes->At(x)->getFlagsHash(), stream->len,
+                 stream->samplerate, stream->starttimeutc.tv_sec, stream->starttimeutc.tv_nsec, first->xyz.x, first->xyz.y, first->xyz.z, last->xyz.x,
+                 last->xyz.y, last->xyz.z);
+        key += str;
+    }
+    return key;
+}
+
+static void getpsf(dsp_t *coverage, dsp_t *psf, int u, int v)
+{
+    int sizes[2] = { u, v };
+    complex_t *buf = (complex_t*)calloc((size_t)u * (size_t)v, sizeof(complex_t));
+    for(int y = 0; y < v; y++)
+        for(int x = 0; x < u; x++)
+            buf[((y - v / 2 + v) % v) * u + (x - u / 2 + u) % u][0] = coverage[y * u + x];
+    dsp_fourier_dft_complex(buf, buf, 2, sizes, 1);
+    for(int y = 0; y < v; y++)
+        for(int x = 0; x < u; x++)
+            psf[((y + v / 2) % v) * u + (x + u / 2) % u] = buf[y * u + x][0];
+    free(buf);
+    dsp_t peak = psf[u / 2 + v / 2 * u];
+    if(peak > 0)
+        for(int x = 0; x < u * v; x++)
+            psf[x] /= peak;
+}
+
+static void publishcoverage(NodeCollection *nodes, const char *coverage_name, const char *psf_name, std::string key, dsp_stream_p like, dsp_t *coverage)
+{
+    ModelCollection *models = nodes->getModels();
+    std::string coverage_key = "coverage " + key;
+    std::string psf_key = "psf " + key;
+    storemodel(nodes, coverage_name, like, coverage);
+    models->setKey(coverage_name, coverage_key.c_str());
+    dsp_stream_p psf = models->Find(psf_key.c_str());
+    if(psf == nullptr)
+    {
+        storemodel(nodes, psf_name, like, coverage);
+        psf = models->Get(psf_name);
+        getpsf(coverage, psf->buf, like->sizes[0], like->sizes[1]);
+        pgarb("%s: point spread function computed\n", psf_name);
+    }
+    else if(strcmp(psf->name, psf_name))
+    {
+        storemodel(nodes, psf_name, psf, psf->buf);
+    }
+    models->setKey(psf_name, psf_key.c_str());
+}
+
+static double unit_delegate(double x, double y)
+{
+    (void)x;
+    (void)y;
+    return 1.0;
+}
+
+static void* collectvisibilities(void *arg)
+{
+    pfunc;
+    struct args
+    {
+        VLBIBaseline *b;
+        NodeCollection *nodes;
+        visibility *vis;
+        long count;
+        long capacity;
+        bool moving_baseline;
+        bool nodelay;
+        int *stop;
+        int *nthreads;
+    };
+    if(arg == nullptr)return nullptr;
+    args *argument = (args*)arg;
+    VLBIBaseline *b = argument->b;
+    NodeCollection *nodes = argument->nodes;
+    argument->count = 0;
+    if(b != nullptr && nodes != nullptr)
+        integratebaseline(nodes, b, 0, argument->moving_baseline, argument->nodelay, argument->stop, nullptr, nullptr,
+                          &argument->vis, &argument->count, &argument->capacity);
+    (*argument->nthreads)--;
+    return nullptr;
+}
+
+static void* stackwplanes(void *arg)
+{
+    pfunc;
+    struct args
+    {
+        NodeCollection *nodes;
+        visibility **vis;
+        long *plane_start;
+        int wplanes;
+        double wmin;
+        double wstep;
+        int *next_plane;
+        complex_t *image;
+        double *weight;
+        int width;
+        int height;
+        int *stop;
+        pthread_mutex_t *lock;
+    };
+    args *argument = (args*)arg;
+    NodeCollection *nodes = argument->nodes;
+    int u = argument->width;
+    int v = argument->height;
+    int sizes[2] = { u, v };
+    double target[2] = { 0, 0 };
+    complex_t *grid = (complex_t*)malloc(sizeof(complex_t) * (size_t)(u * v));
+    VLBIUVPlane *plane = new VLBIUVPlane("wplane");
+    plane->setKernel(nodes->getGriddingKernel(), nodes->getGriddingSupport(), nodes->getGriddingOversampling());
+    plane->Setup(u, v, target, 0, 0, false, false, nullptr);
+    while(!(*argument->stop))
+    {
+        pthread_mutex_lock(argument->lock);
+        int k = (*argument->next_plane)++;
+        pthread_mutex_unlock(argument->lock);
+        if(k >= argument->wplanes)
             break;
-        for (x = 0; x < nodes->Count(); x++)
-        {
-            if(moving_baseline)
-            {
-                nodes->At(x)->setLocation(l);
-            }
-            else
-            {
-                nodes->At(x)->setLocation(0);
-            }
-        }
-        if(nodelay)
+        long first = argument->plane_start[k];
+        long last = argument->plane_start[k + 1];
+        if(first == last)
+            continue;
+        plane->Clear();
+        double weight = 0.0;
+        start_gettime(dsp_perf_gridding);
+        for(long i = first; i < last; i++)
         {
-            offset1 = 0.0;
-            offset2 = 0.0;
+            visibility *vis = argument->vis[i];
+            plane->Grid(vis->u, vis->v, vis->value, vis->weight);
+            weight += vis->weight;
         }
-        else
+        end_gettime(dsp_perf_gridding);
+        double *values = plane->getValues();
+        for(int y = 0; y < v; y++)
         {
-            vlbi_get_offsets((void*)nodes, t, b->getNode1()->getName(), b->getNode2()->getName(), b->getRa(), b->getDec(), &offset1, &offset2);
+            for(int x = 0; x < u; x++)
+            {
+                int idx = ((x + u / 2) % u) + ((y + v / 2) % v) * u;
+                grid[idx][0] = values[x + y * u];
+                grid[idx][1] = 0.0;
+            }
         }
-        b->setTime(t);
-        b->getProjection();
-        int U = (int)b->getU() + u / 2;
-        int V = (int)b->getV() + v / 2;
-        if(U >= 0 && U < u && V >= 0 && V < v)
+        dsp_fourier_dft_complex(grid, grid, 2, sizes, 1);
+        double w = argument->wmin + (k + 0.5) * argument->wstep;
+        start_gettime(dsp_perf_lock);
+        pthread_mutex_lock(argument->lock);
+        end_gettime(dsp_perf_lock);
+        for(int y = 0; y < v; y++)
         {
-            idx = (int)(U + V * u);
-            if(idx != oldidx)
+            double m = (double)(y - v / 2) * AIRY / v;
+            for(int x = 0; x < u; x++)
             {
-                oldidx = idx;
-                val = b->Locked() ? b->Correlate(t) : b->Correlate(t + offset1, t + offset2);
-                if(mutex_initialized)
-                {
-                    lock_mutex();
-                    parent->buf[idx] = (parent->buf[idx]+val/stack)/(stack+1);
-                    unlock_mutex();
-                }
-                e = s;
-                double k = 100.0 * (t - st) / (et - st);
-                pinfo("%.3lf%%\n", k);
+                double l = (double)(x - u / 2) * AIRY / u;
+                double r = 1.0 - l * l - m * m;
+                double n = r > 0.0 ? sqrt(r) : 0.0;
+                double phi = 2.0 * M_PI * w * (n - 1.0);
+                double re = cos(phi);
+                double im = sin(phi);
+                int idx = ((x + u / 2) % u) + ((y + v / 2) % v) * u;
+                argument->image[x + y * u][0] += grid[idx][0] * re - grid[idx][1] * im;
+                argument->image[x + y * u][1] += grid[idx][0] * im + grid[idx][1] * re;
             }
         }
-        s = l + 1;
-        i = s - e;
+        *argument->weight += weight;
+        pthread_mutex_unlock(argument->lock);
+        pgarb("w plane %d of %d stacked, %ld visibilities\n", k + 1, argument->wplanes, last - first);
     }
-    (*argument->nthreads)--;
+    delete plane;
+    free(grid);
     return nullptr;
 }
 
 void* vlbi_init()
 {
-    init_mutex();
     return new NodeCollection();
 }
 
@@ -237,7 +575,16 @@ void vlbi_exit(void* ctx)
     NodeCollection *nodes = (NodeCollection*)ctx;
     nodes->~NodeCollection();
     nodes = nullptr;
-    destroy_mutex();
+}
+
+void vlbi_get_stats(vlbi_context ctx, vlbi_stats *stats)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    stats->nodes = (int)nodes->Count();
+    stats->baselines = (int)nodes->getBaselines()->Count();
+    stats->models = (int)nodes->getModels()->Count();
+    dsp_perf_get(&stats->counters);
 }
 
 void vlbi_set_location(void *ctx, double lat, double lon, double el)
@@ -374,6 +721,84 @@ void vlbi_filter_br_node(void *ctx, const char *name, const char *node, double l
     vlbi_add_node(ctx, stream, name, n->GeographicCoordinates());
 }
 
+static void* flagnode(void *arg)
+{
+    struct args
+    {
+        dsp_t *buf;
+        dsp_t *flags;
+        int len;
+        int window;
+        double threshold;
+        vlbi_flagging method;
+    };
+    args *argument = (args*)arg;
+    if(argument->method == vlbi_flagging_sumthreshold)
+        dsp_buffer_flag_sumthreshold(argument->buf, argument->flags, argument->len, argument->window, argument->threshold, VLBI_FLAGGING_MAX_RUN);
+    else
+        dsp_buffer_flag_mad(argument->buf, argument->flags, argument->len, argument->window, argument->threshold);
+    return nullptr;
+}
+
+void vlbi_flag_node(void *ctx, const char *name, vlbi_flagging method, int window, double threshold)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    if(!nodes->Contains(name))
+        return;
+    VLBINode *n = nodes->Get(name);
+    dsp_stream_p stream = n->getStream();
+    struct args
+    {
+        dsp_t *buf;
+        dsp_t *flags;
+        int len;
+        int window;
+        double threshold;
+        vlbi_flagging method;
+    };
+    dsp_t *flags = n->getFlags();
+    window = Max(1, Min(window, stream->len));
+    int windows = (stream->len + window - 1) / window;
+    int nthreads = (int)Max(1, Min(vlbi_max_threads(0), (unsigned long)windows));
+    int chunk = (windows + nthreads - 1) / nthreads * window;
+    pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+    args *argument = (args*)malloc(sizeof(args) * nthreads);
+    for(int i = 0; i < nthreads; i++)
+    {
+        int start = Min(stream->len, i * chunk);
+        argument[i].buf = &stream->buf[start];
+        argument[i].flags = &flags[start];
+        argument[i].len = Min(chunk, stream->len - start);
+        argument[i].window = window;
+        argument[i].threshold = threshold;
+        argument[i].method = method;
+        pthread_create(&threads[i], nullptr, flagnode, &argument[i]);
+    }
+    for(int i = 0; i < nthreads; i++)
+        pthread_join(threads[i], nullptr);
+    free(argument);
+    free(threads);
+}
+
+void vlbi_unflag_node(void *ctx, const char *name)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    if(!nodes->Contains(name))
+        return;
+    nodes->Get(name)->clearFlags();
+}
+
+dsp_t *vlbi_get_node_flags(void *ctx, const char *name)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    if(!nodes->Contains(name))
+        return nullptr;
+    return nodes->Get(name)->getFlags();
+}
+
 void vlbi_add_model(void *ctx, dsp_stream_p stream, const char *name)
 {
     pfunc;
@@ -526,66 +951,374 @@ void vlbi_get_uv_plot(vlbi_context ctx, const char *name, int u, int v, double *
     if(nodes == nullptr)return;
     BaselineCollection *baselines = nodes->getBaselines();
     if(baselines == nullptr)return;
-    int stop = 0;
     dsp_stream_p parent = baselines->getStream();
-    dsp_buffer_set(parent->buf, parent->len, 0.0);
     baselines->setWidth(u);
     baselines->setHeight(v);
-    baselines->SetFrequency(freq);
-    baselines->SetSampleRate(sr);
-    baselines->setRa(target[0]);
-    baselines->setDec(target[1]);
     parent->child_count = 0;
-    pgarb("%ld nodes, %ld baselines\n", nodes->Count(), baselines->Count());
-    baselines->SetDelegate(delegate);
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-    pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * baselines->Count());
-    int threads_running = 0;
-    int max_threads = (int)vlbi_max_threads(0);
-    struct args
-    {
-        VLBIBaseline *b;
-        NodeCollection *nodes;
-        bool moving_baseline;
+    VLBIUVPlane *plane = new VLBIUVPlane(name);
+    setupplane(nodes, plane, u, v, target, freq, sr, nodelay, moving_baseline, delegate);
+    integrateplane(nodes, plane, nodelay, moving_baseline, interrupt);
+    dsp_t *coverage = (dsp_t*)malloc(sizeof(dsp_t) * (size_t)u * (size_t)v);
+    plane->Normalize(parent, coverage);
+    delete plane;
+    if(vlbi_has_model(ctx, name)) {
+        dsp_stream_p model = vlbi_get_model(ctx, name);
+        dsp_stream_set_dim(model, 0, u);
+        dsp_stream_set_dim(model, 1, v);
+        dsp_stream_alloc_buffer(model, model->len);
+        dsp_buffer_copy(parent->buf, model->buf, model->len);
+    } else
+        vlbi_add_model(ctx, dsp_stream_copy(parent), name);
+    if(interrupt == nullptr || !*interrupt)
+    {
+        char coverage_name[150];
+        char psf_name[150];
+        sprintf(coverage_name, "%s_coverage", name);
+        sprintf(psf_name, "%s_psf", name);
+        publishcoverage(nodes, coverage_name, psf_name, coveragekey(nodes, u, v, target, freq, sr, nodelay, moving_baseline), parent, coverage);
+    }
+    free(coverage);
+    pgarb("aperture synthesis plotting completed\n");
+}
+
+void vlbi_get_coverage(vlbi_context ctx, const char *name, int u, int v, double *target, double freq, double sr, int nodelay,
+                      int moving_baseline, int *interrupt)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    if(nodes == nullptr)return;
+    BaselineCollection *baselines = nodes->getBaselines();
+    if(baselines == nullptr)return;
+    char psf_name[150];
+    sprintf(psf_name, "%s_psf", name);
+    std::string key = coveragekey(nodes, u, v, target, freq, sr, nodelay, moving_baseline);
+    std::string coverage_key = "coverage " + key;
+    dsp_stream_p cached = nodes->getModels()->Find(coverage_key.c_str());
+    if(cached != nullptr)
+    {
+        pgarb("%s: coverage found into %s\n", name, cached->name);
+        dsp_t *coverage = (dsp_t*)malloc(sizeof(dsp_t) * cached->len);
+        dsp_buffer_copy(cached->buf, coverage, cached->len);
+        publishcoverage(nodes, name, psf_name, key, cached, coverage);
+        free(coverage);
+        return;
+    }
+    dsp_stream_p parent = baselines->getStream();
+    baselines->setWidth(u);
+    baselines->setHeight(v);
+    parent->child_count = 0;
+    VLBIUVPlane *plane = new VLBIUVPlane(name);
+    setupplane(nodes, plane, u, v, target, freq, sr, nodelay, moving_baseline, unit_delegate);
+    integrateplane(nodes, plane, nodelay, moving_baseline, interrupt);
+    dsp_t *coverage = (dsp_t*)malloc(sizeof(dsp_t) * (size_t)u * (size_t)v);
+    plane->Normalize(parent, coverage);
+    delete plane;
+    if(interrupt == nullptr || !*interrupt)
+        publishcoverage(nodes, name, psf_name, key, parent, coverage);
+    free(coverage);
+    pgarb("uv coverage plotting completed\n");
+}
+
+void vlbi_get_uv_plot_incremental(vlbi_context ctx, const char *name, int u, int v, double *target, double freq, double sr, int nodelay,
+                      int moving_baseline, vlbi_func2_t delegate, int *interrupt)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    if(nodes == nullptr)return;
+    UVPlaneCollection *planes = nodes->getUVPlanes();
+    VLBIUVPlane *plane = planes->Get(name);
+    if(plane == nullptr)
+    {
+        plane = new VLBIUVPlane(name);
+        planes->Add(plane);
+    }
+    setupplane(nodes, plane, u, v, target, freq, sr, nodelay, moving_baseline, delegate);
+    integrateplane(nodes, plane, nodelay, moving_baseline, interrupt);
+    pgarb("aperture synthesis integration completed\n");
+}
+
+void vlbi_finalize_uv_plot(vlbi_context ctx, const char *name)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    VLBIUVPlane *plane = nodes->getUVPlanes()->Get(name);
+    if(plane == nullptr)
+        return;
+    if(plane->getValues() == nullptr)
+        return;
+    plane->setWeighting(nodes->getWeighting(), nodes->getRobustness());
+    dsp_stream_p model = nullptr;
+    if(vlbi_has_model(ctx, name)) {
+        model = nodes->getModels()->Get(name);
+        dsp_stream_set_dim(model, 0, plane->getWidth());
+        dsp_stream_set_dim(model, 1, plane->getHeight());
+        dsp_stream_alloc_buffer(model, model->len);
+    } else {
+        model = dsp_stream_new();
+        dsp_stream_add_dim(model, plane->getWidth());
+        dsp_stream_add_dim(model, plane->getHeight());
+        dsp_stream_alloc_buffer(model, model->len);
+        vlbi_add_model(ctx, model, name);
+    }
+    plane->Normalize(model);
+}
+
+void vlbi_reset_uv_plot(vlbi_context ctx, const char *name)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    VLBIUVPlane *plane = nodes->getUVPlanes()->Get(name);
+    if(plane == nullptr)
+        return;
+    nodes->getUVPlanes()->Remove(name);
+    delete plane;
+}
+
+void vlbi_set_gridding(vlbi_context ctx, vlbi_gridding_kernel kernel, int support, int oversampling)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    nodes->setGridding(kernel, Max(1, Min(support, VLBI_MAX_KERNEL_SUPPORT)), Max(1, oversampling));
+}
+
+void vlbi_set_weighting(vlbi_context ctx, vlbi_weighting weighting, double robustness)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    nodes->setWeighting(weighting, robustness);
+}
+
+void vlbi_set_averaging(vlbi_context ctx, double fov, double smearing, double interval)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    nodes->setAveraging(Max(0.0, fov), Max(0.0, smearing), Max(0.0, interval));
+}
+
+void vlbi_get_wstacking_image(vlbi_context ctx, const char *name, int u, int v, int wplanes, double *target, double freq, double sr, int nodelay,
+                      int moving_baseline, vlbi_func2_t delegate, int *interrupt)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    if(nodes == nullptr)return;
+    BaselineCollection *baselines = nodes->getBaselines();
+    if(baselines == nullptr || baselines->Count() == 0)return;
+    wplanes = Max(1, wplanes);
+    int stop = 0;
+    dsp_progress *progress = dsp_progress_get();
+    if(interrupt == nullptr && progress != nullptr)
+        interrupt = &progress->cancel;
+    if(interrupt == nullptr)
+        interrupt = &stop;
+    VLBIUVPlane *density = new VLBIUVPlane(name);
+    setupplane(nodes, density, u, v, target, freq, sr, nodelay, moving_baseline, delegate);
+    density->setKernel(vlbi_kernel_box, 1, 1);
+    density->Setup(u, v, target, freq, sr, nodelay, moving_baseline, delegate);
+    syncflags(nodes);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * baselines->Count());
+    int threads_running = 0;
+    int max_threads = (int)vlbi_max_threads(0);
+    struct args
+    {
+        VLBIBaseline *b;
+        NodeCollection *nodes;
+        visibility *vis;
+        long count;
+        long capacity;
+        bool moving_baseline;
         bool nodelay;
         int *stop;
         int *nthreads;
     };
     args *argument = (args*)malloc(sizeof(args) * (size_t)baselines->Count());
+    int nbaselines = 0;
     for(int i = 0; i < baselines->Count(); i++)
     {
         VLBIBaseline *b = baselines->At(i);
         if(b == nullptr)continue;
-        argument[i].b = b;
-        argument[i].nodes = nodes;
-        argument[i].moving_baseline = moving_baseline;
-        argument[i].nodelay = nodelay;
-        argument[i].nthreads = &threads_running;
-        if(interrupt != nullptr)
-            argument[i].stop = interrupt;
-        else
-            argument[i].stop = &stop;
+        int n = nbaselines++;
+        argument[n].b = b;
+        argument[n].nodes = nodes;
+        argument[n].moving_baseline = moving_baseline;
+        argument[n].nodelay = nodelay;
+        argument[n].nthreads = &threads_running;
+        argument[n].stop = interrupt;
+        argument[n].count = 0;
+        argument[n].capacity = nodes->getAveragingFov() > 0.0 ? 0 : (long)ceil((b->getEndTime() - b->getStartTime()) * b->getSampleRate()) + 1;
+        argument[n].vis = (visibility*)malloc(sizeof(visibility) * (size_t)Max(1, argument[n].capacity));
         while(threads_running > max_threads - 1)
             usleep(100000);
         threads_running++;
-        pthread_create(&threads[i], &attr, fillplane, &argument[i]);
+        pthread_create(&threads[n], &attr, collectvisibilities, &argument[n]);
     }
-    for(int i = 0; i < baselines->Count(); i++)
+    for(int i = 0; i < nbaselines; i++)
         pthread_join(threads[i], nullptr);
-    free(argument);
     free(threads);
+
+    long count = 0;
+    unsigned long samples = 0;
+    double wmin = DBL_MAX;
+    double wmax = -DBL_MAX;
+    for(int i = 0; i < nbaselines; i++)
+    {
+        for(long j = 0; j < argument[i].count; j++)
+        {
+            visibility *vis = &argument[i].vis[j];
+            density->Grid(vis->u, vis->v, 1.0, vis->weight, vis->samples);
+            samples += vis->samples;
+            wmin = fmin(wmin, vis->w);
+            wmax = fmax(wmax, vis->w);
+        }
+        count += argument[i].count;
+    }
+    double wstep = (wmax - wmin) / wplanes;
+    if(wstep <= 0.0)
+        wstep = 1.0;
+
+    unsigned long *counts = density->getCounts();
+    double f2 = 0.0;
+    if(nodes->getWeighting() == vlbi_weighting_robust)
+    {
+        double sum = 0.0;
+        double sum2 = 0.0;
+        for(int x = 0; x < u * v; x++)
+        {
+            sum += counts[x];
+            sum2 += (double)counts[x] * counts[x];
+        }
+        if(sum2 > 0.0)
+            f2 = pow(5.0 * pow(10.0, -nodes->getRobustness()), 2) / (sum2 / sum);
+    }
+    long *plane_start = (long*)calloc((size_t)wplanes + 1, sizeof(long));
+    for(int i = 0; i < nbaselines; i++)
+    {
+        for(long j = 0; j < argument[i].count; j++)
+        {
+            visibility *vis = &argument[i].vis[j];
+            int k = Max(0, Min(wplanes - 1, (int)((vis->w - wmin) / wstep)));
+            plane_start[k + 1]++;
+            int U = (int)floor(vis->u + u / 2 + 0.5);
+            int V = (int)floor(vis->v + v / 2 + 0.5);
+            double d = (U >= 0 && U < u && V >= 0 && V < v) ? (double)counts[U + V * u] : 1.0;
+            switch(nodes->getWeighting())
+            {
+                case vlbi_weighting_uniform:
+                    vis->weight /= Max(1.0, d);
+                    break;
+                case vlbi_weighting_robust:
+                    vis->weight /= 1.0 + d * f2;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    for(int k = 0; k < wplanes; k++)
+        plane_start[k + 1] += plane_start[k];
+    visibility **order = (visibility**)malloc(sizeof(visibility*) * (size_t)Max(1, count));
+    long *fill = (long*)malloc(sizeof(long) * (size_t)wplanes);
+    memcpy(fill, plane_start, sizeof(long) * (size_t)wplanes);
+    for(int i = 0; i < nbaselines; i++)
+    {
+        for(long j = 0; j < argument[i].count; j++)
+        {
+            visibility *vis = &argument[i].vis[j];
+            int k = Max(0, Min(wplanes - 1, (int)((vis->w - wmin) / wstep)));
+            order[fill[k]++] = vis;
+        }
+    }
+    free(fill);
+    delete density;
+    pgarb("%ld visibilities averaged from %lu samples in %d w planes, w from %.3lf to %.3lf\n", count, samples, wplanes, wmin, wmax);
+
+    complex_t *image = (complex_t*)calloc((size_t)(u * v), sizeof(complex_t));
+    double weight = 0.0;
+    int next_plane = 0;
+    pthread_mutex_t lock;
+    pthread_mutex_init(&lock, nullptr);
+    int nthreads = Max(1, Min(max_threads, wplanes));
+    pthread_t *workers = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)nthreads);
+    struct wargs
+    {
+        NodeCollection *nodes;
+        visibility **vis;
+        long *plane_start;
+        int wplanes;
+        double wmin;
+        double wstep;
+        int *next_plane;
+        complex_t *image;
+        double *weight;
+        int width;
+        int height;
+        int *stop;
+        pthread_mutex_t *lock;
+    } wargument;
+    wargument.nodes = nodes;
+    wargument.vis = order;
+    wargument.plane_start = plane_start;
+    wargument.wplanes = wplanes;
+    wargument.wmin = wmin;
+    wargument.wstep = wstep;
+    wargument.next_plane = &next_plane;
+    wargument.image = image;
+    wargument.weight = &weight;
+    wargument.width = u;
+    wargument.height = v;
+    wargument.stop = interrupt;
+    wargument.lock = &lock;
+    for(int i = 0; i < nthreads; i++)
+        pthread_create(&workers[i], &attr, stackwplanes, &wargument);
+    for(int i = 0; i < nthreads; i++)
+        pthread_join(workers[i], nullptr);
+    free(workers);
+    for(int i = 0; i < nbaselines; i++)
+        free(argument[i].vis);
+    free(argument);
+    free(order);
+    free(plane_start);
+    pthread_mutex_destroy(&lock);
     pthread_attr_destroy(&attr);
-    if(vlbi_has_model(ctx, name)) {
-        dsp_stream_p model = vlbi_get_model(ctx, name);
-        dsp_stream_set_dim(model, 0, u);
-        dsp_stream_set_dim(model, 1, v);
-        dsp_stream_alloc_buffer(model, model->len);
-        dsp_buffer_copy(parent->buf, model->buf, model->len);
-    } else
-        vlbi_add_model(ctx, dsp_stream_copy(parent), name);
-    pgarb("aperture synthesis plotting completed\n");
+
+    if(!(*interrupt))
+    {
+        dsp_stream_p model = nullptr;
+        if(vlbi_has_model(ctx, name)) {
+            model = nodes->getModels()->Get(name);
+            dsp_stream_set_dim(model, 0, u);
+            dsp_stream_set_dim(model, 1, v);
+            dsp_stream_alloc_buffer(model, model->len);
+        } else {
+            model = dsp_stream_new();
+            dsp_stream_add_dim(model, u);
+            dsp_stream_add_dim(model, v);
+            dsp_stream_alloc_buffer(model, model->len);
+            vlbi_add_model(ctx, model, name);
+        }
+        double *cu = (double*)malloc(sizeof(double) * (size_t)u);
+        double *cv = (double*)malloc(sizeof(double) * (size_t)v);
+        VLBIUVPlane *kernel = new VLBIUVPlane(name);
+        kernel->setKernel(nodes->getGriddingKernel(), nodes->getGriddingSupport(), nodes->getGriddingOversampling());
+        kernel->getCorrection(cu, u);
+        kernel->getCorrection(cv, v);
+        delete kernel;
+        for(int y = 0; y < v; y++)
+        {
+            for(int x = 0; x < u; x++)
+            {
+                double c = cu[x] * cv[y];
+                model->buf[x + y * u] = (dsp_t)((fabs(c) > 1e-3 ? image[x + y * u][0] / c : 0.0) / (weight > 0.0 ? weight : 1.0));
+            }
+        }
+        free(cu);
+        free(cv);
+        pgarb("w-stacking imaging completed\n");
+    }
+    free(image);
 }
 
 void vlbi_get_ifft(vlbi_context ctx, const char *name, const char *magnitude, const char *phase)
@@ -675,19 +1408,12 @@ void vlbi_apply_convolution_matrix(vlbi_context ctx, const char *name, const cha
     dsp_stream_p convolution = nodes->getModels()->Get(matrix);
     if(convoluted->dims == convolution->dims)
     {
-        dsp_fourier_dft(convoluted, 1);
-        dsp_fourier_dft(convolution, 1);
         dsp_convolution_convolution(convoluted, convolution);
         vlbi_add_model(ctx, convoluted, name);
-        dsp_stream_free_buffer(convoluted->magnitude);
-        dsp_stream_free(convoluted->magnitude);
-        dsp_stream_free_buffer(convoluted->phase);
-        dsp_stream_free(convoluted->phase);
-        dsp_stream_free_buffer(convolution->magnitude);
-        dsp_stream_free(convolution->magnitude);
-        dsp_stream_free_buffer(convolution->phase);
-        dsp_stream_free(convolution->phase);
+        return;
     }
+    dsp_stream_free_buffer(convoluted);
+    dsp_stream_free(convoluted);
 }
 
 void vlbi_stack_models(vlbi_context ctx, const char *name, const char *model1, const char *model2)
@@ -729,6 +1455,275 @@ void vlbi_diff_models(vlbi_context ctx, const char *name, const char *model1, co
     }
 }
 
+struct clean_state
+{
+    dsp_t *residual;
+    dsp_t *psf;
+    dsp_t *active;
+    int width;
+    int height;
+    int psf_x;
+    int psf_y;
+    int patch;
+    int component_x;
+    int component_y;
+    double component;
+    int stop;
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+};
+
+struct clean_tile
+{
+    clean_state *state;
+    int first_row;
+    int last_row;
+    long peak;
+};
+
+static void* cleantile(void *arg)
+{
+    clean_tile *tile = (clean_tile*)arg;
+    clean_state *state = tile->state;
+    int w = state->width;
+    int h = state->height;
+    while(true)
+    {
+        pthread_barrier_wait(&state->start);
+        if(state->stop)
+            break;
+        double c = state->component;
+        int cx = state->component_x;
+        int cy = state->component_y;
+        int x0 = Max(0, Max(cx - state->psf_x, cx - state->patch));
+        int x1 = Min(w, Min(cx - state->psf_x + w, cx + state->patch + 1));
+        dsp_t peak = 0;
+        tile->peak = tile->first_row * w;
+        for(int y = tile->first_row; y < tile->last_row; y++)
+        {
+            dsp_t *row = &state->residual[y * w];
+            int py = y - cy + state->psf_y;
+            if(c != 0.0 && py >= 0 && py < h && abs(y - cy) <= state->patch)
+            {
+                dsp_t *beam = &state->psf[py * w - cx + state->psf_x];
+                for(int x = x0; x < x1; x++)
+                    row[x] -= c * beam[x];
+            }
+            dsp_t *active = &state->active[y * w];
+            dsp_t m = 0;
+            for(int x = 0; x < w; x++)
+                m = Max(m, fabs(row[x]) * active[x]);
+            if(m > peak)
+            {
+                peak = m;
+                for(int x = 0; x < w; x++)
+                {
+                    if(fabs(row[x]) * active[x] == m)
+                    {
+                        tile->peak = y * w + x;
+                        break;
+                    }
+                }
+            }
+        }
+        pthread_barrier_wait(&state->done);
+    }
+    return nullptr;
+}
+
+static dsp_t cleanminor(clean_state *state, clean_tile *tiles, int ntiles, dsp_t *components, double gain, double limit, double ceiling, int niter, int *iter)
+{
+    dsp_t peak = 0;
+    while(true)
+    {
+        pthread_barrier_wait(&state->start);
+        pthread_barrier_wait(&state->done);
+        long p = tiles[0].peak;
+        for(int t = 1; t < ntiles; t++)
+        {
+            if(fabs(state->residual[tiles[t].peak]) * state->active[tiles[t].peak] > fabs(state->residual[p]) * state->active[p])
+                p = tiles[t].peak;
+        }
+        peak = state->residual[p];
+        state->component = 0.0;
+        if(fabs(peak) < limit || fabs(peak) > ceiling || *iter >= niter)
+            break;
+        state->component = gain * peak;
+        state->component_x = (int)(p % state->width);
+        state->component_y = (int)(p / state->width);
+        components[p] += state->component;
+        (*iter)++;
+    }
+    return peak;
+}
+
+static void cleanconvolve(dsp_t *in, dsp_t *out, complex_t *kernel, complex_t *buf, int w, int h)
+{
+    int sizes[2] = { w * 2, h * 2 };
+    size_t len = (size_t)sizes[0] * (size_t)sizes[1];
+    memset(buf, 0, sizeof(complex_t) * len);
+    for(int y = 0; y < h; y++)
+        for(int x = 0; x < w; x++)
+            buf[y * sizes[0] + x][0] = in[y * w + x];
+    dsp_fourier_dft_complex(buf, buf, 2, sizes, -1);
+    for(size_t x = 0; x < len; x++)
+    {
+        double re = buf[x][0] * kernel[x][0] - buf[x][1] * kernel[x][1];
+        double im = buf[x][0] * kernel[x][1] + buf[x][1] * kernel[x][0];
+        buf[x][0] = re / len;
+        buf[x][1] = im / len;
+    }
+    dsp_fourier_dft_complex(buf, buf, 2, sizes, 1);
+    for(int y = 0; y < h; y++)
+        for(int x = 0; x < w; x++)
+            out[y * w + x] = buf[y * sizes[0] + x][0];
+}
+
+static void cleankernel(dsp_t *beam, complex_t *kernel, int w, int h, int cx, int cy)
+{
+    int sizes[2] = { w * 2, h * 2 };
+    memset(kernel, 0, sizeof(complex_t) * (size_t)sizes[0] * (size_t)sizes[1]);
+    for(int y = 0; y < h; y++)
+        for(int x = 0; x < w; x++)
+            kernel[((y - cy + sizes[1]) % sizes[1]) * sizes[0] + (x - cx + sizes[0]) % sizes[0]][0] = beam[y * w + x];
+    dsp_fourier_dft_complex(kernel, kernel, 2, sizes, -1);
+}
+
+void vlbi_set_clean_method(vlbi_context ctx, vlbi_clean_method method)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    nodes->setCleanMethod(method);
+}
+
+void vlbi_clean(vlbi_context ctx, const char *name, const char *dirty, const char *psf, double gain, double threshold, int niter)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    if(!vlbi_has_model(ctx, dirty))
+        return;
+    if(!vlbi_has_model(ctx, psf))
+        return;
+    dsp_stream_p image = nodes->getModels()->Get(dirty);
+    dsp_stream_p beam = nodes->getModels()->Get(psf);
+    if(image->dims != 2 || beam->dims != 2)
+        return;
+    if(image->sizes[0] != beam->sizes[0] || image->sizes[1] != beam->sizes[1])
+        return;
+    int w = image->sizes[0];
+    int h = image->sizes[1];
+    int len = w * h;
+    int peak = 0;
+    for(int x = 1; x < len; x++)
+        if(beam->buf[x] > beam->buf[peak])
+            peak = x;
+    if(beam->buf[peak] <= 0)
+        return;
+    clean_state state;
+    state.residual = (dsp_t*)malloc(sizeof(dsp_t) * len);
+    state.psf = (dsp_t*)malloc(sizeof(dsp_t) * len);
+    state.active = (dsp_t*)malloc(sizeof(dsp_t) * len);
+    state.width = w;
+    state.height = h;
+    state.psf_x = peak % w;
+    state.psf_y = peak / w;
+    state.patch = Max(w, h);
+    state.component = 0.0;
+    state.component_x = 0;
+    state.component_y = 0;
+    state.stop = 0;
+    dsp_buffer_copy(image->buf, state.residual, len);
+    dsp_buffer_set(state.active, len, 1);
+    for(int x = 0; x < len; x++)
+        state.psf[x] = beam->buf[x] / beam->buf[peak];
+    dsp_t *components = (dsp_t*)malloc(sizeof(dsp_t) * len);
+    dsp_buffer_set(components, len, 0);
+    complex_t *kernel = (complex_t*)malloc(sizeof(complex_t) * (size_t)len * 4);
+    complex_t *buf = (complex_t*)malloc(sizeof(complex_t) * (size_t)len * 4);
+    vlbi_clean_method method = nodes->getCleanMethod();
+    double sidelobe = 0.0;
+    if(method == vlbi_clean_clark)
+    {
+        state.patch = Max(1, Max(w, h) / 4);
+        for(int y = 0; y < h; y++)
+            for(int x = 0; x < w; x++)
+                if(abs(x - state.psf_x) > state.patch || abs(y - state.psf_y) > state.patch)
+                    sidelobe = fmax(sidelobe, fabs(state.psf[y * w + x]));
+        sidelobe = fmin(sidelobe, 0.5);
+        cleankernel(state.psf, kernel, w, h, state.psf_x, state.psf_y);
+    }
+    int ntiles = Max(1, Min((int)vlbi_max_threads(0), h));
+    pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * ntiles);
+    clean_tile *tiles = (clean_tile*)malloc(sizeof(clean_tile) * ntiles);
+    pthread_barrier_init(&state.start, nullptr, ntiles + 1);
+    pthread_barrier_init(&state.done, nullptr, ntiles + 1);
+    for(int t = 0; t < ntiles; t++)
+    {
+        tiles[t].state = &state;
+        tiles[t].first_row = h * t / ntiles;
+        tiles[t].last_row = h * (t + 1) / ntiles;
+        tiles[t].peak = tiles[t].first_row * w;
+        pthread_create(&threads[t], nullptr, cleantile, &tiles[t]);
+    }
+    int iter = 0;
+    dsp_t residual_peak = cleanminor(&state, tiles, ntiles, components, gain, threshold, DBL_MAX, method == vlbi_clean_clark ? 0 : niter, &iter);
+    if(method == vlbi_clean_clark)
+    {
+        while(iter < niter && fabs(residual_peak) >= threshold)
+        {
+            int cycle = iter;
+            double limit = fmax(threshold, fabs(residual_peak) * sidelobe * 1.5);
+            for(int x = 0; x < len; x++)
+                state.active[x] = fabs(state.residual[x]) >= limit;
+            cleanminor(&state, tiles, ntiles, components, gain, limit, fabs(residual_peak), niter, &iter);
+            if(iter == cycle)
+                break;
+            cleanconvolve(components, state.residual, kernel, buf, w, h);
+            for(int x = 0; x < len; x++)
+                state.residual[x] = image->buf[x] - state.residual[x];
+            dsp_buffer_set(state.active, len, 1);
+            residual_peak = cleanminor(&state, tiles, ntiles, components, gain, threshold, DBL_MAX, 0, &iter);
+            pgarb("major cycle: %d components, residual peak %lf\n", iter - cycle, residual_peak);
+        }
+    }
+    state.stop = 1;
+    pthread_barrier_wait(&state.start);
+    for(int t = 0; t < ntiles; t++)
+        pthread_join(threads[t], nullptr);
+    pthread_barrier_destroy(&state.start);
+    pthread_barrier_destroy(&state.done);
+    pgarb("%d clean components, residual peak %lf\n", iter, residual_peak);
+    char model[150];
+    sprintf(model, "%s_components", name);
+    storemodel(nodes, model, image, components);
+    sprintf(model, "%s_residual", name);
+    storemodel(nodes, model, image, state.residual);
+    int hwx = 1;
+    int hwy = 1;
+    while(state.psf_x + hwx < w && state.psf[peak + hwx] > 0.5)
+        hwx++;
+    while(state.psf_y + hwy < h && state.psf[peak + hwy * w] > 0.5)
+        hwy++;
+    double sx = hwx / sqrt(2.0 * log(2.0));
+    double sy = hwy / sqrt(2.0 * log(2.0));
+    for(int y = 0; y < h; y++)
+        for(int x = 0; x < w; x++)
+            state.psf[y * w + x] = exp(-0.5 * (pow((x - state.psf_x) / sx, 2) + pow((y - state.psf_y) / sy, 2)));
+    cleankernel(state.psf, kernel, w, h, state.psf_x, state.psf_y);
+    cleanconvolve(components, components, kernel, buf, w, h);
+    for(int x = 0; x < len; x++)
+        components[x] += state.residual[x];
+    storemodel(nodes, name, image, components);
+    free(tiles);
+    free(threads);
+    free(buf);
+    free(kernel);
+    free(components);
+    free(state.active);
+    free(state.psf);
+    free(state.residual);
+}
+
 void vlbi_shift(vlbi_context ctx, const char *name)
 {
     NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
@@ -901,6 +1896,15 @@ void vlbi_add_node_from_fits(void *ctx, char *filename, const char *name, int ge
         nodes->Add(new VLBINode(stream, name, nodes->Count(), geo == 1));
 }
 
+void vlbi_add_node_from_fits_memory(void *ctx, void *buf, size_t len, const char *name, int geo)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    dsp_stream_p stream = vlbi_file_read_fits_memory(buf, len);
+    if(stream != nullptr)
+        nodes->Add(new VLBINode(stream, name, nodes->Count(), geo == 1));
+}
+
 void vlbi_add_nodes_from_sdfits(void *ctx, char *filename, const char *name, int geo)
 {
     pfunc;
@@ -913,3 +1917,674 @@ void vlbi_add_nodes_from_sdfits(void *ctx, char *filename, const char *name, int
             nodes->Add(new VLBINode(stream[i], name, nodes->Count(), geo == 1));
     }
 }
+
+static void* writefitsidi(void *arg)
+{
+    pfunc;
+    struct args
+    {
+        VLBIBaseline *b;
+        NodeCollection *nodes;
+        dsp_fits_fitsidi_writer *writer;
+        pthread_mutex_t *lock;
+        bool moving_baseline;
+        bool nodelay;
+        int *stop;
+        int *nthreads;
+    };
+    if(arg == nullptr)return nullptr;
+    args *argument = (args*)arg;
+    VLBIBaseline *b = argument->b;
+    NodeCollection *nodes = argument->nodes;
+    double st = b->getStartTime();
+    double et = b->getEndTime();
+    double tau = 1.0 / b->getSampleRate();
+    double freq = vlbi_astro_mean_speed(0) / b->getWaveLength();
+    int number = 256 * ((int)b->getNode1()->getIndex() + 1) + (int)b->getNode2()->getIndex() + 1;
+    double offset1;
+    double offset2;
+    double uvw[3];
+    complex_t pair;
+    double t = st;
+    int x;
+    for(int l = 0; t < et; t += tau, l++)
+    {
+        if(*argument->stop)
+            break;
+        for (x = 0; x < nodes->Count(); x++)
+            nodes->At(x)->setLocation(argument->moving_baseline ? l : 0);
+        if(argument->nodelay)
+        {
+            offset1 = 0.0;
+            offset2 = 0.0;
+        }
+        else
+        {
+            vlbi_get_offsets((void*)nodes, t, b->getNode1()->getName(), b->getNode2()->getName(), b->getRa(), b->getDec(), &offset1, &offset2);
+        }
+        b->setTime(t);
+        b->getProjection();
+        if(!(b->Locked() ? b->getSamples(t, pair) : b->getSamples(t + offset1, t + offset2, pair)))
+            continue;
+        if(!b->hasVisibilities())
+        {
+            pair[0] = b->Locked() ? b->Correlate(t) : b->Correlate(t + offset1, t + offset2);
+            pair[1] = 0.0;
+        }
+        uvw[0] = b->getU() / freq;
+        uvw[1] = b->getV() / freq;
+        uvw[2] = b->getDelay();
+        pthread_mutex_lock(argument->lock);
+        dsp_fits_append_fitsidi_row(argument->writer, 2451545.0 + t / 86400.0, tau, number, uvw, &pair, b->Locked() ? 1.0 : b->getWeight(t + offset1, t + offset2));
+        pthread_mutex_unlock(argument->lock);
+    }
+    (*argument->nthreads)--;
+    return nullptr;
+}
+
+void vlbi_get_baselines_to_fitsidi(void *ctx, char *filename, double *target, double freq, double sr, int nodelay, int moving_baseline, int *interrupt)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    BaselineCollection *baselines = nodes->getBaselines();
+    if(baselines == nullptr || baselines->Count() == 0)return;
+    int stop = 0;
+    dsp_progress *progress = dsp_progress_get();
+    if(interrupt == nullptr && progress != nullptr)
+        interrupt = &progress->cancel;
+    if(interrupt == nullptr)
+        interrupt = &stop;
+    baselines->SetFrequency(freq);
+    baselines->SetSampleRate(sr);
+    baselines->SetDelegate(vlbi_default_delegate);
+    baselines->setRa(target[0]);
+    baselines->setDec(target[1]);
+    char **names = (char**)malloc(sizeof(char*) * (size_t)nodes->Count());
+    dsp_location *locations = (dsp_location*)malloc(sizeof(dsp_location) * (size_t)nodes->Count());
+    for(int x = 0; x < nodes->Count(); x++)
+    {
+        names[x] = nodes->At(x)->getName();
+        locations[x] = nodes->At(x)->getStream()->location[0];
+    }
+    dsp_fits_fitsidi_writer *writer = dsp_fits_create_fitsidi(filename, nodes->Count(), names, locations, nodes->At(0)->GeographicCoordinates(), 1, freq, sr, 65536);
+    free(names);
+    free(locations);
+    if(writer == nullptr)return;
+    syncflags(nodes);
+
+    pthread_mutex_t lock;
+    pthread_mutex_init(&lock, nullptr);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * baselines->Count());
+    int threads_running = 0;
+    int max_threads = (int)vlbi_max_threads(0);
+    struct args
+    {
+        VLBIBaseline *b;
+        NodeCollection *nodes;
+        dsp_fits_fitsidi_writer *writer;
+        pthread_mutex_t *lock;
+        bool moving_baseline;
+        bool nodelay;
+        int *stop;
+        int *nthreads;
+    };
+    args *argument = (args*)malloc(sizeof(args) * (size_t)baselines->Count());
+    for(int i = 0; i < baselines->Count(); i++)
+    {
+        argument[i].b = baselines->At(i);
+        argument[i].nodes = nodes;
+        argument[i].writer = writer;
+        argument[i].lock = &lock;
+        argument[i].moving_baseline = moving_baseline;
+        argument[i].nodelay = nodelay;
+        argument[i].nthreads = &threads_running;
+        argument[i].stop = interrupt;
+        while(threads_running > max_threads - 1)
+            usleep(100000);
+        threads_running++;
+        pthread_create(&threads[i], &attr, writefitsidi, &argument[i]);
+    }
+    for(int i = 0; i < baselines->Count(); i++)
+        pthread_join(threads[i], nullptr);
+    free(threads);
+    free(argument);
+    pthread_attr_destroy(&attr);
+    pthread_mutex_destroy(&lock);
+    dsp_fits_close_fitsidi(writer);
+}
+
+void vlbi_set_baselines_from_fitsidi(void *ctx, char *filename)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    fitsfile *fptr = nullptr;
+    int status = 0;
+    int anynul = 0;
+    int geo = 0;
+    char frame[FLEN_VALUE];
+    char error_status[64];
+    long nantennas = 0;
+    long nrows = 0;
+    int nchan = 1;
+    double ref_freq = 0.0;
+    int date_col = 0, time_col = 0, baseline_col = 0, inttim_col = 0, flux_col = 0;
+    const long chunk = 65536;
+
+    fits_open_file(&fptr, filename, READONLY, &status);
+    fits_movnam_hdu(fptr, BINARY_TBL, (char*)FITS_TABLE_FITSIDI_ARRAY_GEOMETRY, 0, &status);
+    fits_get_num_rows(fptr, &nantennas, &status);
+    if(status || nantennas < 1)
+    {
+        fits_get_errstatus(status, error_status);
+        perr("FITS Error: %s\n", error_status);
+        status = 0;
+        if(fptr != nullptr)
+            fits_close_file(fptr, &status);
+        return;
+    }
+    fits_read_key(fptr, TSTRING, "FRAME", frame, nullptr, &status);
+    geo = !status && !strcmp(frame, "GEOGRAPHIC");
+    status = 0;
+    char **names = (char**)malloc(sizeof(char*) * (size_t)nantennas);
+    for(long a = 0; a < nantennas; a++)
+        names[a] = (char*)calloc(FLEN_VALUE, 1);
+    double *xyz = (double*)calloc((size_t)nantennas * 3, sizeof(double));
+    int *nosta = (int*)calloc((size_t)nantennas, sizeof(int));
+    fits_read_col(fptr, TSTRING, 1, 1, 1, nantennas, nullptr, names, &anynul, &status);
+    fits_read_col(fptr, TDOUBLE, 2, 1, 1, nantennas * 3, nullptr, xyz, &anynul, &status);
+    fits_read_col(fptr, TINT, 3, 1, 1, nantennas, nullptr, nosta, &anynul, &status);
+
+    fits_movnam_hdu(fptr, BINARY_TBL, (char*)FITS_TABLE_FITSIDI_UV_DATA, 0, &status);
+    fits_read_key(fptr, TINT, FITSIDI_KEYWORD_NO_CHAN, &nchan, nullptr, &status);
+    fits_read_key(fptr, TDOUBLE, FITSIDI_KEYWORD_REF_FREQ, &ref_freq, nullptr, &status);
+    fits_get_colnum(fptr, CASEINSEN, (char*)"DATE", &date_col, &status);
+    fits_get_colnum(fptr, CASEINSEN, (char*)"TIME", &time_col, &status);
+    fits_get_colnum(fptr, CASEINSEN, (char*)"BASELINE", &baseline_col, &status);
+    fits_get_colnum(fptr, CASEINSEN, (char*)"INTTIM", &inttim_col, &status);
+    fits_get_colnum(fptr, CASEINSEN, (char*)"FLUX", &flux_col, &status);
+    fits_get_num_rows(fptr, &nrows, &status);
+
+    double *times = nullptr;
+    int *numbers = nullptr;
+    double inttim = 0.0;
+    if(!status && nrows > 0)
+    {
+        times = (double*)malloc(sizeof(double) * (size_t)nrows);
+        numbers = (int*)malloc(sizeof(int) * (size_t)nrows);
+        double *date = (double*)malloc(sizeof(double) * (size_t)chunk);
+        for(long first = 0; first < nrows && !status; first += chunk)
+        {
+            long n = Min(chunk, nrows - first);
+            fits_read_col(fptr, TDOUBLE, date_col, first + 1, 1, n, nullptr, date, &anynul, &status);
+            fits_read_col(fptr, TDOUBLE, time_col, first + 1, 1, n, nullptr, &times[first], &anynul, &status);
+            fits_read_col(fptr, TINT, baseline_col, first + 1, 1, n, nullptr, &numbers[first], &anynul, &status);
+            for(long r = 0; r < n; r++)
+                times[first + r] = (date[r] + times[first + r] - 2451545.0) * 86400.0;
+        }
+        free(date);
+        fits_read_col(fptr, TDOUBLE, inttim_col, 1, 1, 1, nullptr, &inttim, &anynul, &status);
+    }
+    if(status || inttim <= 0.0)
+    {
+        fits_get_errstatus(status, error_status);
+        perr("FITS Error: %s\n", error_status);
+        nrows = 0;
+    }
+
+    std::map<int, long> antennas;
+    for(long a = 0; a < nantennas; a++)
+        antennas[nosta[a]] = a;
+    double *first_time = (double*)malloc(sizeof(double) * (size_t)nantennas);
+    double *last_time = (double*)malloc(sizeof(double) * (size_t)nantennas);
+    for(long a = 0; a < nantennas; a++)
+    {
+        first_time[a] = DBL_MAX;
+        last_time[a] = -DBL_MAX;
+    }
+    for(long r = 0; r < nrows; r++)
+    {
+        int ants[2] = { numbers[r] / 256, numbers[r] % 256 };
+        for(int a = 0; a < 2; a++)
+        {
+            if(antennas.count(ants[a]) == 0)
+                continue;
+            long idx = antennas[ants[a]];
+            first_time[idx] = fmin(first_time[idx], times[r]);
+            last_time[idx] = fmax(last_time[idx], times[r]);
+        }
+    }
+    for(long a = 0; a < nantennas && nrows > 0; a++)
+    {
+        if(nodes->Get(names[a]) != nullptr || first_time[a] > last_time[a])
+            continue;
+        dsp_stream_p stream = dsp_stream_new();
+        dsp_stream_add_dim(stream, (int)round((last_time[a] - first_time[a]) / inttim) + 1);
+        dsp_stream_alloc_buffer(stream, stream->len);
+        stream->starttimeutc = vlbi_time_J2000time_to_timespec(first_time[a]);
+        stream->samplerate = 1.0 / inttim;
+        if(ref_freq > 0.0)
+            stream->wavelength = vlbi_astro_mean_speed(0) / ref_freq;
+        memcpy(stream->location[0].coordinates, &xyz[a * 3], sizeof(double) * 3);
+        nodes->Add(new VLBINode(stream, names[a], nodes->Count(), geo));
+    }
+
+    struct locked
+    {
+        VLBIBaseline *b;
+        bool swap;
+        double start;
+    };
+    std::map<int, locked> locks;
+    std::map<int, long> lengths;
+    char name[300];
+    for(long r = 0; r < nrows; r++)
+    {
+        if(locks.count(numbers[r]) == 0)
+        {
+            locked l = { nullptr, false, 0.0 };
+            int a1 = numbers[r] / 256;
+            int a2 = numbers[r] % 256;
+            if(antennas.count(a1) && antennas.count(a2))
+            {
+                sprintf(name, "%s_%s", names[antennas[a1]], names[antennas[a2]]);
+                l.b = nodes->getBaselines()->Get(name);
+                if(l.b == nullptr)
+                {
+                    sprintf(name, "%s_%s", names[antennas[a2]], names[antennas[a1]]);
+                    l.b = nodes->getBaselines()->Get(name);
+                    l.swap = true;
+                }
+                if(l.b != nullptr)
+                    l.start = l.b->getStartTime();
+            }
+            locks[numbers[r]] = l;
+            lengths[numbers[r]] = 0;
+        }
+        locked l = locks[numbers[r]];
+        if(l.b != nullptr)
+            lengths[numbers[r]] = Max(lengths[numbers[r]], (long)round((times[r] - l.start) / inttim) + 1);
+    }
+    for(std::map<int, locked>::iterator it = locks.begin(); it != locks.end(); it++)
+    {
+        VLBIBaseline *b = it->second.b;
+        long len = lengths[it->first];
+        if(b == nullptr || len < 1)
+            continue;
+        dsp_stream_set_dim(b->getStream(), 0, (int)len);
+        dsp_stream_alloc_buffer(b->getStream(), (int)len);
+        memset(b->getStream()->dft.pairs, 0, sizeof(complex_t) * (size_t)len);
+        b->Lock(true);
+    }
+
+    float *flux = (float*)malloc(sizeof(float) * (size_t)nchan * 3 * (size_t)Min(chunk, Max(1L, nrows)));
+    for(long first = 0; first < nrows && !status; first += chunk)
+    {
+        long n = Min(chunk, nrows - first);
+        fits_read_col(fptr, TFLOAT, flux_col, first + 1, 1, n * nchan * 3, nullptr, flux, &anynul, &status);
+        for(long r = 0; r < n && !status; r++)
+        {
+            locked l = locks[numbers[first + r]];
+            if(l.b == nullptr)
+                continue;
+            long idx = (long)round((times[first + r] - l.start) / inttim);
+            if(idx < 0 || idx >= l.b->getStream()->len)
+                continue;
+            double re = 0.0, im = 0.0, w = 0.0;
+            for(int c = 0; c < nchan; c++)
+            {
+                float *vis = &flux[(r * nchan + c) * 3];
+                if(vis[2] <= 0.0f)
+                    continue;
+                re += vis[0] * vis[2];
+                im += vis[1] * vis[2];
+                w += vis[2];
+            }
+            if(w <= 0.0)
+                continue;
+            l.b->getStream()->dft.pairs[idx][0] = re / w;
+            //rows stored for the reversed antenna order hold the conjugate visibility
+            l.b->getStream()->dft.pairs[idx][1] = (l.swap ? -im : im) / w;
+        }
+    }
+    free(flux);
+    free(first_time);
+    free(last_time);
+    free(times);
+    free(numbers);
+    free(xyz);
+    free(nosta);
+    for(long a = 0; a < nantennas; a++)
+        free(names[a]);
+    free(names);
+    status = 0;
+    fits_close_file(fptr, &status);
+}
+
+#define VLBI_SNAPSHOT_MAGIC "OVLBISNP"
+#define VLBI_SNAPSHOT_VERSION 2
+#define VLBI_SNAPSHOT_ALIGN 64
+#define VLBI_SNAPSHOT_BYTEORDER 0x01020304
+
+typedef enum
+{
+    snapshot_node = 0,
+    snapshot_model,
+    snapshot_baseline,
+} snapshot_type;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+    uint32_t sample_size;
+    uint32_t location_size;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t size;
+} snapshot_header;
+
+typedef struct
+{
+    uint32_t type;
+    uint32_t geo;
+    char name[sizeof(((dsp_stream*)nullptr)->name)];
+    int32_t dims;
+    int32_t visibility;
+    int64_t len;
+    int64_t tv_sec;
+    int64_t tv_nsec;
+    double samplerate;
+    double wavelength;
+    double target[3];
+    double location[3];
+    uint64_t sizes;
+    uint64_t buf;
+    uint64_t locations;
+    uint64_t dft;
+    uint64_t flags;
+} snapshot_entry;
+
+static uint64_t snapshot_alloc(uint64_t *offset, uint64_t size)
+{
+    uint64_t ret = *offset;
+    *offset = (ret + size + VLBI_SNAPSHOT_ALIGN - 1) & ~(uint64_t)(VLBI_SNAPSHOT_ALIGN - 1);
+    return ret;
+}
+
+static bool snapshot_describe(snapshot_entry *entry, int type, const char *name, dsp_stream_p stream, uint64_t *offset)
+{
+    memset(entry, 0, sizeof(snapshot_entry));
+    size_t namelen = strlen(name);
+    if(namelen >= sizeof(entry->name))
+    {
+        perr("Name %s too long for a snapshot\n", name);
+        return false;
+    }
+    entry->type = (uint32_t)type;
+    memcpy(entry->name, name, namelen);
+    entry->dims = stream->dims;
+    entry->len = stream->len;
+    entry->tv_sec = (int64_t)stream->starttimeutc.tv_sec;
+    entry->tv_nsec = (int64_t)stream->starttimeutc.tv_nsec;
+    entry->samplerate = stream->samplerate;
+    entry->wavelength = stream->wavelength;
+    memcpy(entry->target, stream->target, sizeof(double) * 3);
+    entry->sizes = snapshot_alloc(offset, sizeof(int) * (uint64_t)stream->dims);
+    if(type == snapshot_baseline)
+    {
+        entry->dft = snapshot_alloc(offset, sizeof(complex_t) * (uint64_t)stream->len);
+        return true;
+    }
+    entry->buf = snapshot_alloc(offset, sizeof(dsp_t) * (uint64_t)stream->len);
+    if(type == snapshot_node)
+        entry->locations = snapshot_alloc(offset, sizeof(dsp_location) * (uint64_t)stream->len);
+    return true;
+}
+
+static bool snapshot_flagged(dsp_t *flags, int len)
+{
+    for(int x = 0; x < len; x++)
+        if(flags[x] != 1.0)
+            return true;
+    return false;
+}
+
+static void snapshot_store(unsigned char *map, snapshot_entry *entry, dsp_stream_p stream)
+{
+    memcpy(&map[entry->sizes], stream->sizes, sizeof(int) * (size_t)stream->dims);
+    if(entry->dft > 0)
+        memcpy(&map[entry->dft], stream->dft.pairs, sizeof(complex_t) * (size_t)stream->len);
+    if(entry->buf > 0)
+        memcpy(&map[entry->buf], stream->buf, sizeof(dsp_t) * (size_t)stream->len);
+    if(entry->locations > 0)
+        memcpy(&map[entry->locations], stream->location, sizeof(dsp_location) * (size_t)stream->len);
+}
+
+static bool snapshot_contains(snapshot_header *header, uint64_t offset, uint64_t size)
+{
+    return offset <= header->size && size <= header->size - offset;
+}
+
+static bool snapshot_check(snapshot_header *header, snapshot_entry *entry)
+{
+    if(entry->dims < 1 || entry->len < 1 || entry->type > snapshot_baseline)
+        return false;
+    entry->name[sizeof(entry->name) - 1] = 0;
+    if(!snapshot_contains(header, entry->sizes, sizeof(int) * (uint64_t)entry->dims))
+        return false;
+    if(entry->type == snapshot_baseline)
+        return entry->dft > 0 && snapshot_contains(header, entry->dft, sizeof(complex_t) * (uint64_t)entry->len);
+    if(entry->buf == 0 || !snapshot_contains(header, entry->buf, sizeof(dsp_t) * (uint64_t)entry->len))
+        return false;
+    if(entry->flags > 0 && (entry->type != snapshot_node || !snapshot_contains(header, entry->flags, sizeof(dsp_t) * (uint64_t)entry->len)))
+        return false;
+    if(entry->type == snapshot_node)
+        return entry->locations > 0 && snapshot_contains(header, entry->locations, sizeof(dsp_location) * (uint64_t)entry->len);
+    return true;
+}
+
+static dsp_stream_p snapshot_restore(unsigned char *map, snapshot_entry *entry)
+{
+    int *sizes = (int*)&map[entry->sizes];
+    dsp_stream_p stream = dsp_stream_new();
+    for(int d = 0; d < entry->dims; d++)
+        dsp_stream_add_dim(stream, sizes[d]);
+    if(stream->len != entry->len)
+    {
+        dsp_stream_free_buffer(stream);
+        dsp_stream_free(stream);
+        return nullptr;
+    }
+    dsp_stream_alloc_buffer(stream, stream->len);
+    memcpy(stream->buf, &map[entry->buf], sizeof(dsp_t) * (size_t)stream->len);
+    if(entry->locations > 0)
+        memcpy(stream->location, &map[entry->locations], sizeof(dsp_location) * (size_t)stream->len);
+    memcpy(stream->name, entry->name, sizeof(stream->name));
+    stream->starttimeutc.tv_sec = (time_t)entry->tv_sec;
+    stream->starttimeutc.tv_nsec = (long)entry->tv_nsec;
+    stream->samplerate = entry->samplerate;
+    stream->wavelength = entry->wavelength;
+    memcpy(stream->target, entry->target, sizeof(double) * 3);
+    return stream;
+}
+
+int vlbi_save_snapshot(void *ctx, char *filename)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    ModelCollection *models = nodes->getModels();
+    BaselineCollection *baselines = nodes->getBaselines();
+    int count = nodes->Count() + models->Count();
+    for(int x = 0; x < baselines->Count(); x++)
+        count += baselines->At(x)->Locked();
+    snapshot_entry *entries = (snapshot_entry*)malloc(sizeof(snapshot_entry) * (size_t)Max(count, 1));
+    dsp_stream_p *streams = (dsp_stream_p*)malloc(sizeof(dsp_stream_p) * (size_t)Max(count, 1));
+    uint64_t offset = 0;
+    snapshot_alloc(&offset, sizeof(snapshot_header) + sizeof(snapshot_entry) * (uint64_t)count);
+    bool valid = true;
+    int e = 0;
+    for(int x = 0; x < nodes->Count() && valid; x++, e++)
+    {
+        VLBINode *node = nodes->At(x);
+        streams[e] = node->getStream();
+        valid = snapshot_describe(&entries[e], snapshot_node, node->getName(), streams[e], &offset);
+        entries[e].geo = node->GeographicCoordinates();
+        memcpy(entries[e].location, node->getLocation(), sizeof(double) * 3);
+        if(snapshot_flagged(node->getFlags(), streams[e]->len))
+            entries[e].flags = snapshot_alloc(&offset, sizeof(dsp_t) * (uint64_t)streams[e]->len);
+    }
+    for(int x = 0; x < models->Count() && valid; x++, e++)
+    {
+        streams[e] = models->At(x);
+        valid = snapshot_describe(&entries[e], snapshot_model, streams[e]->name, streams[e], &offset);
+    }
+    for(int x = 0; x < baselines->Count() && valid; x++)
+    {
+        VLBIBaseline *b = baselines->At(x);
+        if(!b->Locked())
+            continue;
+        streams[e] = b->getStream();
+        valid = snapshot_describe(&entries[e], snapshot_baseline, b->getName(), streams[e], &offset);
+        entries[e].visibility = b->hasVisibilities();
+        e++;
+    }
+    int ret = -1;
+    int fd = valid ? open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644) : -1;
+    if(!valid)
+    {
+        perr("Cannot save snapshot %s\n", filename);
+    }
+    else if(fd < 0)
+    {
+        perr("Cannot create snapshot %s\n", filename);
+    }
+    else
+    {
+        void *map = MAP_FAILED;
+        if(!ftruncate(fd, (off_t)offset))
+            map = mmap(nullptr, (size_t)offset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(map != MAP_FAILED)
+        {
+            snapshot_header *header = (snapshot_header*)map;
+            memset(header, 0, sizeof(snapshot_header));
+            memcpy(header->magic, VLBI_SNAPSHOT_MAGIC, sizeof(header->magic));
+            header->version = VLBI_SNAPSHOT_VERSION;
+            header->byteorder = VLBI_SNAPSHOT_BYTEORDER;
+            header->sample_size = sizeof(dsp_t);
+            header->location_size = sizeof(dsp_location);
+            header->count = (uint32_t)count;
+            header->size = offset;
+            memcpy(&header[1], entries, sizeof(snapshot_entry) * (size_t)count);
+            for(int x = 0; x < count; x++)
+                snapshot_store((unsigned char*)map, &entries[x], streams[x]);
+            for(int x = 0; x < nodes->Count(); x++)
+                if(entries[x].flags > 0)
+                    memcpy(&((unsigned char*)map)[entries[x].flags], nodes->At(x)->getFlags(), sizeof(dsp_t) * (size_t)streams[x]->len);
+            msync(map, (size_t)offset, MS_SYNC);
+            munmap(map, (size_t)offset);
+            ret = 0;
+        }
+        else
+        {
+            perr("Cannot map snapshot %s\n", filename);
+        }
+        close(fd);
+    }
+    free(entries);
+    free(streams);
+    return ret;
+}
+
+int vlbi_load_snapshot(void *ctx, char *filename)
+{
+    pfunc;
+    NodeCollection *nodes = (ctx != nullptr) ? (NodeCollection*)ctx : vlbi_nodes;
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+    {
+        perr("Cannot open snapshot %s\n", filename);
+        return -1;
+    }
+    void *map = MAP_FAILED;
+    if(!fstat(fd, &st) && (size_t)st.st_size >= sizeof(snapshot_header))
+        map = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        perr("Cannot map snapshot %s\n", filename);
+        return -1;
+    }
+    unsigned char *data = (unsigned char*)map;
+    snapshot_header *header = (snapshot_header*)map;
+    snapshot_entry *entries = (snapshot_entry*)&header[1];
+    bool valid = !memcmp(header->magic, VLBI_SNAPSHOT_MAGIC, sizeof(header->magic)) &&
+                 header->version == VLBI_SNAPSHOT_VERSION &&
+                 header->byteorder == VLBI_SNAPSHOT_BYTEORDER &&
+                 header->sample_size == sizeof(dsp_t) &&
+                 header->location_size == sizeof(dsp_location) &&
+                 header->size <= (uint64_t)st.st_size &&
+                 snapshot_contains(header, sizeof(snapshot_header), sizeof(snapshot_entry) * (uint64_t)header->count);
+    for(uint32_t x = 0; x < header->count && valid; x++)
+        valid = snapshot_check(header, &entries[x]);
+    if(!valid)
+    {
+        perr("Invalid snapshot %s\n", filename);
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+    for(uint32_t x = 0; x < header->count; x++)
+    {
+        snapshot_entry *entry = &entries[x];
+        if(entry->type == snapshot_baseline)
+            continue;
+        if(entry->type == snapshot_node && nodes->Contains(entry->name))
+            continue;
+        if(entry->type == snapshot_model && nodes->getModels()->Contains(entry->name))
+            continue;
+        dsp_stream_p stream = snapshot_restore(data, entry);
+        if(stream == nullptr)
+            continue;
+        if(entry->type == snapshot_model)
+        {
+            nodes->getModels()->Add(stream, entry->name);
+            continue;
+        }
+        VLBINode *node = new VLBINode(stream, entry->name, nodes->Count(), entry->geo);
+        node->setLocation(entry->location);
+        if(entry->flags > 0)
+            memcpy(node->getFlags(), &data[entry->flags], sizeof(dsp_t) * (size_t)stream->len);
+        nodes->Add(node);
+    }
+    for(uint32_t x = 0; x < header->count; x++)
+    {
+        snapshot_entry *entry = &entries[x];
+        if(entry->type != snapshot_baseline)
+            continue;
+        VLBIBaseline *b = nodes->getBaselines()->Get(entry->name);
+        if(b == nullptr)
+            continue;
+        int *sizes = (int*)&data[entry->sizes];
+        dsp_stream_p stream = b->getStream();
+        for(int d = 0; d < entry->dims; d++)
+        {
+            if(d < stream->dims)
+                dsp_stream_set_dim(stream, d, sizes[d]);
+            else
+                dsp_stream_add_dim(stream, sizes[d]);
+        }
+        if(stream->len != entry->len)
+            continue;
+        dsp_stream_alloc_buffer(stream, stream->len);
+        memcpy(stream->dft.pairs, &data[entry->dft], sizeof(complex_t) * (size_t)stream->len);
+        stream->samplerate = entry->samplerate;
+        stream->wavelength = entry->wavelength;
+        b->Lock(entry->visibility != 0);
+    }
+    munmap(map, (size_t)st.st_size);
+    return 0;
+}
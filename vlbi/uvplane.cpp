@@ -0,0 +1,306 @@
+/*  OpenVLBI - Open Source Very Long Baseline Interferometry
+*   Copyright © 2017-2022  Ilia Platone
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 3 of the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program; if not, write to the Free Software Foundation,
+*   Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "uvplane.h"
+
+static double prolate_spheroidal(double nu)
+{
+    static const double p[2][5] =
+    {
+        { 8.203343e-2, -3.644705e-1, 6.278660e-1, -5.335581e-1, 2.312756e-1 },
+        { 4.028559e-3, -3.697768e-2, 1.021332e-1, -1.201436e-1, 6.412774e-2 }
+    };
+    static const double q[2][3] =
+    {
+        { 1.0000000e0, 8.212018e-1, 2.078043e-1 },
+        { 1.0000000e0, 9.599102e-1, 2.918724e-1 }
+    };
+    int part;
+    double nuend;
+    nu = fabs(nu);
+    if(nu < 0.75)
+    {
+        part = 0;
+        nuend = 0.75;
+    }
+    else if(nu <= 1.0)
+    {
+        part = 1;
+        nuend = 1.0;
+    }
+    else
+        return 0.0;
+    double delnusq = nu * nu - nuend * nuend;
+    double top = p[part][0];
+    double bot = q[part][0];
+    double d = delnusq;
+    for(int k = 1; k < 5; k++, d *= delnusq)
+        top += p[part][k] * d;
+    d = delnusq;
+    for(int k = 1; k < 3; k++, d *= delnusq)
+        bot += q[part][k] * d;
+    double value = (bot != 0.0) ? top / bot : 0.0;
+    return fmax(0.0, value) * (1.0 - nu * nu);
+}
+
+static double kernel_value(vlbi_gridding_kernel kernel, double x, int support)
+{
+    double half = support * 0.5;
+    if(fabs(x) > half)
+        return 0.0;
+    switch(kernel)
+    {
+        case vlbi_kernel_gaussian:
+        {
+            double sigma = half / 3.0;
+            return exp(-0.5 * x * x / (sigma * sigma));
+        }
+        case vlbi_kernel_prolate_spheroidal:
+            return prolate_spheroidal(x / half);
+        default:
+            return 1.0;
+    }
+}
+
+VLBIUVPlane::VLBIUVPlane(const char *name)
+{
+    Name = (char*)malloc(strlen(name) + 1);
+    strcpy(Name, name);
+    pthread_mutex_init(&mutex, nullptr);
+    for(int x = 0; x < VLBI_UVPLANE_ROW_LOCKS; x++)
+        pthread_mutex_init(&RowLocks[x], nullptr);
+    setKernel(vlbi_kernel_box, 1, 1);
+}
+
+VLBIUVPlane::~VLBIUVPlane()
+{
+    free(Values);
+    free(Weights);
+    free(Counts);
+    free(KernelLUT);
+    free(Name);
+    pthread_mutex_destroy(&mutex);
+    for(int x = 0; x < VLBI_UVPLANE_ROW_LOCKS; x++)
+        pthread_mutex_destroy(&RowLocks[x]);
+}
+
+void VLBIUVPlane::lockRows()
+{
+    pthread_mutex_lock(&mutex);
+    for(int x = 0; x < VLBI_UVPLANE_ROW_LOCKS; x++)
+        pthread_mutex_lock(&RowLocks[x]);
+}
+
+void VLBIUVPlane::unlockRows()
+{
+    for(int x = VLBI_UVPLANE_ROW_LOCKS - 1; x >= 0; x--)
+        pthread_mutex_unlock(&RowLocks[x]);
+    pthread_mutex_unlock(&mutex);
+}
+
+void VLBIUVPlane::setKernel(vlbi_gridding_kernel kernel, int support, int oversampling)
+{
+    support = Max(1, Min(support, VLBI_MAX_KERNEL_SUPPORT));
+    oversampling = Max(1, oversampling);
+    if(KernelLUT != nullptr && kernel == Kernel && support == Support && oversampling == Oversampling)
+        return;
+    Kernel = kernel;
+    Support = support;
+    Oversampling = oversampling;
+    KernelChanged = true;
+    int len = Support * Oversampling + 1;
+    KernelLUT = (double*)realloc(KernelLUT, sizeof(double) * (size_t)len);
+    for(int x = 0; x < len; x++)
+        KernelLUT[x] = kernel_value(Kernel, (double)x / Oversampling - Support * 0.5, Support);
+}
+
+bool VLBIUVPlane::Matches(int w, int h, double *target, double freq, double sr, bool nodelay, bool moving_baseline, vlbi_func2_t delegate)
+{
+    if(Values == nullptr || KernelChanged)
+        return false;
+    return w == width && h == height &&
+           target[0] == Ra && target[1] == Dec &&
+           freq == Frequency && sr == SampleRate &&
+           nodelay == NoDelay && moving_baseline == MovingBaseline &&
+           delegate == Delegate;
+}
+
+void VLBIUVPlane::Setup(int w, int h, double *target, double freq, double sr, bool nodelay, bool moving_baseline, vlbi_func2_t delegate)
+{
+    size_t len = (size_t)w * (size_t)h;
+    width = w;
+    height = h;
+    Ra = target[0];
+    Dec = target[1];
+    Frequency = freq;
+    SampleRate = sr;
+    NoDelay = nodelay;
+    MovingBaseline = moving_baseline;
+    Delegate = delegate;
+    KernelChanged = false;
+    Values = (double*)realloc(Values, sizeof(double) * len);
+    Weights = (double*)realloc(Weights, sizeof(double) * len);
+    Counts = (unsigned long*)realloc(Counts, sizeof(unsigned long) * len);
+    Clear();
+}
+
+void VLBIUVPlane::Clear()
+{
+    size_t len = (size_t)width * (size_t)height;
+    lockRows();
+    if(Values != nullptr)
+        memset(Values, 0, sizeof(double) * len);
+    if(Weights != nullptr)
+        memset(Weights, 0, sizeof(double) * len);
+    if(Counts != nullptr)
+        memset(Counts, 0, sizeof(unsigned long) * len);
+    Processed.clear();
+    unlockRows();
+}
+
+void VLBIUVPlane::Grid(double u, double v, double value, double weight, unsigned long samples)
+{
+    double pu = u + width / 2;
+    double pv = v + height / 2;
+    int cu = (int)floor(pu - Support * 0.5) + 1;
+    int cv = (int)floor(pv - Support * 0.5) + 1;
+    if(cu + Support <= 0 || cu >= width || cv + Support <= 0 || cv >= height)
+        return;
+    int lu = (int)((cu - pu + Support * 0.5) * Oversampling + 0.5);
+    int lv = (int)((cv - pv + Support * 0.5) * Oversampling + 0.5);
+    int nu = (int)floor(pu + 0.5);
+    int nv = (int)floor(pv + 0.5);
+    int x0 = Max(0, -cu);
+    int x1 = Min(Support, width - cu);
+    double wu[VLBI_MAX_KERNEL_SUPPORT];
+    for(int x = x0; x < x1; x++)
+        wu[x] = KernelLUT[lu + x * Oversampling] * weight;
+    for(int y = 0; y < Support; y++)
+    {
+        int row = cv + y;
+        if(row < 0 || row >= height)
+            continue;
+        pthread_mutex_t *lock = &RowLocks[row % VLBI_UVPLANE_ROW_LOCKS];
+        start_gettime(dsp_perf_lock);
+        pthread_mutex_lock(lock);
+        end_gettime(dsp_perf_lock);
+        double wv = KernelLUT[lv + y * Oversampling];
+        double *values = &Values[row * width + cu];
+        double *weights = &Weights[row * width + cu];
+        for(int x = x0; x < x1; x++)
+        {
+            double w = wv * wu[x];
+            values[x] += w * value;
+            weights[x] += w;
+        }
+        pthread_mutex_unlock(lock);
+    }
+    if(nu >= 0 && nu < width && nv >= 0 && nv < height && weight > 0.0)
+    {
+        pthread_mutex_t *lock = &RowLocks[nv % VLBI_UVPLANE_ROW_LOCKS];
+        pthread_mutex_lock(lock);
+        Counts[nu + nv * width] += samples;
+        pthread_mutex_unlock(lock);
+    }
+}
+
+void VLBIUVPlane::Normalize(dsp_stream_p stream, dsp_t *coverage)
+{
+    int len = width * height;
+    if(stream == nullptr || stream->len < len)
+        return;
+    lockRows();
+    double f2 = 0.0;
+    double max_weight = 0.0;
+    if(Weighting == vlbi_weighting_robust)
+    {
+        double sum = 0.0;
+        double sum2 = 0.0;
+        for(int x = 0; x < len; x++)
+        {
+            sum += Weights[x];
+            sum2 += Weights[x] * Weights[x];
+        }
+        if(sum2 > 0.0)
+            f2 = pow(5.0 * pow(10.0, -Robustness), 2) / (sum2 / sum);
+    }
+    for(int x = 0; x < len; x++)
+    {
+        double w = Weights[x];
+        if(w <= 0.0)
+        {
+            stream->buf[x] = 0;
+            if(coverage != nullptr)
+                coverage[x] = 0;
+            continue;
+        }
+        switch(Weighting)
+        {
+            case vlbi_weighting_natural:
+                break;
+            case vlbi_weighting_robust:
+                w /= 1.0 + w * f2;
+                break;
+            default:
+                w = 1.0;
+                break;
+        }
+        max_weight = fmax(max_weight, w);
+        stream->buf[x] = (dsp_t)(Values[x] / Weights[x] * w);
+        if(coverage != nullptr)
+            coverage[x] = (dsp_t)w;
+    }
+    if(max_weight > 0.0 && Weighting != vlbi_weighting_uniform)
+    {
+        dsp_buffer_div1(stream, max_weight);
+        if(coverage != nullptr)
+            for(int x = 0; x < len; x++)
+                coverage[x] /= max_weight;
+    }
+    unlockRows();
+}
+
+void VLBIUVPlane::getCorrection(double *correction, int size)
+{
+    int len = Support * Oversampling + 1;
+    for(int p = 0; p < size; p++)
+    {
+        double c = 0.0;
+        for(int x = 0; x < len; x++)
+            c += KernelLUT[x] * cos(2.0 * M_PI * ((double)x / Oversampling - Support * 0.5) * (p - size / 2) / size) * ((x == 0 || x == len - 1) ? 0.5 : 1.0);
+        correction[p] = c / Oversampling;
+    }
+}
+
+long VLBIUVPlane::getProcessedSamples(const char *baseline)
+{
+    long samples = 0;
+    pthread_mutex_lock(&mutex);
+    std::map<std::string, long>::iterator it = Processed.find(baseline);
+    if(it != Processed.end())
+        samples = it->second;
+    pthread_mutex_unlock(&mutex);
+    return samples;
+}
+
+void VLBIUVPlane::setProcessedSamples(const char *baseline, long samples)
+{
+    pthread_mutex_lock(&mutex);
+    Processed[baseline] = samples;
+    pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,93 @@
+/*  OpenVLBI - Open Source Very Long Baseline Interferometry
+    Copyright © 2017-2022  Ilia Platone
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _UVPLANE_H
+#define _UVPLANE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <pthread.h>
+#include <vlbi.h>
+
+#define VLBI_UVPLANE_ROW_LOCKS 64
+
+class VLBIUVPlane
+{
+public:
+    VLBIUVPlane(const char *name);
+    ~VLBIUVPlane();
+
+    inline char *getName() { return Name; }
+    inline int getWidth() { return width; }
+    inline int getHeight() { return height; }
+    inline double *getValues() { return Values; }
+    inline double *getWeights() { return Weights; }
+    inline unsigned long *getCounts() { return Counts; }
+    inline vlbi_gridding_kernel getKernel() { return Kernel; }
+    inline int getSupport() { return Support; }
+    inline int getOversampling() { return Oversampling; }
+    inline vlbi_weighting getWeighting() { return Weighting; }
+    inline double getRobustness() { return Robustness; }
+    inline void setWeighting(vlbi_weighting weighting, double robustness) { Weighting = weighting; Robustness = robustness; }
+
+    void setKernel(vlbi_gridding_kernel kernel, int support, int oversampling);
+    bool Matches(int w, int h, double *target, double freq, double sr, bool nodelay, bool moving_baseline, vlbi_func2_t delegate);
+    void Setup(int w, int h, double *target, double freq, double sr, bool nodelay, bool moving_baseline, vlbi_func2_t delegate);
+    void Clear();
+
+    void Grid(double u, double v, double value, double weight = 1.0, unsigned long samples = 1);
+    void Normalize(dsp_stream_p stream, dsp_t *coverage = nullptr);
+    void getCorrection(double *correction, int size);
+
+    long getProcessedSamples(const char *baseline);
+    void setProcessedSamples(const char *baseline, long samples);
+
+private:
+    void lockRows();
+    void unlockRows();
+
+    char *Name;
+    int width { 0 };
+    int height { 0 };
+    double Ra { 0 };
+    double Dec { 0 };
+    double Frequency { 0 };
+    double SampleRate { 0 };
+    bool NoDelay { false };
+    bool MovingBaseline { false };
+    vlbi_func2_t Delegate { nullptr };
+    vlbi_gridding_kernel Kernel { vlbi_kernel_box };
+    int Support { 1 };
+    int Oversampling { 1 };
+    bool KernelChanged { false };
+    vlbi_weighting Weighting { vlbi_weighting_uniform };
+    double Robustness { 0 };
+    double *KernelLUT { nullptr };
+    double *Values { nullptr };
+    double *Weights { nullptr };
+    unsigned long *Counts { nullptr };
+    std::map<std::string, long> Processed;
+    pthread_mutex_t mutex;
+    pthread_mutex_t RowLocks[VLBI_UVPLANE_ROW_LOCKS];
+};
+
+#endif //_UVPLANE_H
@@ -0,0 +1,56 @@
+/*  OpenVLBI - Open Source Very Long Baseline Interferometry
+*   Copyright © 2017-2022  Ilia Platone
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 3 of the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program; if not, write to the Free Software Foundation,
+*   Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include "uvplanecollection.h"
+
+UVPlaneCollection::UVPlaneCollection() : VLBICollection::VLBICollection()
+{
+}
+
+UVPlaneCollection::~UVPlaneCollection()
+{
+    for(int i = 0; i < Count(); i++)
+        delete At(i);
+}
+
+void UVPlaneCollection::Add(VLBIUVPlane * element)
+{
+    VLBICollection::Add(element, element->getName());
+}
+
+void UVPlaneCollection::Remove(const char* name)
+{
+    VLBICollection::Remove(name);
+}
+
+VLBIUVPlane * UVPlaneCollection::Get(const char* name)
+{
+    return (VLBIUVPlane *)VLBICollection::Get(name);
+}
+
+VLBIUVPlane * UVPlaneCollection::At(int index)
+{
+    return (VLBIUVPlane *)(VLBICollection::At(index));
+}
+
+bool UVPlaneCollection::Contains(const char* element)
+{
+    return VLBICollection::Contains(element);
+}
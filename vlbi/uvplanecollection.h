@@ -0,0 +1,37 @@
+/*  OpenVLBI - Open Source Very Long Baseline Interferometry
+    Copyright © 2017-2022  Ilia Platone
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _UVPLANECOLLECTION_H
+#define _UVPLANECOLLECTION_H
+
+#include "collection.h"
+#include "uvplane.h"
+
+class UVPlaneCollection : public VLBICollection
+{
+    public:
+        UVPlaneCollection();
+        ~UVPlaneCollection();
+        void Add(VLBIUVPlane *element);
+        VLBIUVPlane *Get(const char* name);
+        void Remove(const char* element);
+        VLBIUVPlane * At(int index);
+        bool Contains(const char* element);
+};
+
+#endif //_UVPLANECOLLECTION_H
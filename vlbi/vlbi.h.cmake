@@ -125,6 +125,42 @@ typedef struct {
     dsp_stream_p Stream;
 } vlbi_baseline;
 
+///The convolution kernel used to grid the visibilities into the UV plane
+typedef enum {
+///Box function, with support 1 each visibility falls into its nearest cell
+    vlbi_kernel_box = 0,
+///Gaussian function truncated at three sigma
+    vlbi_kernel_gaussian,
+///Prolate spheroidal wave function (m = 6, alpha = 1), the least aliasing kernel
+    vlbi_kernel_prolate_spheroidal,
+} vlbi_gridding_kernel;
+
+///The weighting applied to the UV plane cells when normalizing
+typedef enum {
+///Each visibility has the same weight, densely sampled cells count more
+    vlbi_weighting_natural = 0,
+///Each sampled cell has the same weight
+    vlbi_weighting_uniform,
+///Briggs robust weighting, in between natural and uniform
+    vlbi_weighting_robust,
+} vlbi_weighting;
+
+///The RFI flagging method used by vlbi_flag_node
+typedef enum {
+///Samples farther than the threshold from the window median are flagged, the deviation is estimated by the MAD
+    vlbi_flagging_mad = 0,
+///SumThreshold, runs of samples are flagged when their sum exceeds a threshold decreasing with the run length
+    vlbi_flagging_sumthreshold,
+} vlbi_flagging;
+
+///The deconvolution algorithm used by vlbi_clean
+typedef enum {
+///Hogbom CLEAN, the whole PSF is subtracted at each component
+    vlbi_clean_hogbom = 0,
+///Clark CLEAN, minor cycles use a PSF patch and major cycles subtract all components through FFTs
+    vlbi_clean_clark,
+} vlbi_clean_method;
+
 /**
 * \brief The delegate function type to pass to vlbi_plot_uv_plane
 *
@@ -142,6 +178,34 @@ typedef void* vlbi_context;
 
 ///Definition of the timespec_t in a C type, just for convenience
 typedef struct timespec timespec_t;
+
+/**
+* \brief Statistics of an OpenVLBI context
+*/
+typedef struct
+{
+///The number of nodes
+    int nodes;
+///The number of baselines
+    int baselines;
+///The number of models
+    int models;
+///The timing counters of the processing stages, process wide and zero unless built with WITH_INSTRUMENTATION
+    dsp_perf_counters counters;
+} vlbi_stats;
+
+/**
+* \brief Index of the lines of a spectrum sorted by wavelength
+*/
+typedef struct
+{
+///The wavelengths of the lines in ascending order
+    double *wavelength;
+///The position of each line into the stars of the indexed spectrum
+    int *line;
+///The number of indexed lines
+    int count;
+} vlbi_spectral_index;
 /**\}*/
 /**
  * \defgroup VLBI_Defines VLBI defines
@@ -218,6 +282,16 @@ typedef struct timespec timespec_t;
 #define cos2sin(c) sin(acos(c))
 #endif
 
+#ifndef VLBI_MAX_KERNEL_SUPPORT
+///The maximum width of the gridding kernels in UV cells
+#define VLBI_MAX_KERNEL_SUPPORT 16
+#endif
+
+#ifndef VLBI_FLAGGING_MAX_RUN
+///The longest run of samples checked by the SumThreshold flagging
+#define VLBI_FLAGGING_MAX_RUN 64
+#endif
+
 #ifndef VLBI_VERSION_STRING
 ///The current OpenVLBI version
 #define VLBI_VERSION_STRING "@VLBI_VERSION_STRING@"
@@ -516,6 +590,15 @@ DLL_EXPORT vlbi_context vlbi_init(void);
 */
 DLL_EXPORT void vlbi_exit(vlbi_context ctx);
 
+/**
+* \brief Obtain the statistics of an OpenVLBI instance.
+* \param ctx The OpenVLBI context
+* \param stats The statistics to fill
+* \sa dsp_perf_reset
+* \sa dsp_perf_trace_dump
+*/
+DLL_EXPORT void vlbi_get_stats(vlbi_context ctx, vlbi_stats *stats);
+
 /**\}*/
 /**
  * \defgroup VLBI_Nodes Nodes API
@@ -579,6 +662,16 @@ DLL_EXPORT int vlbi_get_nodes(void *ctx, vlbi_node** nodes);
 */
 DLL_EXPORT void vlbi_add_node_from_fits(void *ctx, char *filename, const char *name, int geo);
 
+/**
+* \brief Add a node from a 2d image fits file loaded into memory.
+* \param ctx The OpenVLBI context
+* \param buf The content of the fits file
+* \param len The size in bytes of buf
+* \param name The name of the newly created model
+* \param geo whether to consider the file coordinates as geographic or relative to the context station
+*/
+DLL_EXPORT void vlbi_add_node_from_fits_memory(void *ctx, void *buf, size_t len, const char *name, int geo);
+
 /**
 * \brief Add nodes from each row of a single dish fits -SDFITS- file.
 * \param ctx The OpenVLBI context
@@ -588,6 +681,60 @@ DLL_EXPORT void vlbi_add_node_from_fits(void *ctx, char *filename, const char *n
 */
 DLL_EXPORT void vlbi_add_nodes_from_sdfits(void *ctx, char *filename, const char *name, int geo);
 
+/**
+* \brief Write the correlator output of all baselines into a FITS-IDI file.
+* Each UV_DATA row holds one integration of a baseline, rows are appended in batches as they are produced.
+* The FLUX column holds the correlated visibility: the product of the delay-compensated node samples,
+* or of the pairs of baselines locked with vlbi_set_baseline_buffer, as a real visibility, and the complex
+* visibility of baselines locked by vlbi_set_baselines_from_fitsidi.
+* \param ctx The OpenVLBI context
+* \param filename The filename of the FITS-IDI file to write
+* \param target The target position int Ra/Dec celestial coordinates
+* \param freq The frequency observed
+* \param sr The sampling rate, each integration lasts 1/sr seconds
+* \param nodelay if 1 no delay calculation should be done. streams entered are already synced
+* \param moving_baseline if 1 the location field of all streams is an array of coordinates, one per sample
+* \param interrupt if not NULL, setting it to 1 stops the correlation
+* \sa vlbi_set_baselines_from_fitsidi
+*/
+DLL_EXPORT void vlbi_get_baselines_to_fitsidi(void *ctx, char *filename, double *target, double freq, double sr, int nodelay, int moving_baseline, int *interrupt);
+
+/**
+* \brief Lock the baselines with the visibilities of a FITS-IDI file.
+* The antennas of the ARRAY_GEOMETRY table not yet in the context are added as nodes, then the
+* UV_DATA rows are decoded straight into the buffers of the matching baselines, which are locked.
+* These baselines hold visibilities, the real part of which is gridded without passing through the delegate.
+* Use 1/INTTIM as sampling rate when imaging the locked baselines.
+* \param ctx The OpenVLBI context
+* \param filename The filename of the FITS-IDI file to read
+* \sa vlbi_get_baselines_to_fitsidi
+* \sa vlbi_set_baseline_buffer
+*/
+DLL_EXPORT void vlbi_set_baselines_from_fitsidi(void *ctx, char *filename);
+
+/**
+* \brief Save the whole context into a binary snapshot file.
+* The snapshot starts with a versioned header and an index of entries, one per node, model and locked baseline,
+* followed by their sizes, buffers, locations, flag masks and visibilities as raw arrays aligned to 64 bytes in host byte order.
+* Names longer than the stream name field cannot be saved.
+* \param ctx The OpenVLBI context
+* \param filename The filename of the snapshot to write
+* \return 0 on success, -1 on failure
+* \sa vlbi_load_snapshot
+*/
+DLL_EXPORT int vlbi_save_snapshot(void *ctx, char *filename);
+
+/**
+* \brief Load a binary snapshot file into a context.
+* The file is memory-mapped and validated, then nodes and models not yet in the context are added and
+* the saved baselines are locked with their visibilities.
+* \param ctx The OpenVLBI context
+* \param filename The filename of the snapshot to read
+* \return 0 on success, -1 if the file cannot be mapped or is not a snapshot of this build
+* \sa vlbi_save_snapshot
+*/
+DLL_EXPORT int vlbi_load_snapshot(void *ctx, char *filename);
+
 /**
 * \brief Apply a low pass filter on the node buffer.
 * \param ctx The OpenVLBI context
@@ -626,6 +773,35 @@ DLL_EXPORT void vlbi_filter_bp_node(void *ctx, const char *name, const char *nod
 */
 DLL_EXPORT void vlbi_filter_br_node(void *ctx, const char *name, const char *node, double lo_radians, double hi_radians);
 
+/**
+* \brief Flag the RFI affected samples of a node, the correlator and the gridders multiply each sample by its flag
+* so flagged samples add neither signal nor weight. Flags of successive calls combine.
+* Nodes carry a single channel, so samples are flagged along time only, there is no per channel mask.
+* \param ctx The OpenVLBI context
+* \param name The name of the node
+* \param method The flagging method
+* \param window The number of samples over which median and deviation are estimated, windows are flagged in parallel
+* \param threshold The flagging threshold in standard deviations
+* \sa vlbi_unflag_node
+*/
+DLL_EXPORT void vlbi_flag_node(void *ctx, const char *name, vlbi_flagging method, int window, double threshold);
+
+/**
+* \brief Remove all the flags of a node.
+* \param ctx The OpenVLBI context
+* \param name The name of the node
+*/
+DLL_EXPORT void vlbi_unflag_node(void *ctx, const char *name);
+
+/**
+* \brief Get the flag mask of a node, 1 for good samples and 0 for flagged ones, it has the size of the node buffer
+* and can be edited, for example to flag data blocks as they are captured. It is reset to all ones when the node buffer is resized.
+* \param ctx The OpenVLBI context
+* \param name The name of the node
+* \return The flag mask, all ones if the node was never flagged, NULL if the node does not exist
+*/
+DLL_EXPORT dsp_t *vlbi_get_node_flags(void *ctx, const char *name);
+
 /**\}*/
 /**
  * \defgroup VLBI_Baselines Baselines API
@@ -712,6 +888,7 @@ DLL_EXPORT void vlbi_get_offsets(vlbi_context ctx, double J2000Time, const char*
 
 /**
 * \brief Fill a fourier plane with an aperture synthesis projection of the baselines during the integration time and save it into a new model with the given name.
+* The weights of the sampled cells are saved into name_coverage and their point spread function into name_psf, the latter is reused while the geometry does not change.
 * \param ctx The OpenVLBI context
 * \param name The name of the new model
 * \param u The U size of the resulting UV plot
@@ -726,6 +903,107 @@ DLL_EXPORT void vlbi_get_offsets(vlbi_context ctx, double J2000Time, const char*
 */
 DLL_EXPORT void vlbi_get_uv_plot(void *ctx, const char *name, int u, int v, double *target, double freq, double sr, int nodelay, int moving_baseline, vlbi_func2_t delegate, int *interrupt);
 
+/**
+* \brief Save the weights of the UV plane cells sampled by the baselines into a new model with the given name, and their point spread function into name_psf.
+* Both are taken from the models of a previous plot with the same nodes, target, frequency, resolution and gridding settings, if any.
+* \param ctx The OpenVLBI context
+* \param name The name of the new model
+* \param u The U size of the resulting UV plot
+* \param v The V size of the resulting UV plot
+* \param target The target position int Ra/Dec celestial coordinates
+* \param freq The frequency observed. This parameter will scale the plot inverserly.
+* \param sr The sampling rate per second. This parameter will be used as meter for the elements of the streams.
+* \param nodelay if 1 no delay calculation should be done. streams entered are already synced.
+* \param moving_baseline if 1 the location field of all the dsp_stream_p is an array of dsp_location for each element of the dsp_stream_p->buf array.
+* \param interrupt If the value pointed by this parameter changes to 1, then abort plotting.
+*/
+DLL_EXPORT void vlbi_get_coverage(void *ctx, const char *name, int u, int v, double *target, double freq, double sr, int nodelay, int moving_baseline, int *interrupt);
+
+/**
+* \brief Integrate the baselines into a persistent UV plane accumulator, processing only the samples not integrated by previous calls.
+* The accumulator is bound to the name passed and keeps per-cell weights and sample counts. When the resolution, target, frequency, sample rate or delegate change the accumulator restarts from scratch.
+* Call vlbi_finalize_uv_plot to normalize the accumulated plane and publish it as a model.
+* \param ctx The OpenVLBI context
+* \param name The name of the accumulator and of the model published by vlbi_finalize_uv_plot
+* \param u The U size of the resulting UV plot
+* \param v The V size of the resulting UV plot
+* \param target The target position int Ra/Dec celestial coordinates
+* \param freq The frequency observed. This parameter will scale the plot inverserly.
+* \param sr The sampling rate per second. This parameter will be used as meter for the elements of the streams.
+* \param nodelay if 1 no delay calculation should be done. streams entered are already synced.
+* \param moving_baseline if 1 the location field of all the dsp_stream_p is an array of dsp_location for each element of the dsp_stream_p->buf array.
+* \param delegate The delegate function to be executed on each node stream buffer element.
+* \param interrupt If the value pointed by this parameter changes to 1, then abort integration. Samples integrated so far are kept.
+*/
+DLL_EXPORT void vlbi_get_uv_plot_incremental(void *ctx, const char *name, int u, int v, double *target, double freq, double sr, int nodelay, int moving_baseline, vlbi_func2_t delegate, int *interrupt);
+
+/**
+* \brief Normalize the UV plane accumulator by its weights and save the result into a model with the same name.
+* \param ctx The OpenVLBI context
+* \param name The name of the accumulator
+*/
+DLL_EXPORT void vlbi_finalize_uv_plot(void *ctx, const char *name);
+
+/**
+* \brief Discard the UV plane accumulator with the given name. The model published by vlbi_finalize_uv_plot is kept.
+* \param ctx The OpenVLBI context
+* \param name The name of the accumulator
+*/
+DLL_EXPORT void vlbi_reset_uv_plot(void *ctx, const char *name);
+
+/**
+* \brief Synthesize a wide field image with the w-stacking algorithm and save it into a model with the given name.
+* Visibilities are binned by their w term into wplanes planes. Each plane is gridded and inverse transformed on its own,
+* then corrected with its phase screen and summed into the image. Planes are processed in parallel by up to vlbi_max_threads(0) workers,
+* so at most that many grids are allocated at once. The gridding kernel and weighting of the context are used.
+* All the visibilities stay in memory until the planes are stacked, one per sample of each baseline,
+* use vlbi_set_averaging to bound them to one per averaging interval on long observations.
+* \param ctx The OpenVLBI context
+* \param name The name of the new model
+* \param u The horizontal size of the resulting image
+* \param v The vertical size of the resulting image
+* \param wplanes The number of w planes, 1 is the same as ignoring the w term
+* \param target The target position int Ra/Dec celestial coordinates
+* \param freq The frequency observed. This parameter will scale the plot inverserly.
+* \param sr The sampling rate per second. This parameter will be used as meter for the elements of the streams.
+* \param nodelay if 1 no delay calculation should be done. streams entered are already synced.
+* \param moving_baseline if 1 the location field of all the dsp_stream_p is an array of dsp_location for each element of the dsp_stream_p->buf array.
+* \param delegate The delegate function to be executed on each node stream buffer element.
+* \param interrupt If the value pointed by this parameter changes to 1, then abort imaging.
+*/
+DLL_EXPORT void vlbi_get_wstacking_image(void *ctx, const char *name, int u, int v, int wplanes, double *target, double freq, double sr, int nodelay, int moving_baseline, vlbi_func2_t delegate, int *interrupt);
+
+/**
+* \brief Set the convolution kernel used to grid the visibilities into the UV plane.
+* The kernel is tabulated once with the given oversampling, so gridding a visibility costs support * support multiply-adds.
+* \param ctx The OpenVLBI context
+* \param kernel The gridding kernel
+* \param support The full width of the kernel in UV cells, up to VLBI_MAX_KERNEL_SUPPORT
+* \param oversampling The number of kernel samples per UV cell
+*/
+DLL_EXPORT void vlbi_set_gridding(void *ctx, vlbi_gridding_kernel kernel, int support, int oversampling);
+
+/**
+* \brief Set the weighting applied to the UV plane when it gets normalized into a model.
+* \param ctx The OpenVLBI context
+* \param weighting The weighting scheme
+* \param robustness The Briggs robustness parameter, from -2 (close to uniform) to 2 (close to natural), used by vlbi_weighting_robust only
+*/
+DLL_EXPORT void vlbi_set_weighting(void *ctx, vlbi_weighting weighting, double robustness);
+
+/**
+* \brief Set the baseline-dependent averaging applied to the visibilities before gridding.
+* Consecutive samples of a baseline are integrated into a single visibility while their uv track stays within smearing / fov wavelengths,
+* so that the phase of a source at the edge of the field drifts by less than smearing turns. Long baselines sweep the uv plane faster and get
+* shorter bins, short baselines get longer ones. The geometry is evaluated at the bin edges only, so the cost of gridding and the size of the
+* visibility table follow the number of bins. The streams carry a single frequency, so averaging runs along time only, moving baselines are not averaged.
+* \param ctx The OpenVLBI context
+* \param fov The radius of the field of view in radians, 0 disables averaging
+* \param smearing The maximum phase drift at the edge of the field, in turns
+* \param interval The maximum length of a bin in seconds, 0 for no limit
+*/
+DLL_EXPORT void vlbi_set_averaging(void *ctx, double fov, double smearing, double interval);
+
 /**
 * \brief Add a model into the current OpenVLBI context.
 * \param ctx The OpenVLBI context
@@ -827,6 +1105,26 @@ DLL_EXPORT void vlbi_stack_models(vlbi_context ctx, const char *name, const char
 */
 DLL_EXPORT void vlbi_diff_models(vlbi_context ctx, const char *name, const char *model1, const char *model2);
 
+/**
+* \brief Set the algorithm used by vlbi_clean.
+* \param ctx The OpenVLBI context
+* \param method The deconvolution algorithm
+*/
+DLL_EXPORT void vlbi_set_clean_method(vlbi_context ctx, vlbi_clean_method method);
+
+/**
+* \brief Deconvolve a dirty image by its point spread function using the CLEAN algorithm.
+* The restored image is saved into name, the clean components into name_components and the residual into name_residual.
+* \param ctx The OpenVLBI context
+* \param name The name of the newly created model.
+* \param dirty The name of the dirty image model.
+* \param psf The name of the point spread function model, of the same size of the dirty image.
+* \param gain The loop gain, the fraction of the peak subtracted at each iteration.
+* \param threshold Stop when the residual peak falls below this value.
+* \param niter The maximum number of clean components.
+*/
+DLL_EXPORT void vlbi_clean(vlbi_context ctx, const char *name, const char *dirty, const char *psf, double gain, double threshold, int niter);
+
 /**
 * \brief Shift a model by its dimensions.
 * \param ctx The OpenVLBI context
@@ -1042,7 +1340,8 @@ DLL_EXPORT void vlbi_astro_get_alt_az_coordinates(double hour_angle, double dec,
 DLL_EXPORT dsp_stream_p vlbi_astro_load_spectrum(char *filename);
 
 /**
- * \brief Load a spectrum file catalog
+ * \brief Load a spectrum file catalog, the element files are parsed in parallel and a precompiled copy of the catalog
+ * is kept into $XDG_CACHE_HOME/openvlbi (or ~/.cache/openvlbi), it is rebuilt when any element file changes
  * \param path The path of the folder containing index.txt
  * \param catalog A pointer to an array of dsp_stream_p to be allocated and filled
  * \param catalog_size The catalog number of elements passed by reference
@@ -1083,6 +1382,40 @@ DLL_EXPORT void vlbi_astro_scan_spectrum(dsp_stream_p stream, int sample_size);
  */
 DLL_EXPORT dsp_align_info vlbi_astro_align_spectra(dsp_stream_p spectrum, dsp_stream_p catalog, int max_lines, double decimals, double min_score);
 
+/**
+ * \brief Align many spectra to the same reference catalog in parallel, the catalog is indexed once
+ * \param spectra The spectra to analyze, each align_info field will contain the calculated offset and scale ratio
+ * \param count The number of spectra
+ * \param catalog A catalog of spectra to compare
+ * \param max_lines The perfomance-needed limit of lines used for comparison
+ * \param decimals The number of decimals used in comparison
+ * \param min_score The trigger matching score percent to reach
+ * \return The number of spectra matching the catalog
+ */
+DLL_EXPORT int vlbi_astro_align_spectra_batch(dsp_stream_p *spectra, int count, dsp_stream_p catalog, int max_lines, double decimals, double min_score);
+
+/**
+ * \brief Index the lines of a spectrum or a reference catalog by wavelength
+ * \param catalog The spectrum to index
+ * \return A vlbi_spectral_index to be freed with vlbi_astro_free_spectral_index
+ */
+DLL_EXPORT vlbi_spectral_index *vlbi_astro_create_spectral_index(dsp_stream_p catalog);
+
+/**
+ * \brief Free a spectral lines index
+ * \param index The index to free
+ */
+DLL_EXPORT void vlbi_astro_free_spectral_index(vlbi_spectral_index *index);
+
+/**
+ * \brief Find a spectral line into an index
+ * \param index The index of the catalog
+ * \param wavelength The wavelength of the line
+ * \param tolerance The maximum distance in wavelength from the catalog line
+ * \return The position into the catalog stars of the first line in the tolerance window, -1 if none
+ */
+DLL_EXPORT int vlbi_astro_find_spectral_line(vlbi_spectral_index *index, double wavelength, double tolerance);
+
 /**
  * \brief Compare a spectrum to a reference one
  * \param spectrum0 The reference spectrum
@@ -1196,6 +1529,14 @@ DLL_EXPORT double vlbi_astro_redshift_adjust(double distance, double redshift);
  */
 DLL_EXPORT dsp_stream_p vlbi_file_read_fits(char *filename);
 
+/**
+ * \brief Read a FITS file already loaded into memory, uncompressed images are converted straight from the buffer
+ * \param buf The FITS file content
+ * \param len The size in bytes of buf
+ * \return A pointer to a dsp_stream filled with the needed data contained into the FITS buffer
+ */
+DLL_EXPORT dsp_stream_p vlbi_file_read_fits_memory(void *buf, size_t len);
+
 /**
  * \brief Returns the distance of a far object adjusted with its measured redshift
  * \param filename The file name of the FITS file to open
@@ -5,12 +5,15 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
+#include <string>
+#include <memory>
 #include <vlbi/base64.h>
 #include <vlbi/instancecollection.h>
 
 static int is_running = 1;
 
 static InstanceCollection *contexts;
+static const char *job_status_names[] = { "queued", "running", "completed", "cancelled" };
 VLBI::Server::Server()
 {
     input = stdin;
@@ -25,40 +28,40 @@ VLBI::Server::Server()
     context = (char*)malloc(9);
     strcpy(context, "OpenVLBI\0");
     contexts = new InstanceCollection();
+    pthread_mutex_init(&jobs_mutex, nullptr);
+    pthread_cond_init(&jobs_cond, nullptr);
 }
 
 VLBI::Server::~Server()
 {
+    pthread_mutex_lock(&jobs_mutex);
+    stopping = true;
+    for(std::map<int, vlbi_job*>::iterator it = jobs.begin(); it != jobs.end(); it++)
+        __atomic_store_n(&it->second->progress.cancel, 1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&jobs_cond);
+    pthread_mutex_unlock(&jobs_mutex);
+    for(int x = 0; x < nworkers; x++)
+        pthread_join(workers[x], nullptr);
+    free(workers);
+    workers = nullptr;
+    nworkers = 0;
+    queue.clear();
+    pending.clear();
+    while(!jobs.empty())
+        FreeJob(jobs.begin());
     if(GetContext() != nullptr)
     {
         vlbi_exit(GetContext());
     }
 }
 
-static double coverage_delegate(double x, double y)
-{
-    (void)x;
-    (void)y;
-    return 1.0;
-}
-
 void VLBI::Server::AddNode(const char *name, char *b64)
 {
-    char filename[128];
-    strcpy(filename, "tmp_nodeXXXXXX");
-    int fd = mkstemp(filename);
-    if(fd > -1)
-    {
-        size_t b64len = strlen(b64);
-        char* buf = (char*)malloc(b64len * 3 / 4 + 4);
-        size_t len = (size_t)from64tobits_fast(buf, b64, (int)b64len);
-        ssize_t written = write(fd, buf, len);
-        (void)written;
-        free(buf);
-        close(fd);
-        vlbi_add_node_from_fits(GetContext(), filename, name, true);
-        unlink(filename);
-    }
+    size_t b64len = strlen(b64);
+    char* buf = (char*)malloc(b64len * 3 / 4 + 4);
+    size_t len = (size_t)from64tobits_fast(buf, b64, (int)b64len);
+    vlbi_add_node_from_fits_memory(GetContext(), buf, len, name, true);
+    free(buf);
 }
 
 void VLBI::Server::AddNodes(const char *name, char *b64)
@@ -122,22 +125,56 @@ void VLBI::Server::DelNode(const char *name)
 void VLBI::Server::Plot(const char *name, int flags)
 {
     double coords[3] = { Ra, Dec };
+    std::string model(name);
+    int width = w, height = h;
+    double freq = Freq, samplerate = SampleRate;
+    if((flags & plot_flags_uv_coverage) != 0) {
+        AddJob(("coverage " + model).c_str(), [=](vlbi_context ctx, int *interrupt)
+        {
+            double target[3] = { coords[0], coords[1], coords[2] };
+            vlbi_get_coverage(ctx, model.c_str(), width, height, target, freq, samplerate, (flags & plot_flags_synced) != 0,
+                              (flags & plot_flags_moving_baseline) != 0, interrupt);
+        });
+        return;
+    }
     if((flags & plot_flags_custom_delegate) == 0) {
-        setDelegate((flags & plot_flags_uv_coverage) != 0 ? coverage_delegate : vlbi_default_delegate);
+        setDelegate(vlbi_default_delegate);
     }
-    vlbi_get_uv_plot(GetContext(), name, w, h, coords, Freq, SampleRate, (flags & plot_flags_synced) != 0,
-                     (flags & plot_flags_moving_baseline) != 0,
-                     getDelegate(), nullptr);
+    vlbi_func2_t func = getDelegate();
+    std::function<void()> release = delegate_release;
+    delegate_release = nullptr;
+    std::shared_ptr<void> owner(nullptr, [release](void*)
+    {
+        if(release)
+            release();
+    });
+    AddJob(("plot " + model).c_str(), [=](vlbi_context ctx, int *interrupt)
+    {
+        (void)owner;
+        double target[3] = { coords[0], coords[1], coords[2] };
+        vlbi_get_uv_plot(ctx, model.c_str(), width, height, target, freq, samplerate, (flags & plot_flags_synced) != 0,
+                         (flags & plot_flags_moving_baseline) != 0, func, interrupt);
+    });
 }
 
 void VLBI::Server::Idft(const char *model, const char *magnitude, const char *phase)
 {
-    vlbi_get_ifft(GetContext(), model, magnitude, phase);
+    std::string m(model), mag(magnitude), ph(phase);
+    AddJob(("idft " + m).c_str(), [=](vlbi_context ctx, int *interrupt)
+    {
+        (void)interrupt;
+        vlbi_get_ifft(ctx, m.c_str(), mag.c_str(), ph.c_str());
+    });
 }
 
 void VLBI::Server::Dft(const char *model, const char *magnitude, const char *phase)
 {
-    vlbi_get_fft(GetContext(), model, magnitude, phase);
+    std::string m(model), mag(magnitude), ph(phase);
+    AddJob(("dft " + m).c_str(), [=](vlbi_context ctx, int *interrupt)
+    {
+        (void)interrupt;
+        vlbi_get_fft(ctx, m.c_str(), mag.c_str(), ph.c_str());
+    });
 }
 
 void VLBI::Server::Stack(const char *name, const char *model1, const char *model2)
@@ -152,7 +189,22 @@ void VLBI::Server::Diff(const char *name, const char *model1, const char *model2
 
 void VLBI::Server::Convolute(const char *name, const char *model1, const char *model2)
 {
-    vlbi_apply_convolution_matrix(GetContext(), name, model1, model2);
+    std::string m(name), m1(model1), m2(model2);
+    AddJob(("convolution " + m).c_str(), [=](vlbi_context ctx, int *interrupt)
+    {
+        (void)interrupt;
+        vlbi_apply_convolution_matrix(ctx, m.c_str(), m1.c_str(), m2.c_str());
+    });
+}
+
+void VLBI::Server::Clean(const char *name, const char *dirty, const char *psf, double gain, double threshold, int niter)
+{
+    std::string m(name), d(dirty), p(psf);
+    AddJob(("clean " + m).c_str(), [=](vlbi_context ctx, int *interrupt)
+    {
+        (void)interrupt;
+        vlbi_clean(ctx, m.c_str(), d.c_str(), p.c_str(), gain, threshold, niter);
+    });
 }
 
 void VLBI::Server::Mask(const char *name, const char *model, const char *mask)
@@ -167,22 +219,57 @@ void VLBI::Server::Shift(const char *name)
 
 void VLBI::Server::LowPass(const char *name, const char *node, double freq)
 {
-    vlbi_filter_lp_node(GetContext(), name, node, freq);
+    std::string m(name), n(node);
+    AddJob(("lowpass " + m).c_str(), [=](vlbi_context ctx, int *interrupt)
+    {
+        (void)interrupt;
+        vlbi_filter_lp_node(ctx, m.c_str(), n.c_str(), freq);
+    });
 }
 
 void VLBI::Server::HighPass(const char *name, const char *node, double freq)
 {
-    vlbi_filter_hp_node(GetContext(), name, node, freq);
+    std::string m(name), n(node);
+    AddJob(("highpass " + m).c_str(), [=](vlbi_context ctx, int *interrupt)
+    {
+        (void)interrupt;
+        vlbi_filter_hp_node(ctx, m.c_str(), n.c_str(), freq);
+    });
 }
 
 void VLBI::Server::BandPass(const char *name, const char *node, double lofreq, double hifreq)
 {
-    vlbi_filter_bp_node(GetContext(), name, node, lofreq, hifreq);
+    std::string m(name), n(node);
+    AddJob(("bandpass " + m).c_str(), [=](vlbi_context ctx, int *interrupt)
+    {
+        (void)interrupt;
+        vlbi_filter_bp_node(ctx, m.c_str(), n.c_str(), lofreq, hifreq);
+    });
 }
 
 void VLBI::Server::BandReject(const char *name, const char *node, double lofreq, double hifreq)
 {
-    vlbi_filter_br_node(GetContext(), name, node, lofreq, hifreq);
+    std::string m(name), n(node);
+    AddJob(("bandreject " + m).c_str(), [=](vlbi_context ctx, int *interrupt)
+    {
+        (void)interrupt;
+        vlbi_filter_br_node(ctx, m.c_str(), n.c_str(), lofreq, hifreq);
+    });
+}
+
+void VLBI::Server::Flag(const char *node, vlbi_flagging method, int window, double threshold)
+{
+    std::string n(node);
+    AddJob(("flag " + n).c_str(), [=](vlbi_context ctx, int *interrupt)
+    {
+        (void)interrupt;
+        vlbi_flag_node(ctx, n.c_str(), method, window, threshold);
+    });
+}
+
+void VLBI::Server::Unflag(const char *node)
+{
+    vlbi_unflag_node(GetContext(), node);
 }
 
 dsp_stream_p VLBI::Server::GetModel(const char *name)
@@ -190,47 +277,69 @@ dsp_stream_p VLBI::Server::GetModel(const char *name)
     return vlbi_get_model(GetContext(), name);
 }
 
-char* VLBI::Server::GetModel(const char *name, char *format)
+typedef struct
+{
+    FILE *stream;
+    base64_state state;
+} base64_stream;
+
+static void base64_write(void *arg, const void *buf, size_t len)
+{
+    base64_stream *b64 = (base64_stream*)arg;
+    const unsigned char *in = (const unsigned char*)buf;
+    unsigned char out[4096 + 8];
+    while(len > 0)
+    {
+        int n = (int)Min(len, (size_t)3072);
+        fwrite(out, 1, (size_t)to64frombits_update(&b64->state, out, in, n), b64->stream);
+        in += n;
+        len -= (size_t)n;
+    }
+}
+
+static void base64_flush(base64_stream *b64)
+{
+    unsigned char out[8];
+    fwrite(out, 1, (size_t)to64frombits_final(&b64->state, out), b64->stream);
+}
+
+bool VLBI::Server::GetModel(const char *name, char *format, FILE *stream)
 {
-    char filename[128];
     int channels = 1;
-    int fd = -1;
-    ssize_t len = 0;
-    ssize_t outlen = 0;
-    unsigned char *buf = nullptr;
-    unsigned char *b64 = nullptr;
-    strcpy(filename, "tmp_modelXXXXXX");
     dsp_stream_p model = vlbi_get_model(GetContext(), name);
-    dsp_stream_p *stream = (dsp_stream_p*)malloc(sizeof(dsp_stream_p) * (size_t)(channels + 1));
-    for(int c = 0; c <= channels; c++)
-        stream[c] = model;
-    fd = mkstemp(filename);
-    if(fd > -1)
+    if(model == nullptr)
+        return false;
+    dsp_stream_p components[2] = { model, model };
+    base64_stream b64;
+    b64.stream = stream;
+    base64_init(&b64.state);
+    if(!strcmp(format, "jpeg"))
+        dsp_file_encode_jpeg(channels, 100, components, base64_write, &b64);
+    else if(!strcmp(format, "png"))
+        dsp_file_encode_png(channels, 9, components, base64_write, &b64);
+    else if(!strcmp(format, "fits"))
+        dsp_file_encode_fits(channels, 16, components, base64_write, &b64);
+    else
+        return false;
+    base64_flush(&b64);
+    return true;
+}
+
+char* VLBI::Server::GetModel(const char *name, char *format)
+{
+    char *b64 = nullptr;
+    size_t len = 0;
+    FILE *stream = open_memstream(&b64, &len);
+    if(stream == nullptr)
+        return nullptr;
+    bool encoded = GetModel(name, format, stream);
+    fclose(stream);
+    if(!encoded)
     {
-        close(fd);
-        if(!strcmp(format, "jpeg"))
-            dsp_file_write_jpeg_composite(filename, channels, 100, stream);
-        if(!strcmp(format, "png"))
-            dsp_file_write_png_composite(filename, channels, 9, stream);
-        if(!strcmp(format, "fits"))
-            dsp_file_write_fits_composite(filename, channels, 16, stream);
-        FILE* f = fopen(filename, "r");
-        fseek(f, 0, SEEK_END);
-        len = ftell(f);
-        rewind(f);
-        len -= ftell(f);
-        buf = (unsigned char*)malloc((size_t)len);
-        size_t nread = fread(buf, (size_t)len, 1, f);
-        (void)nread;
-        fclose(f);
-        unlink(filename);
-        outlen = len * 4 / 3 + 4;
-        b64 = (unsigned char*)malloc((size_t)outlen);
-        to64frombits(b64, buf, (int)len);
-        free(buf);
-        return (char*)b64;
+        free(b64);
+        return nullptr;
     }
-    return nullptr;
+    return b64;
 }
 
 int VLBI::Server::GetModels(char** names)
@@ -290,335 +399,524 @@ void VLBI::Server::AddModel(const char *name, char *format, char *b64)
     }
 }
 
+#define PARSE_CHUNK 65536
+
+static int parse_token(FILE *f, char *token, size_t size, const char *delims)
+{
+    size_t n = 0;
+    int c;
+    while((c = getc(f)) != EOF && c != '\n' && strchr(delims, c) != nullptr);
+    while(c != EOF && c != '\n' && strchr(delims, c) == nullptr)
+    {
+        if(n + 1 < size)
+            token[n++] = (char)c;
+        c = getc(f);
+    }
+    token[n] = 0;
+    return c;
+}
+
+static void parse_skip_line(FILE *f, int c)
+{
+    while(c != EOF && c != '\n')
+        c = getc(f);
+}
+
+static char *parse_payload(FILE *f, size_t *len, int *delim)
+{
+    char in[PARSE_CHUNK];
+    size_t size = PARSE_CHUNK;
+    char *buf = (char*)malloc(size);
+    base64_state state;
+    base64_init(&state);
+    *len = 0;
+    int c = 0;
+    flockfile(f);
+    while(c != EOF && c != ',' && c != '\n')
+    {
+        int n = 0;
+        while(n < PARSE_CHUNK && (c = getc_unlocked(f)) != EOF && c != ',' && c != '\n')
+            in[n++] = (char)c;
+        size_t needed = *len + (size_t)n * 3 / 4 + 3;
+        if(needed > size)
+        {
+            size = Max(size * 2, needed);
+            buf = (char*)realloc(buf, size);
+        }
+        int decoded = from64tobits_update(&state, buf + *len, in, n);
+        if(decoded < 0)
+            break;
+        *len += (size_t)decoded;
+    }
+    funlockfile(f);
+    *delim = c;
+    if(c == ',' || c == '\n' || c == EOF)
+    {
+        int decoded = from64tobits_final(&state, buf + *len);
+        if(decoded >= 0)
+        {
+            *len += (size_t)decoded;
+            return buf;
+        }
+    }
+    free(buf);
+    *len = 0;
+    return nullptr;
+}
+
+void VLBI::Server::ParseNode(FILE *f)
+{
+    char name[32], geo[8], lat[32], lon[32], el[32], date[64];
+    size_t len = 0;
+    int c = parse_token(f, name, sizeof(name), ",");
+    if(c == ',')
+        c = parse_token(f, geo, sizeof(geo), ",");
+    if(c == ',')
+        c = parse_token(f, lat, sizeof(lat), ",");
+    if(c == ',')
+        c = parse_token(f, lon, sizeof(lon), ",");
+    if(c == ',')
+        c = parse_token(f, el, sizeof(el), ",");
+    if(c != ',' || (strcmp(geo, "geo") && strcmp(geo, "xyz")))
+    {
+        parse_skip_line(f, c);
+        return;
+    }
+    char *buf = parse_payload(f, &len, &c);
+    if(buf == nullptr || c != ',')
+    {
+        parse_skip_line(f, c);
+        free(buf);
+        return;
+    }
+    c = parse_token(f, date, sizeof(date), ",");
+    parse_skip_line(f, c);
+    int samples = (int)(len * 8 / (size_t)abs(Bps));
+    if(samples > 0)
+    {
+        dsp_location *locations = (dsp_location*)malloc(sizeof(dsp_location) * (size_t)samples);
+        for(int x = 0; x < samples; x++)
+        {
+            locations[x].geographic.lat = (double)atof(lat);
+            locations[x].geographic.lon = (double)atof(lon);
+            locations[x].geographic.el = (double)atof(el);
+        }
+        AddNode(name, locations, buf, (int)len, vlbi_time_string_to_timespec(date), !strcmp(geo, "geo"));
+    }
+    free(buf);
+}
+
 void VLBI::Server::Parse()
 {
     FILE* f = input;
     size_t len = 0;
-    char *cmd = nullptr;
-    char *arg = nullptr;
+    char cmd[32], arg[32];
     char *value = nullptr;
     char *str = nullptr;
-    ssize_t ofs = getdelim(&str, &len, (int)'\n', f);
-    (void)ofs;
-    if(str == nullptr)
-        return;
-    if (len == 0)
-        return;
-    *strrchr(str, '\n') = 0;
-    cmd = strtok(str, " ");
-    if (cmd == nullptr)
+    int c = parse_token(f, cmd, sizeof(cmd), " ");
+    if (c == EOF && cmd[0] == 0)
         return;
     if (!strcmp(cmd, "quit"))
     {
+        parse_skip_line(f, c);
         is_running = false;
         return;
     }
     else
     {
-        arg = strtok(nullptr, " ");
-        if (arg == nullptr)
+        if (c != ' ')
+            return;
+        c = parse_token(f, arg, sizeof(arg), " ");
+        if (c != ' ')
             return;
-        value = strtok(nullptr, " ");
-        if(value == nullptr)
+        if(!strcmp(cmd, "add") && !strcmp(arg, "node"))
+        {
+            ParseNode(f);
+            return;
+        }
+        ssize_t ofs = getdelim(&str, &len, (int)'\n', f);
+        if(ofs <= 0)
+        {
+            free(str);
             return;
-        if(!strcmp(cmd, "set"))
+        }
+        value = strtok(str, " \n");
+        if(value != nullptr)
+            ParseCommand(cmd, arg, value);
+        free(str);
+    }
+}
+
+void VLBI::Server::ParseCommand(const char *cmd, const char *arg, char *value)
+{
+    FILE* f = input;
+    if(!strcmp(cmd, "set"))
+    {
+        if(!strcmp(arg, "context"))
+        {
+            SetContext(value);
+        }
+        else if(!strcmp(arg, "mask"))
         {
-            if(!strcmp(arg, "context"))
+            char *t = strtok(value, ",");
+            const char *name = t;
+            if(name == nullptr)
             {
-                SetContext(value);
+                return;
             }
-            else if(!strcmp(arg, "mask"))
+            t = strtok(nullptr, ",");
+            char *model = t;
+            if(model == nullptr)
+            {
+                return;
+            }
+            t = strtok(nullptr, ",");
+            char *mask = t;
+            if(mask == nullptr)
+            {
+                return;
+            }
+            Mask(name, model, mask);
+        }
+        else if(!strcmp(arg, "shifted"))
+        {
+            Shift(value);
+        }
+        else if(!strcmp(arg, "flag"))
+        {
+            char *t = strtok(value, ",");
+            const char *node = t;
+            if(node == nullptr)
             {
-                char *t = strtok(value, ",");
-                const char *name = t;
-                if(name == nullptr)
-                {
-                    return;
-                }
-                t = strtok(nullptr, ",");
-                char *model = t;
-                if(model == nullptr)
-                {
-                    return;
-                }
-                t = strtok(nullptr, ",");
-                char *mask = t;
-                if(mask == nullptr)
-                {
-                    return;
-                }
-                Mask(name, model, mask);
-            }
-            else if(!strcmp(arg, "shifted"))
+                return;
+            }
+            t = strtok(nullptr, ",");
+            char *method = t;
+            if(method == nullptr)
             {
-                Shift(value);
+                return;
             }
-            else if(!strcmp(arg, "resolution"))
+            t = strtok(nullptr, ",");
+            if(t == nullptr)
             {
-                char* W = strtok(value, "x");
-                char* H = strtok(nullptr, "x");
-                w = (int)atof(W);
-                h = (int)atof(H);
+                return;
             }
-            else if(!strcmp(arg, "target"))
-            {
-                char* ra = strtok(value, ",");
-                char* dec = strtok(nullptr, ",");
-                Ra = (double)atof(ra);
-                Dec = (double)atof(dec);
-            }
-            else if(!strcmp(arg, "frequency"))
-            {
-                Freq = (double)atof(value);
-            }
-            else if(!strcmp(arg, "samplerate"))
-            {
-                SampleRate = (double)atof(value);
-            }
-            else if(!strcmp(arg, "bitspersample"))
-            {
-                Bps = (int)atof(value);
-            }
-            else if(!strcmp(arg, "location"))
-            {
-                double lat, lon, el;
-                char *t = strtok(value, ",");
-                lat = (int)atof(t);
-                t = strtok(nullptr, ",");
-                lon = (int)atof(t);
-                t = strtok(nullptr, ",");
-                el = (int)atof(t);
-                vlbi_set_location(GetContext(), lat, lon, el);
-            }
-        }
-        else if(!strcmp(cmd, "get"))
-        {
-            if(!strcmp(arg, "models"))
-            {
-                dsp_stream_p* models;
-                int n = vlbi_get_models(GetContext(), &models);
-                for(int x = 0; x < n; x++)
-                {
-                    fprintf(f, "Model #%d: name:%s width:%d height:%d\n", x,
-                            models[x]->name, models[x]->sizes[0], models[x]->sizes[1]);
-                }
-                free(models);
-            }
-            if(!strcmp(arg, "nodes"))
-            {
-                vlbi_node* nodes;
-                int n = vlbi_get_nodes(GetContext(), &nodes);
-                for(int x = 0; x < n; x++)
-                {
-                    fprintf(f, "Node #%d: name:%s relative?:%s x:%lf y:%lf z:%lf latitude:%lf longitude:%lf elevation:%lf\n", nodes[x].Index,
-                            nodes[x].Name, nodes[x].Geo ? "no" : "yes", nodes[x].Location[0], nodes[x].Location[1], nodes[x].Location[2],
-                            nodes[x].GeographicLocation[0], nodes[x].GeographicLocation[1], nodes[x].GeographicLocation[2]);
-                }
-                free(nodes);
-            }
-            else if(!strcmp(arg, "baselines"))
-            {
-                vlbi_baseline* baselines;
-                int n = vlbi_get_baselines(GetContext(), &baselines);
-                for(int x = 0; x < n; x++)
-                {
-                    fprintf(f, "Baseline #%d: name:%s samplerate:%lf wavelength:%lf custom?:%s\n", x, baselines[x].Name,
-                            baselines[x].SampleRate, baselines[x].WaveLength, baselines[x].locked ? "yes" : "no");
-                }
-                free(baselines);
-            }
-            else if(!strcmp(arg, "model"))
-            {
-                char *t = strtok(value, ",");
-                const char *name = t;
-                if(name == nullptr)
-                {
-                    return;
-                }
-                t = strtok(nullptr, ",");
-                char *format = t;
-                if(format == nullptr)
-                {
-                    return;
-                }
-                char *base64 = GetModel(name, format);
-                fwrite(base64, 1, strlen(base64), output);
-                free(base64);
-            }
-        }
-        else if(!strcmp(cmd, "add"))
-        {
-            if(!strcmp(arg, "context"))
-            {
-                AddContext(value);
-            }
-            else if(!strcmp(arg, "node"))
-            {
-                char name[32], date[64];
-                double lat, lon, el;
-                int geo = 2;
-                char* k = strtok(value, ",");
-                strcpy(name, k);
-                k = strtok(nullptr, ",");
-                if(!strcmp(k, "geo"))
-                    geo = 1;
-                else if(!strcmp(k, "xyz"));
-                else
-                {
-                    geo = 0;
-                    return;
-                }
-                k = strtok(nullptr, ",");
-                lat = (double)atof(k);
-                k = strtok(nullptr, ",");
-                lon = (double)atof(k);
-                k = strtok(nullptr, ",");
-                el = (double)atof(k);
-                k = strtok(nullptr, ",");
-                size_t len = strlen (k);
-                char* base64 = (char*)malloc(len);
-                char* buf = (char*)malloc(len * 3 / 4 + 4);
-                strcpy(base64, k);
-                len = (size_t)from64tobits_fast(buf, base64, (int)len);
-                k = strtok(nullptr, ",");
-                strcpy(date, k);
-                dsp_location location;
-                location.geographic.lat = lat;
-                location.geographic.lon = lon;
-                location.geographic.el = el;
-                if(len > 0 && geo > 0)
-                {
-                    AddNode(name, &location, buf, (int)len, vlbi_time_string_to_timespec(date), geo == 1);
-                }
-            }
-            else if(!strcmp(arg, "plot"))
-            {
-                int flags = 0;
-                char *t = strtok(value, ",");
-                const char *name = t;
-                if(name == nullptr)
-                {
-                    return;
-                }
-                t = strtok(nullptr, ",");
-                if(!strcmp(t, "synthesis"))
-                {
-                }
-                else if(!strcmp(t, "movingbase"))
-                {
-                    flags |= plot_flags_moving_baseline;
-                }
-                else
-                {
-                    return;
-                }
-                t = strtok(nullptr, ",");
-                if(!strcmp(t, "nodelay"))
-                {
-                    flags |= plot_flags_synced;
-                }
-                else if(!strcmp(t, "delay"))
-                {
-                }
-                else
-                {
-                    return;
-                }
-                t = strtok(nullptr, ",");
-                if(!strcmp(t, "raw"))
-                {
-                }
-                else if(!strcmp(t, "coverage"))
-                {
-                    flags |= plot_flags_uv_coverage;
-                }
-                else
-                {
-                    return;
-                }
-                Plot(name, flags);
-            }
-            else if(!strcmp(arg, "idft"))
-            {
-                char *t = strtok(value, ",");
-                char *model = t;
-                if(model == nullptr)
-                {
-                    return;
-                }
-                t = strtok(nullptr, ",");
-                char *magnitude = t;
-                if(magnitude == nullptr)
-                {
-                    return;
-                }
-                t = strtok(nullptr, ",");
-                char *phase = t;
-                if(phase == nullptr)
-                {
-                    return;
-                }
-                Idft(model, magnitude, phase);
-            }
-            else if(!strcmp(arg, "dft"))
-            {
-                char *t = strtok(value, ",");
-                char *model = t;
-                if(model == nullptr)
-                {
-                    return;
-                }
-                t = strtok(nullptr, ",");
-                char *magnitude = t;
-                if(magnitude == nullptr)
-                {
-                    return;
-                }
-                t = strtok(nullptr, ",");
-                char *phase = t;
-                if(phase == nullptr)
-                {
-                    return;
-                }
-                Dft(model, magnitude, phase);
-            }
-            else if(!strcmp(arg, "model"))
-            {
-                char *t = strtok(value, ",");
-                const char *name = t;
-                if(name == nullptr)
-                {
-                    return;
-                }
-                t = strtok(nullptr, ",");
-                char *format = t;
-                if(format == nullptr)
-                {
-                    return;
-                }
-                t = strtok(nullptr, ",");
-                char *b64 = t;
-                if(b64 == nullptr)
-                {
-                    return;
-                }
-                AddModel(name, format, b64);
-            }
-        }
-        else if(!strcmp(cmd, "del"))
-        {
-            if(!strcmp(arg, "node"))
-            {
-                DelNode(value);
-            }
-            else if(!strcmp(arg, "context"))
-            {
-                DelContext(value);
-            }
-            else if(!strcmp(arg, "model"))
-            {
-                DelModel(value);
+            int window = (int)atof(t);
+            t = strtok(nullptr, ",");
+            if(t == nullptr)
+            {
+                return;
             }
+            double threshold = atof(t);
+            Flag(node, !strcmp(method, "sumthreshold") ? vlbi_flagging_sumthreshold : vlbi_flagging_mad, window, threshold);
+        }
+        else if(!strcmp(arg, "resolution"))
+        {
+            char* W = strtok(value, "x");
+            char* H = strtok(nullptr, "x");
+            w = (int)atof(W);
+            h = (int)atof(H);
+        }
+        else if(!strcmp(arg, "target"))
+        {
+            char* ra = strtok(value, ",");
+            char* dec = strtok(nullptr, ",");
+            Ra = (double)atof(ra);
+            Dec = (double)atof(dec);
+        }
+        else if(!strcmp(arg, "frequency"))
+        {
+            Freq = (double)atof(value);
+        }
+        else if(!strcmp(arg, "samplerate"))
+        {
+            SampleRate = (double)atof(value);
+        }
+        else if(!strcmp(arg, "bitspersample"))
+        {
+            Bps = (int)atof(value);
+        }
+        else if(!strcmp(arg, "location"))
+        {
+            double lat, lon, el;
+            char *t = strtok(value, ",");
+            lat = (int)atof(t);
+            t = strtok(nullptr, ",");
+            lon = (int)atof(t);
+            t = strtok(nullptr, ",");
+            el = (int)atof(t);
+            vlbi_set_location(GetContext(), lat, lon, el);
+        }
+        else if(!strcmp(arg, "trace"))
+        {
+            dsp_perf_trace(!strcmp(value, "on"));
+        }
+    }
+    else if(!strcmp(cmd, "get"))
+    {
+        if(!strcmp(arg, "models"))
+        {
+            dsp_stream_p* models;
+            int n = vlbi_get_models(GetContext(), &models);
+            for(int x = 0; x < n; x++)
+            {
+                fprintf(f, "Model #%d: name:%s width:%d height:%d\n", x,
+                        models[x]->name, models[x]->sizes[0], models[x]->sizes[1]);
+            }
+            free(models);
+        }
+        if(!strcmp(arg, "nodes"))
+        {
+            vlbi_node* nodes;
+            int n = vlbi_get_nodes(GetContext(), &nodes);
+            for(int x = 0; x < n; x++)
+            {
+                fprintf(f, "Node #%d: name:%s relative?:%s x:%lf y:%lf z:%lf latitude:%lf longitude:%lf elevation:%lf\n", nodes[x].Index,
+                        nodes[x].Name, nodes[x].Geo ? "no" : "yes", nodes[x].Location[0], nodes[x].Location[1], nodes[x].Location[2],
+                        nodes[x].GeographicLocation[0], nodes[x].GeographicLocation[1], nodes[x].GeographicLocation[2]);
+            }
+            free(nodes);
+        }
+        else if(!strcmp(arg, "baselines"))
+        {
+            vlbi_baseline* baselines;
+            int n = vlbi_get_baselines(GetContext(), &baselines);
+            for(int x = 0; x < n; x++)
+            {
+                fprintf(f, "Baseline #%d: name:%s samplerate:%lf wavelength:%lf custom?:%s\n", x, baselines[x].Name,
+                        baselines[x].SampleRate, baselines[x].WaveLength, baselines[x].locked ? "yes" : "no");
+            }
+            free(baselines);
+        }
+        else if(!strcmp(arg, "model"))
+        {
+            char *t = strtok(value, ",");
+            const char *name = t;
+            if(name == nullptr)
+            {
+                return;
+            }
+            t = strtok(nullptr, ",");
+            char *format = t;
+            if(format == nullptr)
+            {
+                return;
+            }
+            GetModel(name, format, output);
+        }
+        else if(!strcmp(arg, "snapshot"))
+        {
+            vlbi_save_snapshot(GetContext(), value);
+        }
+        else if(!strcmp(arg, "stats"))
+        {
+            GetStats(value, output);
+        }
+        else if(!strcmp(arg, "trace"))
+        {
+            FILE *trace = fopen(value, "w");
+            if(trace == nullptr)
+                return;
+            dsp_perf_trace_dump(trace);
+            fclose(trace);
+        }
+        else if(!strcmp(arg, "jobs"))
+        {
+            GetJobs(value, output);
+        }
+        else if(!strcmp(arg, "job"))
+        {
+            int id = atoi(value);
+            int status = GetJobStatus(id);
+            if(status >= 0)
+                fprintf(output, "Job #%d: status:%s progress:%.1lf%%\n", id, job_status_names[status], GetJobProgress(id) * 100.0);
+        }
+    }
+    else if(!strcmp(cmd, "add"))
+    {
+        if(!strcmp(arg, "context"))
+        {
+            AddContext(value);
+        }
+        else if(!strcmp(arg, "snapshot"))
+        {
+            vlbi_load_snapshot(GetContext(), value);
+        }
+        else if(!strcmp(arg, "plot"))
+        {
+            int flags = 0;
+            char *t = strtok(value, ",");
+            const char *name = t;
+            if(name == nullptr)
+            {
+                return;
+            }
+            t = strtok(nullptr, ",");
+            if(!strcmp(t, "synthesis"))
+            {
+            }
+            else if(!strcmp(t, "movingbase"))
+            {
+                flags |= plot_flags_moving_baseline;
+            }
+            else
+            {
+                return;
+            }
+            t = strtok(nullptr, ",");
+            if(!strcmp(t, "nodelay"))
+            {
+                flags |= plot_flags_synced;
+            }
+            else if(!strcmp(t, "delay"))
+            {
+            }
+            else
+            {
+                return;
+            }
+            t = strtok(nullptr, ",");
+            if(!strcmp(t, "raw"))
+            {
+            }
+            else if(!strcmp(t, "coverage"))
+            {
+                flags |= plot_flags_uv_coverage;
+            }
+            else
+            {
+                return;
+            }
+            Plot(name, flags);
+        }
+        else if(!strcmp(arg, "idft"))
+        {
+            char *t = strtok(value, ",");
+            char *model = t;
+            if(model == nullptr)
+            {
+                return;
+            }
+            t = strtok(nullptr, ",");
+            char *magnitude = t;
+            if(magnitude == nullptr)
+            {
+                return;
+            }
+            t = strtok(nullptr, ",");
+            char *phase = t;
+            if(phase == nullptr)
+            {
+                return;
+            }
+            Idft(model, magnitude, phase);
+        }
+        else if(!strcmp(arg, "dft"))
+        {
+            char *t = strtok(value, ",");
+            char *model = t;
+            if(model == nullptr)
+            {
+                return;
+            }
+            t = strtok(nullptr, ",");
+            char *magnitude = t;
+            if(magnitude == nullptr)
+            {
+                return;
+            }
+            t = strtok(nullptr, ",");
+            char *phase = t;
+            if(phase == nullptr)
+            {
+                return;
+            }
+            Dft(model, magnitude, phase);
+        }
+        else if(!strcmp(arg, "clean"))
+        {
+            char *t = strtok(value, ",");
+            char *name = t;
+            if(name == nullptr)
+            {
+                return;
+            }
+            t = strtok(nullptr, ",");
+            char *dirty = t;
+            if(dirty == nullptr)
+            {
+                return;
+            }
+            t = strtok(nullptr, ",");
+            char *psf = t;
+            if(psf == nullptr)
+            {
+                return;
+            }
+            t = strtok(nullptr, ",");
+            if(t == nullptr)
+            {
+                return;
+            }
+            double gain = atof(t);
+            t = strtok(nullptr, ",");
+            if(t == nullptr)
+            {
+                return;
+            }
+            double threshold = atof(t);
+            t = strtok(nullptr, ",");
+            if(t == nullptr)
+            {
+                return;
+            }
+            int niter = (int)atof(t);
+            Clean(name, dirty, psf, gain, threshold, niter);
+        }
+        else if(!strcmp(arg, "model"))
+        {
+            char *t = strtok(value, ",");
+            const char *name = t;
+            if(name == nullptr)
+            {
+                return;
+            }
+            t = strtok(nullptr, ",");
+            char *format = t;
+            if(format == nullptr)
+            {
+                return;
+            }
+            t = strtok(nullptr, ",");
+            char *b64 = t;
+            if(b64 == nullptr)
+            {
+                return;
+            }
+            AddModel(name, format, b64);
+        }
+    }
+    else if(!strcmp(cmd, "del"))
+    {
+        if(!strcmp(arg, "node"))
+        {
+            DelNode(value);
+        }
+        else if(!strcmp(arg, "context"))
+        {
+            DelContext(value);
+        }
+        else if(!strcmp(arg, "flag"))
+        {
+            Unflag(value);
+        }
+        else if(!strcmp(arg, "model"))
+        {
+            DelModel(value);
+        }
+        else if(!strcmp(arg, "job"))
+        {
+            DelJob(atoi(value));
         }
     }
 }
@@ -632,14 +930,19 @@ void VLBI::Server::SetContext(const char *name)
 {
     if(contexts->Contains(name))
     {
-        context = (char*)realloc(context, strlen(name));
+        context = (char*)realloc(context, strlen(name) + 1);
         strcpy(context, name);
     }
 }
 
 vlbi_context VLBI::Server::GetContext()
 {
-    if(contexts->Contains(context)) return contexts->Get(context);
+    if(contexts->Contains(context))
+    {
+        vlbi_context ctx = contexts->Get(context);
+        WaitContext(ctx);
+        return ctx;
+    }
     return nullptr;
 }
 
@@ -648,11 +951,248 @@ void VLBI::Server::DelContext(const char *name)
     if(contexts->Contains(name))
     {
         vlbi_context ctx = contexts->Get(name);
+        pthread_mutex_lock(&jobs_mutex);
+        for(std::map<int, vlbi_job*>::iterator it = jobs.begin(); it != jobs.end(); it++)
+        {
+            if(it->second->context == ctx)
+                CancelJob(it->second);
+        }
+        pthread_mutex_unlock(&jobs_mutex);
+        WaitContext(ctx);
+        pthread_mutex_lock(&jobs_mutex);
+        ReapJobs(ctx, 0);
+        pending.erase(ctx);
+        running.erase(ctx);
+        pthread_mutex_unlock(&jobs_mutex);
         contexts->Remove(name);
         vlbi_exit(ctx);
     }
 }
 
+void *VLBI::Server::JobWorker(void *arg)
+{
+    Server *owner = (Server*)arg;
+    pthread_mutex_lock(&owner->jobs_mutex);
+    while(!owner->stopping)
+    {
+        vlbi_job *job = nullptr;
+        for(std::deque<vlbi_job*>::iterator it = owner->queue.begin(); it != owner->queue.end(); it++)
+        {
+            if(!owner->running[(*it)->context])
+            {
+                job = *it;
+                owner->queue.erase(it);
+                break;
+            }
+        }
+        if(job == nullptr)
+        {
+            pthread_cond_wait(&owner->jobs_cond, &owner->jobs_mutex);
+            continue;
+        }
+        job->status = job_status_running;
+        owner->running[job->context] = true;
+        pthread_mutex_unlock(&owner->jobs_mutex);
+        dsp_progress_set(&job->progress);
+        job->run(job->context, &job->progress.cancel);
+        dsp_progress_set(nullptr);
+        pthread_mutex_lock(&owner->jobs_mutex);
+        job->status = dsp_progress_cancelled(&job->progress) ? job_status_cancelled : job_status_completed;
+        job->run = nullptr;
+        owner->running[job->context] = false;
+        owner->pending[job->context]--;
+        pthread_cond_broadcast(&owner->jobs_cond);
+    }
+    pthread_mutex_unlock(&owner->jobs_mutex);
+    return nullptr;
+}
+
+void VLBI::Server::WaitContext(vlbi_context ctx)
+{
+    pthread_mutex_lock(&jobs_mutex);
+    while(!stopping && pending[ctx] > 0)
+        pthread_cond_wait(&jobs_cond, &jobs_mutex);
+    pthread_mutex_unlock(&jobs_mutex);
+}
+
+void VLBI::Server::CancelJob(vlbi_job *job)
+{
+    if(job->status == job_status_queued)
+    {
+        for(std::deque<vlbi_job*>::iterator it = queue.begin(); it != queue.end(); it++)
+        {
+            if(*it == job)
+            {
+                queue.erase(it);
+                break;
+            }
+        }
+        job->status = job_status_cancelled;
+        job->run = nullptr;
+        pending[job->context]--;
+        pthread_cond_broadcast(&jobs_cond);
+    }
+    __atomic_store_n(&job->progress.cancel, 1, __ATOMIC_RELAXED);
+}
+
+void VLBI::Server::FreeJob(std::map<int, vlbi_job*>::iterator it)
+{
+    vlbi_job *job = it->second;
+    jobs.erase(it);
+    free(job->context_name);
+    free(job->description);
+    delete job;
+}
+
+void VLBI::Server::ReapJobs(vlbi_context ctx, int keep)
+{
+    int finished = 0;
+    for(std::map<int, vlbi_job*>::iterator it = jobs.begin(); it != jobs.end(); it++)
+    {
+        vlbi_job *job = it->second;
+        if((ctx == nullptr || job->context == ctx) && job->run == nullptr)
+            finished++;
+    }
+    std::map<int, vlbi_job*>::iterator it = jobs.begin();
+    while(finished > keep && it != jobs.end())
+    {
+        vlbi_job *job = it->second;
+        if((ctx == nullptr || job->context == ctx) && job->run == nullptr)
+        {
+            FreeJob(it++);
+            finished--;
+        }
+        else
+            it++;
+    }
+}
+
+int VLBI::Server::AddJob(const char *description, std::function<void(vlbi_context ctx, int *interrupt)> run)
+{
+    if(!contexts->Contains(context))
+        return -1;
+    vlbi_job *job = new vlbi_job();
+    job->context = contexts->Get(context);
+    job->context_name = (char*)malloc(strlen(context) + 1);
+    strcpy(job->context_name, context);
+    job->description = (char*)malloc(strlen(description) + 1);
+    strcpy(job->description, description);
+    job->status = job_status_queued;
+    memset(&job->progress, 0, sizeof(dsp_progress));
+    job->run = run;
+    pthread_mutex_lock(&jobs_mutex);
+    if(workers == nullptr)
+    {
+        nworkers = (int)Max(1, vlbi_max_threads(0));
+        workers = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)nworkers);
+        for(int x = 0; x < nworkers; x++)
+            pthread_create(&workers[x], nullptr, JobWorker, this);
+    }
+    ReapJobs(nullptr, VLBI_SERVER_JOBS_HISTORY - 1);
+    job->id = ++last_job;
+    jobs[job->id] = job;
+    queue.push_back(job);
+    pending[job->context]++;
+    pthread_cond_broadcast(&jobs_cond);
+    pthread_mutex_unlock(&jobs_mutex);
+    return job->id;
+}
+
+void VLBI::Server::DelJob(int id)
+{
+    pthread_mutex_lock(&jobs_mutex);
+    std::map<int, vlbi_job*>::iterator it = jobs.find(id);
+    if(it != jobs.end())
+        CancelJob(it->second);
+    pthread_mutex_unlock(&jobs_mutex);
+}
+
+int VLBI::Server::GetJobStatus(int id)
+{
+    int status = -1;
+    pthread_mutex_lock(&jobs_mutex);
+    std::map<int, vlbi_job*>::iterator it = jobs.find(id);
+    if(it != jobs.end())
+        status = it->second->status;
+    pthread_mutex_unlock(&jobs_mutex);
+    return status;
+}
+
+double VLBI::Server::GetJobProgress(int id)
+{
+    double progress = -1;
+    pthread_mutex_lock(&jobs_mutex);
+    std::map<int, vlbi_job*>::iterator it = jobs.find(id);
+    if(it != jobs.end())
+        progress = it->second->status == job_status_completed ? 1.0 : dsp_progress_value(&it->second->progress);
+    pthread_mutex_unlock(&jobs_mutex);
+    return progress;
+}
+
+int VLBI::Server::GetJobs(const char *name, vlbi_job_info **info)
+{
+    int count = 0;
+    pthread_mutex_lock(&jobs_mutex);
+    *info = (vlbi_job_info*)malloc(sizeof(vlbi_job_info) * (jobs.size() + 1));
+    for(std::map<int, vlbi_job*>::iterator it = jobs.begin(); it != jobs.end(); it++)
+    {
+        vlbi_job *job = it->second;
+        if(strcmp(job->context_name, name))
+            continue;
+        (*info)[count].id = job->id;
+        (*info)[count].description = job->description;
+        (*info)[count].status = job->status;
+        (*info)[count].progress = job->status == job_status_completed ? 1.0 : dsp_progress_value(&job->progress);
+        count++;
+    }
+    pthread_mutex_unlock(&jobs_mutex);
+    return count;
+}
+
+void VLBI::Server::GetJobs(const char *name, FILE *stream)
+{
+    vlbi_job_info *info = nullptr;
+    int count = GetJobs(name, &info);
+    for(int x = 0; x < count; x++)
+        fprintf(stream, "Job #%d: context:%s description:%s status:%s progress:%.1lf%%\n", info[x].id, name, info[x].description,
+                job_status_names[info[x].status], info[x].progress * 100.0);
+    free(info);
+}
+
+bool VLBI::Server::GetStats(const char *name, vlbi_stats *stats)
+{
+    if(!contexts->Contains(name))
+        return false;
+    vlbi_get_stats(contexts->Get(name), stats);
+    return true;
+}
+
+void VLBI::Server::GetStats(const char *name, FILE *stream)
+{
+    vlbi_stats stats;
+    if(!GetStats(name, &stats))
+        return;
+    fprintf(stream, "Stats: context:%s nodes:%d baselines:%d models:%d\n", name, stats.nodes, stats.baselines, stats.models);
+    for(int x = 0; x < dsp_perf_stages; x++)
+        fprintf(stream, "Stage %s: calls:%lu time:%.6lf\n", dsp_perf_stage_name((dsp_perf_stage)x), stats.counters.calls[x],
+                stats.counters.time[x] / 1000000000.0);
+}
+
+void VLBI::Server::WaitJobs()
+{
+    pthread_mutex_lock(&jobs_mutex);
+    while(!stopping)
+    {
+        int n = 0;
+        for(std::map<vlbi_context, int>::iterator it = pending.begin(); it != pending.end(); it++)
+            n += it->second;
+        if(n == 0)
+            break;
+        pthread_cond_wait(&jobs_cond, &jobs_mutex);
+    }
+    pthread_mutex_unlock(&jobs_mutex);
+}
+
 static void sighandler(int signum)
 {
     signal(signum, SIG_IGN);
@@ -701,6 +1241,7 @@ int main(int argc, char** argv)
                 break;
             VLBI::server->Parse();
         }
+        VLBI::server->WaitJobs();
     }
     return EXIT_SUCCESS;
 }
@@ -21,6 +21,13 @@
 
 #include <vlbi.h>
 #include <dsp.h>
+#include <pthread.h>
+#include <functional>
+#include <deque>
+#include <map>
+
+///The number of finished jobs remembered by the server
+#define VLBI_SERVER_JOBS_HISTORY 64
 
 namespace VLBI
 {
@@ -54,6 +61,59 @@ typedef enum
     plot_flags_custom_delegate = 8,
 } vlbi_plot_flags;
 
+/**
+* \brief The state of a job queued into the server worker pool
+* \sa Server::AddJob()
+*/
+typedef enum
+{
+    ///The job waits for a worker or for the previous jobs on its context
+    job_status_queued = 0,
+    ///The job is being executed
+    job_status_running,
+    ///The job has finished
+    job_status_completed,
+    ///The job was cancelled before or during its execution
+    job_status_cancelled,
+} vlbi_job_status;
+
+/**
+* \brief A long running operation pinned to a context
+*/
+typedef struct
+{
+    ///The job identifier
+    int id;
+    ///The context the job operates on
+    vlbi_context context;
+    ///The name of the context
+    char *context_name;
+    ///A short description of the operation
+    char *description;
+    ///The job status
+    vlbi_job_status status;
+    ///The progress counters and cancel flag, bound to the worker thread while the job runs
+    dsp_progress progress;
+    ///The operation
+    std::function<void(vlbi_context ctx, int *interrupt)> run;
+} vlbi_job;
+
+/**
+* \brief A snapshot of the state of a job
+* \sa Server::GetJobs()
+*/
+typedef struct
+{
+    ///The job identifier
+    int id;
+    ///A short description of the operation
+    const char *description;
+    ///The job status
+    vlbi_job_status status;
+    ///The completed fraction of the job, between 0 and 1
+    double progress;
+} vlbi_job_info;
+
 /**
 * \brief Inherit this class to create an OpenVLBI server application
 */
@@ -86,6 +146,20 @@ class Server
         */
         virtual void Parse(void);
 
+        /**
+        * \brief Execute a command whose verb and argument were already read, used by Parse()
+        * \param cmd The command verb (set, get, add or del)
+        * \param arg The command argument
+        * \param value The command value, it may be modified while tokenizing
+        */
+        void ParseCommand(const char *cmd, const char *arg, char *value);
+
+        /**
+        * \brief Read the value of an add node command from a stream, decoding the base64 payload while it is being read
+        * \param f The stream positioned after the add node prefix
+        */
+        void ParseNode(FILE *f);
+
         /**
         * \brief Add a new OpenVLBI context by giving it a name. VLBI::Server has an internal context collection
         * \param name The name of the new context
@@ -105,11 +179,76 @@ class Server
         void SetContext(const char *name);
 
         /**
-        * \brief Obtain the current OpenVLBI context object.
+        * \brief Obtain the current OpenVLBI context object, waiting for the jobs queued on it to finish.
         * \return The vlbi_context object representing the current context
         */
         vlbi_context GetContext(void);
 
+        /**
+        * \brief Queue a long running operation on the current context, it will be executed by the worker pool.
+        * Jobs on the same context run in order, one at a time, jobs on different contexts run concurrently.
+        * Only the last VLBI_SERVER_JOBS_HISTORY finished jobs are remembered, older ones are released.
+        * \param description A short description of the operation
+        * \param run The operation, it receives the context and the cancel flag of the job
+        * \return The job identifier, or -1 if there is no current context
+        */
+        int AddJob(const char *description, std::function<void(vlbi_context ctx, int *interrupt)> run);
+
+        /**
+        * \brief Cancel a job, queued jobs are dropped and running ones are interrupted.
+        * \param id The job identifier
+        */
+        void DelJob(int id);
+
+        /**
+        * \brief Obtain the status of a job.
+        * \param id The job identifier
+        * \return The job status, or -1 if the job does not exist
+        */
+        int GetJobStatus(int id);
+
+        /**
+        * \brief Obtain the progress of a job.
+        * \param id The job identifier
+        * \return The completed fraction of the job between 0 and 1, or -1 if the job does not exist
+        */
+        double GetJobProgress(int id);
+
+        /**
+        * \brief Obtain a snapshot of the jobs of a context.
+        * \param name The name of the context
+        * \param info Filled with an array of job states, to be freed by the caller, the descriptions are valid until the next job is queued
+        * \return The number of jobs
+        */
+        int GetJobs(const char *name, vlbi_job_info **info);
+
+        /**
+        * \brief Print the jobs of a context into a stream.
+        * \param name The name of the context
+        * \param stream The stream receiving the job list
+        */
+        void GetJobs(const char *name, FILE *stream);
+
+        /**
+        * \brief Print the statistics and the stage timing counters of a context into a stream, without waiting for its jobs.
+        * \param name The name of the context
+        * \param stream The stream receiving the statistics
+        */
+        void GetStats(const char *name, FILE *stream);
+
+        /**
+        * \brief Obtain the statistics and the stage timing counters of a context, without waiting for its jobs.
+        * \param name The name of the context
+        * \param stats The statistics to fill
+        * \return false if the context does not exist
+        */
+        bool GetStats(const char *name, vlbi_stats *stats);
+
+        /**
+        * \brief Wait for all the queued jobs to finish.
+        */
+        void WaitJobs(void);
+
         /**
         * \brief Obtain the name current OpenVLBI context.
         * \return The name of the current context
@@ -142,6 +281,15 @@ class Server
         */
         char* GetModel(const char *name, char *format);
 
+        /**
+        * \brief Write the base64 encoded file buffer of a model into a stream while it is being encoded.
+        * \param name The name of the model
+        * \param format The format of the picture exported, can be one of png, jpeg or fits
+        * \param stream The stream receiving the base64 text
+        * \return false if the model does not exist or the format is unknown
+        */
+        bool GetModel(const char *name, char *format, FILE *stream);
+
         /**
         * \brief Delete from the current context an existing model by name.
         * \param name The name of the model to be deleted
@@ -241,6 +389,17 @@ class Server
         */
         void Convolute(const char *name, const char *model1, const char *model2);
 
+        /**
+        * \brief Deconvolve a dirty image model by its point spread function using CLEAN
+        * \param name The name of the new model
+        * \param dirty The name of the dirty image model
+        * \param psf The name of the point spread function model
+        * \param gain The loop gain
+        * \param threshold The residual peak at which to stop
+        * \param niter The maximum number of clean components
+        */
+        void Clean(const char *name, const char *dirty, const char *psf, double gain, double threshold, int niter);
+
         /**
         * \brief Apply a low pass filter on a node buffer
         * \param name The name of the new node
@@ -266,6 +425,21 @@ class Server
         */
         void BandPass(const char *name, const char *node, double lofreq, double hifreq);
 
+        /**
+        * \brief Flag the RFI affected samples of a node
+        * \param node The name of the node
+        * \param method The flagging method
+        * \param window The number of samples of each estimation window
+        * \param threshold The flagging threshold in standard deviations
+        */
+        void Flag(const char *node, vlbi_flagging method, int window, double threshold);
+
+        /**
+        * \brief Remove the flags of a node
+        * \param node The name of the node
+        */
+        void Unflag(const char *node);
+
         /**
         * \brief Apply a band reject filter on a node buffer
         * \param name The name of the new node
@@ -446,10 +620,14 @@ class Server
         /**
         * \brief Set the delegate function
         * \param func The new delegate
+        * \param release Called once the delegate is no longer used, when the plot job that took it is released or when it is replaced
         */
-        inline void setDelegate(vlbi_func2_t func)
+        inline void setDelegate(vlbi_func2_t func, std::function<void()> release = nullptr)
         {
+            if(delegate_release)
+                delegate_release();
             delegate = func;
+            delegate_release = release;
         }
 
         /**
@@ -460,6 +638,7 @@ class Server
 
     private:
         vlbi_func2_t delegate;
+        std::function<void()> delegate_release;
         double Ra;
         double Dec;
         double Freq;
@@ -469,6 +648,21 @@ class Server
         int h;
         FILE *input, *output;
         char *context;
+        static void *JobWorker(void *arg);
+        void WaitContext(vlbi_context ctx);
+        void CancelJob(vlbi_job *job);
+        void FreeJob(std::map<int, vlbi_job*>::iterator it);
+        void ReapJobs(vlbi_context ctx, int keep);
+        pthread_mutex_t jobs_mutex;
+        pthread_cond_t jobs_cond;
+        std::deque<vlbi_job*> queue;
+        std::map<int, vlbi_job*> jobs;
+        std::map<vlbi_context, int> pending;
+        std::map<vlbi_context, bool> running;
+        pthread_t *workers { nullptr };
+        int nworkers { 0 };
+        int last_job { 0 };
+        bool stopping { false };
 };
 extern VLBI::Server *server;
 /**\}*/
@@ -1,6 +1,9 @@
 ﻿#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cmath>
+#include <cctype>
+#include <pthread.h>
 #include <signal.h>
 #include <vlbi.h>
 #include <fitsio2.h>
@@ -10,25 +13,421 @@
 #include "json.h"
 #include "vlbi_server_json.h"
 
-static char *js_code_str;
+static const char *job_status_names[] = { "queued", "running", "completed", "cancelled" };
 
-static double js_callback(double a, double b) {
-    struct mjs *mjs = mjs_create();
-    char *str = (char*)malloc(strlen(js_code_str)+100);
-    sprintf(str, "function callback(a, b) { %s }; callback(%lf, %lf);", js_code_str, a, b);
+#define JS_STACK_SIZE 32
+#define JS_DELEGATES 8
+
+typedef enum
+{
+    js_op_const,
+    js_op_a,
+    js_op_b,
+    js_op_neg,
+    js_op_add,
+    js_op_sub,
+    js_op_mul,
+    js_op_div,
+    js_op_mod,
+    js_op_func1,
+    js_op_func2,
+} js_opcode;
+
+typedef struct
+{
+    js_opcode op;
+    double value;
+    double (*func1)(double);
+    double (*func2)(double, double);
+} js_instruction;
+
+typedef struct
+{
+    js_instruction *code;
+    int len;
+    int depth;
+    int max_depth;
+} js_program;
+
+typedef struct
+{
+    char *code;
+    js_program native;
+    bool compiled;
+    bool used;
+    unsigned long generation;
+} js_delegate;
+
+typedef struct
+{
+    struct mjs *mjs;
+    mjs_val_t func[JS_DELEGATES];
+    unsigned long generation[JS_DELEGATES];
+} js_worker;
+
+static js_delegate js_delegates[JS_DELEGATES];
+static unsigned long js_generation;
+static pthread_mutex_t js_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t js_cond = PTHREAD_COND_INITIALIZER;
+static pthread_key_t js_worker_key;
+
+//Math.round rounds halves up, Math.min and Math.max return NaN if any argument is NaN
+static double js_round(double x)
+{
+    return floor(x + 0.5);
+}
+
+static double js_min(double x, double y)
+{
+    return (std::isnan(x) || std::isnan(y)) ? NAN : fmin(x, y);
+}
+
+static double js_max(double x, double y)
+{
+    return (std::isnan(x) || std::isnan(y)) ? NAN : fmax(x, y);
+}
+
+static const struct
+{
+    const char *name;
+    double (*func1)(double);
+    double (*func2)(double, double);
+} js_math[] =
+{
+    { "abs", fabs, nullptr },
+    { "sqrt", sqrt, nullptr },
+    { "exp", exp, nullptr },
+    { "log", log, nullptr },
+    { "sin", sin, nullptr },
+    { "cos", cos, nullptr },
+    { "tan", tan, nullptr },
+    { "asin", asin, nullptr },
+    { "acos", acos, nullptr },
+    { "atan", atan, nullptr },
+    { "floor", floor, nullptr },
+    { "ceil", ceil, nullptr },
+    { "round", js_round, nullptr },
+    { "atan2", nullptr, atan2 },
+    { "pow", nullptr, pow },
+    { "min", nullptr, js_min },
+    { "max", nullptr, js_max },
+};
+
+static double js_apply(js_instruction *ins, double x, double y)
+{
+    switch(ins->op)
+    {
+        case js_op_neg:
+            return -x;
+        case js_op_add:
+            return x + y;
+        case js_op_sub:
+            return x - y;
+        case js_op_mul:
+            return x * y;
+        case js_op_div:
+            return x / y;
+        case js_op_mod:
+            return fmod(x, y);
+        case js_op_func1:
+            return ins->func1(x);
+        case js_op_func2:
+            return ins->func2(x, y);
+        default:
+            return ins->value;
+    }
+}
+
+static void js_emit(js_program *program, js_instruction ins)
+{
+    int args = 0;
+    if(ins.op == js_op_neg || ins.op == js_op_func1)
+        args = 1;
+    else if(ins.op != js_op_const && ins.op != js_op_a && ins.op != js_op_b)
+        args = 2;
+    if(args > 0 && program->len >= args)
+    {
+        js_instruction *last = &program->code[program->len - args];
+        if(last[0].op == js_op_const && (args == 1 || last[1].op == js_op_const))
+        {
+            last[0].value = js_apply(&ins, last[0].value, args == 2 ? last[1].value : 0);
+            program->len -= args - 1;
+            program->depth -= args - 1;
+            return;
+        }
+    }
+    program->code = (js_instruction*)realloc(program->code, sizeof(js_instruction) * (size_t)(program->len + 1));
+    program->code[program->len++] = ins;
+    program->depth += 1 - args;
+    program->max_depth = Max(program->max_depth, program->depth);
+}
+
+static void js_skip(const char **s)
+{
+    while(isspace(**s))
+        (*s)++;
+}
+
+static bool js_match(const char **s, const char *token)
+{
+    js_skip(s);
+    size_t len = strlen(token);
+    if(strncmp(*s, token, len))
+        return false;
+    if(isalnum(token[len - 1]) && (isalnum((*s)[len]) || (*s)[len] == '_'))
+        return false;
+    *s += len;
+    return true;
+}
+
+static bool js_compile_expression(const char **s, js_program *program);
+
+static bool js_compile_primary(const char **s, js_program *program)
+{
+    js_instruction ins;
+    memset(&ins, 0, sizeof(ins));
+    js_skip(s);
+    if(js_match(s, "("))
+        return js_compile_expression(s, program) && js_match(s, ")");
+    if(js_match(s, "a"))
+        ins.op = js_op_a;
+    else if(js_match(s, "b"))
+        ins.op = js_op_b;
+    else if(js_match(s, "Math.PI"))
+        ins.value = M_PI;
+    else if(js_match(s, "Math.E"))
+        ins.value = M_E;
+    else if(js_match(s, "Math."))
+    {
+        size_t x;
+        for(x = 0; x < sizeof(js_math) / sizeof(js_math[0]); x++)
+            if(js_match(s, js_math[x].name))
+                break;
+        if(x == sizeof(js_math) / sizeof(js_math[0]) || !js_match(s, "(") || !js_compile_expression(s, program))
+            return false;
+        ins.op = js_op_func1;
+        ins.func1 = js_math[x].func1;
+        if(js_math[x].func2 != nullptr)
+        {
+            if(!js_match(s, ",") || !js_compile_expression(s, program))
+                return false;
+            ins.op = js_op_func2;
+            ins.func2 = js_math[x].func2;
+        }
+        if(!js_match(s, ")"))
+            return false;
+    }
+    else
+    {
+        char *end;
+        ins.value = strtod(*s, &end);
+        if(end == *s || isalpha(**s))
+            return false;
+        *s = end;
+    }
+    js_emit(program, ins);
+    return true;
+}
+
+static bool js_compile_unary(const char **s, js_program *program)
+{
+    if(js_match(s, "+"))
+        return js_compile_unary(s, program);
+    if(js_match(s, "-"))
+    {
+        js_instruction ins;
+        memset(&ins, 0, sizeof(ins));
+        ins.op = js_op_neg;
+        if(!js_compile_unary(s, program))
+            return false;
+        js_emit(program, ins);
+        return true;
+    }
+    return js_compile_primary(s, program);
+}
+
+static bool js_compile_term(const char **s, js_program *program)
+{
+    if(!js_compile_unary(s, program))
+        return false;
+    while(true)
+    {
+        js_instruction ins;
+        memset(&ins, 0, sizeof(ins));
+        if(js_match(s, "*"))
+            ins.op = js_op_mul;
+        else if(js_match(s, "/"))
+            ins.op = js_op_div;
+        else if(js_match(s, "%"))
+            ins.op = js_op_mod;
+        else
+            return true;
+        if(!js_compile_unary(s, program))
+            return false;
+        js_emit(program, ins);
+    }
+}
+
+static bool js_compile_expression(const char **s, js_program *program)
+{
+    if(!js_compile_term(s, program))
+        return false;
+    while(true)
+    {
+        js_instruction ins;
+        memset(&ins, 0, sizeof(ins));
+        if(js_match(s, "+"))
+            ins.op = js_op_add;
+        else if(js_match(s, "-"))
+            ins.op = js_op_sub;
+        else
+            return true;
+        if(!js_compile_term(s, program))
+            return false;
+        js_emit(program, ins);
+    }
+}
+
+static bool js_compile(const char *code, js_program *program)
+{
+    const char *s = code;
+    program->len = 0;
+    program->depth = 0;
+    program->max_depth = 0;
+    js_match(&s, "return");
+    if(!js_compile_expression(&s, program))
+        return false;
+    js_match(&s, ";");
+    js_skip(&s);
+    return *s == 0 && program->max_depth <= JS_STACK_SIZE;
+}
+
+static double js_native_run(js_program *program, double a, double b)
+{
+    double stack[JS_STACK_SIZE];
+    int sp = 0;
+    for(int x = 0; x < program->len; x++)
+    {
+        js_instruction *ins = &program->code[x];
+        switch(ins->op)
+        {
+            case js_op_const:
+                stack[sp++] = ins->value;
+                break;
+            case js_op_a:
+                stack[sp++] = a;
+                break;
+            case js_op_b:
+                stack[sp++] = b;
+                break;
+            case js_op_neg:
+            case js_op_func1:
+                stack[sp - 1] = js_apply(ins, stack[sp - 1], 0);
+                break;
+            default:
+                sp--;
+                stack[sp - 1] = js_apply(ins, stack[sp - 1], stack[sp]);
+                break;
+        }
+    }
+    return stack[0];
+}
+
+static void js_worker_free(void *arg)
+{
+    js_worker *worker = (js_worker*)arg;
+    mjs_destroy(worker->mjs);
+    free(worker);
+}
+
+static double js_script_run(int slot, double a, double b)
+{
+    js_delegate *delegate = &js_delegates[slot];
+    js_worker *worker = (js_worker*)pthread_getspecific(js_worker_key);
+    if(worker == nullptr)
+    {
+        worker = (js_worker*)calloc(1, sizeof(js_worker));
+        worker->mjs = mjs_create();
+        pthread_setspecific(js_worker_key, worker);
+    }
+    if(worker->generation[slot] != delegate->generation)
+    {
+        char *str = (char*)malloc(strlen(delegate->code) + 64);
+        sprintf(str, "function callback(a, b) { %s }; callback;", delegate->code);
+        if(worker->generation[slot] != 0)
+            mjs_disown(worker->mjs, &worker->func[slot]);
+        worker->func[slot] = mjs_mk_undefined();
+        mjs_exec(worker->mjs, str, &worker->func[slot]);
+        mjs_own(worker->mjs, &worker->func[slot]);
+        worker->generation[slot] = delegate->generation;
+        free(str);
+    }
     mjs_val_t result;
-    mjs_exec(mjs, str, &result);
-    return (double)result;
+    if(mjs_call(worker->mjs, &result, worker->func[slot], mjs_mk_undefined(), 2, mjs_mk_number(worker->mjs, a),
+                mjs_mk_number(worker->mjs, b)) != MJS_OK || !mjs_is_number(result))
+        return 0;
+    return mjs_get_double(worker->mjs, result);
+}
+
+/* The delegate is a plain function pointer, so each plot job holding a custom delegate gets its own slot
+ * with its own code, which stays valid until the job is released. */
+template <int slot>
+static double js_callback(double a, double b)
+{
+    if(js_delegates[slot].compiled)
+        return js_native_run(&js_delegates[slot].native, a, b);
+    return js_script_run(slot, a, b);
+}
+
+static const vlbi_func2_t js_callbacks[JS_DELEGATES] =
+{
+    js_callback<0>, js_callback<1>, js_callback<2>, js_callback<3>,
+    js_callback<4>, js_callback<5>, js_callback<6>, js_callback<7>,
+};
+
+static int js_acquire(const char *code)
+{
+    int slot = 0;
+    pthread_mutex_lock(&js_mutex);
+    while(true)
+    {
+        for(slot = 0; slot < JS_DELEGATES; slot++)
+            if(!js_delegates[slot].used)
+                break;
+        if(slot < JS_DELEGATES)
+            break;
+        pthread_cond_wait(&js_cond, &js_mutex);
+    }
+    js_delegate *delegate = &js_delegates[slot];
+    delegate->used = true;
+    delegate->generation = ++js_generation;
+    pthread_mutex_unlock(&js_mutex);
+    delegate->code = (char*)malloc(strlen(code) + 1);
+    strcpy(delegate->code, code);
+    delegate->compiled = js_compile(delegate->code, &delegate->native);
+    return slot;
+}
+
+static void js_release(int slot)
+{
+    js_delegate *delegate = &js_delegates[slot];
+    pthread_mutex_lock(&js_mutex);
+    free(delegate->code);
+    free(delegate->native.code);
+    memset(delegate, 0, sizeof(js_delegate));
+    delegate->used = false;
+    pthread_cond_broadcast(&js_cond);
+    pthread_mutex_unlock(&js_mutex);
 }
 
 JSONServer::JSONServer()
 {
-    js_code_str = (char*)malloc(1);
+    pthread_key_create(&js_worker_key, js_worker_free);
 }
 
 JSONServer::~JSONServer()
 {
-    free(js_code_str);
+    pthread_key_delete(js_worker_key);
 }
 
 int JSONServer::Init(int argc, char** argv)
@@ -276,10 +675,8 @@ void JSONServer::Parse()
                         {
                             if(!strcmp(values[z].name, values[y].value->u.string.ptr))
                             {
-                                size_t len = strlen(values[z].value->u.string.ptr);
-                                js_code_str = (char*)realloc(js_code_str, len);
-                                memcpy(js_code_str, values[z].value->u.string.ptr, len);
-                                setDelegate(js_callback);
+                                int slot = js_acquire(values[z].value->u.string.ptr);
+                                setDelegate(js_callbacks[slot], [slot]() { js_release(slot); });
                                 flags |= plot_flags_custom_delegate;
                                 mask |= 1 << 9;
                             }
@@ -322,11 +719,11 @@ void JSONServer::Parse()
             }
             if(CheckMask(mask, 2))
             {
-                char *base64 = GetModel(name, format);
                 fprintf(GetOutput(),
-                        "{\n \"context\": \"%s\",\n \"model\": {\n  \"name\": \"%s\",\n  \"format\": \"%s\",\n  \"buffer\": \"%s\"\n }\n}\n",
-                        CurrentContext(), name, format, base64);
-                free(base64);
+                        "{\n \"context\": \"%s\",\n \"model\": {\n  \"name\": \"%s\",\n  \"format\": \"%s\",\n  \"buffer\": \"",
+                        CurrentContext(), name, format);
+                GetModel(name, format, GetOutput());
+                fprintf(GetOutput(), "\"\n }\n}\n");
             }
         }
         if(!strcmp(n, "upload"))
@@ -503,6 +900,36 @@ void JSONServer::Parse()
                 }
             }
         }
+        if(!strcmp(n, "jobs"))
+        {
+            vlbi_job_info *info = nullptr;
+            int count = GetJobs(v->u.string.ptr, &info);
+            fprintf(GetOutput(), "{\n \"context\": \"%s\",\n \"jobs\": [", v->u.string.ptr);
+            for(int y = 0; y < count; y++)
+                fprintf(GetOutput(), "%s\n  {\n   \"id\": %d,\n   \"description\": \"%s\",\n   \"status\": \"%s\",\n   \"progress\": %.3lf\n  }",
+                        y > 0 ? "," : "", info[y].id, info[y].description, job_status_names[info[y].status], info[y].progress);
+            fprintf(GetOutput(), "\n ]\n}\n");
+            free(info);
+        }
+        if(!strcmp(n, "stats"))
+        {
+            vlbi_stats stats;
+            if(!GetStats(v->u.string.ptr, &stats))
+                continue;
+            fprintf(GetOutput(), "{\n \"context\": \"%s\",\n \"nodes\": %d,\n \"baselines\": %d,\n \"models\": %d,\n \"stages\": {",
+                    v->u.string.ptr, stats.nodes, stats.baselines, stats.models);
+            for(int y = 0; y < dsp_perf_stages; y++)
+                fprintf(GetOutput(), "%s\n  \"%s\": { \"calls\": %lu, \"time\": %.9lf }", y > 0 ? "," : "", dsp_perf_stage_name((dsp_perf_stage)y),
+                        stats.counters.calls[y], stats.counters.time[y] / 1000000000.0);
+            fprintf(GetOutput(), "\n }\n}\n");
+        }
+        if(!strcmp(n, "cancel"))
+        {
+            if(v->type == json_integer)
+                DelJob((int)v->u.integer);
+            else if(v->type == json_string)
+                DelJob(atoi(v->u.string.ptr));
+        }
     }
     json_value_free(value);
 }